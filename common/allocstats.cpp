@@ -0,0 +1,150 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <atomic>
+#include <new>
+
+#include "allocstats.hpp"
+
+static std::atomic<unsigned long long> allocationCount(0), allocatedBytes(0), liveBytes(0), peakBytes(0);
+
+// Every block starts with its size, so that delete knows how much goes away.
+// 16 bytes keep what follows aligned like malloc's.
+static const size_t HEADER = 16;
+
+static void countAllocation(size_t size){
+	allocationCount++;
+	allocatedBytes += size;
+	unsigned long long live = liveBytes += size;
+	unsigned long long peak = peakBytes;
+	while (live > peak && !peakBytes.compare_exchange_weak(peak, live))
+		;
+}
+
+void * operator new(size_t size){
+	unsigned char * p = (unsigned char *)malloc(size + HEADER);
+	if (!p)
+		throw std::bad_alloc();
+	*(size_t *)p = size;
+	countAllocation(size);
+	return p + HEADER;
+}
+
+void * operator new[](size_t size){
+	return operator new(size);
+}
+
+// Some standard libraries implement these with malloc : they must go through
+// the header too
+void * operator new(size_t size, const std::nothrow_t &) noexcept{
+	try {
+		return operator new(size);
+	} catch (...) {
+		return NULL;
+	}
+}
+
+void * operator new[](size_t size, const std::nothrow_t &) noexcept{
+	return operator new(size, std::nothrow);
+}
+
+void operator delete(void * p) noexcept{
+	if (!p)
+		return;
+	unsigned char * block = (unsigned char *)p - HEADER;
+	liveBytes -= *(size_t *)block;
+	free(block);
+}
+
+void operator delete[](void * p) noexcept{
+	operator delete(p);
+}
+
+void operator delete(void * p, const std::nothrow_t &) noexcept{
+	operator delete(p);
+}
+
+void operator delete[](void * p, const std::nothrow_t &) noexcept{
+	operator delete(p);
+}
+
+// C++14 sized deallocation : the header knows the size already
+void operator delete(void * p, size_t) noexcept{
+	operator delete(p);
+}
+
+void operator delete[](void * p, size_t) noexcept{
+	operator delete(p);
+}
+
+#ifdef __cpp_aligned_new
+// Over-aligned types (C++17). malloc's alignment isn't enough : the block is
+// over-allocated and aligned by hand, with the size and what malloc returned
+// stored just before it.
+void * operator new(size_t size, std::align_val_t alignment){
+	size_t align = (size_t)alignment < HEADER ? HEADER : (size_t)alignment;
+	unsigned char * block = (unsigned char *)malloc(size + align + HEADER);
+	if (!block)
+		throw std::bad_alloc();
+	unsigned char * p = (unsigned char *)(((uintptr_t)block + HEADER + align - 1) & ~(uintptr_t)(align - 1));
+	((void **)p)[-1] = block;
+	((size_t *)p)[-2] = size;
+	countAllocation(size);
+	return p;
+}
+
+void * operator new[](size_t size, std::align_val_t alignment){
+	return operator new(size, alignment);
+}
+
+void * operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept{
+	try {
+		return operator new(size, alignment);
+	} catch (...) {
+		return NULL;
+	}
+}
+
+void * operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept{
+	return operator new(size, alignment, std::nothrow);
+}
+
+void operator delete(void * p, std::align_val_t) noexcept{
+	if (!p)
+		return;
+	liveBytes -= ((size_t *)p)[-2];
+	free(((void **)p)[-1]);
+}
+
+void operator delete[](void * p, std::align_val_t alignment) noexcept{
+	operator delete(p, alignment);
+}
+
+void operator delete(void * p, size_t, std::align_val_t alignment) noexcept{
+	operator delete(p, alignment);
+}
+
+void operator delete[](void * p, size_t, std::align_val_t alignment) noexcept{
+	operator delete(p, alignment);
+}
+
+void operator delete(void * p, std::align_val_t alignment, const std::nothrow_t &) noexcept{
+	operator delete(p, alignment);
+}
+
+void operator delete[](void * p, std::align_val_t alignment, const std::nothrow_t &) noexcept{
+	operator delete(p, alignment);
+}
+#endif
+
+AllocationStats getAllocationStats(){
+	AllocationStats stats;
+	stats.allocations = allocationCount;
+	stats.bytes = allocatedBytes;
+	stats.liveBytes = liveBytes;
+	stats.peakBytes = peakBytes;
+	return stats;
+}
+
+void resetAllocationPeak(){
+	peakBytes = (unsigned long long)liveBytes;
+}
@@ -0,0 +1,19 @@
+#ifndef ALLOCSTATS_HPP
+#define ALLOCSTATS_HPP
+
+// Heap use of the whole process, counted by replacing the global operator new
+// and delete. Only the binaries that link allocstats.cpp pay for it (the
+// benchmarks) ; everything else keeps the standard ones.
+struct AllocationStats {
+	unsigned long long allocations;   // calls to new, ever
+	unsigned long long bytes;         // asked of new, ever
+	unsigned long long liveBytes;     // not deleted yet
+	unsigned long long peakBytes;     // most live at once, since resetAllocationPeak()
+};
+
+AllocationStats getAllocationStats();
+
+// The peak starts again from what is live now
+void resetAllocationPeak();
+
+#endif
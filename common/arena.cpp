@@ -0,0 +1,51 @@
+#include <stdlib.h>
+#include <vector>
+#include <new>
+
+#include "arena.hpp"
+
+BumpArena::BumpArena(size_t size)
+	: blockSize(size), used(0), reserved(0)
+{
+}
+
+BumpArena::~BumpArena(){
+	for (size_t i = 0; i < blocks.size(); i++)
+		delete[] blocks[i].data;
+}
+
+void * BumpArena::allocate(size_t size, size_t alignment){
+	if (!blocks.empty()){
+		Block & b = blocks.back();
+		size_t offset = (b.top + alignment - 1) & ~(alignment - 1);
+		if (offset + size <= b.size){
+			b.top = offset + size;
+			used += size;
+			return b.data + offset;
+		}
+	}
+	// new[] is aligned for any fundamental type, which is all we hand out
+	Block b;
+	b.size = size > blockSize ? size : blockSize;
+	b.data = new unsigned char[b.size];
+	b.top = size;
+	if (size > blockSize && !blocks.empty())
+		blocks.insert(blocks.end() - 1, b);   // keep filling the current one
+	else
+		blocks.push_back(b);
+	used += size;
+	reserved += b.size;
+	return b.data;
+}
+
+void BumpArena::reset(){
+	for (size_t i = 1; i < blocks.size(); i++){
+		reserved -= blocks[i].size;
+		delete[] blocks[i].data;
+	}
+	if (!blocks.empty()){
+		blocks.resize(1);
+		blocks[0].top = 0;
+	}
+	used = 0;
+}
@@ -0,0 +1,40 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <stddef.h>
+#include <vector>
+
+// Bump allocator for data that dies all at once, like a loader's temporaries :
+// allocating is moving a pointer, nothing is freed until reset() or the end.
+// Nothing is constructed either, keep it to plain types.
+class BumpArena {
+public:
+	BumpArena(size_t blockSize = 1 << 20);
+	~BumpArena();
+
+	// Bigger than the block size : a block of its own
+	void * allocate(size_t size, size_t alignment = 16);
+
+	template <typename T>
+	T * allocateArray(size_t count){ return (T *)allocate(count * sizeof(T), alignof(T)); }
+
+	// Forgets everything, keeps the first block for the next use
+	void reset();
+
+	size_t getUsed() const { return used; }
+	size_t getReserved() const { return reserved; }
+
+private:
+	BumpArena(const BumpArena &);
+	BumpArena & operator=(const BumpArena &);
+
+	struct Block {
+		unsigned char * data;
+		size_t size, top;
+	};
+	std::vector<Block> blocks;
+	size_t blockSize;
+	size_t used, reserved;
+};
+
+#endif
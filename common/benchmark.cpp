@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "benchmark.hpp"
+
+// Nearest rank : the smallest sample with at least p% of them at or below it
+static double percentile(const std::vector<double> & sorted, double p){
+	size_t rank = (size_t)(p / 100.0 * sorted.size() + 0.999999);
+	return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+TimingSummary summarizeTimings(std::vector<double> samples){
+	TimingSummary s = { 0, 0, 0, 0, 0, 0 };
+	if (samples.empty())
+		return s;
+	std::sort(samples.begin(), samples.end());
+	double total = 0.0;
+	for (size_t i = 0; i < samples.size(); i++)
+		total += samples[i];
+	s.mean = total / samples.size();
+	s.min = samples.front();
+	s.p50 = percentile(samples, 50.0);
+	s.p95 = percentile(samples, 95.0);
+	s.p99 = percentile(samples, 99.0);
+	s.max = samples.back();
+	return s;
+}
+
+GPUFrameTimer::GPUFrameTimer() : oldest(0), count(0){
+	glGenQueries(2 * LATENCY, &queries[0][0]);
+}
+
+GPUFrameTimer::~GPUFrameTimer(){
+	glDeleteQueries(2 * LATENCY, &queries[0][0]);
+}
+
+void GPUFrameTimer::begin(){
+	// All the queries in flight : the oldest one has to be read first
+	if (count == LATENCY)
+		readOldest(true);
+	glQueryCounter(queries[(oldest + count) % LATENCY][0], GL_TIMESTAMP);
+}
+
+void GPUFrameTimer::end(){
+	glQueryCounter(queries[(oldest + count) % LATENCY][1], GL_TIMESTAMP);
+	count++;
+}
+
+bool GPUFrameTimer::readOldest(bool wait){
+	if (count == 0)
+		return false;
+	if (!wait){
+		GLint available = 0;
+		glGetQueryObjectiv(queries[oldest][1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			return false;
+	}
+	GLuint64 start = 0, end = 0;
+	glGetQueryObjectui64v(queries[oldest][0], GL_QUERY_RESULT, &start);
+	glGetQueryObjectui64v(queries[oldest][1], GL_QUERY_RESULT, &end);
+	done.push_back((end - start) / 1e6);
+	oldest = (oldest + 1) % LATENCY;
+	count--;
+	return true;
+}
+
+void GPUFrameTimer::collect(std::vector<double> & out_milliseconds, bool wait){
+	while (readOldest(wait))
+		;
+	out_milliseconds.insert(out_milliseconds.end(), done.begin(), done.end());
+	done.clear();
+}
+
+static void writeSummary(FILE * f, const char * name, const std::vector<double> & samples, bool last){
+	TimingSummary s = summarizeTimings(samples);
+	fprintf(f, "  \"%s\": { \"samples\": %u, \"mean\": %.4f, \"min\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }%s\n",
+		name, (unsigned int)samples.size(), s.mean, s.min, s.p50, s.p95, s.p99, s.max, last ? "" : ",");
+}
+
+// The GL strings may hold anything
+static std::string jsonEscape(const std::string & s){
+	std::string out;
+	for (size_t i = 0; i < s.size(); i++){
+		if (s[i] == '"' || s[i] == '\\')
+			out += '\\';
+		if ((unsigned char)s[i] >= 0x20)
+			out += s[i];
+	}
+	return out;
+}
+
+bool writeBenchmarkResults(const char * path, const BenchmarkResults & results){
+	FILE * f = path ? fopen(path, "w") : stdout;
+	if (!f){
+		printf("Could not write %s\n", path);
+		return false;
+	}
+	fprintf(f, "{\n");
+	fprintf(f, "  \"script\": \"%s\",\n", jsonEscape(results.scriptPath).c_str());
+	fprintf(f, "  \"renderer\": \"%s\",\n", jsonEscape(results.renderer).c_str());
+	fprintf(f, "  \"version\": \"%s\",\n", jsonEscape(results.version).c_str());
+	fprintf(f, "  \"warmupFrames\": %u,\n", results.warmupFrames);
+	writeSummary(f, "cpuMs", results.cpuMilliseconds, false);
+	writeSummary(f, "gpuMs", results.gpuMilliseconds, false);
+	writeSummary(f, "frameMs", results.frameMilliseconds, true);
+	fprintf(f, "}\n");
+	if (path)
+		fclose(f);
+	return true;
+}
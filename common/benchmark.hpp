@@ -0,0 +1,48 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <string>
+#include <vector>
+
+// Nearest rank percentiles of a set of frame times, in ms
+struct TimingSummary {
+	double mean, min, p50, p95, p99, max;
+};
+TimingSummary summarizeTimings(std::vector<double> samples);
+
+// GPU time of whole frames, between two GL_TIMESTAMP queries : unlike
+// GL_TIME_ELAPSED, they leave the profiler's GPU scopes free to run inside.
+// The results are read a few frames later, so that the CPU never waits for
+// the GPU, and come out in frame order.
+class GPUFrameTimer {
+public:
+	GPUFrameTimer();
+	~GPUFrameTimer();
+
+	void begin();
+	void end();
+
+	// Appends the times that came in ; with wait, all of them (end of the run)
+	void collect(std::vector<double> & out_milliseconds, bool wait);
+
+private:
+	bool readOldest(bool wait);
+
+	static const unsigned int LATENCY = 4;
+	GLuint queries[LATENCY][2];   // frame start, frame end
+	unsigned int oldest, count;   // frames in flight : queries[oldest], ... count of them
+	std::vector<double> done;     // read, not collected yet
+};
+
+struct BenchmarkResults {
+	std::string scriptPath, renderer, version;
+	unsigned int warmupFrames;
+	std::vector<double> cpuMilliseconds;     // frame start to the last GL call
+	std::vector<double> gpuMilliseconds;
+	std::vector<double> frameMilliseconds;   // frame start to next frame start
+};
+
+// JSON, to path or to stdout if path is NULL
+bool writeBenchmarkResults(const char * path, const BenchmarkResults & results);
+
+#endif
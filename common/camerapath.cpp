@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+
+#include <glm/glm.hpp>
+
+#include "jsonreader.hpp"
+#include "camerapath.hpp"
+
+static CameraKey readKey(JsonReader & json){
+	CameraKey key;
+	key.time = 0.0f;
+	key.position = glm::vec3(0.0f);
+	key.horizontalAngle = 3.14f;
+	key.verticalAngle = 0.0f;
+	json.expect('{');
+	if (json.accept('}'))
+		return key;
+	do {
+		std::string name = json.string();
+		json.expect(':');
+		if (name == "time")
+			key.time = (float)json.number();
+		else if (name == "horizontalAngle")
+			key.horizontalAngle = (float)json.number();
+		else if (name == "verticalAngle")
+			key.verticalAngle = (float)json.number();
+		else if (name == "position"){
+			json.expect('[');
+			for (int i = 0; i < 3; i++){
+				if (i > 0)
+					json.expect(',');
+				key.position[i] = (float)json.number();
+			}
+			json.expect(']');
+		} else
+			json.skipValue();
+	} while (json.ok && json.accept(','));
+	json.expect('}');
+	return key;
+}
+
+bool loadCameraPath(const char * path, CameraPath & out){
+	std::ifstream stream(path, std::ios::in);
+	if (!stream.is_open()){
+		printf("Could not open %s\n", path);
+		return false;
+	}
+	std::stringstream sstr;
+	sstr << stream.rdbuf();
+	std::string text = sstr.str();
+
+	JsonReader json = { text.c_str(), true };
+	out = CameraPath();
+	json.expect('{');
+	if (!json.accept('}')){
+		do {
+			std::string name = json.string();
+			json.expect(':');
+			if (name == "frames")
+				out.frames = (unsigned int)json.number();
+			else if (name == "warmupFrames")
+				out.warmupFrames = (unsigned int)json.number();
+			else if (name == "keys"){
+				json.expect('[');
+				if (!json.accept(']')){
+					do {
+						out.keys.push_back(readKey(json));
+					} while (json.ok && json.accept(','));
+					json.expect(']');
+				}
+			} else
+				json.skipValue();
+		} while (json.ok && json.accept(','));
+		json.expect('}');
+	}
+	if (!json.ok){
+		printf("%s : syntax error at offset %d\n", path, (int)(json.p - text.c_str()));
+		return false;
+	}
+	if (out.keys.empty()){
+		printf("%s : no camera keys\n", path);
+		return false;
+	}
+	for (size_t i = 1; i < out.keys.size(); i++){
+		if (out.keys[i].time < out.keys[i - 1].time){
+			printf("%s : the keys are not in time order\n", path);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool saveCameraPath(const char * path, const CameraPath & cameraPath){
+	FILE * f = fopen(path, "w");
+	if (!f){
+		printf("Could not write %s\n", path);
+		return false;
+	}
+	fprintf(f, "{\n  \"frames\": %u,\n  \"warmupFrames\": %u,\n  \"keys\": [\n", cameraPath.frames, cameraPath.warmupFrames);
+	for (size_t i = 0; i < cameraPath.keys.size(); i++){
+		const CameraKey & k = cameraPath.keys[i];
+		fprintf(f, "    { \"time\": %.4f, \"position\": [%.5f, %.5f, %.5f], \"horizontalAngle\": %.5f, \"verticalAngle\": %.5f }%s\n",
+			k.time, k.position.x, k.position.y, k.position.z, k.horizontalAngle, k.verticalAngle,
+			i + 1 < cameraPath.keys.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+	fclose(f);
+	return true;
+}
+
+template <typename T>
+static T catmullRom(const T & p0, const T & p1, const T & p2, const T & p3, float s){
+	float s2 = s * s, s3 = s2 * s;
+	return 0.5f * ((2.0f * p1) + (p2 - p0) * s + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * s2 + (3.0f * p1 - p0 - 3.0f * p2 + p3) * s3);
+}
+
+CameraKey sampleCameraPath(const CameraPath & cameraPath, float t){
+	const std::vector<CameraKey> & keys = cameraPath.keys;
+	if (keys.size() == 1 || t <= keys.front().time)
+		return keys.front();
+	if (t >= keys.back().time)
+		return keys.back();
+
+	size_t i = 1;
+	while (keys[i].time < t)
+		i++;
+	// Segment keys[i-1] -> keys[i], the tangents come from the keys around it
+	const CameraKey & k0 = keys[i > 1 ? i - 2 : 0];
+	const CameraKey & k1 = keys[i - 1];
+	const CameraKey & k2 = keys[i];
+	const CameraKey & k3 = keys[i + 1 < keys.size() ? i + 1 : i];
+	float length = k2.time - k1.time;
+	float s = length > 0.0f ? (t - k1.time) / length : 1.0f;
+
+	CameraKey key;
+	key.time = t;
+	key.position = catmullRom(k0.position, k1.position, k2.position, k3.position, s);
+	key.horizontalAngle = catmullRom(k0.horizontalAngle, k1.horizontalAngle, k2.horizontalAngle, k3.horizontalAngle, s);
+	key.verticalAngle = catmullRom(k0.verticalAngle, k1.verticalAngle, k2.verticalAngle, k3.verticalAngle, s);
+	return key;
+}
@@ -0,0 +1,34 @@
+#ifndef CAMERAPATH_HPP
+#define CAMERAPATH_HPP
+
+#include <vector>
+
+// A camera pose at a given time, as controls.cpp stores it
+struct CameraKey {
+	float time;   // seconds
+	glm::vec3 position;
+	float horizontalAngle, verticalAngle;
+};
+
+// Recorded with --record, played back with --benchmark. As JSON :
+// { "frames": 600, "warmupFrames": 60,
+//   "keys": [ { "time": 0.0, "position": [0, 1.5, 4], "horizontalAngle": 3.14, "verticalAngle": -0.2 }, ... ] }
+// The frames are spread evenly over the keys' duration, whatever the frame
+// rate, so that every run renders the same images.
+struct CameraPath {
+	std::vector<CameraKey> keys;   // by increasing time
+	unsigned int frames;           // measured frames
+	unsigned int warmupFrames;     // rendered at the first key before measuring
+
+	CameraPath() : frames(600), warmupFrames(60) {}
+
+	float duration() const { return keys.empty() ? 0.0f : keys.back().time - keys.front().time; }
+};
+
+bool loadCameraPath(const char * path, CameraPath & out);
+bool saveCameraPath(const char * path, const CameraPath & cameraPath);
+
+// Catmull-Rom through the keys ; t is clamped to the path
+CameraKey sampleCameraPath(const CameraPath & cameraPath, float t);
+
+#endif
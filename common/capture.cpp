@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <GL/glew.h>
+
+#include "dxtcompress.hpp"
+#include "imagediff.hpp"
+#include "capture.hpp"
+
+typedef std::chrono::high_resolution_clock CaptureClock;
+
+static double millisecondsSince(CaptureClock::time_point start){
+	return std::chrono::duration<double, std::milli>(CaptureClock::now() - start).count();
+}
+
+// Frames read back but not written yet, at most. Past that the encoder can't
+// keep up and capture() waits for it rather than eating all the memory.
+static const size_t MAX_QUEUED_FRAMES = 8;
+
+FrameCapture::FrameCapture()
+	: y4m(false), width(0), height(0), y4mFile(NULL), nextSlot(0), inFlight(0),
+	  writtenFrames(0), quit(false), capturedFrames(0), stallTimeMs(0.0)
+{
+}
+
+FrameCapture::~FrameCapture(){
+	stop();
+}
+
+bool FrameCapture::start(const char * newPath, int newWidth, int newHeight, unsigned int fps, unsigned int numSlots){
+	stop();
+	path = newPath;
+	width = newWidth;
+	height = newHeight;
+	y4m = path.size() > 4 && path.compare(path.size() - 4, 4, ".y4m") == 0;
+	if (y4m){
+		y4mFile = fopen(newPath, "wb");
+		if (!y4mFile){
+			printf("Could not write %s\n", newPath);
+			return false;
+		}
+		fprintf(y4mFile, "YUV4MPEG2 W%d H%d F%u:1 Ip A1:1 C420jpeg\n", width, height, fps);
+	}
+
+	size_t frameSize = (size_t)width * height * 4;
+	buffers.resize(numSlots);
+	fences.assign(numSlots, (GLsync)0);
+	glGenBuffers(numSlots, &buffers[0]);
+	for (unsigned int i = 0; i < numSlots; i++){
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, frameSize, NULL, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	nextSlot = inFlight = 0;
+	capturedFrames = writtenFrames = 0;
+	stallTimeMs = 0.0;
+
+	quit = false;
+	encoder = std::thread(&FrameCapture::encoderLoop, this);
+	return true;
+}
+
+void FrameCapture::capture(){
+	if (buffers.empty())
+		return;
+
+	// Hand over every slot the GPU is done with, oldest first
+	while (inFlight > 0){
+		unsigned int oldest = (nextSlot + buffers.size() - inFlight) % buffers.size();
+		GLenum status = glClientWaitSync(fences[oldest], 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			break;
+		retire(false);
+	}
+	// The GPU is a whole ring behind : nothing to do but wait
+	if (inFlight == buffers.size())
+		retire(true);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[nextSlot]);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	fences[nextSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	nextSlot = (nextSlot + 1) % buffers.size();
+	inFlight++;
+	capturedFrames++;
+}
+
+void FrameCapture::retire(bool wait){
+	unsigned int slot = (nextSlot + buffers.size() - inFlight) % buffers.size();
+	CaptureClock::time_point start = CaptureClock::now();
+	if (wait)
+		glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+	glDeleteSync(fences[slot]);
+	fences[slot] = 0;
+	inFlight--;
+
+	RGBAImage frame;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		cond.wait(lock, [this]{ return queue.size() < MAX_QUEUED_FRAMES; });
+		if (!freeFrames.empty()){
+			frame.pixels.swap(freeFrames.back().pixels);
+			freeFrames.pop_back();
+		}
+	}
+	stallTimeMs += millisecondsSince(start);
+
+	frame.width = width;
+	frame.height = height;
+	frame.pixels.resize((size_t)width * height * 4);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[slot]);
+	const unsigned char * pixels = (const unsigned char *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frame.pixels.size(), GL_MAP_READ_BIT);
+	if (pixels){
+		memcpy(&frame.pixels[0], pixels, frame.pixels.size());
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if (!pixels)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back(RGBAImage());
+		queue.back().width = frame.width;
+		queue.back().height = frame.height;
+		queue.back().pixels.swap(frame.pixels);
+	}
+	cond.notify_all();
+}
+
+void FrameCapture::stop(){
+	if (buffers.empty())
+		return;
+	while (inFlight > 0)
+		retire(true);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	cond.notify_all();
+	encoder.join();
+
+	glDeleteBuffers((GLsizei)buffers.size(), &buffers[0]);
+	buffers.clear();
+	fences.clear();
+	if (y4mFile){
+		fclose(y4mFile);
+		y4mFile = NULL;
+	}
+	freeFrames.clear();
+}
+
+void FrameCapture::encoderLoop(){
+	bool failed = false;
+	while (true){
+		RGBAImage frame;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cond.wait(lock, [this]{ return !queue.empty() || quit; });
+			if (queue.empty())
+				return;   // quit, and everything is written
+			frame.width = queue.front().width;
+			frame.height = queue.front().height;
+			frame.pixels.swap(queue.front().pixels);
+			queue.pop_front();
+		}
+		cond.notify_all();
+
+		// Keep going after a failure so that capture() never blocks on us
+		if (!failed && !writeFrame(frame)){
+			printf("Frame capture stopped writing after %u frames\n", writtenFrames);
+			failed = true;
+		}
+		writtenFrames++;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		freeFrames.push_back(RGBAImage());
+		freeFrames.back().pixels.swap(frame.pixels);
+	}
+}
+
+bool FrameCapture::writeFrame(const RGBAImage & frame){
+	if (!y4m){
+		char name[32];
+		snprintf(name, sizeof(name), "_%06u.bmp", writtenFrames);
+		return saveBMPImage((path + name).c_str(), frame);
+	}
+
+	// BT.601 studio range, chroma averaged over 2x2 texels. Y4M is top down.
+	unsigned int w = frame.width, h = frame.height;
+	unsigned int cw = (w + 1) / 2, ch = (h + 1) / 2;
+	yuv.resize((size_t)w * h + 2 * (size_t)cw * ch);
+	unsigned char * Y = &yuv[0];
+	unsigned char * U = Y + (size_t)w * h;
+	unsigned char * V = U + (size_t)cw * ch;
+	for (unsigned int y = 0; y < h; y++){
+		const unsigned char * row = &frame.pixels[4 * (size_t)(h - 1 - y) * w];
+		for (unsigned int x = 0; x < w; x++){
+			const unsigned char * p = row + 4 * x;
+			Y[(size_t)y * w + x] = (unsigned char)(16 + ((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >> 8));
+		}
+	}
+	for (unsigned int y = 0; y < ch; y++)
+		for (unsigned int x = 0; x < cw; x++){
+			int r = 0, g = 0, b = 0, n = 0;
+			for (unsigned int dy = 0; dy < 2 && 2 * y + dy < h; dy++)
+				for (unsigned int dx = 0; dx < 2 && 2 * x + dx < w; dx++){
+					const unsigned char * p = &frame.pixels[4 * ((size_t)(h - 1 - 2 * y - dy) * w + 2 * x + dx)];
+					r += p[0];
+					g += p[1];
+					b += p[2];
+					n++;
+				}
+			r /= n;
+			g /= n;
+			b /= n;
+			U[(size_t)y * cw + x] = (unsigned char)(128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8));
+			V[(size_t)y * cw + x] = (unsigned char)(128 + ((112 * r - 94 * g - 18 * b + 128) >> 8));
+		}
+
+	return fputs("FRAME\n", y4mFile) >= 0 && fwrite(&yuv[0], 1, yuv.size(), y4mFile) == yuv.size();
+}
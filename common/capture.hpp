@@ -0,0 +1,64 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Records the frames without stalling the render loop. Each capture() reads
+// the framebuffer into one of a ring of pixel pack buffers and fences it ;
+// the buffer is mapped a few frames later, once the GPU is done with it, and
+// the copy goes to an encoder thread that writes the files.
+//
+// path ending in .y4m : raw YUV 4:2:0 video (ffmpeg, mpv and vlc play it).
+// Anything else is a prefix for a BMP sequence : path_000000.bmp, ...
+class FrameCapture {
+public:
+	FrameCapture();
+	~FrameCapture();
+
+	bool start(const char * path, int width, int height, unsigned int fps = 60, unsigned int numSlots = 3);
+
+	// Call once the frame is drawn, with the framebuffer to record bound for
+	// reading. Only waits if the ring or the encoder queue is full.
+	void capture();
+
+	// Writes every frame still in flight and closes the files
+	void stop();
+
+	bool isRecording() const { return !buffers.empty(); }
+	unsigned int getCapturedFrames() const { return capturedFrames; }
+	double getStallTime() const { return stallTimeMs; }   // waiting on the ring or the encoder, in all
+
+private:
+	void retire(bool wait);   // the oldest slot in flight -> encoder queue
+	void encoderLoop();
+	bool writeFrame(const RGBAImage & frame);
+
+	std::string path;
+	bool y4m;
+	int width, height;
+	FILE * y4mFile;
+
+	std::vector<GLuint> buffers;
+	std::vector<GLsync> fences;
+	unsigned int nextSlot, inFlight;
+
+	// Frames waiting for the encoder, and the ones it is done with, for reuse
+	std::deque<RGBAImage> queue;
+	std::vector<RGBAImage> freeFrames;
+	std::vector<unsigned char> yuv;   // encoder thread only
+	unsigned int writtenFrames;       // encoder thread only
+	std::thread encoder;
+	std::mutex mutex;
+	std::condition_variable cond;
+	bool quit;
+
+	unsigned int capturedFrames;
+	double stallTimeMs;
+};
+
+#endif
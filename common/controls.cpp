@@ -32,6 +32,23 @@ float initialFoV = 45.0f;
 float speed = 2.0f; // 3 units / second
 float mouseSpeed = 0.005f;
 
+bool inputEnabled = true;
+
+void setInputEnabled(bool enabled){
+	inputEnabled = enabled;
+}
+
+void setCameraPose(const glm::vec3 & newPosition, float newHorizontalAngle, float newVerticalAngle){
+	position = newPosition;
+	horizontalAngle = newHorizontalAngle;
+	verticalAngle = newVerticalAngle;
+}
+
+void getCameraPose(glm::vec3 & out_position, float & out_horizontalAngle, float & out_verticalAngle){
+	out_position = position;
+	out_horizontalAngle = horizontalAngle;
+	out_verticalAngle = verticalAngle;
+}
 
 
 void computeMatricesFromInputs(){
@@ -43,16 +60,18 @@ void computeMatricesFromInputs(){
 	double currentTime = glfwGetTime();
 	float deltaTime = float(currentTime - lastTime);
 
-	// Get mouse position
-	double xpos, ypos;
-	glfwGetCursorPos(window, &xpos, &ypos);
+	if (inputEnabled){
+		// Get mouse position
+		double xpos, ypos;
+		glfwGetCursorPos(window, &xpos, &ypos);
 
-	// Reset mouse position for next frame
-	glfwSetCursorPos(window, 1024/2, 768/2);
+		// Reset mouse position for next frame
+		glfwSetCursorPos(window, 1024/2, 768/2);
 
-	// Compute new orientation
-	horizontalAngle += mouseSpeed * float(1024/2 - xpos );
-	verticalAngle   += mouseSpeed * float( 768/2 - ypos );
+		// Compute new orientation
+		horizontalAngle += mouseSpeed * float(1024/2 - xpos );
+		verticalAngle   += mouseSpeed * float( 768/2 - ypos );
+	}
 
 	// Direction : Spherical coordinates to Cartesian coordinates conversion
 	glm::vec3 direction(
@@ -72,19 +91,19 @@ void computeMatricesFromInputs(){
 	glm::vec3 up = glm::cross( right, direction );
 
 	// Move forward
-	if (glfwGetKey( window, GLFW_KEY_UP ) == GLFW_PRESS){
+	if (inputEnabled && glfwGetKey( window, GLFW_KEY_UP ) == GLFW_PRESS){
 		position += direction * deltaTime * speed;
 	}
 	// Move backward
-	if (glfwGetKey( window, GLFW_KEY_DOWN ) == GLFW_PRESS){
+	if (inputEnabled && glfwGetKey( window, GLFW_KEY_DOWN ) == GLFW_PRESS){
 		position -= direction * deltaTime * speed;
 	}
 	// Strafe right
-	if (glfwGetKey( window, GLFW_KEY_RIGHT ) == GLFW_PRESS){
+	if (inputEnabled && glfwGetKey( window, GLFW_KEY_RIGHT ) == GLFW_PRESS){
 		position += right * deltaTime * speed;
 	}
 	// Strafe left
-	if (glfwGetKey( window, GLFW_KEY_LEFT ) == GLFW_PRESS){
+	if (inputEnabled && glfwGetKey( window, GLFW_KEY_LEFT ) == GLFW_PRESS){
 		position -= right * deltaTime * speed;
 	}
 
@@ -5,4 +5,10 @@ void computeMatricesFromInputs();
 glm::mat4 getViewMatrix();
 glm::mat4 getProjectionMatrix();
 
+// Scripted cameras (benchmark playback, recording) : with the input off,
+// computeMatricesFromInputs only builds the matrices of the pose set here.
+void setInputEnabled(bool enabled);
+void setCameraPose(const glm::vec3 & position, float horizontalAngle, float verticalAngle);
+void getCameraPose(glm::vec3 & position, float & horizontalAngle, float & verticalAngle);
+
 #endif
\ No newline at end of file
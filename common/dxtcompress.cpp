@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DXT_SSE2
+#endif
+
+#include "dxtcompress.hpp"
+#include "mipmap.hpp"
+
+static unsigned char clampByte(float v){
+	return (unsigned char)std::min(255.0f, std::max(0.0f, v + 0.5f));
+}
+
+static void downsampleBox(const RGBAImage & src, RGBAImage & dst){
+	for (unsigned int y = 0; y < dst.height; y++)
+		for (unsigned int x = 0; x < dst.width; x++){
+			unsigned int x0 = (2 * x) % src.width, x1 = (2 * x + 1) % src.width;
+			unsigned int y0 = (2 * y) % src.height, y1 = (2 * y + 1) % src.height;
+			for (int c = 0; c < 4; c++){
+				unsigned int sum = src.pixels[4 * (y0 * src.width + x0) + c] + src.pixels[4 * (y0 * src.width + x1) + c]
+				                 + src.pixels[4 * (y1 * src.width + x0) + c] + src.pixels[4 * (y1 * src.width + x1) + c];
+				dst.pixels[4 * (y * dst.width + x) + c] = (unsigned char)((sum + 2) / 4);
+			}
+		}
+}
+
+// Modified Bessel function of the first kind, order 0
+static double besselI0(double x){
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 32; k++){
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+// Weights of the source texels around one destination texel, along one axis.
+// The destination texel center is between source texels 2i and 2i+1 :
+// weights[t] goes to source texel 2i + 1 - 2 * KAISER_RADIUS + t.
+static const int KAISER_RADIUS = 3;     // in destination texels
+static const double KAISER_ALPHA = 4.0;
+static const double PI = 3.14159265358979323846;
+
+static void kaiserWeights(std::vector<float> & weights){
+	weights.clear();
+	double total = 0.0;
+	for (int i = -2 * KAISER_RADIUS; i < 2 * KAISER_RADIUS; i++){
+		double x = (i + 0.5) / 2.0; // distance in destination texels
+		double sinc = fabs(x) < 1e-9 ? 1.0 : sin(PI * x) / (PI * x);
+		double r = x / KAISER_RADIUS;
+		double window = besselI0(KAISER_ALPHA * sqrt(std::max(0.0, 1.0 - r * r))) / besselI0(KAISER_ALPHA);
+		weights.push_back((float)(sinc * window));
+		total += sinc * window;
+	}
+	for (size_t i = 0; i < weights.size(); i++)
+		weights[i] = (float)(weights[i] / total);
+}
+
+static void downsampleKaiser(const RGBAImage & src, RGBAImage & dst){
+	std::vector<float> weights;
+	kaiserWeights(weights);
+	int taps = (int)weights.size();
+
+	// Horizontal pass to floats, then vertical pass to bytes
+	unsigned int halfWidth = dst.width;
+	std::vector<float> rows((size_t)src.height * halfWidth * 4);
+	for (unsigned int y = 0; y < src.height; y++)
+		for (unsigned int x = 0; x < halfWidth; x++){
+			float sum[4] = { 0, 0, 0, 0 };
+			for (int t = 0; t < taps; t++){
+				int sx = (int)(2 * x) - 2 * KAISER_RADIUS + 1 + t;
+				sx = ((sx % (int)src.width) + (int)src.width) % (int)src.width;
+				const unsigned char * p = &src.pixels[4 * (y * src.width + sx)];
+				for (int c = 0; c < 4; c++)
+					sum[c] += weights[t] * p[c];
+			}
+			for (int c = 0; c < 4; c++)
+				rows[4 * (y * halfWidth + x) + c] = src.width > 1 ? sum[c] : src.pixels[4 * y + c];
+		}
+	for (unsigned int y = 0; y < dst.height; y++)
+		for (unsigned int x = 0; x < halfWidth; x++){
+			float sum[4] = { 0, 0, 0, 0 };
+			for (int t = 0; t < taps; t++){
+				int sy = (int)(2 * y) - 2 * KAISER_RADIUS + 1 + t;
+				sy = ((sy % (int)src.height) + (int)src.height) % (int)src.height;
+				for (int c = 0; c < 4; c++)
+					sum[c] += weights[t] * rows[4 * (sy * halfWidth + x) + c];
+			}
+			for (int c = 0; c < 4; c++)
+				dst.pixels[4 * (y * dst.width + x) + c] = clampByte(src.height > 1 ? sum[c] : rows[4 * x + c]);
+		}
+}
+
+void buildMipChain(const RGBAImage & level0, MipFilter filter, std::vector<RGBAImage> & out_levels){
+	out_levels.clear();
+	out_levels.push_back(level0);
+	if (filter == MIP_FILTER_GAMMA_BOX){
+		std::vector< std::vector<unsigned char> > levels;
+		generateMipmaps(level0.pixels.empty() ? NULL : &level0.pixels[0], level0.width, level0.height, 4, 1, true, 0, 0, levels);
+		for (size_t i = 0; i < levels.size(); i++){
+			RGBAImage dst;
+			dst.width  = std::max(1u, level0.width >> (i + 1));
+			dst.height = std::max(1u, level0.height >> (i + 1));
+			dst.pixels.swap(levels[i]);
+			out_levels.push_back(dst);
+		}
+		return;
+	}
+	while (out_levels.back().width > 1 || out_levels.back().height > 1){
+		const RGBAImage & src = out_levels.back();
+		RGBAImage dst;
+		dst.width  = std::max(1u, src.width / 2);
+		dst.height = std::max(1u, src.height / 2);
+		dst.pixels.resize((size_t)dst.width * dst.height * 4);
+		if (filter == MIP_FILTER_KAISER)
+			downsampleKaiser(src, dst);
+		else
+			downsampleBox(src, dst);
+		out_levels.push_back(dst);
+	}
+}
+
+static unsigned short packRGB565(const float c[3]){
+	unsigned int r = (unsigned int)std::min(31.0f, std::max(0.0f, c[0] * 31.0f / 255.0f + 0.5f));
+	unsigned int g = (unsigned int)std::min(63.0f, std::max(0.0f, c[1] * 63.0f / 255.0f + 0.5f));
+	unsigned int b = (unsigned int)std::min(31.0f, std::max(0.0f, c[2] * 31.0f / 255.0f + 0.5f));
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+static void unpackRGB565(unsigned short v, float c[3]){
+	unsigned int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+	c[0] = (float)((r << 3) | (r >> 2));
+	c[1] = (float)((g << 2) | (g >> 4));
+	c[2] = (float)((b << 3) | (b >> 2));
+}
+
+// Closest palette entry for each of the 16 texels, returns the total squared error
+static float selectIndices(const float * r, const float * g, const float * b, const float palette[4][3], unsigned int indices[16]){
+	float error = 0.0f;
+#ifdef DXT_SSE2
+	for (int i = 0; i < 16; i += 4){
+		__m128 pr = _mm_loadu_ps(r + i), pg = _mm_loadu_ps(g + i), pb = _mm_loadu_ps(b + i);
+		__m128 best = _mm_set1_ps(1e30f);
+		__m128i bestIndex = _mm_setzero_si128();
+		for (int c = 0; c < 4; c++){
+			__m128 dr = _mm_sub_ps(pr, _mm_set1_ps(palette[c][0]));
+			__m128 dg = _mm_sub_ps(pg, _mm_set1_ps(palette[c][1]));
+			__m128 db = _mm_sub_ps(pb, _mm_set1_ps(palette[c][2]));
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+			__m128i closer = _mm_castps_si128(_mm_cmplt_ps(d, best));
+			best = _mm_min_ps(d, best);
+			bestIndex = _mm_or_si128(_mm_andnot_si128(closer, bestIndex), _mm_and_si128(closer, _mm_set1_epi32(c)));
+		}
+		int lanes[4];
+		float errors[4];
+		_mm_storeu_si128((__m128i *)lanes, bestIndex);
+		_mm_storeu_ps(errors, best);
+		for (int k = 0; k < 4; k++){
+			indices[i + k] = (unsigned int)lanes[k];
+			error += errors[k];
+		}
+	}
+#else
+	for (int i = 0; i < 16; i++){
+		float best = 1e30f;
+		for (unsigned int c = 0; c < 4; c++){
+			float dr = r[i] - palette[c][0], dg = g[i] - palette[c][1], db = b[i] - palette[c][2];
+			float d = dr * dr + dg * dg + db * db;
+			if (d < best){
+				best = d;
+				indices[i] = c;
+			}
+		}
+		error += best;
+	}
+#endif
+	return error;
+}
+
+// Quantizes the endpoints, builds the 4 colour palette and picks the indices.
+// Returns the squared error ; the block is written to out.
+static float encodeColorEndpoints(const float * r, const float * g, const float * b, const float e0[3], const float e1[3], unsigned char out[8]){
+	unsigned short c0 = packRGB565(e0), c1 = packRGB565(e1);
+	// c0 > c1 selects the 4 colour mode
+	if (c0 < c1)
+		std::swap(c0, c1);
+
+	float palette[4][3];
+	unpackRGB565(c0, palette[0]);
+	unpackRGB565(c1, palette[1]);
+	for (int k = 0; k < 3; k++){
+		palette[2][k] = (2.0f * palette[0][k] + palette[1][k]) / 3.0f;
+		palette[3][k] = (palette[0][k] + 2.0f * palette[1][k]) / 3.0f;
+	}
+
+	unsigned int indices[16];
+	float error = selectIndices(r, g, b, palette, indices);
+	unsigned int bits = 0;
+	if (c0 != c1)
+		for (int i = 0; i < 16; i++)
+			bits |= indices[i] << (2 * i);
+
+	out[0] = (unsigned char)(c0 & 0xFF); out[1] = (unsigned char)(c0 >> 8);
+	out[2] = (unsigned char)(c1 & 0xFF); out[3] = (unsigned char)(c1 >> 8);
+	for (int k = 0; k < 4; k++)
+		out[4 + k] = (unsigned char)(bits >> (8 * k));
+	return error;
+}
+
+// Endpoints on the principal axis of the colours, then one least squares pass
+// on the chosen indices.
+static void compressColorBlock(const unsigned char rgba[64], unsigned char out[8]){
+	float r[16], g[16], b[16];
+	float mean[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++){
+		r[i] = rgba[4 * i]; g[i] = rgba[4 * i + 1]; b[i] = rgba[4 * i + 2];
+		mean[0] += r[i]; mean[1] += g[i]; mean[2] += b[i];
+	}
+	for (int k = 0; k < 3; k++)
+		mean[k] /= 16.0f;
+
+	float cov[6] = { 0, 0, 0, 0, 0, 0 }; // rr rg rb gg gb bb
+	for (int i = 0; i < 16; i++){
+		float dr = r[i] - mean[0], dg = g[i] - mean[1], db = b[i] - mean[2];
+		cov[0] += dr * dr; cov[1] += dr * dg; cov[2] += dr * db;
+		cov[3] += dg * dg; cov[4] += dg * db; cov[5] += db * db;
+	}
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (int iteration = 0; iteration < 8; iteration++){
+		float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		float len = std::max(std::max(fabsf(x), fabsf(y)), fabsf(z));
+		if (len < 1e-6f)
+			break;
+		axis[0] = x / len; axis[1] = y / len; axis[2] = z / len;
+	}
+	float axisLength2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+
+	float tMin = 1e30f, tMax = -1e30f;
+	for (int i = 0; i < 16; i++){
+		float t = ((r[i] - mean[0]) * axis[0] + (g[i] - mean[1]) * axis[1] + (b[i] - mean[2]) * axis[2]) / axisLength2;
+		tMin = std::min(tMin, t);
+		tMax = std::max(tMax, t);
+	}
+	// Inset a little : the extremes are rarely worth a whole palette entry
+	float inset = (tMax - tMin) / 16.0f;
+	float e0[3], e1[3];
+	for (int k = 0; k < 3; k++){
+		e0[k] = mean[k] + axis[k] * (tMax - inset);
+		e1[k] = mean[k] + axis[k] * (tMin + inset);
+	}
+	float error = encodeColorEndpoints(r, g, b, e0, e1, out);
+	if (error == 0.0f)
+		return;
+
+	// Least squares endpoints for the indices we got
+	unsigned short c0 = (unsigned short)(out[0] | (out[1] << 8)), c1 = (unsigned short)(out[2] | (out[3] << 8));
+	if (c0 == c1)
+		return;
+	unsigned int bits = out[4] | (out[5] << 8) | (out[6] << 16) | ((unsigned int)out[7] << 24);
+	const float weightOf[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+	float aa = 0, bb = 0, ab = 0, ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++){
+		float w = weightOf[(bits >> (2 * i)) & 3];
+		float x[3] = { r[i], g[i], b[i] };
+		aa += w * w; bb += (1 - w) * (1 - w); ab += w * (1 - w);
+		for (int k = 0; k < 3; k++){
+			ax[k] += w * x[k];
+			bx[k] += (1 - w) * x[k];
+		}
+	}
+	float det = aa * bb - ab * ab;
+	if (fabsf(det) < 1e-6f)
+		return;
+	float f0[3], f1[3];
+	for (int k = 0; k < 3; k++){
+		f0[k] = (ax[k] * bb - bx[k] * ab) / det;
+		f1[k] = (bx[k] * aa - ax[k] * ab) / det;
+	}
+	unsigned char refined[8];
+	if (encodeColorEndpoints(r, g, b, f0, f1, refined) < error)
+		memcpy(out, refined, 8);
+}
+
+// 8 alphas mode : a0 > a1, 3 bits per texel
+static void compressAlphaBlock(const unsigned char rgba[64], unsigned char out[8]){
+	unsigned char a0 = 0, a1 = 255;
+	for (int i = 0; i < 16; i++){
+		a0 = std::max(a0, rgba[4 * i + 3]);
+		a1 = std::min(a1, rgba[4 * i + 3]);
+	}
+	out[0] = a0;
+	out[1] = a1;
+	unsigned long long bits = 0;
+	if (a0 > a1){
+		for (int i = 0; i < 16; i++){
+			// Step k of 7 from a1 to a0 ; index 0 is a0, 1 is a1, 2..7 are steps 6..1
+			int k = (int)floorf((rgba[4 * i + 3] - a1) * 7.0f / (a0 - a1) + 0.5f);
+			unsigned long long index = (k == 7) ? 0 : (k == 0) ? 1 : (unsigned long long)(8 - k);
+			bits |= index << (3 * i);
+		}
+	}
+	for (int k = 0; k < 6; k++)
+		out[2 + k] = (unsigned char)(bits >> (8 * k));
+}
+
+void compressDXT(const RGBAImage & image, bool bc3, unsigned int numThreads, std::vector<unsigned char> & out){
+	unsigned int blocksX = (image.width + 3) / 4, blocksY = (image.height + 3) / 4;
+	unsigned int blockSize = bc3 ? 16 : 8;
+	out.assign((size_t)blocksX * blocksY * blockSize, 0);
+
+	// Each thread takes the next block row
+	std::atomic<unsigned int> nextRow(0);
+	auto work = [&](){
+		unsigned char rgba[64];
+		for (unsigned int by = nextRow++; by < blocksY; by = nextRow++)
+			for (unsigned int bx = 0; bx < blocksX; bx++){
+				// Edge blocks repeat their last texels
+				for (unsigned int y = 0; y < 4; y++)
+					for (unsigned int x = 0; x < 4; x++){
+						unsigned int sx = std::min(bx * 4 + x, image.width - 1);
+						unsigned int sy = std::min(by * 4 + y, image.height - 1);
+						memcpy(&rgba[4 * (4 * y + x)], &image.pixels[4 * (sy * image.width + sx)], 4);
+					}
+				unsigned char * block = &out[((size_t)by * blocksX + bx) * blockSize];
+				if (bc3){
+					compressAlphaBlock(rgba, block);
+					compressColorBlock(rgba, block + 8);
+				}else{
+					compressColorBlock(rgba, block);
+				}
+			}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int t = 1; t < numThreads; t++)
+		threads.push_back(std::thread(work));
+	work();
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+}
+
+static void writeUint(FILE * file, unsigned int v){
+	fwrite(&v, 4, 1, file);
+}
+
+bool saveDDS(const char * path, unsigned int width, unsigned int height, bool bc3,
+	const std::vector< std::vector<unsigned char> > & levels)
+{
+	FILE * file = fopen(path, "wb");
+	if (!file){
+		printf("Could not write %s\n", path);
+		return false;
+	}
+
+	fwrite("DDS ", 1, 4, file);
+	writeUint(file, 124);                                   // header size
+	writeUint(file, 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000); // caps, height, width, pixel format, mipmap count, linear size
+	writeUint(file, height);
+	writeUint(file, width);
+	writeUint(file, (unsigned int)levels[0].size());        // linear size of the top level
+	writeUint(file, 0);                                     // depth
+	writeUint(file, (unsigned int)levels.size());
+	for (int i = 0; i < 11; i++)
+		writeUint(file, 0);
+	// Pixel format
+	writeUint(file, 32);
+	writeUint(file, 0x4);                                   // DDPF_FOURCC
+	fwrite(bc3 ? "DXT5" : "DXT1", 1, 4, file);
+	for (int i = 0; i < 5; i++)
+		writeUint(file, 0);
+	writeUint(file, 0x1000 | 0x400000 | 0x8);               // texture, mipmap, complex
+	for (int i = 0; i < 4; i++)
+		writeUint(file, 0);
+
+	for (size_t i = 0; i < levels.size(); i++)
+		fwrite(&levels[i][0], 1, levels[i].size(), file);
+	bool ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
@@ -0,0 +1,31 @@
+#ifndef DXTCOMPRESS_HPP
+#define DXTCOMPRESS_HPP
+
+// Offline texture compression : mip chain generation and BC1 / BC3 (DXT1 /
+// DXT5) block encoding. No OpenGL involved, this is what tools/texcook uses.
+
+// 4 bytes per pixel, R G B A, rows tightly packed
+struct RGBAImage {
+	unsigned int width, height;
+	std::vector<unsigned char> pixels;
+};
+
+enum MipFilter {
+	MIP_FILTER_BOX,     // 2x2 average
+	MIP_FILTER_KAISER,  // Kaiser windowed sinc, sharper, no ringing to speak of
+	MIP_FILTER_GAMMA_BOX // 2x2 average in linear space, multi-threaded (see mipmap.hpp) ; no wrapping
+};
+
+// out_levels[0] is a copy of level0, then every level is half the previous one
+// down to 1x1. Filters wrap around the edges, like GL_REPEAT sampling does.
+void buildMipChain(const RGBAImage & level0, MipFilter filter, std::vector<RGBAImage> & out_levels);
+
+// Compresses one level. BC1 is 8 bytes per 4x4 block and ignores alpha, BC3 is
+// 16 bytes and keeps it. Block rows are shared between numThreads threads.
+void compressDXT(const RGBAImage & image, bool bc3, unsigned int numThreads, std::vector<unsigned char> & out);
+
+// Writes a DDS that decodeDDS() reads back : levels[i] is compressDXT's output for level i.
+bool saveDDS(const char * path, unsigned int width, unsigned int height, bool bc3,
+	const std::vector< std::vector<unsigned char> > & levels);
+
+#endif
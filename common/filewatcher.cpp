@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include <sys/stat.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+#include "filewatcher.hpp"
+
+static bool fileStat(const std::string & path, long long & modified, long long & size){
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+		return false;
+	modified = (long long)st.st_mtime;
+	size = (long long)st.st_size;
+	return true;
+}
+
+FileWatcher::FileWatcher(unsigned int settleMilliseconds)
+	: settleMilliseconds(settleMilliseconds), fd(-1)
+{
+#ifdef __linux__
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		printf("inotify_init1 failed, watching modification times instead\n");
+#endif
+}
+
+FileWatcher::~FileWatcher(){
+#ifdef __linux__
+	if (fd >= 0)
+		close(fd);
+#endif
+}
+
+bool FileWatcher::watch(const char * path){
+	WatchedFile file;
+	file.path = path;
+	size_t slash = file.path.find_last_of("/\\");
+	file.directory = slash == std::string::npos ? "." : file.path.substr(0, slash);
+	file.name = slash == std::string::npos ? file.path : file.path.substr(slash + 1);
+	if (!fileStat(file.path, file.modified, file.size)){
+		printf("Cannot watch %s : no such file\n", path);
+		return false;
+	}
+
+#ifdef __linux__
+	if (fd >= 0){
+		bool watched = false;
+		for (std::map<int, std::string>::iterator it = directories.begin(); it != directories.end(); ++it)
+			watched = watched || it->second == file.directory;
+		if (!watched){
+			int wd = inotify_add_watch(fd, file.directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+			if (wd < 0){
+				printf("inotify_add_watch failed on %s, watching modification times instead\n", file.directory.c_str());
+				close(fd);
+				fd = -1;
+				directories.clear();
+			} else {
+				directories[wd] = file.directory;
+			}
+		}
+	}
+#endif
+	files.push_back(file);
+	return true;
+}
+
+void FileWatcher::touched(const std::string & path){
+	dirty[path] = Clock::now();
+}
+
+bool FileWatcher::poll(std::vector<std::string> & out_changed){
+#ifdef __linux__
+	if (fd >= 0){
+		char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+		ssize_t length;
+		while ((length = read(fd, buffer, sizeof(buffer))) > 0){
+			for (char * p = buffer; p < buffer + length; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len){
+				const struct inotify_event * event = (const struct inotify_event *)p;
+				if (event->len == 0)
+					continue;
+				const std::string & directory = directories[event->wd];
+				for (size_t i = 0; i < files.size(); i++)
+					if (files[i].directory == directory && files[i].name == event->name)
+						touched(files[i].path);
+			}
+		}
+	}
+#endif
+	if (fd < 0){
+		for (size_t i = 0; i < files.size(); i++){
+			long long modified, size;
+			if (fileStat(files[i].path, modified, size) && (modified != files[i].modified || size != files[i].size)){
+				files[i].modified = modified;
+				files[i].size = size;
+				touched(files[i].path);
+			}
+		}
+	}
+
+	// Only files that settled, and that are back if they were renamed away
+	bool changed = false;
+	Clock::time_point now = Clock::now();
+	for (std::map<std::string, Clock::time_point>::iterator it = dirty.begin(); it != dirty.end(); ){
+		long long modified, size;
+		if (now - it->second >= std::chrono::milliseconds(settleMilliseconds) && fileStat(it->first, modified, size)){
+			out_changed.push_back(it->first);
+			changed = true;
+			dirty.erase(it++);
+		} else {
+			++it;
+		}
+	}
+	return changed;
+}
@@ -0,0 +1,43 @@
+#ifndef FILEWATCHER_HPP
+#define FILEWATCHER_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <chrono>
+
+// Tells which of a set of files were modified, without ever blocking : inotify
+// on Linux, modification times elsewhere (checked on every poll).
+// The directories are watched rather than the files, because most editors save
+// by writing a new file and renaming it over the old one.
+class FileWatcher {
+public:
+	// Changes are reported once the file has been left alone for settleMilliseconds,
+	// so that an editor's several writes make a single change
+	explicit FileWatcher(unsigned int settleMilliseconds = 100);
+	~FileWatcher();
+
+	// path as given here is what poll reports
+	bool watch(const char * path);
+
+	// Appends the files that changed since the last poll ; false if none did
+	bool poll(std::vector<std::string> & out_changed);
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	void touched(const std::string & path);
+
+	struct WatchedFile {
+		std::string path, directory, name;
+		long long modified, size;   // for the fallback
+	};
+	std::vector<WatchedFile> files;
+	std::map<std::string, Clock::time_point> dirty;   // path -> last time it was touched
+	unsigned int settleMilliseconds;
+
+	int fd;                                          // inotify, -1 if unused
+	std::map<int, std::string> directories;          // watch descriptor -> directory
+};
+
+#endif
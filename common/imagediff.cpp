@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "texture.hpp"
+#include "dxtcompress.hpp"
+#include "imagediff.hpp"
+
+// sRGB 8 bits -> CIE Lab (D65)
+static void toLab(const unsigned char * rgb, float lab[3]){
+	float linear[3];
+	for (int c = 0; c < 3; c++){
+		float v = rgb[c] / 255.0f;
+		linear[c] = v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+	}
+	float xyz[3] = {
+		(0.4124f * linear[0] + 0.3576f * linear[1] + 0.1805f * linear[2]) / 0.95047f,
+		(0.2126f * linear[0] + 0.7152f * linear[1] + 0.0722f * linear[2]),
+		(0.0193f * linear[0] + 0.1192f * linear[1] + 0.9505f * linear[2]) / 1.08883f
+	};
+	for (int c = 0; c < 3; c++)
+		xyz[c] = xyz[c] > 0.008856f ? cbrtf(xyz[c]) : 7.787f * xyz[c] + 16.0f / 116.0f;
+	lab[0] = 116.0f * xyz[1] - 16.0f;
+	lab[1] = 500.0f * (xyz[0] - xyz[1]);
+	lab[2] = 200.0f * (xyz[1] - xyz[2]);
+}
+
+bool compareImages(const RGBAImage & a, const RGBAImage & b, float threshold,
+	ImageDiffResult & out, RGBAImage * out_diff)
+{
+	memset(&out, 0, sizeof(out));
+	if (a.width != b.width || a.height != b.height){
+		printf("compareImages : %ux%u against %ux%u\n", a.width, a.height, b.width, b.height);
+		return false;
+	}
+	size_t count = (size_t)a.width * a.height;
+	if (out_diff){
+		out_diff->width = a.width;
+		out_diff->height = a.height;
+		out_diff->pixels.resize(count * 4);
+	}
+
+	double total = 0.0;
+	for (size_t i = 0; i < count; i++){
+		const unsigned char * pa = &a.pixels[4 * i];
+		const unsigned char * pb = &b.pixels[4 * i];
+		float deltaE = 0.0f;
+		if (pa[0] != pb[0] || pa[1] != pb[1] || pa[2] != pb[2]){
+			float labA[3], labB[3];
+			toLab(pa, labA);
+			toLab(pb, labB);
+			deltaE = sqrtf((labA[0] - labB[0]) * (labA[0] - labB[0]) +
+			               (labA[1] - labB[1]) * (labA[1] - labB[1]) +
+			               (labA[2] - labB[2]) * (labA[2] - labB[2]));
+		}
+		total += deltaE;
+		out.maxDeltaE = std::max(out.maxDeltaE, (double)deltaE);
+		bool different = deltaE > threshold;
+		if (different)
+			out.differentPixels++;
+
+		if (out_diff){
+			unsigned char * d = &out_diff->pixels[4 * i];
+			unsigned char grey = (unsigned char)((pa[0] * 77 + pa[1] * 150 + pa[2] * 29) >> 10);   // a quarter of the luma
+			if (different){
+				d[0] = (unsigned char)std::min(255.0f, 128.0f + 4.0f * deltaE);
+				d[1] = d[2] = 0;
+			} else {
+				d[0] = d[1] = d[2] = grey;
+			}
+			d[3] = 255;
+		}
+	}
+	out.differentFraction = count ? double(out.differentPixels) / count : 0.0;
+	out.meanDeltaE = count ? total / count : 0.0;
+	return true;
+}
+
+bool saveBMPImage(const char * path, const RGBAImage & image){
+	unsigned int rowBytes = (image.width * 3 + 3) & ~3u;
+	unsigned int imageSize = rowBytes * image.height;
+	unsigned char header[54];
+	memset(header, 0, sizeof(header));
+	header[0] = 'B';
+	header[1] = 'M';
+	*(unsigned int *)&header[0x02] = 54 + imageSize;
+	*(unsigned int *)&header[0x0A] = 54;
+	*(unsigned int *)&header[0x0E] = 40;
+	*(int *)&header[0x12] = (int)image.width;
+	*(int *)&header[0x16] = (int)image.height;
+	*(unsigned short *)&header[0x1A] = 1;
+	*(unsigned short *)&header[0x1C] = 24;
+	*(unsigned int *)&header[0x22] = imageSize;
+	*(int *)&header[0x26] = 2835;   // 72 dpi
+	*(int *)&header[0x2A] = 2835;
+
+	std::vector<unsigned char> data(imageSize, 0);
+	for (unsigned int y = 0; y < image.height; y++)
+		for (unsigned int x = 0; x < image.width; x++){
+			const unsigned char * src = &image.pixels[4 * ((size_t)y * image.width + x)];
+			unsigned char * dst = &data[(size_t)y * rowBytes + 3 * x];
+			dst[0] = src[2];
+			dst[1] = src[1];
+			dst[2] = src[0];
+		}
+
+	FILE * f = fopen(path, "wb");
+	if (!f){
+		printf("Could not write %s\n", path);
+		return false;
+	}
+	fwrite(header, 1, sizeof(header), f);
+	if (!data.empty())
+		fwrite(&data[0], 1, data.size(), f);
+	fclose(f);
+	return true;
+}
+
+void bmpToRGBA(const TextureImage & bmp, RGBAImage & out){
+	out.width = bmp.width;
+	out.height = bmp.height;
+	out.pixels.resize((size_t)bmp.width * bmp.height * 4);
+	size_t rowBytes = ((size_t)bmp.width * 3 + 3) & ~(size_t)3;
+	for (unsigned int y = 0; y < bmp.height; y++)
+		for (unsigned int x = 0; x < bmp.width; x++){
+			const unsigned char * src = &bmp.data[y * rowBytes + x * 3];
+			unsigned char * dst = &out.pixels[4 * ((size_t)y * bmp.width + x)];
+			dst[0] = src[2];
+			dst[1] = src[1];
+			dst[2] = src[0];
+			dst[3] = 255;
+		}
+}
+
+bool loadBMPImage(const char * path, RGBAImage & out){
+	std::vector<unsigned char> file;
+	TextureImage bmp;
+	if (!readFile(path, file) || !decodeBMP(file.empty() ? NULL : &file[0], file.size(), bmp))
+		return false;
+	bmpToRGBA(bmp, out);
+	return true;
+}
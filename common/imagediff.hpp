@@ -0,0 +1,32 @@
+#ifndef IMAGEDIFF_HPP
+#define IMAGEDIFF_HPP
+
+#include <vector>
+
+// Perceptual comparison of two renders of the same size : the CIE76 delta E
+// of every pixel, in Lab space. 2.3 is about the smallest difference people
+// notice ; rasterization changes (a triangle edge moving by a pixel) give a
+// few pixels far above it, hence a budget of pixels allowed over threshold.
+struct ImageDiffResult {
+	unsigned int differentPixels;   // delta E above the threshold
+	double differentFraction;
+	double maxDeltaE, meanDeltaE;
+};
+
+// RGBA, rows in the same order in both (alpha is ignored). false if the sizes
+// differ. out_diff, if given, is a dimmed grey copy of a with the differences
+// in red, brighter as they grow.
+bool compareImages(const RGBAImage & a, const RGBAImage & b, float threshold,
+	ImageDiffResult & out, RGBAImage * out_diff = NULL);
+
+// 24 bits BMPs, rows bottom up like glReadPixels gives them
+bool saveBMPImage(const char * path, const RGBAImage & image);
+bool loadBMPImage(const char * path, RGBAImage & out);
+
+struct TextureImage;
+
+// What decodeBMP gives (BGR, rows 4 bytes aligned) -> RGBA, tightly packed,
+// alpha 255. Rows stay in the same order.
+void bmpToRGBA(const TextureImage & bmp, RGBAImage & out);
+
+#endif
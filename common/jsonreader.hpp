@@ -0,0 +1,78 @@
+#ifndef JSONREADER_HPP
+#define JSONREADER_HPP
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+// Just enough JSON for the files we write ourselves (camera paths, limits) :
+// objects, arrays, numbers, and strings without escapes. The caller walks
+// the structure it expects and skips the rest with skipValue ; ok turns false
+// on the first syntax error.
+struct JsonReader {
+	const char * p;
+	bool ok;
+
+	void skipSpaces(){
+		while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+			p++;
+	}
+	bool accept(char c){
+		skipSpaces();
+		if (*p != c)
+			return false;
+		p++;
+		return true;
+	}
+	void expect(char c){
+		if (!accept(c))
+			ok = false;
+	}
+	std::string string(){
+		std::string s;
+		expect('"');
+		while (ok && *p && *p != '"')
+			s += *p++;
+		expect('"');
+		return s;
+	}
+	double number(){
+		skipSpaces();
+		char * end;
+		double value = strtod(p, &end);
+		if (end == p)
+			ok = false;
+		p = end;
+		return value;
+	}
+	void skipValue(){
+		skipSpaces();
+		if (*p == '"'){
+			string();
+		} else if (accept('{')){
+			if (accept('}'))
+				return;
+			do {
+				string();
+				expect(':');
+				skipValue();
+			} while (ok && accept(','));
+			expect('}');
+		} else if (accept('[')){
+			if (accept(']'))
+				return;
+			do {
+				skipValue();
+			} while (ok && accept(','));
+			expect(']');
+		} else if (strncmp(p, "true", 4) == 0 || strncmp(p, "null", 4) == 0){
+			p += 4;
+		} else if (strncmp(p, "false", 5) == 0){
+			p += 5;
+		} else {
+			number();
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,147 @@
+#include <vector>
+#include <map>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "meshcluster.hpp"
+
+struct ClusterKey {
+	glm::vec3 p;
+	bool operator<(const ClusterKey & that) const{
+		return memcmp((const void*)this, (const void*)&that, sizeof(ClusterKey)) < 0;
+	}
+};
+
+static unsigned int findRoot(std::vector<unsigned int> & parent, unsigned int i){
+	while (parent[i] != i){
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+void buildMeshClusters(
+	const std::vector<glm::vec3> & positions,
+	const std::vector<unsigned int> & indices,
+	float cellSize,
+	std::vector<MeshCluster> & out_clusters,
+	std::vector<unsigned int> & out_indices
+){
+	size_t numTriangles = indices.size() / 3;
+	out_clusters.clear();
+	out_indices.clear();
+	if (numTriangles == 0)
+		return;
+
+	// Vertices that only differ by their attributes are one position
+	std::map<ClusterKey, unsigned int> weldIds;
+	std::vector<unsigned int> weldOf(positions.size());
+	for (size_t i = 0; i < positions.size(); i++){
+		ClusterKey key = { positions[i] };
+		std::map<ClusterKey, unsigned int>::iterator it = weldIds.find(key);
+		if (it == weldIds.end())
+			it = weldIds.insert(std::make_pair(key, (unsigned int)weldIds.size())).first;
+		weldOf[i] = it->second;
+	}
+
+	// Objects : union-find over the positions of each triangle
+	std::vector<unsigned int> parent(weldIds.size());
+	for (size_t i = 0; i < parent.size(); i++)
+		parent[i] = (unsigned int)i;
+	for (size_t t = 0; t < numTriangles; t++){
+		unsigned int a = findRoot(parent, weldOf[indices[3*t]]);
+		for (int k = 1; k < 3; k++){
+			unsigned int b = findRoot(parent, weldOf[indices[3*t+k]]);
+			if (a != b)
+				parent[b] = a;
+		}
+	}
+
+	// Bounds of each object, numbered in order of first triangle
+	std::vector<int> objectOfRoot(parent.size(), -1);
+	std::vector<unsigned int> objectOfTriangle(numTriangles);
+	std::vector<glm::vec3> objectMin, objectMax;
+	for (size_t t = 0; t < numTriangles; t++){
+		unsigned int root = findRoot(parent, weldOf[indices[3*t]]);
+		if (objectOfRoot[root] < 0){
+			objectOfRoot[root] = (int)objectMin.size();
+			objectMin.push_back(glm::vec3(1e30f));
+			objectMax.push_back(glm::vec3(-1e30f));
+		}
+		unsigned int o = (unsigned int)objectOfRoot[root];
+		objectOfTriangle[t] = o;
+		for (int k = 0; k < 3; k++){
+			objectMin[o] = glm::min(objectMin[o], positions[indices[3*t+k]]);
+			objectMax[o] = glm::max(objectMax[o], positions[indices[3*t+k]]);
+		}
+	}
+
+	// Objects to clusters : the small ones by grid cell, the others alone
+	std::map< std::vector<int>, unsigned int > clusterOfCell;
+	std::vector<unsigned int> clusterOfObject(objectMin.size());
+	unsigned int numClusters = 0;
+	for (size_t o = 0; o < objectMin.size(); o++){
+		glm::vec3 size = objectMax[o] - objectMin[o];
+		if (std::max(size.x, std::max(size.y, size.z)) > cellSize){
+			clusterOfObject[o] = numClusters++;
+			continue;
+		}
+		glm::vec3 center = (objectMin[o] + objectMax[o]) * (0.5f / cellSize);
+		std::vector<int> cell(3);
+		for (int k = 0; k < 3; k++)
+			cell[k] = (int)floor(center[k]);
+		std::map< std::vector<int>, unsigned int >::iterator it = clusterOfCell.find(cell);
+		if (it == clusterOfCell.end())
+			it = clusterOfCell.insert(std::make_pair(cell, numClusters++)).first;
+		clusterOfObject[o] = it->second;
+	}
+
+	// Counting sort of the triangles by cluster, stable
+	std::vector<unsigned int> start(numClusters + 1, 0);
+	for (size_t t = 0; t < numTriangles; t++)
+		start[clusterOfObject[objectOfTriangle[t]] + 1]++;
+	for (unsigned int c = 0; c < numClusters; c++)
+		start[c + 1] += start[c];
+
+	out_clusters.resize(numClusters);
+	for (unsigned int c = 0; c < numClusters; c++){
+		out_clusters[c].indexOffset = start[c] * 3;
+		out_clusters[c].indexCount = (start[c + 1] - start[c]) * 3;
+		out_clusters[c].boundsMin = glm::vec3(1e30f);
+		out_clusters[c].boundsMax = glm::vec3(-1e30f);
+	}
+	out_indices.resize(indices.size());
+	for (size_t t = 0; t < numTriangles; t++){
+		unsigned int o = objectOfTriangle[t];
+		MeshCluster & cluster = out_clusters[clusterOfObject[o]];
+		unsigned int slot = start[clusterOfObject[o]]++;
+		for (int k = 0; k < 3; k++)
+			out_indices[3 * slot + k] = indices[3*t+k];
+		cluster.boundsMin = glm::min(cluster.boundsMin, objectMin[o]);
+		cluster.boundsMax = glm::max(cluster.boundsMax, objectMax[o]);
+	}
+}
+
+void compactClusterVertices(
+	const std::vector<unsigned int> & indices,
+	size_t begin,
+	size_t count,
+	std::vector<unsigned int> & out_indices,
+	std::vector<unsigned int> & out_vertexMap
+){
+	out_indices.resize(count);
+	out_vertexMap.clear();
+	std::map<unsigned int, unsigned int> localOf;
+	for (size_t i = 0; i < count; i++){
+		unsigned int v = indices[begin + i];
+		std::map<unsigned int, unsigned int>::iterator it = localOf.find(v);
+		if (it == localOf.end()){
+			it = localOf.insert(std::make_pair(v, (unsigned int)out_vertexMap.size())).first;
+			out_vertexMap.push_back(v);
+		}
+		out_indices[i] = it->second;
+	}
+}
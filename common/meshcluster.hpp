@@ -0,0 +1,39 @@
+#ifndef MESHCLUSTER_HPP
+#define MESHCLUSTER_HPP
+
+#include <vector>
+
+// A group of nearby objects of one mesh, contiguous in the index buffer :
+// what the culling and the LOD selection work on, instead of a whole material
+// mesh that spans the room.
+struct MeshCluster {
+	unsigned int indexOffset;   // in the reordered index buffer
+	unsigned int indexCount;
+	glm::vec3 boundsMin, boundsMax;
+};
+
+// Triangles connected through shared positions make an object (a bench, a
+// wall). Objects smaller than cellSize are grouped by the grid cell of their
+// centre ; bigger ones are clusters on their own. out_indices holds the same
+// triangles as indices, cluster after cluster. No OpenGL involved.
+void buildMeshClusters(
+	const std::vector<glm::vec3> & positions,
+	const std::vector<unsigned int> & indices,
+	float cellSize,
+	std::vector<MeshCluster> & out_clusters,
+	std::vector<unsigned int> & out_indices
+);
+
+// The vertices used by indices[begin, begin + count), numbered from 0 in
+// order of first use : out_indices are the same triangles in that numbering,
+// and out_vertexMap[i] is the index in the full vertex buffer of vertex i.
+// Lets the simplifier and the meshlet builder work on one cluster at a time.
+void compactClusterVertices(
+	const std::vector<unsigned int> & indices,
+	size_t begin,
+	size_t count,
+	std::vector<unsigned int> & out_indices,
+	std::vector<unsigned int> & out_vertexMap
+);
+
+#endif
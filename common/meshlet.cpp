@@ -0,0 +1,215 @@
+#include <vector>
+#include <map>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "meshlet.hpp"
+
+struct WeldKey {
+	glm::vec3 p;
+	bool operator<(const WeldKey & that) const{
+		return memcmp((const void*)this, (const void*)&that, sizeof(WeldKey)) < 0;
+	}
+};
+
+// Ritter's bounding sphere
+static void boundingSphere(const std::vector<glm::vec3> & points, glm::vec3 & center, float & radius){
+	glm::vec3 a = points[0];
+	glm::vec3 b = a;
+	float best = -1.0f;
+	for (size_t i = 0; i < points.size(); i++){
+		float d = glm::dot(points[i] - a, points[i] - a);
+		if (d > best){ best = d; b = points[i]; }
+	}
+	glm::vec3 c = b;
+	best = -1.0f;
+	for (size_t i = 0; i < points.size(); i++){
+		float d = glm::dot(points[i] - b, points[i] - b);
+		if (d > best){ best = d; c = points[i]; }
+	}
+	center = (b + c) * 0.5f;
+	radius = glm::length(c - b) * 0.5f;
+	for (size_t i = 0; i < points.size(); i++){
+		float d = glm::length(points[i] - center);
+		if (d > radius){
+			float newRadius = (radius + d) * 0.5f;
+			center += (points[i] - center) * ((newRadius - radius) / d);
+			radius = newRadius;
+		}
+	}
+}
+
+static void finishMeshlet(
+	Meshlet & m,
+	const std::vector<glm::vec3> & positions,
+	const std::vector<unsigned int> & meshletIndices,
+	const std::vector<glm::vec3> & faceNormals,
+	const std::vector<unsigned int> & meshletTriangles
+){
+	std::vector<glm::vec3> points;
+	for (size_t i = 0; i < meshletIndices.size(); i++)
+		points.push_back(positions[meshletIndices[i]]);
+	boundingSphere(points, m.center, m.radius);
+
+	glm::vec3 sum(0.0f);
+	for (size_t i = 0; i < meshletTriangles.size(); i++)
+		sum += faceNormals[meshletTriangles[i]];
+	float len = glm::length(sum);
+	if (len < 1e-6f){
+		m.coneAxis = glm::vec3(0, 1, 0);
+		m.coneSin = 2.0f;
+		return;
+	}
+	m.coneAxis = sum / len;
+	float minDot = 1.0f;
+	for (size_t i = 0; i < meshletTriangles.size(); i++)
+		minDot = std::min(minDot, glm::dot(faceNormals[meshletTriangles[i]], m.coneAxis));
+	// Wider than a half space : some face always looks at the camera
+	m.coneSin = (minDot <= 0.0f) ? 2.0f : sqrt(std::max(0.0f, 1.0f - minDot * minDot));
+}
+
+void buildMeshlets(
+	const std::vector<glm::vec3> & positions,
+	const std::vector<unsigned int> & indices,
+	unsigned int maxVertices,
+	unsigned int maxTriangles,
+	std::vector<Meshlet> & out_meshlets,
+	std::vector<unsigned int> & out_indices
+){
+	size_t numTriangles = indices.size() / 3;
+	out_meshlets.clear();
+	out_indices.clear();
+	out_indices.reserve(numTriangles * 3);
+
+	// Adjacency goes through positions, not vertices : hard edges split the
+	// vertices, but the faces on both sides still belong together.
+	std::map<WeldKey, unsigned int> weldIds;
+	std::vector<unsigned int> weldOf(positions.size());
+	for (size_t i = 0; i < positions.size(); i++){
+		WeldKey key = { positions[i] };
+		std::map<WeldKey, unsigned int>::iterator it = weldIds.find(key);
+		if (it == weldIds.end())
+			it = weldIds.insert(std::make_pair(key, (unsigned int)weldIds.size())).first;
+		weldOf[i] = it->second;
+	}
+
+	// Face normals (unit, from the winding) and position -> triangles adjacency
+	std::vector<glm::vec3> faceNormals(numTriangles);
+	std::vector< std::vector<unsigned int> > trianglesOf(weldIds.size());
+	for (size_t t = 0; t < numTriangles; t++){
+		const glm::vec3 & a = positions[indices[3*t]];
+		const glm::vec3 & b = positions[indices[3*t+1]];
+		const glm::vec3 & c = positions[indices[3*t+2]];
+		glm::vec3 n = glm::cross(b - a, c - a);
+		float len = glm::length(n);
+		faceNormals[t] = len > 0.0f ? n / len : glm::vec3(0.0f);
+		for (int k = 0; k < 3; k++)
+			trianglesOf[weldOf[indices[3*t+k]]].push_back((unsigned int)t);
+	}
+
+	std::vector<char> used(numTriangles, 0);
+	// Which meshlet a vertex was last added to, to count unique vertices
+	std::vector<int> vertexMeshlet(positions.size(), -1);
+	size_t nextSeed = 0;
+
+	while (true){
+		while (nextSeed < numTriangles && used[nextSeed])
+			nextSeed++;
+		if (nextSeed >= numTriangles)
+			break;
+
+		int id = (int)out_meshlets.size();
+		Meshlet m;
+		m.indexOffset = (unsigned int)out_indices.size();
+		std::vector<unsigned int> meshletIndices;   // unique vertices
+		std::vector<unsigned int> meshletTriangles;
+		glm::vec3 normalSum(0.0f);
+
+		unsigned int current = (unsigned int)nextSeed;
+		while (true){
+			used[current] = 1;
+			meshletTriangles.push_back(current);
+			normalSum += faceNormals[current];
+			for (int k = 0; k < 3; k++){
+				unsigned int v = indices[3*current+k];
+				out_indices.push_back(v);
+				if (vertexMeshlet[v] != id){
+					vertexMeshlet[v] = id;
+					meshletIndices.push_back(v);
+				}
+			}
+			if (meshletTriangles.size() >= maxTriangles)
+				break;
+
+			// Best unused neighbour : shares the most vertices, faces the same way
+			glm::vec3 axis = glm::length(normalSum) > 0.0f ? glm::normalize(normalSum) : glm::vec3(0.0f);
+			int best = -1;
+			float bestScore = -1e30f;
+			for (size_t i = 0; i < meshletIndices.size(); i++){
+				const std::vector<unsigned int> & around = trianglesOf[weldOf[meshletIndices[i]]];
+				for (size_t j = 0; j < around.size(); j++){
+					unsigned int t = around[j];
+					if (used[t]) continue;
+					unsigned int extra = 0;
+					for (int k = 0; k < 3; k++)
+						if (vertexMeshlet[indices[3*t+k]] != id)
+							extra++;
+					if (meshletIndices.size() + extra > maxVertices)
+						continue;
+					// A cone wider than ~75 degrees rarely culls anything
+					float alignment = glm::dot(faceNormals[t], axis);
+					if (alignment < 0.25f)
+						continue;
+					float score = (3 - extra) + 4.0f * alignment;
+					if (score > bestScore){
+						bestScore = score;
+						best = (int)t;
+					}
+				}
+			}
+			if (best < 0)
+				break;
+			current = (unsigned int)best;
+		}
+
+		m.triangleCount = (unsigned int)meshletTriangles.size();
+		m.vertexCount = (unsigned int)meshletIndices.size();
+		finishMeshlet(m, positions, meshletIndices, faceNormals, meshletTriangles);
+		out_meshlets.push_back(m);
+	}
+}
+
+void extractFrustumPlanes(const glm::mat4 & viewProj, glm::vec4 planes[6]){
+	// Gribb & Hartmann, on the rows of the matrix
+	glm::vec4 row0(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+	glm::vec4 row1(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+	glm::vec4 row2(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+	glm::vec4 row3(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+	planes[0] = row3 + row0; // left
+	planes[1] = row3 - row0; // right
+	planes[2] = row3 + row1; // bottom
+	planes[3] = row3 - row1; // top
+	planes[4] = row3 + row2; // near
+	planes[5] = row3 - row2; // far
+	for (int i = 0; i < 6; i++)
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+bool isMeshletVisible(const Meshlet & m, const glm::vec3 & cameraPosition, const glm::vec4 planes[6]){
+	for (int i = 0; i < 6; i++)
+		if (glm::dot(glm::vec3(planes[i]), m.center) + planes[i].w < -m.radius)
+			return false;
+
+	// Every face is seen from behind if the view direction to any point of the
+	// sphere stays within (90 - half angle) degrees of the cone axis.
+	if (m.coneSin <= 1.0f){
+		glm::vec3 toCenter = m.center - cameraPosition;
+		float distance = glm::length(toCenter);
+		if (glm::dot(toCenter, m.coneAxis) >= m.coneSin * distance + m.radius * (1.0f + m.coneSin))
+			return false;
+	}
+	return true;
+}
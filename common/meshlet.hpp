@@ -0,0 +1,37 @@
+#ifndef MESHLET_HPP
+#define MESHLET_HPP
+
+// A small cluster of triangles, contiguous in the index buffer, with what we
+// need to cull it : a bounding sphere and a cone containing all its normals.
+struct Meshlet {
+	unsigned int indexOffset;   // in the reordered index buffer
+	unsigned int triangleCount;
+	unsigned int vertexCount;   // unique vertices, <= maxVertices
+
+	glm::vec3 center;
+	float radius;
+
+	glm::vec3 coneAxis;         // average face normal
+	float coneSin;              // sine of the cone half angle, > 1 if it can't be back-face culled
+};
+
+// Splits the triangles in meshlets of at most maxVertices unique vertices and
+// maxTriangles triangles. Meshlets grow over shared vertices, preferring faces
+// that point the same way, so that the normal cones stay narrow.
+// out_indices holds the same triangles as indices, in meshlet order.
+void buildMeshlets(
+	const std::vector<glm::vec3> & positions,
+	const std::vector<unsigned int> & indices,
+	unsigned int maxVertices,
+	unsigned int maxTriangles,
+	std::vector<Meshlet> & out_meshlets,
+	std::vector<unsigned int> & out_indices
+);
+
+// Planes are (normal, d), inside when dot(normal, p) + d >= 0
+void extractFrustumPlanes(const glm::mat4 & viewProj, glm::vec4 planes[6]);
+
+// Conservative : false only if the meshlet is off screen or entirely back facing.
+bool isMeshletVisible(const Meshlet & meshlet, const glm::vec3 & cameraPosition, const glm::vec4 planes[6]);
+
+#endif
@@ -0,0 +1,256 @@
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+#include <glm/glm.hpp>
+
+#include "meshsimplify.hpp"
+
+// Symmetric 4x4 matrix : a2 ab ac ad b2 bc bd c2 cd d2
+struct Quadric {
+	double m[10];
+};
+
+static void quadricZero(Quadric & q){
+	memset(q.m, 0, sizeof(q.m));
+}
+
+static void quadricAddPlane(Quadric & q, const glm::dvec3 & n, double d, double weight){
+	q.m[0] += weight * n.x * n.x; q.m[1] += weight * n.x * n.y; q.m[2] += weight * n.x * n.z; q.m[3] += weight * n.x * d;
+	q.m[4] += weight * n.y * n.y; q.m[5] += weight * n.y * n.z; q.m[6] += weight * n.y * d;
+	q.m[7] += weight * n.z * n.z; q.m[8] += weight * n.z * d;
+	q.m[9] += weight * d * d;
+}
+
+static void quadricAdd(Quadric & q, const Quadric & other){
+	for (int i = 0; i < 10; i++)
+		q.m[i] += other.m[i];
+}
+
+// v^T Q v
+static double quadricError(const Quadric & q, const glm::vec3 & p){
+	double x = p.x, y = p.y, z = p.z;
+	return q.m[0]*x*x + 2*q.m[1]*x*y + 2*q.m[2]*x*z + 2*q.m[3]*x
+	     + q.m[4]*y*y + 2*q.m[5]*y*z + 2*q.m[6]*y
+	     + q.m[7]*z*z + 2*q.m[8]*z
+	     + q.m[9];
+}
+
+struct PositionKey {
+	glm::vec3 p;
+	bool operator<(const PositionKey & that) const{
+		return memcmp((const void*)this, (const void*)&that, sizeof(PositionKey)) < 0;
+	}
+};
+
+struct SimplifyTriangle {
+	unsigned int w[3];     // welded vertices, updated by collapses
+	unsigned int orig[3];  // vertices of the input triangle
+};
+
+struct Collapse {
+	unsigned int from, to;
+	double cost;
+	bool operator<(const Collapse & that) const { return cost < that.cost; }
+};
+
+static glm::vec3 triangleNormal(const glm::vec3 & a, const glm::vec3 & b, const glm::vec3 & c){
+	return glm::cross(b - a, c - a);
+}
+
+void simplifyMesh(
+	const std::vector<glm::vec3> & positions,
+	const std::vector<glm::vec3> & normals,
+	const std::vector<unsigned int> & indices,
+	size_t targetIndexCount,
+	float maxError,
+	std::vector<unsigned int> & out_indices
+){
+	// Weld vertices that only differ by their attributes
+	std::map<PositionKey, unsigned int> positionToWeld;
+	std::vector<unsigned int> weldOf(positions.size());
+	std::vector<glm::vec3> wpos;
+	std::vector< std::vector<unsigned int> > verticesAt;
+	for (unsigned int i = 0; i < positions.size(); i++){
+		PositionKey key = { positions[i] };
+		std::map<PositionKey, unsigned int>::iterator it = positionToWeld.find(key);
+		if (it == positionToWeld.end()){
+			unsigned int w = (unsigned int)wpos.size();
+			positionToWeld[key] = w;
+			wpos.push_back(positions[i]);
+			verticesAt.push_back(std::vector<unsigned int>());
+			it = positionToWeld.find(key);
+		}
+		weldOf[i] = it->second;
+		verticesAt[it->second].push_back(i);
+	}
+	size_t numWelded = wpos.size();
+
+	std::vector<SimplifyTriangle> tris;
+	for (size_t i = 0; i + 2 < indices.size(); i += 3){
+		SimplifyTriangle t;
+		for (int k = 0; k < 3; k++){
+			t.orig[k] = indices[i + k];
+			t.w[k] = weldOf[indices[i + k]];
+		}
+		if (t.w[0] != t.w[1] && t.w[1] != t.w[2] && t.w[0] != t.w[2])
+			tris.push_back(t);
+	}
+
+	// Plane quadrics. Not area weighted, so that errors stay squared distances.
+	std::vector<Quadric> quadrics(numWelded);
+	for (size_t i = 0; i < numWelded; i++)
+		quadricZero(quadrics[i]);
+	for (size_t i = 0; i < tris.size(); i++){
+		glm::dvec3 n = glm::dvec3(triangleNormal(wpos[tris[i].w[0]], wpos[tris[i].w[1]], wpos[tris[i].w[2]]));
+		double area = glm::length(n);
+		if (area <= 0.0) continue;
+		n /= area;
+		double d = -glm::dot(n, glm::dvec3(wpos[tris[i].w[0]]));
+		for (int k = 0; k < 3; k++)
+			quadricAddPlane(quadrics[tris[i].w[k]], n, d, 1.0);
+	}
+
+	// Open borders get a plane perpendicular to the face, so they keep their shape
+	std::map< std::pair<unsigned int, unsigned int>, int > edgeUse;
+	for (size_t i = 0; i < tris.size(); i++)
+		for (int k = 0; k < 3; k++){
+			unsigned int a = tris[i].w[k], b = tris[i].w[(k + 1) % 3];
+			edgeUse[std::make_pair(std::min(a, b), std::max(a, b))]++;
+		}
+	for (size_t i = 0; i < tris.size(); i++){
+		glm::dvec3 fn = glm::dvec3(triangleNormal(wpos[tris[i].w[0]], wpos[tris[i].w[1]], wpos[tris[i].w[2]]));
+		for (int k = 0; k < 3; k++){
+			unsigned int a = tris[i].w[k], b = tris[i].w[(k + 1) % 3];
+			if (edgeUse[std::make_pair(std::min(a, b), std::max(a, b))] != 1)
+				continue;
+			glm::dvec3 n = glm::cross(glm::dvec3(wpos[b] - wpos[a]), fn);
+			double len = glm::length(n);
+			if (len <= 0.0) continue;
+			n /= len;
+			double d = -glm::dot(n, glm::dvec3(wpos[a]));
+			double weight = 10.0;
+			quadricAddPlane(quadrics[a], n, d, weight);
+			quadricAddPlane(quadrics[b], n, d, weight);
+		}
+	}
+
+	std::vector<unsigned int> remap(numWelded);
+	for (unsigned int i = 0; i < numWelded; i++)
+		remap[i] = i;
+
+	// Independent collapses by increasing cost, then rebuild, until done.
+	while (tris.size() * 3 > targetIndexCount){
+		std::vector<Collapse> collapses;
+		std::map< std::pair<unsigned int, unsigned int>, bool > seen;
+		for (size_t i = 0; i < tris.size(); i++)
+			for (int k = 0; k < 3; k++){
+				unsigned int a = tris[i].w[k], b = tris[i].w[(k + 1) % 3];
+				std::pair<unsigned int, unsigned int> key(std::min(a, b), std::max(a, b));
+				if (seen.count(key)) continue;
+				seen[key] = true;
+				Quadric q = quadrics[a];
+				quadricAdd(q, quadrics[b]);
+				Collapse c;
+				double costToB = quadricError(q, wpos[b]);
+				double costToA = quadricError(q, wpos[a]);
+				if (costToB <= costToA){ c.from = a; c.to = b; c.cost = costToB; }
+				else                   { c.from = b; c.to = a; c.cost = costToA; }
+				collapses.push_back(c);
+			}
+		std::sort(collapses.begin(), collapses.end());
+		if (collapses.empty() || collapses[0].cost > maxError)
+			break;
+
+		std::vector< std::vector<unsigned int> > trisOf(numWelded);
+		for (size_t i = 0; i < tris.size(); i++)
+			for (int k = 0; k < 3; k++)
+				trisOf[tris[i].w[k]].push_back((unsigned int)i);
+
+		std::vector<char> locked(numWelded, 0);
+		size_t toRemove = (tris.size() * 3 - targetIndexCount + 2) / 3;
+		size_t removed = 0;
+		size_t done = 0;
+
+		for (size_t c = 0; c < collapses.size() && removed < toRemove; c++){
+			const Collapse & col = collapses[c];
+			if (col.cost > maxError)
+				break;
+			if (locked[col.from] || locked[col.to])
+				continue;
+
+			// Reject collapses that flip a triangle around "from"
+			bool flips = false;
+			const std::vector<unsigned int> & around = trisOf[col.from];
+			for (size_t i = 0; i < around.size() && !flips; i++){
+				const SimplifyTriangle & t = tris[around[i]];
+				if (t.w[0] == col.to || t.w[1] == col.to || t.w[2] == col.to)
+					continue;
+				glm::vec3 p[3], q[3];
+				for (int k = 0; k < 3; k++){
+					p[k] = wpos[t.w[k]];
+					q[k] = (t.w[k] == col.from) ? wpos[col.to] : p[k];
+				}
+				glm::vec3 before = triangleNormal(p[0], p[1], p[2]);
+				glm::vec3 after  = triangleNormal(q[0], q[1], q[2]);
+				float lb = glm::length(before), la = glm::length(after);
+				if (la <= 0.0f || lb <= 0.0f || glm::dot(before, after) < 0.25f * lb * la)
+					flips = true;
+			}
+			if (flips)
+				continue;
+
+			remap[col.from] = col.to;
+			quadricAdd(quadrics[col.to], quadrics[col.from]);
+			locked[col.from] = locked[col.to] = 1;
+			for (size_t i = 0; i < around.size(); i++){
+				const SimplifyTriangle & t = tris[around[i]];
+				for (int k = 0; k < 3; k++)
+					locked[t.w[k]] = 1;
+				if (t.w[0] == col.to || t.w[1] == col.to || t.w[2] == col.to)
+					removed++;
+			}
+			done++;
+		}
+		if (done == 0)
+			break;
+
+		std::vector<SimplifyTriangle> kept;
+		kept.reserve(tris.size());
+		for (size_t i = 0; i < tris.size(); i++){
+			SimplifyTriangle t = tris[i];
+			for (int k = 0; k < 3; k++)
+				t.w[k] = remap[t.w[k]];
+			if (t.w[0] != t.w[1] && t.w[1] != t.w[2] && t.w[0] != t.w[2])
+				kept.push_back(t);
+		}
+		tris.swap(kept);
+	}
+
+	// Back to real vertices : the corner keeps its vertex if it did not move,
+	// otherwise takes the one at the new position with the closest normal.
+	out_indices.clear();
+	out_indices.reserve(tris.size() * 3);
+	for (size_t i = 0; i < tris.size(); i++){
+		for (int k = 0; k < 3; k++){
+			const SimplifyTriangle & t = tris[i];
+			if (weldOf[t.orig[k]] == t.w[k]){
+				out_indices.push_back(t.orig[k]);
+				continue;
+			}
+			const std::vector<unsigned int> & candidates = verticesAt[t.w[k]];
+			unsigned int best = candidates[0];
+			float bestDot = -2.0f;
+			for (size_t c = 0; c < candidates.size(); c++){
+				float d = glm::dot(normals[candidates[c]], normals[t.orig[k]]);
+				if (d > bestDot){
+					bestDot = d;
+					best = candidates[c];
+				}
+			}
+			out_indices.push_back(best);
+		}
+	}
+}
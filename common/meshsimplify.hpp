@@ -0,0 +1,21 @@
+#ifndef MESHSIMPLIFY_HPP
+#define MESHSIMPLIFY_HPP
+
+// Quadric error edge collapse (Garland & Heckbert) on an indexed mesh.
+// Vertices are only ever moved onto existing vertices, so the result is a new
+// index buffer for the *same* vertex buffer : LODs can share it.
+// Vertices that share a position are welded for the topology, and each output
+// corner picks the vertex at its new position whose normal matches best.
+//
+// Stops when out_indices.size() <= targetIndexCount or when the next collapse
+// would cost more than maxError (a squared distance).
+void simplifyMesh(
+	const std::vector<glm::vec3> & positions,
+	const std::vector<glm::vec3> & normals,
+	const std::vector<unsigned int> & indices,
+	size_t targetIndexCount,
+	float maxError,
+	std::vector<unsigned int> & out_indices
+);
+
+#endif
@@ -0,0 +1,217 @@
+#include <string.h>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MIP_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIP_SSE2
+#endif
+
+#include "threadpool.hpp"
+#include "mipmap.hpp"
+
+// 8 bit <-> 16 bit linear. Levels are kept in 16 bits RGBA between two
+// downsamplings, so the chain is decoded once and every level encoded once.
+struct GammaTables {
+	unsigned short toLinear[256];
+	unsigned char toSRGB[65536];
+
+	GammaTables(){
+		for (int i = 0; i < 256; i++){
+			double c = i / 255.0;
+			double l = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+			toLinear[i] = (unsigned short)(l * 65535.0 + 0.5);
+		}
+		for (int i = 0; i < 65536; i++){
+			double l = i / 65535.0;
+			double c = l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1.0 / 2.4) - 0.055;
+			toSRGB[i] = (unsigned char)(c * 255.0 + 0.5);
+		}
+	}
+};
+static const GammaTables gammaTables;
+
+static inline unsigned short avg16(unsigned short a, unsigned short b){
+	return (unsigned short)((a + b + 1) >> 1);
+}
+
+// One row of RGBA16 texels, 2x2 -> 1. Vertical then horizontal rounded
+// averages, the same in every kernel so they give the same bits.
+static void downsampleRow(const unsigned short * row0, const unsigned short * row1, unsigned int srcWidth,
+	unsigned short * dst, unsigned int dstWidth)
+{
+	unsigned int x = 0;
+	if (srcWidth >= 2){
+#ifdef MIP_AVX2
+		// 8 source texels -> 4
+		for (; x + 4 <= dstWidth; x += 4){
+			const unsigned short * a = row0 + 8 * x;
+			const unsigned short * b = row1 + 8 * x;
+			__m256i v0 = _mm256_avg_epu16(_mm256_loadu_si256((const __m256i *)a), _mm256_loadu_si256((const __m256i *)b));
+			__m256i v1 = _mm256_avg_epu16(_mm256_loadu_si256((const __m256i *)(a + 16)), _mm256_loadu_si256((const __m256i *)(b + 16)));
+			// Per 128 bit lane : [t0 t4 | t2 t6] and [t1 t5 | t3 t7], then back in order
+			__m256i h = _mm256_avg_epu16(_mm256_unpacklo_epi64(v0, v1), _mm256_unpackhi_epi64(v0, v1));
+			_mm256_storeu_si256((__m256i *)(dst + 4 * x), _mm256_permute4x64_epi64(h, _MM_SHUFFLE(3, 1, 2, 0)));
+		}
+#endif
+#ifdef MIP_SSE2
+		// 4 source texels -> 2
+		for (; x + 2 <= dstWidth; x += 2){
+			const unsigned short * a = row0 + 8 * x;
+			const unsigned short * b = row1 + 8 * x;
+			__m128i v0 = _mm_avg_epu16(_mm_loadu_si128((const __m128i *)a), _mm_loadu_si128((const __m128i *)b));
+			__m128i v1 = _mm_avg_epu16(_mm_loadu_si128((const __m128i *)(a + 8)), _mm_loadu_si128((const __m128i *)(b + 8)));
+			__m128i h = _mm_avg_epu16(_mm_unpacklo_epi64(v0, v1), _mm_unpackhi_epi64(v0, v1));
+			_mm_storeu_si128((__m128i *)(dst + 4 * x), h);
+		}
+#endif
+	}
+	// A one texel wide level keeps its column
+	for (; x < dstWidth; x++){
+		unsigned int x0 = 2 * x, x1 = std::min(2 * x + 1, srcWidth - 1);
+		for (int c = 0; c < 4; c++)
+			dst[4 * x + c] = avg16(avg16(row0[4 * x0 + c], row1[4 * x0 + c]), avg16(row0[4 * x1 + c], row1[4 * x1 + c]));
+	}
+}
+
+struct MipChain {
+	unsigned int channels, rowAlignment;
+	bool srgb;
+	std::vector<unsigned int> widths, heights;
+	std::vector< std::vector<unsigned short> > linear;   // RGBA16, one per level
+	std::vector< std::vector<unsigned char> > * out;
+
+	size_t rowBytes(unsigned int level) const{
+		return ((size_t)widths[level] * channels + rowAlignment - 1) / rowAlignment * rowAlignment;
+	}
+
+	void decodeRows(const unsigned char * pixels, unsigned int begin, unsigned int end){
+		for (unsigned int y = begin; y < end; y++){
+			const unsigned char * src = pixels + y * rowBytes(0);
+			unsigned short * dst = &linear[0][(size_t)y * widths[0] * 4];
+			for (unsigned int x = 0; x < widths[0]; x++, src += channels, dst += 4){
+				for (int c = 0; c < 3; c++)
+					dst[c] = srgb ? gammaTables.toLinear[src[c]] : (unsigned short)(src[c] * 257);
+				dst[3] = channels == 4 ? (unsigned short)(src[3] * 257) : 65535;
+			}
+		}
+	}
+
+	void downsampleRows(unsigned int level, unsigned int begin, unsigned int end){
+		unsigned int srcWidth = widths[level - 1], srcHeight = heights[level - 1], width = widths[level];
+		std::vector<unsigned char> & dstLevel = (*out)[level - 1];
+		for (unsigned int y = begin; y < end; y++){
+			const unsigned short * row0 = &linear[level - 1][(size_t)(2 * y) * srcWidth * 4];
+			const unsigned short * row1 = &linear[level - 1][(size_t)std::min(2 * y + 1, srcHeight - 1) * srcWidth * 4];
+			unsigned short * dst = &linear[level][(size_t)y * width * 4];
+			downsampleRow(row0, row1, srcWidth, dst, width);
+
+			unsigned char * encoded = &dstLevel[y * rowBytes(level)];
+			for (unsigned int x = 0; x < width; x++, dst += 4, encoded += channels){
+				for (int c = 0; c < 3; c++)
+					encoded[c] = srgb ? gammaTables.toSRGB[dst[c]] : (unsigned char)((dst[c] + 128) / 257);
+				if (channels == 4)
+					encoded[3] = (unsigned char)((dst[3] + 128) / 257);
+			}
+		}
+	}
+};
+
+// The bands of one call, shared with the pool's jobs. A job that starts after
+// the last band was taken returns without touching band, whose captures are
+// gone by then : only this struct outlives the call.
+struct MipBands {
+	std::function<void(unsigned int)> band;
+	unsigned int count;
+	std::atomic<unsigned int> next;
+	std::mutex mutex;
+	std::condition_variable allDone;
+	unsigned int done;
+};
+
+static void runBands(std::shared_ptr<MipBands> bands){
+	for (unsigned int j = bands->next++; j < bands->count; j = bands->next++){
+		bands->band(j);
+		std::lock_guard<std::mutex> lock(bands->mutex);
+		if (++bands->done == bands->count)
+			bands->allDone.notify_all();
+	}
+}
+
+void generateMipmaps(const unsigned char * pixels, unsigned int width, unsigned int height,
+	unsigned int channels, unsigned int rowAlignment, bool srgb, unsigned int numThreads,
+	unsigned int maxLevels, std::vector< std::vector<unsigned char> > & out_levels)
+{
+	MipChain chain;
+	chain.channels = channels;
+	chain.rowAlignment = std::max(1u, rowAlignment);
+	chain.srgb = srgb;
+	chain.out = &out_levels;
+	chain.widths.push_back(width);
+	chain.heights.push_back(height);
+	while ((chain.widths.back() > 1 || chain.heights.back() > 1) && (maxLevels == 0 || chain.widths.size() <= maxLevels)){
+		chain.widths.push_back(std::max(1u, chain.widths.back() / 2));
+		chain.heights.push_back(std::max(1u, chain.heights.back() / 2));
+	}
+	unsigned int levels = (unsigned int)chain.widths.size();
+	out_levels.resize(levels - 1);
+	chain.linear.resize(levels);
+	for (unsigned int l = 0; l < levels; l++){
+		chain.linear[l].resize((size_t)chain.widths[l] * chain.heights[l] * 4);
+		if (l > 0)
+			out_levels[l - 1].assign(chain.rowBytes(l) * chain.heights[l], 0);
+	}
+	if (levels == 1)
+		return;
+
+	// Rows [j * band, (j + 1) * band) of level 0 make rows [j * band >> l,
+	// (j + 1) * band >> l) of level l, down to bandLevels. The few levels
+	// after that are done by the calling thread.
+	const unsigned int bandLevels = std::min(levels - 1, 5u);
+	const unsigned int band = 1u << bandLevels;
+	std::shared_ptr<MipBands> bands(new MipBands());
+	bands->count = (height + band - 1) / band;
+	bands->next = 0;
+	bands->done = 0;
+	bands->band = [&](unsigned int j){
+		chain.decodeRows(pixels, j * band, std::min((j + 1) * band, height));
+		for (unsigned int l = 1; l <= bandLevels; l++)
+			chain.downsampleRows(l, (j * band) >> l, std::min(((j + 1) * band) >> l, chain.heights[l]));
+	};
+
+	// The calling thread takes bands too and only waits for the ones already
+	// started : called from a pool job, it can't wait on jobs queued behind it.
+	ThreadPool & pool = getSharedThreadPool();
+	if (numThreads == 0)
+		numThreads = pool.size() + 1;
+	for (unsigned int t = 1; t < std::min(numThreads, bands->count); t++)
+		pool.enqueue(std::bind(runBands, bands));
+	runBands(bands);
+	{
+		std::unique_lock<std::mutex> lock(bands->mutex);
+		bands->allDone.wait(lock, [&]{ return bands->done == bands->count; });
+	}
+
+	for (unsigned int l = bandLevels + 1; l < levels; l++)
+		chain.downsampleRows(l, 0, chain.heights[l]);
+}
+
+const char * getMipmapKernel(){
+#if defined(MIP_AVX2)
+	return "AVX2";
+#elif defined(MIP_SSE2)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
@@ -0,0 +1,27 @@
+#ifndef MIPMAP_HPP
+#define MIPMAP_HPP
+
+#include <vector>
+
+// CPU replacement for glGenerateMipmap : 2x2 box filter on 8 bit images with
+// 3 or 4 channels. No OpenGL involved.
+//
+// With srgb, the first three channels are averaged in linear space and encoded
+// back, so that dark and bright texels keep their weight ; the fourth channel
+// (alpha) is always averaged as is. Odd sizes round down, like GL does.
+//
+// The image is cut in bands of rows shared between the calling thread and
+// numThreads - 1 jobs on the shared thread pool (0 : as many as the pool has
+// threads), and each band goes down several levels on its own, so threads
+// don't wait for each other between levels. Safe to call from a pool job.
+
+// Rows of every level are rowAlignment bytes aligned, like GL_UNPACK_ALIGNMENT.
+// out_levels[i] is level i+1, down to 1x1, or maxLevels levels if not 0.
+void generateMipmaps(const unsigned char * pixels, unsigned int width, unsigned int height,
+	unsigned int channels, unsigned int rowAlignment, bool srgb, unsigned int numThreads,
+	unsigned int maxLevels, std::vector< std::vector<unsigned char> > & out_levels);
+
+// "AVX2", "SSE2" or "scalar", whichever the build uses
+const char * getMipmapKernel();
+
+#endif
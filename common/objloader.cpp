@@ -2,10 +2,11 @@
 #include <stdio.h>
 #include <string>
 #include <cstring>
-#include <unordered_map>
+#include <stdlib.h>
 
 #include <glm/glm.hpp>
 
+#include "arena.hpp"
 #include "objloader.hpp"
 
 // Very, VERY simple OBJ loader.
@@ -111,69 +112,172 @@ bool loadOBJ(
 	printf("OBJ file load complete...\n");
 	return true;
 }
-struct TempFaceIndex {
-    unsigned v, t, n;
-};
+// loadOBJWithMaterials reads the whole file and walks it twice : once to
+// count, so that the positions, UVs and normals go in arrays of the right
+// size in a BumpArena (with the file itself), and every mesh is reserved to
+// its final size ; once to fill them. Nothing grows, nothing is copied.
+
+static const char * skipBlanks(const char * p){
+    while (*p == ' ' || *p == '\t' || *p == '\r')
+        p++;
+    return p;
+}
 
-bool loadOBJWithMaterials(const char* path, std::vector<MaterialMesh>& meshes)
-{
-    FILE* file = fopen(path, "r");
-    if (!file) return false;
+static const char * nextLine(const char * p){
+    while (*p && *p != '\n')
+        p++;
+    return *p ? p + 1 : p;
+}
 
-    std::vector<glm::vec3> temp_vertices;
-    std::vector<glm::vec2> temp_uvs;
-    std::vector<glm::vec3> temp_normals;
+// The first word of the line, in [out_begin, return)
+static const char * readWord(const char * p, const char ** out_begin){
+    p = skipBlanks(p);
+    *out_begin = p;
+    while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+        p++;
+    return p;
+}
 
-    std::unordered_map<std::string, MaterialMesh> meshMap;
-    std::string currentMaterial = "default";
+static bool wordIs(const char * begin, const char * end, const char * word){
+    size_t length = strlen(word);
+    return (size_t)(end - begin) == length && memcmp(begin, word, length) == 0;
+}
 
-    char line[256];
-    while (fscanf(file, "%s", line) != EOF) {
-        if (strcmp(line, "v") == 0) {
-            glm::vec3 v; fscanf(file, "%f %f %f", &v.x, &v.y, &v.z);
-            temp_vertices.push_back(v);
-        }
-        else if (strcmp(line, "vt") == 0) {
-            glm::vec2 uv; fscanf(file, "%f %f", &uv.x, &uv.y);
-            temp_uvs.push_back(uv);
+// v/t/n, 1 based
+static const char * readFaceVertex(const char * p, unsigned long index[3]){
+    for (int i = 0; i < 3; i++) {
+        if (i > 0) {
+            if (*p != '/')
+                return NULL;
+            p++;
         }
-        else if (strcmp(line, "vn") == 0) {
-            glm::vec3 n; fscanf(file, "%f %f %f", &n.x, &n.y, &n.z);
-            temp_normals.push_back(n);
-        }
-        else if (strcmp(line, "usemtl") == 0) {
-            char matName[128];
-            fscanf(file, "%s", matName);
-            currentMaterial = matName;
-            if (meshMap.find(currentMaterial) == meshMap.end()) {
-                meshMap[currentMaterial] = MaterialMesh();
-                meshMap[currentMaterial].materialName = currentMaterial;
+        char * end;
+        index[i] = strtoul(p, &end, 10);
+        if (end == p)
+            return NULL;
+        p = end;
+    }
+    return p;
+}
+
+static size_t findMaterial(const std::vector<MaterialMesh> & meshes, size_t first, const char * begin, const char * end){
+    for (size_t i = first; i < meshes.size(); i++)
+        if (meshes[i].materialName.size() == (size_t)(end - begin) &&
+            memcmp(meshes[i].materialName.data(), begin, end - begin) == 0)
+            return i;
+    return meshes.size();
+}
+
+bool loadOBJWithMaterials(const char* path, std::vector<MaterialMesh>& meshes)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size < 0) {
+        fclose(file);
+        return false;
+    }
+    BumpArena arena(1 << 16);
+    char* text = arena.allocateArray<char>((size_t)size + 1);
+    size_t read = fread(text, 1, (size_t)size, file);
+    fclose(file);
+    text[read] = 0;
+
+    // Counting : a mesh per material, in the order they appear. Like before,
+    // usemtl makes one even if no face follows, and faces before any usemtl
+    // go to "default".
+    const size_t first = meshes.size();
+    std::vector<size_t> faceCounts;
+    size_t numVertices = 0, numUVs = 0, numNormals = 0;
+    size_t current = (size_t)-1;
+    for (const char* p = text; *p; p = nextLine(p)) {
+        const char* word;
+        const char* end = readWord(p, &word);
+        if (wordIs(word, end, "v")) numVertices++;
+        else if (wordIs(word, end, "vt")) numUVs++;
+        else if (wordIs(word, end, "vn")) numNormals++;
+        else if (wordIs(word, end, "usemtl") || wordIs(word, end, "f")) {
+            const char* name = "default";
+            const char* nameEnd = name + 7;
+            if (*word == 'u')
+                nameEnd = readWord(end, &name);
+            else if (current != (size_t)-1) {
+                faceCounts[current]++;
+                continue;
+            }
+            current = findMaterial(meshes, first, name, nameEnd);
+            if (current == meshes.size()) {
+                meshes.push_back(MaterialMesh());
+                meshes.back().materialName.assign(name, nameEnd);
+                faceCounts.push_back(0);
             }
+            current -= first;
+            if (*word == 'f')
+                faceCounts[current]++;
         }
-        else if (strcmp(line, "f") == 0) {
-            TempFaceIndex f[3];
-            fscanf(file,
-                "%u/%u/%u %u/%u/%u %u/%u/%u",
-                &f[0].v, &f[0].t, &f[0].n,
-                &f[1].v, &f[1].t, &f[1].n,
-                &f[2].v, &f[2].t, &f[2].n);
-
-            MaterialMesh& mesh = meshMap[currentMaterial];
+    }
+    for (size_t i = 0; i < faceCounts.size(); i++) {
+        MaterialMesh& mesh = meshes[first + i];
+        mesh.vertices.reserve(3 * faceCounts[i]);
+        mesh.uvs.reserve(3 * faceCounts[i]);
+        mesh.normals.reserve(3 * faceCounts[i]);
+    }
 
+    glm::vec3* temp_vertices = arena.allocateArray<glm::vec3>(numVertices);
+    glm::vec2* temp_uvs = arena.allocateArray<glm::vec2>(numUVs);
+    glm::vec3* temp_normals = arena.allocateArray<glm::vec3>(numNormals);
+    numVertices = numUVs = numNormals = 0;
+
+    // Filling
+    MaterialMesh* mesh = NULL;
+    unsigned int lineNumber = 0;
+    for (const char* p = text; *p; p = nextLine(p)) {
+        lineNumber++;
+        const char* word;
+        const char* end = readWord(p, &word);
+        char* next;
+        if (wordIs(word, end, "v") || wordIs(word, end, "vn")) {
+            glm::vec3 v;
             for (int i = 0; i < 3; i++) {
-                mesh.vertices.push_back(temp_vertices[f[i].v - 1]);
-                mesh.uvs.push_back(temp_uvs[f[i].t - 1]);
-                mesh.normals.push_back(temp_normals[f[i].n - 1]);
+                v[i] = strtof(end, &next);
+                end = next;
             }
+            if (word[1] == 'n') temp_normals[numNormals++] = v;
+            else temp_vertices[numVertices++] = v;
         }
-        else {
-            fgets(line, sizeof(line), file);
+        else if (wordIs(word, end, "vt")) {
+            glm::vec2 uv;
+            for (int i = 0; i < 2; i++) {
+                uv[i] = strtof(end, &next);
+                end = next;
+            }
+            temp_uvs[numUVs++] = uv;
+        }
+        else if (wordIs(word, end, "usemtl")) {
+            const char* name;
+            const char* nameEnd = readWord(end, &name);
+            mesh = &meshes[findMaterial(meshes, first, name, nameEnd)];
+        }
+        else if (wordIs(word, end, "f")) {
+            if (!mesh)
+                mesh = &meshes[findMaterial(meshes, first, "default", "default" + 7)];
+            for (int i = 0; i < 3; i++) {
+                unsigned long index[3];
+                end = readFaceVertex(skipBlanks(end), index);
+                if (!end || index[0] < 1 || index[0] > numVertices || index[1] < 1 || index[1] > numUVs ||
+                    index[2] < 1 || index[2] > numNormals) {
+                    printf("%s, line %u : only triangles with v/vt/vn indices of what is above are supported\n", path, lineNumber);
+                    meshes.resize(first);
+                    return false;
+                }
+                mesh->vertices.push_back(temp_vertices[index[0] - 1]);
+                mesh->uvs.push_back(temp_uvs[index[1] - 1]);
+                mesh->normals.push_back(temp_normals[index[2] - 1]);
+            }
         }
     }
-
-    fclose(file);
-
-    for (auto& kv : meshMap) meshes.push_back(kv.second);
     return true;
 }
 
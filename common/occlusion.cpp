@@ -0,0 +1,295 @@
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUSION_SSE2
+#endif
+
+#include <glm/glm.hpp>
+
+#include "occlusion.hpp"
+
+// Triangles or boxes with a vertex closer than this (in clip space w) are not
+// projected : occluders are dropped and boxes are considered visible.
+static const float NEAR_W = 1e-3f;
+
+OcclusionBuffer::OcclusionBuffer(int w, int h){
+	// Rows are processed 4 pixels at a time
+	width  = (w + 3) & ~3;
+	height = h;
+
+	int lw = width, lh = height;
+	while (true){
+		levelWidths.push_back(lw);
+		levelHeights.push_back(lh);
+		levels.push_back(std::vector<float>(lw * lh, 1.0f));
+		if (lw == 1 && lh == 1)
+			break;
+		lw = std::max(1, (lw + 1) / 2);
+		lh = std::max(1, (lh + 1) / 2);
+	}
+}
+
+void OcclusionBuffer::clear(){
+	std::fill(levels[0].begin(), levels[0].end(), 1.0f);
+}
+
+void OcclusionBuffer::rasterizeOccluders(const glm::mat4 & viewProj, const std::vector<glm::vec3> & triangles){
+	for (size_t i = 0; i + 2 < triangles.size(); i += 3){
+		glm::vec3 screen[3];
+		bool clipped = false;
+		for (int k = 0; k < 3; k++){
+			glm::vec4 p = viewProj * glm::vec4(triangles[i + k], 1.0f);
+			if (p.w < NEAR_W){
+				clipped = true;
+				break;
+			}
+			float invW = 1.0f / p.w;
+			screen[k] = glm::vec3(
+				(p.x * invW * 0.5f + 0.5f) * width,
+				(p.y * invW * 0.5f + 0.5f) * height,
+				p.z * invW * 0.5f + 0.5f
+			);
+		}
+		// Not drawing an occluder is always safe
+		if (!clipped)
+			rasterizeTriangle(screen[0], screen[1], screen[2]);
+	}
+}
+
+void OcclusionBuffer::rasterizeTriangle(const glm::vec3 & v0, const glm::vec3 & v1in, const glm::vec3 & v2in){
+	glm::vec3 v1 = v1in, v2 = v2in;
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+	if (fabs(area) < 1e-6f)
+		return;
+	if (area < 0.0f){
+		std::swap(v1, v2);
+		area = -area;
+	}
+
+	int minX = std::max(0,          (int)floor(std::min(v0.x, std::min(v1.x, v2.x))));
+	int maxX = std::min(width - 1,  (int)ceil (std::max(v0.x, std::max(v1.x, v2.x))));
+	int minY = std::max(0,          (int)floor(std::min(v0.y, std::min(v1.y, v2.y))));
+	int maxY = std::min(height - 1, (int)ceil (std::max(v0.y, std::max(v1.y, v2.y))));
+	if (minX > maxX || minY > maxY)
+		return;
+	// Start on a group of 4
+	minX &= ~3;
+
+	// Edge functions e = A*x + B*y + C, positive inside.
+	// w0 is opposite to v0 (edge v1->v2), and so on.
+	float A0 = v1.y - v2.y, B0 = v2.x - v1.x, C0 = v1.x * v2.y - v1.y * v2.x;
+	float A1 = v2.y - v0.y, B1 = v0.x - v2.x, C1 = v2.x * v0.y - v2.y * v0.x;
+	float A2 = v0.y - v1.y, B2 = v1.x - v0.x, C2 = v0.x * v1.y - v0.y * v1.x;
+
+	// z is linear in screen space : z = w0*z0' + w1*z1' + w2*z2'
+	float invArea = 1.0f / area;
+	float z0 = v0.z * invArea, z1 = v1.z * invArea, z2 = v2.z * invArea;
+
+	std::vector<float> & depth = levels[0];
+
+#ifdef OCCLUSION_SSE2
+	const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 stepA0 = _mm_set1_ps(A0 * 4.0f), stepA1 = _mm_set1_ps(A1 * 4.0f), stepA2 = _mm_set1_ps(A2 * 4.0f);
+	const __m128 vz0 = _mm_set1_ps(z0), vz1 = _mm_set1_ps(z1), vz2 = _mm_set1_ps(z2);
+
+	for (int y = minY; y <= maxY; y++){
+		float py = y + 0.5f;
+		__m128 px = _mm_add_ps(_mm_set1_ps((float)minX), offsets);
+		__m128 w0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A0), px), _mm_set1_ps(B0 * py + C0));
+		__m128 w1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A1), px), _mm_set1_ps(B1 * py + C1));
+		__m128 w2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A2), px), _mm_set1_ps(B2 * py + C2));
+
+		float * row = &depth[y * width];
+		for (int x = minX; x <= maxX; x += 4){
+			__m128 inside = _mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_and_ps(_mm_cmpge_ps(w1, zero), _mm_cmpge_ps(w2, zero)));
+			if (_mm_movemask_ps(inside)){
+				__m128 z = _mm_add_ps(_mm_mul_ps(w0, vz0), _mm_add_ps(_mm_mul_ps(w1, vz1), _mm_mul_ps(w2, vz2)));
+				__m128 old = _mm_loadu_ps(row + x);
+				__m128 closer = _mm_min_ps(old, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, old)));
+			}
+			w0 = _mm_add_ps(w0, stepA0);
+			w1 = _mm_add_ps(w1, stepA1);
+			w2 = _mm_add_ps(w2, stepA2);
+		}
+	}
+#else
+	for (int y = minY; y <= maxY; y++){
+		float py = y + 0.5f;
+		float * row = &depth[y * width];
+		for (int x = minX; x <= maxX; x++){
+			float px = x + 0.5f;
+			float w0 = A0 * px + B0 * py + C0;
+			float w1 = A1 * px + B1 * py + C1;
+			float w2 = A2 * px + B2 * py + C2;
+			if (w0 >= 0.0f && w1 >= 0.0f && w2 >= 0.0f){
+				float z = w0 * z0 + w1 * z1 + w2 * z2;
+				if (z < row[x])
+					row[x] = z;
+			}
+		}
+	}
+#endif
+}
+
+void OcclusionBuffer::buildHiZ(){
+	// Each texel keeps the farthest depth of the 2x2 texels below it,
+	// so an object is hidden if it is behind that.
+	for (size_t l = 1; l < levels.size(); l++){
+		const std::vector<float> & src = levels[l - 1];
+		std::vector<float> & dst = levels[l];
+		int sw = levelWidths[l - 1], sh = levelHeights[l - 1];
+		int dw = levelWidths[l],     dh = levelHeights[l];
+		for (int y = 0; y < dh; y++){
+			int y0 = std::min(2 * y, sh - 1), y1 = std::min(2 * y + 1, sh - 1);
+			for (int x = 0; x < dw; x++){
+				int x0 = std::min(2 * x, sw - 1), x1 = std::min(2 * x + 1, sw - 1);
+				dst[y * dw + x] = std::max(
+					std::max(src[y0 * sw + x0], src[y0 * sw + x1]),
+					std::max(src[y1 * sw + x0], src[y1 * sw + x1])
+				);
+			}
+		}
+	}
+}
+
+bool OcclusionBuffer::isVisible(const glm::mat4 & viewProj, const glm::vec3 & boxMin, const glm::vec3 & boxMax) const{
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	float minZ = FLT_MAX;
+	for (int i = 0; i < 8; i++){
+		glm::vec3 corner(
+			(i & 1) ? boxMax.x : boxMin.x,
+			(i & 2) ? boxMax.y : boxMin.y,
+			(i & 4) ? boxMax.z : boxMin.z
+		);
+		glm::vec4 p = viewProj * glm::vec4(corner, 1.0f);
+		if (p.w < NEAR_W)
+			return true; // Crosses the near plane : the camera may be inside it
+		float invW = 1.0f / p.w;
+		float sx = (p.x * invW * 0.5f + 0.5f) * width;
+		float sy = (p.y * invW * 0.5f + 0.5f) * height;
+		float sz = p.z * invW * 0.5f + 0.5f;
+		minX = std::min(minX, sx); maxX = std::max(maxX, sx);
+		minY = std::min(minY, sy); maxY = std::max(maxY, sy);
+		minZ = std::min(minZ, sz);
+	}
+
+	if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height || minZ > 1.0f)
+		return false;
+
+	int x0 = std::max(0, (int)floor(minX)), x1 = std::min(width - 1,  (int)floor(maxX));
+	int y0 = std::max(0, (int)floor(minY)), y1 = std::min(height - 1, (int)floor(maxY));
+
+	// Go up the pyramid until the rectangle covers at most 2x2 texels
+	size_t level = 0;
+	while (level + 1 < levels.size() && (x1 - x0 > 1 || y1 - y0 > 1)){
+		x0 >>= 1; x1 >>= 1;
+		y0 >>= 1; y1 >>= 1;
+		level++;
+	}
+
+	const std::vector<float> & hiz = levels[level];
+	int lw = levelWidths[level];
+	for (int y = y0; y <= y1; y++)
+		for (int x = x0; x <= x1; x++)
+			if (minZ <= hiz[y * lw + x])
+				return true;
+	return false;
+}
+
+
+
+OcclusionCuller::OcclusionCuller(int width, int height)
+	: buffer(width, height), submittedFrame(0), completedFrame(0), quit(false), culledCount(0), cullTimeMs(0.0)
+{
+	worker = std::thread(&OcclusionCuller::workerLoop, this);
+}
+
+OcclusionCuller::~OcclusionCuller(){
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	cond.notify_all();
+	worker.join();
+}
+
+void OcclusionCuller::setOccluders(const std::vector<glm::vec3> & triangles){
+	wait();
+	occluders = triangles;
+}
+
+void OcclusionCuller::setObjects(const std::vector<OcclusionBox> & boxes){
+	wait();
+	objects = boxes;
+	visible.assign(objects.size(), 1);
+}
+
+void OcclusionCuller::submit(const glm::mat4 & viewProj){
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pendingViewProj = viewProj;
+		submittedFrame++;
+	}
+	cond.notify_all();
+}
+
+const std::vector<char> & OcclusionCuller::wait(){
+	std::unique_lock<std::mutex> lock(mutex);
+	cond.wait(lock, [this]{ return completedFrame == submittedFrame; });
+	return visible;
+}
+
+int OcclusionCuller::getCulledCount() const{
+	std::lock_guard<std::mutex> lock(mutex);
+	return culledCount;
+}
+
+double OcclusionCuller::getCullTime() const{
+	std::lock_guard<std::mutex> lock(mutex);
+	return cullTimeMs;
+}
+
+void OcclusionCuller::workerLoop(){
+	while (true){
+		glm::mat4 viewProj;
+		unsigned long frame;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cond.wait(lock, [this]{ return completedFrame != submittedFrame || quit; });
+			if (quit)
+				return;
+			viewProj = pendingViewProj;
+			frame = submittedFrame;
+		}
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+		buffer.clear();
+		buffer.rasterizeOccluders(viewProj, occluders);
+		buffer.buildHiZ();
+
+		int culled = 0;
+		for (size_t i = 0; i < objects.size(); i++){
+			visible[i] = buffer.isVisible(viewProj, objects[i].min, objects[i].max) ? 1 : 0;
+			if (!visible[i])
+				culled++;
+		}
+
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			culledCount = culled;
+			cullTimeMs = elapsed.count();
+			completedFrame = frame;
+		}
+		cond.notify_all();
+	}
+}
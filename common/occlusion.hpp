@@ -0,0 +1,84 @@
+#ifndef OCCLUSION_HPP
+#define OCCLUSION_HPP
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Axis aligned box of a mesh, in world space.
+struct OcclusionBox {
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+// Low resolution software depth buffer with a Hi-Z (max depth) pyramid.
+// Depth is window depth in [0,1], 1 being the far plane. No OpenGL involved.
+class OcclusionBuffer {
+public:
+	OcclusionBuffer(int width, int height);
+
+	void clear();
+
+	// triangles : 3 world space positions per triangle, both windings are drawn.
+	void rasterizeOccluders(const glm::mat4 & viewProj, const std::vector<glm::vec3> & triangles);
+
+	// Must be called after the occluders are rasterized and before isVisible().
+	void buildHiZ();
+
+	// Conservative : returns false only if the box is fully hidden or off screen.
+	bool isVisible(const glm::mat4 & viewProj, const glm::vec3 & boxMin, const glm::vec3 & boxMax) const;
+
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+	const std::vector<float> & getDepth() const { return levels[0]; }
+
+private:
+	void rasterizeTriangle(const glm::vec3 & a, const glm::vec3 & b, const glm::vec3 & c);
+
+	int width, height;
+	std::vector< std::vector<float> > levels; // levels[0] is the full resolution depth
+	std::vector<int> levelWidths, levelHeights;
+};
+
+// Runs an OcclusionBuffer on a worker thread : submit() the camera of frame N
+// right after the input is read, do the rest of the CPU frame work while the
+// GPU is still busy with frame N-1, then wait() for the visibility flags.
+class OcclusionCuller {
+public:
+	OcclusionCuller(int width, int height);
+	~OcclusionCuller();
+
+	// Only call these while no frame is in flight.
+	void setOccluders(const std::vector<glm::vec3> & triangles);
+	void setObjects(const std::vector<OcclusionBox> & boxes);
+
+	void submit(const glm::mat4 & viewProj);
+
+	// Blocks until the last submitted frame is done. One flag per object.
+	const std::vector<char> & wait();
+
+	// Of the last completed frame. Written by the worker : they take the lock.
+	int getCulledCount() const;
+	double getCullTime() const;
+
+private:
+	void workerLoop();
+
+	OcclusionBuffer buffer;
+	std::vector<glm::vec3> occluders;
+	std::vector<OcclusionBox> objects;
+	std::vector<char> visible;
+	glm::mat4 pendingViewProj;
+
+	std::thread worker;
+	mutable std::mutex mutex;
+	std::condition_variable cond;
+	unsigned long submittedFrame, completedFrame;
+	bool quit;
+
+	int culledCount;
+	double cullTimeMs;
+};
+
+#endif
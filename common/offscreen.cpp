@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "dxtcompress.hpp"
+#include "offscreen.hpp"
+
+OffscreenTarget::OffscreenTarget()
+	: width(0), height(0), samples(0), framebuffer(0), resolveFramebuffer(0), resolveRenderbuffer(0)
+{
+	renderbuffers[0] = renderbuffers[1] = 0;
+}
+
+OffscreenTarget::~OffscreenTarget(){
+	destroy();
+}
+
+bool OffscreenTarget::create(int newWidth, int newHeight, int newSamples){
+	destroy();
+	width = newWidth;
+	height = newHeight;
+	samples = newSamples > 1 ? newSamples : 0;
+
+	glGenRenderbuffers(2, renderbuffers);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH_COMPONENT24, width, height);
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+	if (complete && samples){
+		glGenRenderbuffers(1, &resolveRenderbuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, resolveRenderbuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glGenFramebuffers(1, &resolveFramebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, resolveFramebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, resolveRenderbuffer);
+		complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	if (!complete){
+		printf("The %dx%d offscreen framebuffer (%d samples) is incomplete\n", width, height, samples);
+		destroy();
+		return false;
+	}
+	return true;
+}
+
+void OffscreenTarget::destroy(){
+	if (framebuffer){
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteRenderbuffers(2, renderbuffers);
+	}
+	if (resolveFramebuffer){
+		glDeleteFramebuffers(1, &resolveFramebuffer);
+		glDeleteRenderbuffers(1, &resolveRenderbuffer);
+	}
+	framebuffer = resolveFramebuffer = resolveRenderbuffer = 0;
+	renderbuffers[0] = renderbuffers[1] = 0;
+}
+
+void OffscreenTarget::bind() const{
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glViewport(0, 0, width, height);
+}
+
+bool OffscreenTarget::read(RGBAImage & out) const{
+	if (!framebuffer)
+		return false;
+	GLuint source = framebuffer;
+	if (samples){
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolveFramebuffer);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		source = resolveFramebuffer;
+	}
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, source);
+	out.width = width;
+	out.height = height;
+	out.pixels.resize((size_t)width * height * 4);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &out.pixels[0]);
+	for (size_t i = 3; i < out.pixels.size(); i += 4)
+		out.pixels[i] = 255;
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	return true;
+}
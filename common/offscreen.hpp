@@ -0,0 +1,33 @@
+#ifndef OFFSCREEN_HPP
+#define OFFSCREEN_HPP
+
+// A framebuffer of any size to render into instead of the window, for the
+// benchmarks and the image captures : RGBA8 colour, multisampled if asked,
+// and 24 bits depth.
+class OffscreenTarget {
+public:
+	OffscreenTarget();
+	~OffscreenTarget();
+
+	// samples <= 1 : no multisampling
+	bool create(int width, int height, int samples = 0);
+	void destroy();
+
+	// Draw into it, over all of it
+	void bind() const;
+
+	// The colour, rows bottom up, alpha 255. Resolves the multisampling first.
+	// Leaves this target bound.
+	bool read(RGBAImage & out) const;
+
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+	GLuint getFramebuffer() const { return framebuffer; }
+
+private:
+	int width, height, samples;
+	GLuint framebuffer, renderbuffers[2];          // colour, depth
+	GLuint resolveFramebuffer, resolveRenderbuffer; // single sampled copy, if multisampled
+};
+
+#endif
@@ -0,0 +1,132 @@
+#include <algorithm>
+
+#include "pageresidency.hpp"
+
+PageResidency::PageResidency(unsigned int pagesX, unsigned int pagesY, unsigned int levels, unsigned int numSlots)
+	: pagesX(pagesX), pagesY(pagesY), levels(levels), numSlots(numSlots), frame(0),
+	  indirectionDirty(true), evictions(0), misses(0)
+{
+	// Slot 0 comes out first
+	for (unsigned int s = numSlots; s > 0; s--)
+		freeSlots.push_back(s - 1);
+}
+
+unsigned int PageResidency::getPagesX(unsigned int level) const{
+	return std::max(1u, pagesX >> level);
+}
+
+unsigned int PageResidency::getPagesY(unsigned int level) const{
+	return std::max(1u, pagesY >> level);
+}
+
+void PageResidency::touch(Resident & r){
+	r.lastUsed = frame;
+	lru.splice(lru.begin(), lru, r.lru);
+}
+
+void PageResidency::update(const std::vector<unsigned int> & requested, unsigned int maxLoads, std::vector<unsigned int> & out_load){
+	frame++;
+	out_load.clear();
+
+	std::set<unsigned int> wanted(requested.begin(), requested.end());
+	unsigned int root = levels - 1;
+	for (unsigned int y = 0; y < getPagesY(root); y++)
+		for (unsigned int x = 0; x < getPagesX(root); x++)
+			wanted.insert(pageId(root, x, y));
+
+	// A page and all its ancestors : while it loads, the shader falls back to
+	// the finest of them that is resident
+	std::set<unsigned int> missing;
+	for (std::set<unsigned int>::iterator it = wanted.begin(); it != wanted.end(); ++it){
+		unsigned int level = pageLevel(*it), x = pageX(*it), y = pageY(*it);
+		if (level >= levels || x >= getPagesX(level) || y >= getPagesY(level))
+			continue;
+		for (; level < levels; level++, x /= 2, y /= 2){
+			unsigned int page = pageId(level, x, y);
+			std::map<unsigned int, Resident>::iterator r = resident.find(page);
+			if (r != resident.end()){
+				if (r->second.lastUsed == frame)
+					break;   // the rest of the chain was seen already
+				touch(r->second);
+			}else if (!loading.count(page)){
+				missing.insert(page);
+			}
+		}
+	}
+	misses += (unsigned int)missing.size();
+
+	// The level is in the high bits : coarsest first is descending order
+	for (std::set<unsigned int>::reverse_iterator it = missing.rbegin(); it != missing.rend() && out_load.size() < maxLoads; ++it){
+		out_load.push_back(*it);
+		loading.insert(*it);
+	}
+}
+
+int PageResidency::pageLoaded(unsigned int page){
+	loading.erase(page);
+	if (resident.count(page))
+		return resident[page].slot;
+
+	unsigned int slot;
+	if (!freeSlots.empty()){
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+	}else{
+		// Least recently used first, skipping what this frame needs and the
+		// coarsest level
+		std::list<unsigned int>::reverse_iterator victim = lru.rbegin();
+		while (victim != lru.rend() &&
+			(resident[*victim].lastUsed == frame || pageLevel(*victim) == levels - 1))
+			++victim;
+		if (victim == lru.rend())
+			return -1;
+		slot = resident[*victim].slot;
+		resident.erase(*victim);
+		lru.erase(--victim.base());
+		evictions++;
+	}
+
+	lru.push_front(page);
+	Resident r = { slot, frame, lru.begin() };
+	resident[page] = r;
+	indirectionDirty = true;
+	return (int)slot;
+}
+
+void PageResidency::pageFailed(unsigned int page){
+	loading.erase(page);
+}
+
+int PageResidency::getSlot(unsigned int page) const{
+	std::map<unsigned int, Resident>::const_iterator it = resident.find(page);
+	return it != resident.end() ? (int)it->second.slot : -1;
+}
+
+void PageResidency::buildIndirection(unsigned int slotsPerRow, std::vector< std::vector<unsigned char> > & out_levels){
+	out_levels.resize(levels);
+	// Coarsest first, so that a missing page can copy its parent
+	for (unsigned int l = levels; l > 0; l--){
+		unsigned int level = l - 1;
+		unsigned int w = getPagesX(level), h = getPagesY(level);
+		std::vector<unsigned char> & texels = out_levels[level];
+		texels.assign((size_t)w * h * 4, 0);
+		for (unsigned int y = 0; y < h; y++)
+			for (unsigned int x = 0; x < w; x++){
+				unsigned char * texel = &texels[4 * ((size_t)y * w + x)];
+				int slot = getSlot(pageId(level, x, y));
+				if (slot >= 0){
+					texel[0] = (unsigned char)(slot % slotsPerRow);
+					texel[1] = (unsigned char)(slot / slotsPerRow);
+					texel[2] = (unsigned char)level;
+					texel[3] = 255;
+				}else if (level + 1 < levels){
+					const std::vector<unsigned char> & parent = out_levels[level + 1];
+					unsigned int pw = getPagesX(level + 1), ph = getPagesY(level + 1);
+					unsigned int px = std::min(x / 2, pw - 1), py = std::min(y / 2, ph - 1);
+					for (int c = 0; c < 4; c++)
+						texel[c] = parent[4 * ((size_t)py * pw + px) + c];
+				}
+			}
+	}
+	indirectionDirty = false;
+}
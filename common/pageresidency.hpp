@@ -0,0 +1,73 @@
+#ifndef PAGERESIDENCY_HPP
+#define PAGERESIDENCY_HPP
+
+#include <vector>
+#include <list>
+#include <map>
+#include <set>
+
+// Which pages of a virtual texture sit in which slot of the physical cache.
+// No GL in here : the caller feeds it the feedback of each frame and the pages
+// its loaders return, and uploads whatever it is told to.
+//
+// Pages are named by pageId(level, x, y). The pages of the coarsest level are
+// always requested and never evicted, so every texel has something to show.
+class PageResidency {
+public:
+	PageResidency(unsigned int pagesX, unsigned int pagesY, unsigned int levels, unsigned int numSlots);
+
+	static unsigned int pageId(unsigned int level, unsigned int x, unsigned int y){ return (level << 24) | (y << 12) | x; }
+	static unsigned int pageLevel(unsigned int page){ return page >> 24; }
+	static unsigned int pageX(unsigned int page){ return page & 0xFFF; }
+	static unsigned int pageY(unsigned int page){ return (page >> 12) & 0xFFF; }
+
+	unsigned int getPagesX(unsigned int level) const;
+	unsigned int getPagesY(unsigned int level) const;
+	unsigned int getLevels() const { return levels; }
+	unsigned int getNumSlots() const { return numSlots; }
+
+	// Starts a new frame with the pages its feedback asked for. Resident pages
+	// (and their ancestors) become the most recently used ; the missing ones
+	// go to out_load, coarsest first, at most maxLoads of them, and count as
+	// loading until pageLoaded or pageFailed.
+	void update(const std::vector<unsigned int> & requested, unsigned int maxLoads, std::vector<unsigned int> & out_load);
+
+	// A page came back from its loader. Returns its slot, taking a free one or
+	// the least recently used page not requested this frame, or -1 if every
+	// slot is needed right now (the page is dropped and asked for again later).
+	int pageLoaded(unsigned int page);
+	void pageFailed(unsigned int page);
+
+	bool isResident(unsigned int page) const { return resident.count(page) != 0; }
+	int getSlot(unsigned int page) const;
+
+	// One RGBA8 texel per page and per level : the slot (x, y in a grid of
+	// slotsPerRow) and the level of the finest resident page covering it.
+	bool isIndirectionDirty() const { return indirectionDirty; }
+	void buildIndirection(unsigned int slotsPerRow, std::vector< std::vector<unsigned char> > & out_levels);
+
+	size_t getResidentCount() const { return resident.size(); }
+	size_t getLoadingCount() const { return loading.size(); }
+	unsigned int getEvictions() const { return evictions; }
+	unsigned int getMisses() const { return misses; }
+
+private:
+	struct Resident {
+		unsigned int slot;
+		unsigned int lastUsed;  // frame
+		std::list<unsigned int>::iterator lru;
+	};
+
+	void touch(Resident & r);
+
+	unsigned int pagesX, pagesY, levels, numSlots;
+	unsigned int frame;
+	std::map<unsigned int, Resident> resident;
+	std::list<unsigned int> lru;           // most recently used first
+	std::set<unsigned int> loading;
+	std::vector<unsigned int> freeSlots;
+	bool indirectionDirty;
+	unsigned int evictions, misses;
+};
+
+#endif
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include <GL/glew.h>
+
+#include "text2D.hpp"
+#include "profiler.hpp"
+
+// What one of the two frame slots holds until its GPU results are read
+struct ProfileSlot {
+	ProfileFrame frame;
+	std::vector<GLuint> queries;   // grows to the most GPU scopes seen in a frame
+	unsigned int queriesUsed;
+	bool pending;
+};
+
+static ProfileSlot profileSlots[2];
+static unsigned int profileFrameNumber = 0;
+static bool profileInFrame = false;
+static std::vector<int> profileOpenEvents;   // indices in the current frame, -1 outside of frames
+static bool profileGPUScopeOpen = false;
+static ProfileFrame profileLastFrame;
+static unsigned long long profileDroppedFrames = 0;
+
+static bool profileTracing = false;
+static std::vector<ProfileFrame> profileTrace;
+static const size_t MAX_TRACE_FRAMES = 20000;
+
+static std::chrono::steady_clock::time_point profileEpoch = std::chrono::steady_clock::now();
+
+static double profileNow(){
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - profileEpoch).count();
+}
+
+static ProfileSlot & currentSlot(){
+	return profileSlots[profileFrameNumber % 2];
+}
+
+// Never waits : the queries finish in order, so if the last one is in, all are
+static void resolveSlot(ProfileSlot & slot){
+	if (!slot.pending)
+		return;
+	slot.pending = false;
+
+	bool available = true;
+	if (slot.queriesUsed > 0){
+		GLint done = 0;
+		glGetQueryObjectiv(slot.queries[slot.queriesUsed - 1], GL_QUERY_RESULT_AVAILABLE, &done);
+		available = done != 0;
+	}
+	for (size_t i = 0; i < slot.frame.events.size(); i++){
+		ProfileEvent & e = slot.frame.events[i];
+		if (e.query < 0)
+			continue;
+		if (available){
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(slot.queries[e.query], GL_QUERY_RESULT, &elapsed);
+			e.gpuMilliseconds = elapsed / 1e6;
+		}
+	}
+	if (available)
+		profileLastFrame = slot.frame;
+	else
+		profileDroppedFrames++;
+
+	if (profileTracing){
+		profileTrace.push_back(slot.frame);
+		if (profileTrace.size() >= MAX_TRACE_FRAMES){
+			printf("Profiler : trace full after %u frames, stopped capturing\n", (unsigned int)profileTrace.size());
+			profileTracing = false;
+		}
+	}
+}
+
+void profilerBeginFrame(){
+	ProfileSlot & slot = currentSlot();
+	resolveSlot(slot);
+	slot.frame.number = profileFrameNumber;
+	slot.frame.start = profileNow();
+	slot.frame.cpuMilliseconds = 0.0;
+	slot.frame.events.clear();
+	slot.queriesUsed = 0;
+	profileInFrame = true;
+}
+
+void profilerEndFrame(){
+	if (!profileOpenEvents.empty()){
+		printf("Profiler : %u scopes still open at the end of the frame\n", (unsigned int)profileOpenEvents.size());
+		while (!profileOpenEvents.empty())
+			profilerEnd();
+	}
+	ProfileSlot & slot = currentSlot();
+	slot.frame.cpuMilliseconds = profileNow() - slot.frame.start;
+	slot.pending = true;
+	profileInFrame = false;
+	profileFrameNumber++;
+}
+
+void profilerBegin(const char * name, bool gpu){
+	if (!profileInFrame){
+		profileOpenEvents.push_back(-1);
+		return;
+	}
+	ProfileSlot & slot = currentSlot();
+	ProfileEvent e;
+	e.name = name;
+	e.depth = (int)profileOpenEvents.size();
+	e.cpuMilliseconds = 0.0;
+	e.gpuMilliseconds = -1.0;
+	e.query = -1;
+	if (gpu && !profileGPUScopeOpen){
+		if (slot.queriesUsed == slot.queries.size()){
+			GLuint query;
+			glGenQueries(1, &query);
+			slot.queries.push_back(query);
+		}
+		e.query = (int)slot.queriesUsed++;
+		profileGPUScopeOpen = true;
+		glBeginQuery(GL_TIME_ELAPSED, slot.queries[e.query]);
+	}
+	e.start = profileNow();
+	profileOpenEvents.push_back((int)slot.frame.events.size());
+	slot.frame.events.push_back(e);
+}
+
+void profilerEnd(){
+	if (profileOpenEvents.empty())
+		return;
+	int index = profileOpenEvents.back();
+	profileOpenEvents.pop_back();
+	if (index < 0)
+		return;
+	ProfileEvent & e = currentSlot().frame.events[index];
+	if (e.query >= 0){
+		glEndQuery(GL_TIME_ELAPSED);
+		profileGPUScopeOpen = false;
+	}
+	e.cpuMilliseconds = profileNow() - e.start;
+}
+
+const ProfileFrame & profilerGetLastFrame(){
+	return profileLastFrame;
+}
+
+void profilerStartTrace(){
+	profileTrace.clear();
+	profileTracing = true;
+}
+
+bool profilerWriteTrace(const char * path){
+	FILE * f = fopen(path, "w");
+	if (!f){
+		printf("Could not write %s\n", path);
+		return false;
+	}
+	// Microseconds, CPU scopes on thread 1, GPU ones on thread 2
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+	for (size_t i = 0; i < profileTrace.size(); i++){
+		const ProfileFrame & frame = profileTrace[i];
+		fprintf(f, ",\n{\"name\":\"frame %u\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+			frame.number, frame.start * 1000.0, frame.cpuMilliseconds * 1000.0);
+		for (size_t j = 0; j < frame.events.size(); j++){
+			const ProfileEvent & e = frame.events[j];
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+				e.name, e.start * 1000.0, e.cpuMilliseconds * 1000.0);
+			if (e.gpuMilliseconds >= 0.0)
+				fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":%.3f,\"dur\":%.3f}",
+					e.name, e.start * 1000.0, e.gpuMilliseconds * 1000.0);
+		}
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+	printf("Profiler : %u frames written to %s, %llu without GPU times\n",
+		(unsigned int)profileTrace.size(), path, profileDroppedFrames);
+	return true;
+}
+
+void profilerDrawOverlay(int x, int y, int size){
+	// Refreshed 4 times a second, every frame would be unreadable
+	static ProfileFrame shown;
+	static double shownAt = -1e9;
+	double now = profileNow();
+	if (now - shownAt >= 250.0){
+		shown = profileLastFrame;
+		shownAt = now;
+	}
+
+	char line[128];
+	sprintf(line, "frame %6.2f ms cpu", shown.cpuMilliseconds);
+	printText2D(line, x, y, size);
+	for (size_t i = 0; i < shown.events.size(); i++){
+		const ProfileEvent & e = shown.events[i];
+		y -= size;
+		if (e.gpuMilliseconds >= 0.0)
+			sprintf(line, "%*s%-14s %6.2f %6.2f", e.depth, "", e.name, e.cpuMilliseconds, e.gpuMilliseconds);
+		else
+			sprintf(line, "%*s%-14s %6.2f", e.depth, "", e.name, e.cpuMilliseconds);
+		printText2D(line, x, y, size);
+	}
+}
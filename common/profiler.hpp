@@ -0,0 +1,73 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <string>
+#include <vector>
+
+// Frame profiler. A scope times the CPU between its begin and end ; a GPU
+// scope also puts a GL_TIME_ELAPSED query around the commands issued meanwhile.
+// GL allows one such query at a time : GPU scopes don't nest (an inner one
+// only gets its CPU time), CPU scopes do, inside GPU scopes too.
+//
+// The frames are double buffered : the GPU times of a frame are read when its
+// slot comes back, two frames later. A result that isn't in by then is dropped
+// rather than waited for.
+//
+// Everything compiles out with PROFILER_DISABLED.
+
+struct ProfileEvent {
+	const char * name;     // a string literal, kept as is
+	int depth;             // 0 : outermost
+	double start;          // ms since the first frame
+	double cpuMilliseconds;
+	double gpuMilliseconds;   // -1 : CPU only, or the result was dropped
+	int query;             // in the frame's pool, -1 if none
+};
+
+struct ProfileFrame {
+	unsigned int number;
+	double start, cpuMilliseconds;
+	std::vector<ProfileEvent> events;   // in begin order
+};
+
+void profilerBeginFrame();
+void profilerEndFrame();
+void profilerBegin(const char * name, bool gpu);
+void profilerEnd();
+
+// The latest frame whose GPU times are known
+const ProfileFrame & profilerGetLastFrame();
+
+// Keeps every frame from now on, for profilerWriteTrace
+void profilerStartTrace();
+// chrome://tracing (or ui.perfetto.dev) JSON. The GPU scopes are drawn on a
+// track of their own, starting when their commands were issued : only their
+// durations come from the GPU.
+bool profilerWriteTrace(const char * path);
+
+// The last frame's scopes, indented, with printText2D (initText2D first)
+void profilerDrawOverlay(int x, int y, int size);
+
+// Ends the scope with the enclosing C++ block
+struct ProfileScope {
+	ProfileScope(const char * name, bool gpu) { profilerBegin(name, gpu); }
+	~ProfileScope() { profilerEnd(); }
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#ifndef PROFILER_DISABLED
+#define PROFILE_BEGIN(name)     profilerBegin(name, false)
+#define PROFILE_GPU_BEGIN(name) profilerBegin(name, true)
+#define PROFILE_END()           profilerEnd()
+#define PROFILE_SCOPE(name)     ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name, false)
+#define PROFILE_GPU_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name, true)
+#else
+#define PROFILE_BEGIN(name)
+#define PROFILE_GPU_BEGIN(name)
+#define PROFILE_END()
+#define PROFILE_SCOPE(name)
+#define PROFILE_GPU_SCOPE(name)
+#endif
+
+#endif
@@ -0,0 +1,384 @@
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+#include <glm/glm.hpp>
+
+#include "objloader.hpp"
+#include "pvs.hpp"
+
+int PVSData::cellIndex(const glm::vec3 & p) const{
+	glm::vec3 c = (p - origin) / cellSize;
+	int x = (int)floor(c.x), y = (int)floor(c.y), z = (int)floor(c.z);
+	if (x < 0 || y < 0 || z < 0 || x >= dims[0] || y >= dims[1] || z >= dims[2])
+		return -1;
+	return (z * dims[1] + y) * dims[0] + x;
+}
+
+// Clamped cell coordinates of a point
+static void cellCoords(const PVSData & pvs, const glm::vec3 & p, int out[3]){
+	glm::vec3 c = (p - pvs.origin) / pvs.cellSize;
+	for (int k = 0; k < 3; k++)
+		out[k] = std::min(pvs.dims[k] - 1, std::max(0, (int)floor(c[k])));
+}
+
+void PVSData::cellsOfTriangles(const std::vector<glm::vec3> & triangles, std::vector<int> & out_cells) const{
+	// Collected then deduplicated : a cluster only touches a few cells of the grid
+	out_cells.clear();
+	for (size_t i = 0; i + 2 < triangles.size(); i += 3){
+		glm::vec3 tmin = glm::min(triangles[i], glm::min(triangles[i + 1], triangles[i + 2]));
+		glm::vec3 tmax = glm::max(triangles[i], glm::max(triangles[i + 1], triangles[i + 2]));
+		int c0[3], c1[3];
+		cellCoords(*this, tmin, c0);
+		cellCoords(*this, tmax, c1);
+		for (int z = c0[2]; z <= c1[2]; z++)
+			for (int y = c0[1]; y <= c1[1]; y++)
+				for (int x = c0[0]; x <= c1[0]; x++)
+					out_cells.push_back((z * dims[1] + y) * dims[0] + x);
+	}
+	std::sort(out_cells.begin(), out_cells.end());
+	out_cells.erase(std::unique(out_cells.begin(), out_cells.end()), out_cells.end());
+}
+
+
+// Scene triangles binned in the PVS cells, so that a ray only tests the
+// triangles of the cells it goes through.
+struct TriangleGrid {
+	std::vector<glm::vec3> triangles;
+	std::vector< std::vector<unsigned int> > cellTriangles;
+};
+
+// Moller-Trumbore, restricted to the open segment ]0,1[
+static bool segmentHitsTriangle(const glm::vec3 & orig, const glm::vec3 & dir, const glm::vec3 * tri){
+	const float EPS = 1e-7f;
+	glm::vec3 e1 = tri[1] - tri[0];
+	glm::vec3 e2 = tri[2] - tri[0];
+	glm::vec3 p = glm::cross(dir, e2);
+	float det = glm::dot(e1, p);
+	if (fabs(det) < EPS)
+		return false;
+	float invDet = 1.0f / det;
+	glm::vec3 s = orig - tri[0];
+	float u = glm::dot(s, p) * invDet;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+	glm::vec3 q = glm::cross(s, e1);
+	float v = glm::dot(dir, q) * invDet;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+	float t = glm::dot(e2, q) * invDet;
+	return t > 1e-4f && t < 1.0f - 1e-4f;
+}
+
+// 3D DDA through the grid, from a to b (both inside of the grid)
+static bool segmentBlocked(const PVSData & pvs, const TriangleGrid & grid, const glm::vec3 & a, const glm::vec3 & b){
+	glm::vec3 dir = b - a;
+	int cell[3], endCell[3], step[3];
+	float tMax[3], tDelta[3];
+	cellCoords(pvs, a, cell);
+	cellCoords(pvs, b, endCell);
+
+	for (int k = 0; k < 3; k++){
+		if (dir[k] > 0.0f){
+			step[k] = 1;
+			float boundary = pvs.origin[k] + (cell[k] + 1) * pvs.cellSize;
+			tMax[k] = (boundary - a[k]) / dir[k];
+			tDelta[k] = pvs.cellSize / dir[k];
+		}else if (dir[k] < 0.0f){
+			step[k] = -1;
+			float boundary = pvs.origin[k] + cell[k] * pvs.cellSize;
+			tMax[k] = (boundary - a[k]) / dir[k];
+			tDelta[k] = -pvs.cellSize / dir[k];
+		}else{
+			step[k] = 0;
+			tMax[k] = FLT_MAX;
+			tDelta[k] = FLT_MAX;
+		}
+	}
+
+	while (true){
+		const std::vector<unsigned int> & tris = grid.cellTriangles[(cell[2] * pvs.dims[1] + cell[1]) * pvs.dims[0] + cell[0]];
+		for (size_t i = 0; i < tris.size(); i++)
+			if (segmentHitsTriangle(a, dir, &grid.triangles[3 * tris[i]]))
+				return true;
+
+		if (cell[0] == endCell[0] && cell[1] == endCell[1] && cell[2] == endCell[2])
+			return false;
+
+		int axis = (tMax[0] < tMax[1]) ? (tMax[0] < tMax[2] ? 0 : 2) : (tMax[1] < tMax[2] ? 1 : 2);
+		if (tMax[axis] > 1.0f)
+			return false;
+		cell[axis] += step[axis];
+		if (cell[axis] < 0 || cell[axis] >= pvs.dims[axis])
+			return false;
+		tMax[axis] += tDelta[axis];
+	}
+}
+
+// Small deterministic generator, so that two bakes of the same scene give the same file
+static float randomFloat(unsigned int & state){
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return (state & 0xFFFFFF) / float(0x1000000);
+}
+
+template <typename Work>
+static void runOnThreads(Work & work, int numThreads){
+	std::vector<std::thread> threads;
+	for (int t = 1; t < numThreads; t++)
+		threads.push_back(std::thread(std::ref(work)));
+	work();
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+}
+
+void bakePVS(
+	const std::vector<MaterialMesh> & meshes,
+	float cellSize,
+	int raysPerPair,
+	int dilation,
+	int numThreads,
+	PVSData & out
+){
+	TriangleGrid grid;
+	glm::vec3 minV(FLT_MAX), maxV(-FLT_MAX);
+	for (size_t m = 0; m < meshes.size(); m++){
+		for (size_t i = 0; i < meshes[m].vertices.size(); i++){
+			minV = glm::min(minV, meshes[m].vertices[i]);
+			maxV = glm::max(maxV, meshes[m].vertices[i]);
+		}
+		grid.triangles.insert(grid.triangles.end(), meshes[m].vertices.begin(), meshes[m].vertices.end());
+	}
+
+	// Small margin so that nothing lies exactly on the outer boundary
+	glm::vec3 margin(cellSize * 0.01f);
+	out.origin = minV - margin;
+	out.cellSize = cellSize;
+	glm::vec3 size = maxV + margin - out.origin;
+	for (int k = 0; k < 3; k++)
+		out.dims[k] = std::max(1, (int)ceil(size[k] / cellSize));
+	out.sourceTriangles = (unsigned int)(grid.triangles.size() / 3);
+
+	int n = out.numCells();
+	printf("Baking PVS : %d x %d x %d cells, %u triangles, %d threads\n",
+		out.dims[0], out.dims[1], out.dims[2], out.sourceTriangles, numThreads);
+
+	grid.cellTriangles.resize(n);
+	for (size_t t = 0; t < grid.triangles.size() / 3; t++){
+		glm::vec3 tmin = glm::min(grid.triangles[3*t], glm::min(grid.triangles[3*t+1], grid.triangles[3*t+2]));
+		glm::vec3 tmax = glm::max(grid.triangles[3*t], glm::max(grid.triangles[3*t+1], grid.triangles[3*t+2]));
+		int c0[3], c1[3];
+		cellCoords(out, tmin, c0);
+		cellCoords(out, tmax, c1);
+		for (int z = c0[2]; z <= c1[2]; z++)
+			for (int y = c0[1]; y <= c1[1]; y++)
+				for (int x = c0[0]; x <= c1[0]; x++)
+					grid.cellTriangles[(z * out.dims[1] + y) * out.dims[0] + x].push_back((unsigned int)t);
+	}
+
+	// Straight into the bitsets : the thread that takes cell i writes the
+	// bits j >= i of row i, and nothing else. The other half is mirrored after.
+	size_t rowBytes = (n + 7) / 8;
+	out.visibility.assign(n, std::vector<unsigned char>(rowBytes, 0));
+	std::atomic<int> nextCell(0);
+
+	auto work = [&](){
+		while (true){
+			int i = nextCell++;
+			if (i >= n)
+				break;
+			std::vector<unsigned char> & row = out.visibility[i];
+			row[i >> 3] |= (unsigned char)(1 << (i & 7));
+			glm::vec3 cellI(i % out.dims[0], (i / out.dims[0]) % out.dims[1], i / (out.dims[0] * out.dims[1]));
+			for (int j = i + 1; j < n; j++){
+				glm::vec3 cellJ(j % out.dims[0], (j / out.dims[0]) % out.dims[1], j / (out.dims[0] * out.dims[1]));
+				unsigned int state = (unsigned int)(i * 7919 + j * 104729) | 1u;
+				bool seen = false;
+				for (int r = 0; r < raysPerPair && !seen; r++){
+					glm::vec3 a = out.origin + (cellI + glm::vec3(randomFloat(state), randomFloat(state), randomFloat(state))) * cellSize;
+					glm::vec3 b = out.origin + (cellJ + glm::vec3(randomFloat(state), randomFloat(state), randomFloat(state))) * cellSize;
+					seen = !segmentBlocked(out, grid, a, b);
+				}
+				if (seen)
+					row[j >> 3] |= (unsigned char)(1 << (j & 7));
+			}
+		}
+	};
+	runOnThreads(work, numThreads);
+
+	for (int i = 0; i < n; i++){
+		const std::vector<unsigned char> & row = out.visibility[i];
+		for (size_t b = (size_t)i >> 3; b < rowBytes; b++){
+			if (!row[b])
+				continue;
+			for (int k = 0; k < 8; k++){
+				int j = (int)(b * 8) + k;
+				if (j > i && j < n && ((row[b] >> k) & 1))
+					out.visibility[j][i >> 3] |= (unsigned char)(1 << (i & 7));
+			}
+		}
+	}
+
+	// Random rays only sample each pair : a gap thinner than the rays can
+	// find is missed, and the pair stays hidden. Each dilation step adds what
+	// the 26 neighbour cells see, to give the sampling some margin.
+	for (int step = 0; step < dilation; step++){
+		std::vector< std::vector<unsigned char> > sampled;
+		sampled.swap(out.visibility);
+		out.visibility.assign(n, std::vector<unsigned char>(rowBytes, 0));
+		nextCell = 0;
+		auto dilate = [&](){
+			while (true){
+				int i = nextCell++;
+				if (i >= n)
+					break;
+				int x = i % out.dims[0], y = (i / out.dims[0]) % out.dims[1], z = i / (out.dims[0] * out.dims[1]);
+				std::vector<unsigned char> & row = out.visibility[i];
+				for (int dz = std::max(0, z - 1); dz <= std::min(out.dims[2] - 1, z + 1); dz++)
+					for (int dy = std::max(0, y - 1); dy <= std::min(out.dims[1] - 1, y + 1); dy++)
+						for (int dx = std::max(0, x - 1); dx <= std::min(out.dims[0] - 1, x + 1); dx++){
+							const std::vector<unsigned char> & neighbour = sampled[(dz * out.dims[1] + dy) * out.dims[0] + dx];
+							for (size_t b = 0; b < rowBytes; b++)
+								row[b] |= neighbour[b];
+						}
+			}
+		};
+		runOnThreads(dilate, numThreads);
+	}
+
+	size_t visiblePairs = 0;
+	for (int i = 0; i < n; i++)
+		for (size_t b = 0; b < rowBytes; b++)
+			for (unsigned char bits = out.visibility[i][b]; bits; bits &= bits - 1)
+				visiblePairs++;
+	printf("PVS baked : %.1f%% of the cell pairs are visible\n", 100.0 * visiblePairs / ((double)n * n));
+}
+
+
+
+// Zero bytes are stored as a 0 followed by the length of the run (1..255),
+// everything else is copied as is.
+static void compressRow(const std::vector<unsigned char> & row, std::vector<unsigned char> & out){
+	out.clear();
+	for (size_t i = 0; i < row.size(); ){
+		if (row[i] != 0){
+			out.push_back(row[i++]);
+			continue;
+		}
+		unsigned int run = 0;
+		while (i < row.size() && row[i] == 0 && run < 255){
+			run++;
+			i++;
+		}
+		out.push_back(0);
+		out.push_back((unsigned char)run);
+	}
+}
+
+static bool decompressRow(const unsigned char * in, size_t inSize, std::vector<unsigned char> & row){
+	size_t o = 0;
+	for (size_t i = 0; i < inSize; i++){
+		if (in[i] != 0){
+			if (o >= row.size()) return false;
+			row[o++] = in[i];
+			continue;
+		}
+		if (++i >= inSize) return false;
+		unsigned int run = in[i];
+		if (o + run > row.size()) return false;
+		memset(&row[o], 0, run);
+		o += run;
+	}
+	return o == row.size();
+}
+
+static const char PVS_MAGIC[4] = { 'P', 'V', 'S', '1' };
+
+bool savePVS(const char * path, const PVSData & pvs){
+	FILE * file = fopen(path, "wb");
+	if (!file){
+		printf("Impossible to write %s\n", path);
+		return false;
+	}
+	fwrite(PVS_MAGIC, 1, 4, file);
+	fwrite(&pvs.origin[0], sizeof(float), 3, file);
+	fwrite(&pvs.cellSize, sizeof(float), 1, file);
+	fwrite(pvs.dims, sizeof(int), 3, file);
+	fwrite(&pvs.sourceTriangles, sizeof(unsigned int), 1, file);
+
+	size_t total = 0;
+	std::vector<unsigned char> packed;
+	for (size_t i = 0; i < pvs.visibility.size(); i++){
+		compressRow(pvs.visibility[i], packed);
+		unsigned int size = (unsigned int)packed.size();
+		fwrite(&size, sizeof(unsigned int), 1, file);
+		if (size)
+			fwrite(&packed[0], 1, size, file);
+		total += size;
+	}
+	fclose(file);
+	printf("Wrote %s (%u bytes of visibility, %u uncompressed)\n", path,
+		(unsigned int)total, (unsigned int)(pvs.visibility.size() * ((pvs.numCells() + 7) / 8)));
+	return true;
+}
+
+bool loadPVS(const char * path, PVSData & pvs){
+	FILE * file = fopen(path, "rb");
+	if (!file)
+		return false;
+
+	char magic[4];
+	bool ok = fread(magic, 1, 4, file) == 4 && memcmp(magic, PVS_MAGIC, 4) == 0;
+	ok = ok && fread(&pvs.origin[0], sizeof(float), 3, file) == 3;
+	ok = ok && fread(&pvs.cellSize, sizeof(float), 1, file) == 1;
+	ok = ok && fread(pvs.dims, sizeof(int), 3, file) == 3;
+	ok = ok && fread(&pvs.sourceTriangles, sizeof(unsigned int), 1, file) == 1;
+	ok = ok && pvs.dims[0] > 0 && pvs.dims[1] > 0 && pvs.dims[2] > 0 && pvs.cellSize > 0.0f;
+	if (!ok){
+		printf("%s is not a PVS file\n", path);
+		fclose(file);
+		return false;
+	}
+
+	// Every row takes at least its 4 bytes of size : more cells than that
+	// can't be in the file, whatever the header says
+	long start = ftell(file);
+	fseek(file, 0, SEEK_END);
+	long end = ftell(file);
+	fseek(file, start, SEEK_SET);
+	unsigned long long remaining = (start >= 0 && end > start) ? (unsigned long long)(end - start) : 0;
+	unsigned long long cells = (unsigned long long)pvs.dims[0] * pvs.dims[1] * pvs.dims[2];
+	if (cells * sizeof(unsigned int) > remaining){
+		printf("%s : %d x %d x %d cells don't fit in the file\n", path, pvs.dims[0], pvs.dims[1], pvs.dims[2]);
+		fclose(file);
+		return false;
+	}
+
+	int n = pvs.numCells();
+	pvs.visibility.assign(n, std::vector<unsigned char>((n + 7) / 8, 0));
+	std::vector<unsigned char> packed;
+	for (int i = 0; i < n && ok; i++){
+		unsigned int size = 0;
+		ok = fread(&size, sizeof(unsigned int), 1, file) == 1;
+		remaining -= sizeof(unsigned int);
+		// The rows left need their size fields too
+		ok = ok && (unsigned long long)size + (unsigned long long)(n - 1 - i) * sizeof(unsigned int) <= remaining;
+		if (!ok) break;
+		remaining -= size;
+		packed.resize(size);
+		ok = (size == 0 || fread(&packed[0], 1, size, file) == size)
+			&& decompressRow(size ? &packed[0] : NULL, size, pvs.visibility[i]);
+	}
+	fclose(file);
+	if (!ok)
+		printf("%s is truncated or corrupted\n", path);
+	return ok;
+}
@@ -0,0 +1,46 @@
+#ifndef PVS_HPP
+#define PVS_HPP
+
+// Potentially visible sets : the scene bounds are split in a regular grid of
+// cells, and for each cell we store which other cells can be seen from it.
+struct PVSData {
+	glm::vec3 origin;      // min corner of the grid
+	float cellSize;
+	int dims[3];
+	unsigned int sourceTriangles; // to detect a .pvs baked from another scene
+
+	// One bitset per cell, (numCells()+7)/8 bytes each. Uncompressed in memory.
+	std::vector< std::vector<unsigned char> > visibility;
+
+	int numCells() const { return dims[0] * dims[1] * dims[2]; }
+
+	// Returns -1 if p is outside of the grid
+	int cellIndex(const glm::vec3 & p) const;
+
+	bool isVisible(int fromCell, int toCell) const {
+		return (visibility[fromCell][toCell >> 3] >> (toCell & 7)) & 1;
+	}
+
+	// All the cells touched by the bounding box of each triangle of the mesh.
+	void cellsOfTriangles(const std::vector<glm::vec3> & triangles, std::vector<int> & out_cells) const;
+};
+
+// Ray casts between random points of every pair of cells, on numThreads threads.
+// A pair is visible as soon as one ray gets through. Sampling is not
+// conservative : a gap no ray goes through is missed. Each of the dilation
+// steps adds to a cell what its 26 neighbours see, as a safety margin.
+void bakePVS(
+	const std::vector<MaterialMesh> & meshes,
+	float cellSize,
+	int raysPerPair,
+	int dilation,
+	int numThreads,
+	PVSData & out
+);
+
+// The bitsets are stored zero-run-length compressed. loadPVS checks the grid
+// size and the row lengths against the file before allocating anything.
+bool savePVS(const char * path, const PVSData & pvs);
+bool loadPVS(const char * path, PVSData & pvs);
+
+#endif
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "jsonreader.hpp"
+#include "renderstats.hpp"
+
+static const char * const COUNTER_NAMES[] = {
+	"drawCalls", "triangles", "vertices", "programBinds", "vertexArrayBinds",
+	"textureBinds", "uniformUploads", "uploadBytes", "objectsDrawn", "objectsCulled"
+};
+
+void RenderStats::reset(){
+	drawCalls = triangles = vertices = 0;
+	programBinds = vertexArrayBinds = textureBinds = 0;
+	uniformUploads = uploadBytes = 0;
+	objectsDrawn = objectsCulled = 0;
+}
+
+unsigned int RenderStats::numCounters(){
+	return sizeof(COUNTER_NAMES) / sizeof(COUNTER_NAMES[0]);
+}
+
+const char * RenderStats::counterName(unsigned int i){
+	return COUNTER_NAMES[i];
+}
+
+unsigned long long RenderStats::counter(unsigned int i) const{
+	const unsigned long long * counters[] = {
+		&drawCalls, &triangles, &vertices, &programBinds, &vertexArrayBinds,
+		&textureBinds, &uniformUploads, &uploadBytes, &objectsDrawn, &objectsCulled
+	};
+	return *counters[i];
+}
+
+void RenderStats::keepMax(const RenderStats & other){
+	drawCalls        = std::max(drawCalls, other.drawCalls);
+	triangles        = std::max(triangles, other.triangles);
+	vertices         = std::max(vertices, other.vertices);
+	programBinds     = std::max(programBinds, other.programBinds);
+	vertexArrayBinds = std::max(vertexArrayBinds, other.vertexArrayBinds);
+	textureBinds     = std::max(textureBinds, other.textureBinds);
+	uniformUploads   = std::max(uniformUploads, other.uniformUploads);
+	uploadBytes      = std::max(uploadBytes, other.uploadBytes);
+	objectsDrawn     = std::max(objectsDrawn, other.objectsDrawn);
+	objectsCulled    = std::max(objectsCulled, other.objectsCulled);
+}
+
+void writeRenderStatsHeader(FILE * f){
+	fprintf(f, "frame,cpuMs");
+	for (unsigned int i = 0; i < RenderStats::numCounters(); i++)
+		fprintf(f, ",%s", RenderStats::counterName(i));
+	fprintf(f, "\n");
+}
+
+void writeRenderStatsRow(FILE * f, unsigned int frame, double cpuMilliseconds, const RenderStats & stats){
+	fprintf(f, "%u,%.4f", frame, cpuMilliseconds);
+	for (unsigned int i = 0; i < RenderStats::numCounters(); i++)
+		fprintf(f, ",%llu", stats.counter(i));
+	fprintf(f, "\n");
+}
+
+bool loadRenderStatsLimits(const char * path, RenderStatsLimits & out){
+	std::ifstream stream(path, std::ios::in);
+	if (!stream.is_open()){
+		printf("Could not open %s\n", path);
+		return false;
+	}
+	std::stringstream sstr;
+	sstr << stream.rdbuf();
+	std::string text = sstr.str();
+
+	out.maxima.assign(RenderStats::numCounters(), 0);
+	out.limited.assign(RenderStats::numCounters(), false);
+	JsonReader json = { text.c_str(), true };
+	json.expect('{');
+	if (!json.accept('}')){
+		do {
+			std::string name = json.string();
+			json.expect(':');
+			double value = json.number();
+			unsigned int i = 0;
+			while (i < RenderStats::numCounters() && name != RenderStats::counterName(i))
+				i++;
+			if (i == RenderStats::numCounters()){
+				printf("%s : unknown counter %s\n", path, name.c_str());
+				return false;
+			}
+			out.maxima[i] = (unsigned long long)value;
+			out.limited[i] = true;
+		} while (json.ok && json.accept(','));
+		json.expect('}');
+	}
+	if (!json.ok){
+		printf("%s : syntax error at offset %d\n", path, (int)(json.p - text.c_str()));
+		return false;
+	}
+	return true;
+}
+
+unsigned int checkRenderStatsLimits(const RenderStats & worst, const RenderStatsLimits & limits){
+	unsigned int failures = 0;
+	for (unsigned int i = 0; i < RenderStats::numCounters() && i < limits.maxima.size(); i++){
+		if (limits.limited[i] && worst.counter(i) > limits.maxima[i]){
+			printf("Render stats limit exceeded : %s is %llu, the limit is %llu\n",
+				RenderStats::counterName(i), worst.counter(i), limits.maxima[i]);
+			failures++;
+		}
+	}
+	return failures;
+}
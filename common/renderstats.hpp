@@ -0,0 +1,49 @@
+#ifndef RENDERSTATS_HPP
+#define RENDERSTATS_HPP
+
+#include <stdio.h>
+#include <vector>
+
+// What one frame asked of GL, counted by the render loop where it makes the
+// calls. Debug drawing (the profiler overlay) is left out.
+struct RenderStats {
+	unsigned long long drawCalls;       // a glMultiDraw* is one call
+	unsigned long long triangles;
+	unsigned long long vertices;        // indices submitted
+	unsigned long long programBinds;
+	unsigned long long vertexArrayBinds;
+	unsigned long long textureBinds;
+	unsigned long long uniformUploads;  // glUniform* calls
+	unsigned long long uploadBytes;     // buffer and texture data sent
+	unsigned long long objectsDrawn;
+	unsigned long long objectsCulled;
+
+	RenderStats() { reset(); }
+	void reset();
+
+	// Every counter, by index : CSV columns and limits
+	static unsigned int numCounters();
+	static const char * counterName(unsigned int i);
+	unsigned long long counter(unsigned int i) const;
+
+	// Each counter becomes the largest of the two
+	void keepMax(const RenderStats & other);
+};
+
+// CSV, one row per frame : frame, cpuMs, then the counters
+void writeRenderStatsHeader(FILE * f);
+void writeRenderStatsRow(FILE * f, unsigned int frame, double cpuMilliseconds, const RenderStats & stats);
+
+// Regression limits, the most a frame may use of each counter, as JSON :
+// { "drawCalls": 12, "programBinds": 6, "triangles": 400000 }
+// A counter left out has no limit.
+struct RenderStatsLimits {
+	std::vector<unsigned long long> maxima;   // by counter index
+	std::vector<bool> limited;
+};
+bool loadRenderStatsLimits(const char * path, RenderStatsLimits & out);
+
+// Prints every counter of worst above its limit ; returns how many are
+unsigned int checkRenderStatsLimits(const RenderStats & worst, const RenderStatsLimits & limits);
+
+#endif
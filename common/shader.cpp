@@ -5,107 +5,385 @@
 #include <fstream>
 #include <algorithm>
 #include <sstream>
+#include <chrono>
 using namespace std;
 
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
 #include <GL/glew.h>
 
 #include "shader.hpp"
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+static std::string shaderCacheDirectory = "shadercache";
+static std::vector<ShaderLoadStats> shaderLoadStats;
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+typedef std::chrono::high_resolution_clock Clock;
+
+static double millisecondsSince(Clock::time_point start){
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+void setShaderCacheDirectory(const char * path){
+	shaderCacheDirectory = path ? path : "";
+}
+
+const std::vector<ShaderLoadStats> & getShaderLoadStats(){
+	return shaderLoadStats;
+}
+
+static bool readShaderFile(const char * path, std::string & out){
+	std::ifstream stream(path, std::ios::in);
+	if (!stream.is_open())
+		return false;
+	std::stringstream sstr;
+	sstr << stream.rdbuf();
+	out = sstr.str();
+	return true;
+}
+
+// Right after the #version line, which has to stay first
+static void injectDefines(std::string & code, const char * defines){
+	if (!defines || !*defines)
+		return;
+	size_t at = 0;
+	size_t version = code.find("#version");
+	if (version != std::string::npos){
+		size_t eol = code.find('\n', version);
+		if (eol == std::string::npos){
+			code += '\n';
+			eol = code.size() - 1;
+		}
+		at = eol + 1;
+	}
+	code.insert(at, defines);
+}
+
+// FNV-1a, 64 bits
+static unsigned long long hashString(unsigned long long hash, const char * s){
+	if (!s)
+		s = "";
+	// The terminating zero goes in too, so that "ab" + "c" != "a" + "bc"
+	do {
+		hash ^= (unsigned char)*s;
+		hash *= 1099511628211ULL;
+	} while (*s++);
+	return hash;
+}
+
+// A binary is only good for the driver that made it
+static unsigned long long programKey(const std::string & vertexCode, const std::string & fragmentCode){
+	unsigned long long key = 14695981039346656037ULL;
+	key = hashString(key, vertexCode.c_str());
+	key = hashString(key, fragmentCode.c_str());
+	key = hashString(key, (const char *)glGetString(GL_VENDOR));
+	key = hashString(key, (const char *)glGetString(GL_RENDERER));
+	key = hashString(key, (const char *)glGetString(GL_VERSION));
+	return key;
+}
+
+static bool programBinariesSupported(){
+	if (shaderCacheDirectory.empty() || !(GLEW_ARB_get_program_binary || GLEW_VERSION_4_1))
+		return false;
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+static std::string cachePath(unsigned long long key){
+	char name[32];
+	sprintf(name, "/%016llx.bin", key);
+	return shaderCacheDirectory + name;
+}
+
+struct ProgramBinaryHeader {
+	char magic[4];            // "PBIN"
+	unsigned int format;      // GLenum from glGetProgramBinary
+	unsigned int length;
+	unsigned long long key;
+};
+
+// 0 if there is no binary, or if the driver refuses it (updated since, ...)
+// driverMilliseconds : glProgramBinary and the link status, not the file
+static GLuint loadProgramBinary(unsigned long long key, double & driverMilliseconds){
+	std::vector<unsigned char> file;
+	FILE * f = fopen(cachePath(key).c_str(), "rb");
+	if (!f)
+		return 0;
+	ProgramBinaryHeader header;
+	bool ok = fread(&header, sizeof(header), 1, f) == 1 && memcmp(header.magic, "PBIN", 4) == 0 && header.key == key;
+	if (ok){
+		// The length must be what follows the header, before anything is
+		// allocated for it : a damaged file could claim gigabytes
+		ok = fseek(f, 0, SEEK_END) == 0;
+		long size = ok ? ftell(f) : -1;
+		ok = size >= 0 && header.length > 0 && (unsigned long)size - sizeof(header) == header.length &&
+			fseek(f, sizeof(header), SEEK_SET) == 0;
+	}
+	if (ok){
+		file.resize(header.length);
+		ok = fread(&file[0], 1, header.length, f) == header.length;
+	}
+	fclose(f);
+	if (!ok)
+		return 0;
+
+	Clock::time_point start = Clock::now();
+	GLuint ProgramID = glCreateProgram();
+	glProgramBinary(ProgramID, header.format, &file[0], (GLsizei)header.length);
+	GLint Result = GL_FALSE;
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	driverMilliseconds += millisecondsSince(start);
+	if (Result != GL_TRUE){
+		glDeleteProgram(ProgramID);
+		return 0;
+	}
+	return ProgramID;
+}
+
+static void saveProgramBinary(GLuint ProgramID, unsigned long long key){
+	GLint length = 0;
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	std::vector<unsigned char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(ProgramID, length, &length, &format, &binary[0]);
+
+#ifdef _WIN32
+	_mkdir(shaderCacheDirectory.c_str());
+#else
+	mkdir(shaderCacheDirectory.c_str(), 0755);
+#endif
+	FILE * f = fopen(cachePath(key).c_str(), "wb");
+	if (!f){
+		printf("Could not write the program binary to %s\n", cachePath(key).c_str());
+		return;
+	}
+	ProgramBinaryHeader header;
+	memcpy(header.magic, "PBIN", 4);
+	header.format = format;
+	header.length = (unsigned int)length;
+	header.key = key;
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(&binary[0], 1, length, f);
+	fclose(f);
+}
+
+// A program on its way : compiled and linked, but nothing checked yet
+struct PendingProgram {
+	std::string vertexPath, fragmentPath, defines;
+	GLuint VertexShaderID, FragmentShaderID, ProgramID;
+	bool useCache, fromCache, resolved, linked;
+	unsigned long long key;
+	double driverMilliseconds;   // in GL calls so far, reading the files aside
+};
+static std::vector<PendingProgram> pendingPrograms;
+
+static bool hasExtension(const char * name){
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+		if (strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+			return true;
+	return false;
+}
+
+// GL_KHR_parallel_shader_compile and the ARB version share their tokens ; GLEW
+// only knows the ARB one
+static bool parallelCompileSupported(){
+	static int supported = -1;
+	if (supported < 0){
+		supported = GLEW_ARB_parallel_shader_compile || hasExtension("GL_KHR_parallel_shader_compile");
+		if (GLEW_ARB_parallel_shader_compile)
+			glMaxShaderCompilerThreadsARB(0xFFFFFFFF);   // as many as the driver likes
+	}
+	return supported != 0;
+}
+
+// Reads the sources, then loads the cached binary or hands the sources to the
+// compiler, without waiting for it
+static PendingProgram startProgram(const char * vertex_file_path, const char * fragment_file_path, const char * defines){
+	PendingProgram p;
+	p.vertexPath = vertex_file_path;
+	p.fragmentPath = fragment_file_path;
+	p.defines = defines ? defines : "";
+	p.VertexShaderID = p.FragmentShaderID = p.ProgramID = 0;
+	p.fromCache = false;
+	p.resolved = false;
+	p.linked = false;
+	p.key = 0;
+	p.driverMilliseconds = 0.0;
 
 	// Read the Vertex Shader code from the file
 	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << VertexShaderStream.rdbuf();
-		VertexShaderCode = sstr.str();
-		VertexShaderStream.close();
-	}else{
+	if (!readShaderFile(vertex_file_path, VertexShaderCode)){
 		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
 		getchar();
-		return 0;
+		p.useCache = false;
+		p.resolved = true;
+		return p;
 	}
 
 	// Read the Fragment Shader code from the file
 	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << FragmentShaderStream.rdbuf();
-		FragmentShaderCode = sstr.str();
-		FragmentShaderStream.close();
-	}
+	readShaderFile(fragment_file_path, FragmentShaderCode);
 
-	GLint Result = GL_FALSE;
-	int InfoLogLength;
+	injectDefines(VertexShaderCode, defines);
+	injectDefines(FragmentShaderCode, defines);
 
+	p.useCache = programBinariesSupported();
+	if (p.useCache){
+		p.key = programKey(VertexShaderCode, FragmentShaderCode);
+		p.ProgramID = loadProgramBinary(p.key, p.driverMilliseconds);
+		if (p.ProgramID){
+			p.fromCache = true;
+			p.linked = true;
+			return p;
+		}
+	}
 
-	// Compile Vertex Shader
 	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-	glCompileShader(VertexShaderID);
-
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if ( InfoLogLength > 0 ){
-		std::vector<char> VertexShaderErrorMessage(InfoLogLength+1);
-		glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-		printf("%s\n", &VertexShaderErrorMessage[0]);
-	}
+	printf("Compiling shader : %s\n", fragment_file_path);
+	printf("Linking program\n");
+	Clock::time_point start = Clock::now();
 
+	// Create the shaders
+	p.VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	p.FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
 
+	// Compile Vertex Shader
+	char const * VertexSourcePointer = VertexShaderCode.c_str();
+	glShaderSource(p.VertexShaderID, 1, &VertexSourcePointer , NULL);
+	glCompileShader(p.VertexShaderID);
 
 	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
 	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-	glCompileShader(FragmentShaderID);
-
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if ( InfoLogLength > 0 ){
-		std::vector<char> FragmentShaderErrorMessage(InfoLogLength+1);
-		glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-		printf("%s\n", &FragmentShaderErrorMessage[0]);
-	}
+	glShaderSource(p.FragmentShaderID, 1, &FragmentSourcePointer , NULL);
+	glCompileShader(p.FragmentShaderID);
+
+	// Link the program. Linking right away is fine : if a shader failed, the
+	// link fails too, and both logs are printed by finishProgram.
+	p.ProgramID = glCreateProgram();
+	glAttachShader(p.ProgramID, p.VertexShaderID);
+	glAttachShader(p.ProgramID, p.FragmentShaderID);
+	if (p.useCache)
+		glProgramParameteri(p.ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(p.ProgramID);
+	p.driverMilliseconds += millisecondsSince(start);
+	return p;
+}
 
+static bool isReady(const PendingProgram & p){
+	if (p.resolved || p.fromCache || !parallelCompileSupported())
+		return true;
+	GLint done = GL_FALSE;
+	glGetProgramiv(p.ProgramID, GL_COMPLETION_STATUS_ARB, &done);
+	return done == GL_TRUE;
+}
 
+// Blocks until the driver is done : logs, shader cleanup, cache, stats
+static void finishProgram(PendingProgram & p){
+	if (p.resolved)
+		return;
+	p.resolved = true;
 
-	// Link the program
-	printf("Linking program\n");
-	GLuint ProgramID = glCreateProgram();
-	glAttachShader(ProgramID, VertexShaderID);
-	glAttachShader(ProgramID, FragmentShaderID);
-	glLinkProgram(ProgramID);
+	GLint Result = GL_FALSE;
+	int InfoLogLength;
 
-	// Check the program
-	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if ( InfoLogLength > 0 ){
-		std::vector<char> ProgramErrorMessage(InfoLogLength+1);
-		glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
-		printf("%s\n", &ProgramErrorMessage[0]);
+	if (p.VertexShaderID){
+		// The status queries wait for the compiler, the logs don't
+		GLint VertexResult = GL_FALSE, FragmentResult = GL_FALSE;
+		Clock::time_point start = Clock::now();
+		glGetShaderiv(p.VertexShaderID, GL_COMPILE_STATUS, &VertexResult);
+		glGetShaderiv(p.FragmentShaderID, GL_COMPILE_STATUS, &FragmentResult);
+		glGetProgramiv(p.ProgramID, GL_LINK_STATUS, &Result);
+		p.driverMilliseconds += millisecondsSince(start);
+
+		// Check Vertex Shader
+		glGetShaderiv(p.VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+		if ( InfoLogLength > 0 ){
+			std::vector<char> VertexShaderErrorMessage(InfoLogLength+1);
+			glGetShaderInfoLog(p.VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
+			printf("%s\n", &VertexShaderErrorMessage[0]);
+		}
+
+		// Check Fragment Shader
+		glGetShaderiv(p.FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+		if ( InfoLogLength > 0 ){
+			std::vector<char> FragmentShaderErrorMessage(InfoLogLength+1);
+			glGetShaderInfoLog(p.FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
+			printf("%s\n", &FragmentShaderErrorMessage[0]);
+		}
+
+		// Check the program
+		glGetProgramiv(p.ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+		if ( InfoLogLength > 0 ){
+			std::vector<char> ProgramErrorMessage(InfoLogLength+1);
+			glGetProgramInfoLog(p.ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+			printf("%s\n", &ProgramErrorMessage[0]);
+		}
+
+		glDetachShader(p.ProgramID, p.VertexShaderID);
+		glDetachShader(p.ProgramID, p.FragmentShaderID);
+
+		glDeleteShader(p.VertexShaderID);
+		glDeleteShader(p.FragmentShaderID);
+		p.VertexShaderID = p.FragmentShaderID = 0;
+
+		p.linked = Result == GL_TRUE;
+		if (p.useCache && p.linked)
+			saveProgramBinary(p.ProgramID, p.key);
 	}
 
-	
-	glDetachShader(ProgramID, VertexShaderID);
-	glDetachShader(ProgramID, FragmentShaderID);
-	
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
+	ShaderLoadStats stats;
+	stats.vertexPath = p.vertexPath;
+	stats.fragmentPath = p.fragmentPath;
+	stats.defines = p.defines;
+	stats.fromCache = p.fromCache;
+	stats.milliseconds = p.driverMilliseconds;
+	std::string variant = p.defines;
+	std::replace(variant.begin(), variant.end(), '\n', ' ');
+	printf("%s + %s %s: %s in %.2f ms\n", stats.vertexPath.c_str(), stats.fragmentPath.c_str(), variant.c_str(),
+		stats.fromCache ? "program binary loaded" : "compiled", stats.milliseconds);
+	shaderLoadStats.push_back(stats);
+}
 
-	return ProgramID;
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path, const char * defines){
+	PendingProgram p = startProgram(vertex_file_path, fragment_file_path, defines);
+	finishProgram(p);
+	return p.ProgramID;
+}
+
+unsigned int LoadShadersAsync(const char * vertex_file_path, const char * fragment_file_path, const char * defines){
+	pendingPrograms.push_back(startProgram(vertex_file_path, fragment_file_path, defines));
+	return (unsigned int)pendingPrograms.size();
 }
 
+bool isProgramReady(unsigned int handle){
+	if (handle == 0 || handle > pendingPrograms.size())
+		return true;
+	return isReady(pendingPrograms[handle - 1]);
+}
 
+GLuint getProgram(unsigned int handle){
+	if (handle == 0 || handle > pendingPrograms.size())
+		return 0;
+	PendingProgram & p = pendingPrograms[handle - 1];
+	finishProgram(p);
+	return p.ProgramID;
+}
+
+bool isProgramLinked(unsigned int handle){
+	if (handle == 0 || handle > pendingPrograms.size())
+		return false;
+	PendingProgram & p = pendingPrograms[handle - 1];
+	finishProgram(p);
+	return p.linked;
+}
@@ -1,6 +1,44 @@
 #ifndef SHADER_HPP
 #define SHADER_HPP
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path);
+#include <string>
+#include <vector>
+
+// Linked programs are kept on disk (GL_ARB_get_program_binary), keyed by a hash
+// of both sources and of the GL vendor, renderer and version : later launches
+// load the binary instead of compiling, until a source or the driver changes.
+// A binary the driver rejects is compiled again and replaced.
+// defines ("#define A 1\n#define B\n") goes in both sources right after their
+// #version line : each set of defines is a program of its own.
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path, const char * defines = NULL);
+
+// Same, without waiting for the driver : the sources are submitted and a handle
+// returned at once, so that many programs compile together (and alongside the
+// asset loading) on drivers with GL_KHR_parallel_shader_compile.
+// isProgramReady never blocks there ; elsewhere it always says yes, and
+// getProgram does the waiting. getProgram prints the logs like LoadShaders and
+// returns the same program every time.
+unsigned int LoadShadersAsync(const char * vertex_file_path, const char * fragment_file_path, const char * defines = NULL);
+bool isProgramReady(unsigned int handle);
+GLuint getProgram(unsigned int handle);
+
+// Whether compile and link succeeded, waiting like getProgram. A failed program
+// is still returned by getProgram (it draws nothing) : check this before
+// replacing a working one.
+bool isProgramLinked(unsigned int handle);
+
+// "shadercache" by default, relative to the working directory ; NULL turns the
+// cache off
+void setShaderCacheDirectory(const char * path);
+
+// One per LoadShaders call, in order
+struct ShaderLoadStats {
+	std::string vertexPath, fragmentPath, defines;
+	bool fromCache;
+	double milliseconds;   // in the driver on this thread : compile, link and the status
+	                       // queries that wait for them, or glProgramBinary. Reading
+	                       // the files and time between submit and check don't count.
+};
+const std::vector<ShaderLoadStats> & getShaderLoadStats();
 
 #endif
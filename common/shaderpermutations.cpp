@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "shader.hpp"
+#include "shaderpermutations.hpp"
+
+ShaderPermutations::ShaderPermutations(const char * vertexPath, const char * fragmentPath, int numLights)
+	: vertexPath(vertexPath), fragmentPath(fragmentPath), numLights(numLights), reloadAgain(false)
+{
+}
+
+std::string ShaderPermutations::makeDefines(unsigned int features, int numLights){
+	std::string defines;
+	if (numLights > 0){
+		char lights[64];
+		sprintf(lights, "#define NUM_LIGHTS %d\n", numLights);
+		defines = lights;
+	}
+	if (features & SHADER_TEXTURED)
+		defines += "#define TEXTURED\n";
+	if (features & SHADER_VIRTUAL_TEXTURE)
+		defines += "#define VIRTUAL_TEXTURE\n";
+	return defines;
+}
+
+void ShaderPermutations::request(unsigned int features){
+	if (handles.count(features))
+		return;
+	handles[features] = LoadShadersAsync(vertexPath.c_str(), fragmentPath.c_str(), makeDefines(features, numLights).c_str());
+}
+
+GLuint ShaderPermutations::get(unsigned int features){
+	request(features);
+	return getProgram(handles[features]);
+}
+
+std::vector<GLuint> ShaderPermutations::getPrograms(){
+	std::vector<GLuint> programs;
+	for (std::map<unsigned int, unsigned int>::iterator it = handles.begin(); it != handles.end(); ++it)
+		programs.push_back(getProgram(it->second));
+	return programs;
+}
+
+void ShaderPermutations::reload(){
+	if (!reloading.empty()){
+		reloadAgain = true;
+		return;
+	}
+	printf("Reloading %s + %s\n", vertexPath.c_str(), fragmentPath.c_str());
+	for (std::map<unsigned int, unsigned int>::iterator it = handles.begin(); it != handles.end(); ++it)
+		reloading[it->first] = LoadShadersAsync(vertexPath.c_str(), fragmentPath.c_str(), makeDefines(it->first, numLights).c_str());
+}
+
+bool ShaderPermutations::update(){
+	bool swapped = false;
+	for (std::map<unsigned int, unsigned int>::iterator it = reloading.begin(); it != reloading.end(); ){
+		if (!isProgramReady(it->second)){
+			++it;
+			continue;
+		}
+		GLuint program = getProgram(it->second);
+		if (isProgramLinked(it->second)){
+			// Deleting the bound program is fine : GL waits until it is unbound
+			glDeleteProgram(getProgram(handles[it->first]));
+			handles[it->first] = it->second;
+			swapped = true;
+		} else {
+			printf("%s + %s : keeping the previous program\n", vertexPath.c_str(), fragmentPath.c_str());
+			glDeleteProgram(program);
+		}
+		reloading.erase(it++);
+	}
+	if (reloading.empty() && reloadAgain){
+		reloadAgain = false;
+		reload();
+	}
+	return swapped;
+}
@@ -0,0 +1,57 @@
+#ifndef SHADERPERMUTATIONS_HPP
+#define SHADERPERMUTATIONS_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Features a variant is compiled with, as #defines
+enum ShaderFeature {
+	SHADER_TEXTURED        = 1 << 0,   // TEXTURED : samples the material's texture array
+	SHADER_VIRTUAL_TEXTURE = 1 << 1    // VIRTUAL_TEXTURE : samples the virtual texture
+};
+
+// The variants of one vertex / fragment pair. Instead of branching on uniforms,
+// the shaders test #ifdefs, and every combination of features the scene uses
+// is a program of its own (compiled asynchronously, and cached on disk like
+// any other, see LoadShadersAsync). NUM_LIGHTS is defined too (unless 0), so
+// that the light loops have a constant bound.
+class ShaderPermutations {
+public:
+	ShaderPermutations(const char * vertexPath, const char * fragmentPath, int numLights = 0);
+
+	// Starts compiling a variant, unless it was requested already
+	void request(unsigned int features);
+
+	// The variant's program, waiting for it (or compiling it) if needed
+	GLuint get(unsigned int features);
+
+	// Every variant requested so far, for the uniforms they all share
+	std::vector<GLuint> getPrograms();
+
+	static std::string makeDefines(unsigned int features, int numLights);
+
+	// Hot reload : reload() compiles every variant again from the files, in the
+	// background ; update(), once a frame, swaps in the variants that are done.
+	// A variant that fails to compile or link keeps its previous program, so a
+	// typo in the editor never blanks the scene. Reloading while a reload is
+	// pending starts again once it is done.
+	// update() returns true when programs changed : their uniforms must be set
+	// and their locations looked up again.
+	void reload();
+	bool update();
+	bool isReloading() const { return !reloading.empty(); }
+
+	bool uses(const std::string & path) const { return path == vertexPath || path == fragmentPath; }
+	const std::string & getVertexPath() const { return vertexPath; }
+	const std::string & getFragmentPath() const { return fragmentPath; }
+
+private:
+	std::string vertexPath, fragmentPath;
+	int numLights;
+	std::map<unsigned int, unsigned int> handles;     // features -> LoadShadersAsync handle
+	std::map<unsigned int, unsigned int> reloading;   // features -> handle of the new version
+	bool reloadAgain;
+};
+
+#endif
@@ -13,6 +13,7 @@ using namespace glm;
 #include "text2D.hpp"
 
 unsigned int Text2DTextureID;
+unsigned int Text2DVertexArrayID;
 unsigned int Text2DVertexBufferID;
 unsigned int Text2DUVBufferID;
 unsigned int Text2DShaderID;
@@ -23,6 +24,9 @@ void initText2D(const char * texturePath){
 	// Initialize texture
 	Text2DTextureID = loadDDS(texturePath);
 
+	// A VAO of its own : the caller's keeps its attributes
+	glGenVertexArrays(1, &Text2DVertexArrayID);
+
 	// Initialize VBO
 	glGenBuffers(1, &Text2DVertexBufferID);
 	glGenBuffers(1, &Text2DUVBufferID);
@@ -78,6 +82,10 @@ void printText2D(const char * text, int x, int y, int size){
 	glBindBuffer(GL_ARRAY_BUFFER, Text2DUVBufferID);
 	glBufferData(GL_ARRAY_BUFFER, UVs.size() * sizeof(glm::vec2), &UVs[0], GL_STATIC_DRAW);
 
+	GLint previousVertexArray = 0;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVertexArray);
+	glBindVertexArray(Text2DVertexArrayID);
+
 	// Bind shader
 	glUseProgram(Text2DShaderID);
 
@@ -108,6 +116,7 @@ void printText2D(const char * text, int x, int y, int size){
 	glDisableVertexAttribArray(0);
 	glDisableVertexAttribArray(1);
 
+	glBindVertexArray(previousVertexArray);
 }
 
 void cleanupText2D(){
@@ -119,6 +128,8 @@ void cleanupText2D(){
 	// Delete texture
 	glDeleteTextures(1, &Text2DTextureID);
 
+	glDeleteVertexArrays(1, &Text2DVertexArrayID);
+
 	// Delete shader
 	glDeleteProgram(Text2DShaderID);
 }
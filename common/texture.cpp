@@ -2,49 +2,61 @@
 #include <stdlib.h>
 #include <string.h>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include <GL/glew.h>
 
 #include <GLFW/glfw3.h>
 #include "texture.hpp"
+#include "mipmap.hpp"
+
+bool readFile(const char * path, std::vector<unsigned char> & out){
+	FILE * file = fopen(path, "rb");
+	if (!file)
+		return false;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (size < 0){
+		fclose(file);
+		return false;
+	}
+	out.resize((size_t)size);
+	size_t read = size > 0 ? fread(&out[0], 1, (size_t)size, file) : 0;
+	fclose(file);
+	return read == (size_t)size;
+}
 
-GLuint loadBMP_custom(const char * imagepath){
-
-	printf("Reading image %s\n", imagepath);
+// Everything but the pixels, which start at dataPos
+static bool parseBMP(const unsigned char * file, size_t size, TextureImage & out, unsigned int & dataPos, unsigned int & imageSize){
 
 	// Data read from the header of the BMP file
-	unsigned char header[54];
-	unsigned int dataPos;
-	unsigned int imageSize;
+	const unsigned char * header = file;
 	unsigned int width, height;
-	// Actual RGB data
-	unsigned char * data;
-
-	// Open the file
-	FILE * file = fopen(imagepath,"rb");
-	if (!file){
-		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
-		getchar();
-		return 0;
-	}
-
-	// Read the header, i.e. the 54 first bytes
 
-	// If less than 54 bytes are read, problem
-	if ( fread(header, 1, 54, file)!=54 ){ 
+	// If less than 54 bytes are available, problem
+	if ( size < 54 ){ 
 		printf("Not a correct BMP file\n");
-		fclose(file);
-		return 0;
+		return false;
 	}
 	// A BMP files always begins with "BM"
 	if ( header[0]!='B' || header[1]!='M' ){
 		printf("Not a correct BMP file\n");
-		fclose(file);
-		return 0;
+		return false;
 	}
 	// Make sure this is a 24bpp file
-	if ( *(int*)&(header[0x1E])!=0  )         {printf("Not a correct BMP file\n");    fclose(file); return 0;}
-	if ( *(int*)&(header[0x1C])!=24 )         {printf("Not a correct BMP file\n");    fclose(file); return 0;}
+	if ( *(int*)&(header[0x1E])!=0  )         {printf("Not a correct BMP file\n");    return false;}
+	if ( *(int*)&(header[0x1C])!=24 )         {printf("Not a correct BMP file\n");    return false;}
 
 	// Read the information about the image
 	dataPos    = *(int*)&(header[0x0A]);
@@ -52,31 +64,110 @@ GLuint loadBMP_custom(const char * imagepath){
 	width      = *(int*)&(header[0x12]);
 	height     = *(int*)&(header[0x16]);
 
+	if ( width==0 || height==0 || width>MAX_TEXTURE_DIMENSION || height>MAX_TEXTURE_DIMENSION ){
+		printf("BMP files must be 1 to %d texels wide and tall\n", MAX_TEXTURE_DIMENSION);
+		return false;
+	}
+
 	// Some BMP files are misformatted, guess missing information
-	if (imageSize==0)    imageSize=width*height*3; // 3 : one byte for each Red, Green and Blue component
+	if (imageSize==0)    imageSize=((width*3+3)&~3u)*height; // 3 : one byte for each Red, Green and Blue component, rows are 4 bytes aligned
 	if (dataPos==0)      dataPos=54; // The BMP header is done that way
 
-	// Create a buffer
-	data = new unsigned char [imageSize];
+	if ( (size_t)dataPos + imageSize > size ){
+		printf("Not a correct BMP file\n");
+		return false;
+	}
+
+	out.width       = width;
+	out.height      = height;
+	out.format      = GL_BGR;
+	out.compressed  = false;
+	out.mipMapCount = 1;
+	return true;
+}
 
-	// Read the actual data from the file into the buffer
-	fread(data,1,imageSize,file);
+bool decodeBMP(const unsigned char * file, size_t size, TextureImage & out){
+	unsigned int dataPos, imageSize;
+	if (!parseBMP(file, size, out, dataPos, imageSize))
+		return false;
+	out.data.assign(file + dataPos, file + dataPos + imageSize);
+	return true;
+}
 
-	// Everything is in memory now, the file can be closed.
-	fclose (file);
+GLuint createTexture(const TextureImage & image){
 
 	// Create one OpenGL texture
 	GLuint textureID;
 	glGenTextures(1, &textureID);
+
+	if (!uploadTexture(textureID, image, &image.data[0])){
+		glDeleteTextures(1, &textureID);
+		return 0;
+	}
+
+	// Return the ID of the texture we just created
+	return textureID;
+}
+
+bool isTextureFormatSupported(GLenum format){
+	bool bptc = format == GL_COMPRESSED_RGBA_BPTC_UNORM || format == GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+	         || format == GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT || format == GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT;
+	return !bptc || GLEW_ARB_texture_compression_bptc;
+}
+
+bool uploadTexture(GLuint textureID, const TextureImage & image, const unsigned char * pixels){
+
+	if (image.compressed && !isTextureFormatSupported(image.format)){
+		printf("BC6H / BC7 textures need GL_ARB_texture_compression_bptc\n");
+		return false;
+	}
 	
-	// "Bind" the newly created texture : all future texture functions will modify this texture
+	// "Bind" the texture : all future texture functions will modify this texture
 	glBindTexture(GL_TEXTURE_2D, textureID);
 
-	// Give the image to OpenGL
-	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, data);
+	if (image.compressed){
+		glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+
+		size_t offset = 0;
+		unsigned int width = image.width, height = image.height;
+
+		/* load the mipmaps */ 
+		for (unsigned int level = 0; level < image.mipMapCount; ++level) 
+		{ 
+			size_t size = compressedLevelSize(image.format, width, height); 
+			glCompressedTexImage2D(GL_TEXTURE_2D, level, image.format, width, height,  
+				0, (GLsizei)size, pixels + offset); 
+		 
+			offset += size; 
+			width  /= 2; 
+			height /= 2; 
+
+			// Deal with Non-Power-Of-Two textures. This code is not included in the webpage to reduce clutter.
+			if(width < 1) width = 1;
+			if(height < 1) height = 1;
+		} 
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.mipMapCount - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, image.mipMapCount > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		return true;
+	}
 
-	// OpenGL has now copied the data. Free our own version
-	delete [] data;
+	// Give the image to OpenGL. BMP rows are 4 bytes aligned.
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, image.width, image.height, 0, image.format, GL_UNSIGNED_BYTE, pixels);
+
+	// The other levels come from the CPU, averaged in linear space (the BMPs
+	// are sRGB) : glGenerateMipmap is a plain box filter, on the render thread
+	// with software drivers.
+	std::vector< std::vector<unsigned char> > levels;
+	generateMipmaps(pixels, image.width, image.height, 3, 4, true, 0, 0, levels);
+	for (size_t level = 0; level < levels.size(); level++){
+		GLsizei width  = std::max(1u, image.width  >> (level + 1));
+		GLsizei height = std::max(1u, image.height >> (level + 1));
+		glTexImage2D(GL_TEXTURE_2D, (GLint)level + 1, GL_RGB, width, height, 0, image.format, GL_UNSIGNED_BYTE, &levels[level][0]);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size());
 
 	// Poor filtering, or ...
 	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -87,11 +178,28 @@ GLuint loadBMP_custom(const char * imagepath){
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	// ... which requires mipmaps. Generate them automatically.
-	glGenerateMipmap(GL_TEXTURE_2D);
+	// ... which requires the mipmaps above.
+	return true;
+}
 
-	// Return the ID of the texture we just created
-	std::cout << "Loaded texture: " << imagepath << " (width: " << width << ", height: " << height << ")\n";
+GLuint loadBMP_custom(const char * imagepath){
+
+	printf("Reading image %s\n", imagepath);
+
+	// Open the file and read it in memory
+	std::vector<unsigned char> file;
+	if (!readFile(imagepath, file)){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
+		getchar();
+		return 0;
+	}
+
+	TextureImage image;
+	if (!decodeBMP(file.empty() ? NULL : &file[0], file.size(), image))
+		return 0;
+
+	GLuint textureID = createTexture(image);
+	std::cout << "Loaded texture: " << imagepath << " (width: " << image.width << ", height: " << image.height << ")\n";
 	return textureID;
 }
 
@@ -125,49 +233,75 @@ GLuint loadBMP_custom(const char * imagepath){
 #define FOURCC_DXT1 0x31545844 // Equivalent to "DXT1" in ASCII
 #define FOURCC_DXT3 0x33545844 // Equivalent to "DXT3" in ASCII
 #define FOURCC_DXT5 0x35545844 // Equivalent to "DXT5" in ASCII
+#define FOURCC_ATI1 0x31495441 // "ATI1", BC4
+#define FOURCC_BC4U 0x55344342 // "BC4U"
+#define FOURCC_ATI2 0x32495441 // "ATI2", BC5
+#define FOURCC_BC5U 0x55354342 // "BC5U"
+#define FOURCC_DX10 0x30315844 // "DX10" : a DDS_HEADER_DXT10 follows the header
 
-GLuint loadDDS(const char * imagepath){
+static unsigned int textureMipSkip = 0;
 
-	unsigned char header[124];
+void setTextureMipSkip(unsigned int levels){
+	textureMipSkip = levels;
+}
 
-	FILE *fp; 
- 
-	/* try to open the file */ 
-	fp = fopen(imagepath, "rb"); 
-	if (fp == NULL){
-		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath); getchar(); 
-		return 0;
+unsigned int getTextureMipSkip(){
+	return textureMipSkip;
+}
+
+unsigned int compressedBlockSize(GLenum format){
+	switch (format){
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RED_RGTC1:
+	case GL_COMPRESSED_SIGNED_RED_RGTC1:
+		return 8;
+	default:
+		return 16;
 	}
-   
-	/* verify the type of file */ 
-	char filecode[4]; 
-	fread(filecode, 1, 4, fp); 
-	if (strncmp(filecode, "DDS ", 4) != 0) { 
-		fclose(fp); 
-		return 0; 
+}
+
+size_t compressedLevelSize(GLenum format, unsigned int width, unsigned int height){
+	return (((size_t)width + 3) / 4) * (((size_t)height + 3) / 4) * compressedBlockSize(format);
+}
+
+// DXGI_FORMAT values of the block compressed formats
+static GLenum formatFromDXGI(unsigned int dxgiFormat){
+	switch (dxgiFormat){
+	case 71: return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;         // BC1_UNORM
+	case 72: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT;   // BC1_UNORM_SRGB
+	case 74: return GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;         // BC2_UNORM
+	case 75: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT;   // BC2_UNORM_SRGB
+	case 77: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;         // BC3_UNORM
+	case 78: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;   // BC3_UNORM_SRGB
+	case 80: return GL_COMPRESSED_RED_RGTC1;                  // BC4_UNORM
+	case 81: return GL_COMPRESSED_SIGNED_RED_RGTC1;           // BC4_SNORM
+	case 83: return GL_COMPRESSED_RG_RGTC2;                   // BC5_UNORM
+	case 84: return GL_COMPRESSED_SIGNED_RG_RGTC2;            // BC5_SNORM
+	case 95: return GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT;    // BC6H_UF16
+	case 96: return GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT;      // BC6H_SF16
+	case 98: return GL_COMPRESSED_RGBA_BPTC_UNORM;            // BC7_UNORM
+	case 99: return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;      // BC7_UNORM_SRGB
+	default: return 0;
 	}
+}
+
+bool parseDDS(const unsigned char * file, size_t size, unsigned int skipLevels, DDSView & out){
+
+	/* verify the type of file */ 
+	if (size < 128 || strncmp((const char*)file, "DDS ", 4) != 0)
+		return false; 
 	
 	/* get the surface desc */ 
-	fread(&header, 124, 1, fp); 
+	const unsigned char * header = file + 4;
 
 	unsigned int height      = *(unsigned int*)&(header[8 ]);
 	unsigned int width	     = *(unsigned int*)&(header[12]);
-	unsigned int linearSize	 = *(unsigned int*)&(header[16]);
 	unsigned int mipMapCount = *(unsigned int*)&(header[24]);
 	unsigned int fourCC      = *(unsigned int*)&(header[80]);
+	size_t dataOffset = 128;
 
- 
-	unsigned char * buffer;
-	unsigned int bufsize;
-	/* how big is it going to be including all mipmaps? */ 
-	bufsize = mipMapCount > 1 ? linearSize * 2 : linearSize; 
-	buffer = (unsigned char*)malloc(bufsize * sizeof(unsigned char)); 
-	fread(buffer, 1, bufsize, fp); 
-	/* close the file pointer */ 
-	fclose(fp);
-
-	unsigned int components  = (fourCC == FOURCC_DXT1) ? 3 : 4; 
-	unsigned int format;
+	GLenum format;
 	switch(fourCC) 
 	{ 
 	case FOURCC_DXT1: 
@@ -179,40 +313,192 @@ GLuint loadDDS(const char * imagepath){
 	case FOURCC_DXT5: 
 		format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; 
 		break; 
+	case FOURCC_ATI1:
+	case FOURCC_BC4U:
+		format = GL_COMPRESSED_RED_RGTC1;
+		break;
+	case FOURCC_ATI2:
+	case FOURCC_BC5U:
+		format = GL_COMPRESSED_RG_RGTC2;
+		break;
+	case FOURCC_DX10:
+		// dxgiFormat, resourceDimension (3 is 2D), miscFlag, arraySize, miscFlags2
+		if (size < 148)
+			return false;
+		format = formatFromDXGI(*(unsigned int*)&(file[128]));
+		if (*(unsigned int*)&(file[132]) != 3 || *(unsigned int*)&(file[140]) > 1){
+			printf("Only single 2D textures are supported in DDS files\n");
+			return false;
+		}
+		dataOffset = 148;
+		break;
 	default: 
-		free(buffer); 
-		return 0; 
+		format = 0;
+	}
+	if (format == 0){
+		printf("Unsupported DDS format\n");
+		return false;
+	}
+	if (mipMapCount == 0)
+		mipMapCount = 1;
+	if (width == 0 || height == 0 || width > MAX_TEXTURE_DIMENSION || height > MAX_TEXTURE_DIMENSION){
+		printf("DDS files must be 1 to %d texels wide and tall\n", MAX_TEXTURE_DIMENSION);
+		return false;
 	}
 
-	// Create one OpenGL texture
-	GLuint textureID;
-	glGenTextures(1, &textureID);
+	/* Sum the real level sizes, linearSize*2 is wrong for non square chains.
+	   The skipped levels are only stepped over : a mapped file never reads them. */ 
+	unsigned int skip = std::min(skipLevels, mipMapCount - 1);
+	size_t skippedBytes = 0, bufsize = 0;
+	unsigned int levels = 0;
+	unsigned int w = width, h = height;
+	for (unsigned int level = 0; level < mipMapCount; ++level){
+		size_t levelSize = compressedLevelSize(format, w, h);
+		if (level < skip){
+			skippedBytes += levelSize;
+		}else{
+			if (levels == 0){
+				out.width  = w;
+				out.height = h;
+			}
+			bufsize += levelSize;
+			++levels;
+		}
+		if (w == 1 && h == 1)
+			break;
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+	if (dataOffset + skippedBytes + bufsize > size)
+		return false;
+
+	out.format      = format;
+	out.mipMapCount = levels;
+	out.data        = file + dataOffset + skippedBytes;
+	out.size        = bufsize;
+	return true;
+}
 
-	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glPixelStorei(GL_UNPACK_ALIGNMENT,1);	
-	
-	unsigned int blockSize = (format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16; 
-	unsigned int offset = 0;
+bool decodeDDS(const unsigned char * file, size_t size, TextureImage & out){
+	DDSView view;
+	if (!parseDDS(file, size, textureMipSkip, view))
+		return false;
+
+	out.width       = view.width;
+	out.height      = view.height;
+	out.format      = view.format;
+	out.compressed  = true;
+	out.mipMapCount = view.mipMapCount;
+	out.data.assign(view.data, view.data + view.size);
+	return true;
+}
 
-	/* load the mipmaps */ 
-	for (unsigned int level = 0; level < mipMapCount && (width || height); ++level) 
-	{ 
-		unsigned int size = ((width+3)/4)*((height+3)/4)*blockSize; 
-		glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height,  
-			0, size, buffer + offset); 
-	 
-		offset += size; 
-		width  /= 2; 
-		height /= 2; 
+bool readTextureInfo(const char * path, TextureImage & out){
+	MappedFile file;
+	if (!mapFile(path, file))
+		return false;
+	size_t len = strlen(path);
+	bool ok;
+	if (len >= 4 && strcmp(path + len - 4, ".dds") == 0){
+		DDSView view;
+		ok = parseDDS(file.data, file.size, textureMipSkip, view);
+		if (ok){
+			out.width       = view.width;
+			out.height      = view.height;
+			out.format      = view.format;
+			out.compressed  = true;
+			out.mipMapCount = view.mipMapCount;
+		}
+	}else{
+		unsigned int dataPos, imageSize;
+		ok = parseBMP(file.data, file.size, out, dataPos, imageSize);
+	}
+	out.data.clear();
+	unmapFile(file);
+	return ok;
+}
 
-		// Deal with Non-Power-Of-Two textures. This code is not included in the webpage to reduce clutter.
-		if(width < 1) width = 1;
-		if(height < 1) height = 1;
+bool mapFile(const char * path, MappedFile & out){
+	out.data = NULL;
+	out.size = 0;
+#ifdef _WIN32
+	out.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (out.file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	GetFileSizeEx(out.file, &size);
+	out.size = (size_t)size.QuadPart;
+	out.mapping = out.size ? CreateFileMappingA(out.file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+	if (out.mapping)
+		out.data = (const unsigned char *)MapViewOfFile(out.mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!out.data){
+		if (out.mapping) CloseHandle(out.mapping);
+		CloseHandle(out.file);
+		return false;
+	}
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0){
+		close(fd);
+		return false;
+	}
+	void * data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // the mapping keeps the file
+	if (data == MAP_FAILED)
+		return false;
+	out.data = (const unsigned char *)data;
+	out.size = (size_t)st.st_size;
+#endif
+	return true;
+}
 
-	} 
+void unmapFile(MappedFile & file){
+	if (!file.data)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(file.data);
+	CloseHandle(file.mapping);
+	CloseHandle(file.file);
+#else
+	munmap((void *)file.data, file.size);
+#endif
+	file.data = NULL;
+	file.size = 0;
+}
 
-	free(buffer); 
+GLuint loadDDS(const char * imagepath){
+
+	// The levels go to the driver straight from the mapping : no copy of
+	// ours, and the skipped levels are never even paged in.
+	MappedFile file;
+	if (!mapFile(imagepath, file)){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath); getchar(); 
+		return 0;
+	}
+
+	DDSView view;
+	if (!parseDDS(file.data, file.size, textureMipSkip, view)){
+		unmapFile(file);
+		return 0;
+	}
+	TextureImage image;
+	image.width       = view.width;
+	image.height      = view.height;
+	image.format      = view.format;
+	image.compressed  = true;
+	image.mipMapCount = view.mipMapCount;
+
+	GLuint textureID;
+	glGenTextures(1, &textureID);
+	if (!uploadTexture(textureID, image, view.data)){
+		printf("Could not load %s\n", imagepath);
+		glDeleteTextures(1, &textureID);
+		textureID = 0;
+	}
+	unmapFile(file);
 
 	return textureID;
 }
@@ -1,6 +1,78 @@
 #ifndef TEXTURE_HPP
 #define TEXTURE_HPP
 
+// A decoded image, in the layout glTexImage2D / glCompressedTexImage2D want
+struct TextureImage {
+	unsigned int width, height;
+	GLenum format;                   // GL_BGR for BMPs, GL_COMPRESSED_* for DDS
+	bool compressed;
+	unsigned int mipMapCount;        // levels in data ; 1 means "make them when uploading"
+	std::vector<unsigned char> data; // all the levels, back to back
+};
+
+// Read a whole file in memory
+bool readFile(const char * path, std::vector<unsigned char> & out);
+
+// A read only memory mapping of a whole file
+struct MappedFile {
+	const unsigned char * data;
+	size_t size;
+#ifdef _WIN32
+	void * file;
+	void * mapping;
+#endif
+};
+bool mapFile(const char * path, MappedFile & out);
+void unmapFile(MappedFile & file);
+
+// Low memory mode : DDS files drop their first levels levels (1 is half the
+// width and height), as long as one level is left. BMPs are not affected.
+void setTextureMipSkip(unsigned int levels);
+unsigned int getTextureMipSkip();
+
+// The levels of a DDS file, pointing into the file itself : nothing is copied.
+// Handles DXT1/3/5, BC4/BC5 (ATI1/ATI2) and DX10 headers with BC1 to BC7.
+struct DDSView {
+	unsigned int width, height;      // of the first kept level
+	GLenum format;
+	unsigned int mipMapCount;        // kept levels
+	const unsigned char * data;
+	size_t size;
+};
+bool parseDDS(const unsigned char * file, size_t size, unsigned int skipLevels, DDSView & out);
+
+// 8 bytes per 4x4 block for BC1 and BC4, 16 for the others
+unsigned int compressedBlockSize(GLenum format);
+// One level, counted in size_t : a 32 bit product wraps for big images
+size_t compressedLevelSize(GLenum format, unsigned int width, unsigned int height);
+
+// Files wider or taller than this are rejected before any size is computed
+// from their header : it is the GL_MAX_TEXTURE_SIZE of most GL 3.3 drivers.
+#define MAX_TEXTURE_DIMENSION 16384
+
+// Decode a .BMP / .DDS file that is already in memory. No OpenGL involved.
+// decodeDDS copies the levels left by setTextureMipSkip().
+bool decodeBMP(const unsigned char * file, size_t size, TextureImage & out);
+bool decodeDDS(const unsigned char * file, size_t size, TextureImage & out);
+
+// False for BC6H / BC7 without GL_ARB_texture_compression_bptc. Every path
+// that hands compressed levels to GL checks it first.
+bool isTextureFormatSupported(GLenum format);
+
+// The size and format of a .dds (after setTextureMipSkip) or .bmp file, from
+// its header : out.data stays empty. Only the header pages are read.
+bool readTextureInfo(const char * path, TextureImage & out);
+
+// Create an OpenGL texture from a decoded image. Returns 0 if the format is
+// not supported.
+GLuint createTexture(const TextureImage & image);
+
+// (Re)specify an existing texture. pixels is image.data, a mapped DDS view, or
+// for compressed images an offset in the bound GL_PIXEL_UNPACK_BUFFER.
+// Uncompressed images get their mipmaps from generateMipmaps().
+// Returns false, uploading nothing, if the format is not supported.
+bool uploadTexture(GLuint textureID, const TextureImage & image, const unsigned char * pixels);
+
 // Load a .BMP file using our custom loader
 GLuint loadBMP_custom(const char * imagepath);
 
@@ -9,7 +81,7 @@ GLuint loadBMP_custom(const char * imagepath);
 //// Load a .TGA file using GLFW's own loader
 //GLuint loadTGA_glfw(const char * imagepath);
 
-// Load a .DDS file using GLFW's own loader
+// Load a .DDS file, uploading the levels from a mapping of the file
 GLuint loadDDS(const char * imagepath);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,475 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "texture.hpp"
+#include "threadpool.hpp"
+#include "mipmap.hpp"
+#include "texturestreamer.hpp"
+#include "texturecache.hpp"
+#include "texturearray.hpp"
+
+// The levels every layer of an array (or every rectangle of the atlas) has :
+// the base level only goes down to a level once all of them are in
+struct ArrayProgress {
+	GLuint array;
+	int baseLevel;
+	std::vector<unsigned int> layersLeft; // per level
+};
+
+// One file, read on the shared pool, and where its levels go
+struct MaterialTextureJob {
+	std::string path;
+	TextureImage info;                // from the header : what the destination was made for
+	std::shared_ptr<ArrayProgress> progress;
+	GLint layer;
+	bool atlas;
+	unsigned int x, y;                // atlas : the padded rectangle
+	unsigned int width, height;       // of the destination, padding included
+	unsigned int padding;
+	int maxLevel;
+
+	MappedFile file;                  // compressed : the levels stay in the mapping
+	const unsigned char * pixels;     // compressed : every level, back to back
+	std::vector<unsigned char> grey;  // compressed : the placeholder, if the file can't be read
+	std::vector< std::vector<unsigned char> > levels; // uncompressed : rows 4 bytes aligned
+	bool missing;                     // the header couldn't be read : not even tried again
+	bool ok;
+	std::atomic<bool> done, cancelled;
+
+	MaterialTextureJob() : layer(0), atlas(false), x(0), y(0), width(0), height(0), padding(0), maxLevel(0),
+		pixels(NULL), missing(false), ok(false), done(false), cancelled(false) { file.data = NULL; file.size = 0; }
+	~MaterialTextureJob() { unmapFile(file); }
+};
+
+// A 4x4 block of mid grey ; zeros for BC6H / BC7, which are not worth encoding by hand
+static void greyBlock(GLenum format, unsigned char block[16]){
+	const unsigned char bc1[8] = { 0x10, 0x84, 0x10, 0x84, 0, 0, 0, 0 }; // 565 grey as both colours
+	const unsigned char bc4[8] = { 128, 128, 0, 0, 0, 0, 0, 0 };
+	memset(block, 0, 16);
+	switch (format){
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+		memcpy(block, bc1, 8);
+		break;
+	case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+		memset(block, 0xFF, 8);
+		memcpy(block + 8, bc1, 8);
+		break;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+		block[0] = block[1] = 0xFF;
+		memcpy(block + 8, bc1, 8);
+		break;
+	case GL_COMPRESSED_RED_RGTC1:
+		memcpy(block, bc4, 8);
+		break;
+	case GL_COMPRESSED_RG_RGTC2:
+		memcpy(block, bc4, 8);
+		memcpy(block + 8, bc4, 8);
+		break;
+	}
+}
+
+static void fillGreyBlocks(GLenum format, std::vector<unsigned char> & data){
+	unsigned char block[16];
+	greyBlock(format, block);
+	unsigned int blockSize = compressedBlockSize(format);
+	for (size_t i = 0; i + blockSize <= data.size(); i += blockSize)
+		memcpy(&data[i], block, blockSize);
+}
+
+static bool decodeCompressed(MaterialTextureJob & job){
+	if (!mapFile(job.path.c_str(), job.file))
+		return false;
+	DDSView view;
+	if (!parseDDS(job.file.data, job.file.size, getTextureMipSkip(), view))
+		return false;
+	// Changed since the header was read : it doesn't fit its layer any more
+	if (view.width != job.info.width || view.height != job.info.height || view.format != job.info.format ||
+		view.mipMapCount != job.info.mipMapCount)
+		return false;
+	job.pixels = view.data;
+	return true;
+}
+
+static bool decodeUncompressed(MaterialTextureJob & job){
+	MappedFile file;
+	TextureImage image;
+	bool ok = mapFile(job.path.c_str(), file) && decodeBMP(file.data, file.size, image);
+	unmapFile(file);
+	if (!ok || image.width != job.info.width || image.height != job.info.height)
+		return false;
+
+	job.levels.resize(1);
+	if (!job.atlas){
+		job.levels[0].swap(image.data);
+	}else{
+		// The border repeats the opposite edge, like GL_REPEAT
+		size_t srcRow = ((size_t)image.width * 3 + 3) & ~(size_t)3;
+		size_t dstRow = ((size_t)job.width * 3 + 3) & ~(size_t)3;
+		std::vector<unsigned char> & rect = job.levels[0];
+		rect.assign(dstRow * job.height, 0);
+		int w = (int)image.width, h = (int)image.height, pad = (int)job.padding;
+		for (int y = 0; y < (int)job.height; y++)
+			for (int x = 0; x < (int)job.width; x++){
+				int sx = (((x - pad) % w) + w) % w, sy = (((y - pad) % h) + h) % h;
+				memcpy(&rect[y * dstRow + x * 3], &image.data[sy * srcRow + sx * 3], 3);
+			}
+	}
+	if (job.maxLevel > 0){
+		std::vector< std::vector<unsigned char> > mips;
+		generateMipmaps(&job.levels[0][0], job.width, job.height, 3, 4, true, 0, job.maxLevel, mips);
+		for (size_t i = 0; i < mips.size(); i++)
+			job.levels.push_back(std::vector<unsigned char>());
+		for (size_t i = 0; i < mips.size(); i++)
+			job.levels[i + 1].swap(mips[i]);
+	}
+	return true;
+}
+
+// Like the asynchronous loader, a file that can't be read shows as grey
+static void fillGrey(MaterialTextureJob & job){
+	if (job.info.compressed){
+		size_t size = 0;
+		for (int level = 0; level <= job.maxLevel; level++)
+			size += compressedLevelSize(job.info.format, std::max(1u, job.width >> level), std::max(1u, job.height >> level));
+		job.grey.resize(size);
+		fillGreyBlocks(job.info.format, job.grey);
+		job.pixels = &job.grey[0];
+		return;
+	}
+	job.levels.resize(job.maxLevel + 1);
+	for (int level = 0; level <= job.maxLevel; level++){
+		size_t rowBytes = ((size_t)std::max(1u, job.width >> level) * 3 + 3) & ~(size_t)3;
+		job.levels[level].assign(rowBytes * std::max(1u, job.height >> level), 128);
+	}
+}
+
+// On the shared pool : the file, and the mipmaps of BMPs
+static void decodeJob(std::shared_ptr<MaterialTextureJob> job){
+	if (!job->cancelled){
+		job->ok = !job->missing && (job->info.compressed ? decodeCompressed(*job) : decodeUncompressed(*job));
+		if (!job->ok)
+			fillGrey(*job);
+	}
+	job->done = true;
+}
+
+static void levelUploaded(std::shared_ptr<ArrayProgress> progress, int level){
+	progress->layersLeft[level]--;
+	int base = progress->baseLevel;
+	while (base > 0 && progress->layersLeft[base - 1] == 0)
+		base--;
+	if (base == progress->baseLevel)
+		return;
+	progress->baseLevel = base;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, progress->array);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, base);
+}
+
+// Smallest level first, each level straight from the job
+static void enqueueLevels(TextureStreamer & streamer, const std::shared_ptr<MaterialTextureJob> & job){
+	std::vector<size_t> offsets(job->maxLevel + 1, 0);
+	if (job->info.compressed)
+		for (int level = 1; level <= job->maxLevel; level++)
+			offsets[level] = offsets[level - 1] + compressedLevelSize(job->info.format,
+				std::max(1u, job->width >> (level - 1)), std::max(1u, job->height >> (level - 1)));
+
+	for (int level = job->maxLevel; level >= 0; level--){
+		unsigned int w = std::max(1u, job->width >> level), h = std::max(1u, job->height >> level);
+		const unsigned char * pixels;
+		size_t size;
+		if (job->info.compressed){
+			pixels = job->pixels + offsets[level];
+			size = compressedLevelSize(job->info.format, w, h);
+		}else{
+			pixels = &job->levels[level][0];
+			size = job->levels[level].size();
+		}
+		streamer.enqueueSubImage(job->progress->array, level, job->layer, job->x >> level, job->y >> level, w, h,
+			job->info.format, job->info.compressed, pixels, size, job, std::bind(levelUploaded, job->progress, level));
+	}
+}
+
+static void setArrayParameters(int maxLevel){
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, maxLevel > 0 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, maxLevel);
+}
+
+// Storage for every level of the layers, nothing uploaded yet but the
+// coarsest level, grey : only that one is sampled until the layers come in.
+static std::shared_ptr<ArrayProgress> createArray(GLenum format, bool compressed, unsigned int width, unsigned int height,
+	GLsizei layers, int maxLevel)
+{
+	std::shared_ptr<ArrayProgress> progress(new ArrayProgress());
+	glGenTextures(1, &progress->array);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, progress->array);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	for (int level = 0; level <= maxLevel; level++){
+		unsigned int w = std::max(1u, width >> level), h = std::max(1u, height >> level);
+		if (compressed)
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, format, w, h, layers, 0,
+				(GLsizei)(compressedLevelSize(format, w, h) * layers), NULL);
+		else
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGB8, w, h, layers, 0, format, GL_UNSIGNED_BYTE, NULL);
+	}
+
+	unsigned int w = std::max(1u, width >> maxLevel), h = std::max(1u, height >> maxLevel);
+	std::vector<unsigned char> grey;
+	if (compressed){
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		grey.resize(compressedLevelSize(format, w, h) * layers);
+		fillGreyBlocks(format, grey);
+		glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, maxLevel, 0, 0, 0, w, h, layers, format, (GLsizei)grey.size(), &grey[0]);
+	}else{
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		grey.assign((((size_t)w * 3 + 3) & ~(size_t)3) * h * layers, 128);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, maxLevel, 0, 0, 0, w, h, layers, format, GL_UNSIGNED_BYTE, &grey[0]);
+	}
+	setArrayParameters(maxLevel);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, maxLevel);
+
+	progress->baseLevel = maxLevel;
+	progress->layersLeft.assign(maxLevel + 1, (unsigned int)layers);
+	return progress;
+}
+
+// What its levels take in the array (or the atlas) ; drivers store RGB8 as RGBA8
+static size_t residentBytes(const MaterialTextureJob & job){
+	size_t bytes = 0;
+	for (int level = 0; level <= job.maxLevel; level++){
+		unsigned int w = std::max(1u, job.width >> level), h = std::max(1u, job.height >> level);
+		bytes += job.info.compressed ? compressedLevelSize(job.info.format, w, h) : (size_t)w * h * 4;
+	}
+	return bytes;
+}
+
+// Down to 1x1 for BMPs, whose mipmaps are made on the pool ; what the file has for DDS
+static int maxLevelOf(const TextureImage & info){
+	if (info.compressed)
+		return (int)info.mipMapCount - 1;
+	int maxLevel = 0;
+	while ((info.width >> (maxLevel + 1)) > 0 || (info.height >> (maxLevel + 1)) > 0)
+		maxLevel++;
+	return maxLevel;
+}
+
+// Shelf packing, tallest first. Rectangles are padded and rounded up to a
+// multiple of align, and so are their positions : the atlas mipmaps, down to
+// log2(align), are then exactly the mipmaps of each rectangle on its own.
+// Returns false if it doesn't fit in maxSize.
+static bool packAtlas(std::vector< std::shared_ptr<MaterialTextureJob> > & members, unsigned int padding, unsigned int align,
+	unsigned int maxSize, unsigned int & atlasWidth, unsigned int & atlasHeight)
+{
+	std::sort(members.begin(), members.end(), [](const std::shared_ptr<MaterialTextureJob> & a, const std::shared_ptr<MaterialTextureJob> & b){
+		return a->info.height > b->info.height;
+	});
+
+	size_t area = 0;
+	unsigned int widest = 0;
+	for (size_t i = 0; i < members.size(); i++){
+		MaterialTextureJob & job = *members[i];
+		job.padding = padding;
+		job.width  = (job.info.width  + 2 * padding + align - 1) / align * align;
+		job.height = (job.info.height + 2 * padding + align - 1) / align * align;
+		area += (size_t)job.width * job.height;
+		widest = std::max(widest, job.width);
+	}
+	atlasWidth = 1;
+	while ((size_t)atlasWidth * atlasWidth < area || atlasWidth < widest)
+		atlasWidth *= 2;
+
+	unsigned int x = 0, y = 0, shelfHeight = 0;
+	for (size_t i = 0; i < members.size(); i++){
+		MaterialTextureJob & job = *members[i];
+		if (x + job.width > atlasWidth){
+			y += shelfHeight;
+			x = 0;
+			shelfHeight = 0;
+		}
+		job.x = x;
+		job.y = y;
+		x += job.width;
+		shelfHeight = std::max(shelfHeight, job.height);
+	}
+	atlasHeight = y + shelfHeight;
+	return atlasWidth <= maxSize && atlasHeight <= maxSize;
+}
+
+bool packMaterialTextures(const std::vector<std::string> & paths, unsigned int padding, MaterialTextures & out){
+	out.arrays.clear();
+	out.textures.assign(paths.size(), PackedTexture());
+	out.jobs.clear();
+	out.cacheKeys.clear();
+
+	GLint maxSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+
+	// Every image once, by the cache's key (files that can't be read by their
+	// path). Only the headers are read here, the rest comes later.
+	std::vector< std::shared_ptr<MaterialTextureJob> > sources;
+	std::map<std::string, size_t> sourceOf;
+	std::vector<size_t> sourceOfPath(paths.size());
+	for (size_t i = 0; i < paths.size(); i++){
+		std::string key = acquireTextureFile(paths[i].c_str());
+		out.cacheKeys.push_back(key);
+		const std::string & source = key.empty() ? paths[i] : key;
+		std::map<std::string, size_t>::iterator it = sourceOf.find(source);
+		if (it == sourceOf.end()){
+			it = sourceOf.insert(std::make_pair(source, sources.size())).first;
+			std::shared_ptr<MaterialTextureJob> job(new MaterialTextureJob());
+			job->path = source;
+			TextureImage & info = job->info;
+			bool ok = readTextureInfo(source.c_str(), info);
+			if (ok && info.compressed && !isTextureFormatSupported(info.format)){
+				printf("%s : BC6H / BC7 textures need GL_ARB_texture_compression_bptc\n", source.c_str());
+				ok = false;
+			}
+			if (ok && (info.width > (unsigned int)maxSize || info.height > (unsigned int)maxSize)){
+				printf("%s : %ux%u is more than GL_MAX_TEXTURE_SIZE (%d)\n", source.c_str(), info.width, info.height, maxSize);
+				ok = false;
+			}
+			if (!ok){
+				printf("Could not load %s, using a grey placeholder\n", source.c_str());
+				job->missing = true;
+				info.width = info.height = 1;
+				info.format = GL_BGR;
+				info.compressed = false;
+				info.mipMapCount = 1;
+			}
+			job->width = info.width;
+			job->height = info.height;
+			job->maxLevel = maxLevelOf(info);
+			sources.push_back(job);
+		}
+		sourceOfPath[i] = it->second;
+	}
+
+	// Group by size and format
+	std::map< std::vector<unsigned int>, std::vector<size_t> > groups;
+	for (size_t i = 0; i < sources.size(); i++){
+		const TextureImage & info = sources[i]->info;
+		std::vector<unsigned int> key;
+		key.push_back(info.width);
+		key.push_back(info.height);
+		key.push_back(info.format);
+		key.push_back(info.mipMapCount);
+		groups[key].push_back(i);
+	}
+
+	std::vector<PackedTexture> packed(sources.size());
+	std::vector<size_t> atlasMembers;
+	std::vector<size_t> alone;
+	for (std::map< std::vector<unsigned int>, std::vector<size_t> >::iterator g = groups.begin(); g != groups.end(); ++g){
+		const std::vector<size_t> & members = g->second;
+		if (members.size() == 1 && !sources[members[0]]->info.compressed){
+			atlasMembers.push_back(members[0]);
+			continue;
+		}
+		const MaterialTextureJob & first = *sources[members[0]];
+		std::shared_ptr<ArrayProgress> progress = createArray(first.info.format, first.info.compressed,
+			first.width, first.height, (GLsizei)members.size(), first.maxLevel);
+		for (size_t i = 0; i < members.size(); i++){
+			PackedTexture p = { (unsigned int)out.arrays.size(), (unsigned int)i, glm::vec4(0, 0, 1, 1) };
+			packed[members[i]] = p;
+			sources[members[i]]->progress = progress;
+			sources[members[i]]->layer = (GLint)i;
+		}
+		out.arrays.push_back(progress->array);
+	}
+
+	// Past log2(padding), the mipmaps would mix neighbours : not even made
+	int atlasMaxLevel = 0;
+	while ((2u << atlasMaxLevel) <= padding)
+		atlasMaxLevel++;
+	std::vector< std::shared_ptr<MaterialTextureJob> > rects;
+	for (size_t i = 0; i < atlasMembers.size(); i++)
+		rects.push_back(sources[atlasMembers[i]]);
+	unsigned int atlasWidth = 0, atlasHeight = 0;
+	if (rects.size() > 1 && packAtlas(rects, padding, 1u << atlasMaxLevel, (unsigned int)maxSize, atlasWidth, atlasHeight)){
+		std::shared_ptr<ArrayProgress> progress = createArray(GL_BGR, false, atlasWidth, atlasHeight, 1, atlasMaxLevel);
+		progress->layersLeft.assign(atlasMaxLevel + 1, (unsigned int)rects.size());
+		for (size_t r = 0; r < rects.size(); r++){
+			MaterialTextureJob & job = *rects[r];
+			job.atlas = true;
+			job.maxLevel = atlasMaxLevel;
+			job.progress = progress;
+			PackedTexture p = { (unsigned int)out.arrays.size(), 0,
+				glm::vec4(float(job.x + padding) / atlasWidth, float(job.y + padding) / atlasHeight,
+				          float(job.info.width) / atlasWidth, float(job.info.height) / atlasHeight) };
+			packed[sourceOf[job.path]] = p;
+		}
+		out.arrays.push_back(progress->array);
+		printf("Texture atlas : %u textures in %ux%u\n", (unsigned int)rects.size(), atlasWidth, atlasHeight);
+	}else{
+		// Alone, or too big for an atlas : one array each
+		for (size_t i = 0; i < atlasMembers.size(); i++){
+			MaterialTextureJob & job = *sources[atlasMembers[i]];
+			job.x = job.y = job.padding = 0;
+			job.width = job.info.width;
+			job.height = job.info.height;
+			job.progress = createArray(job.info.format, false, job.width, job.height, 1, job.maxLevel);
+			PackedTexture p = { (unsigned int)out.arrays.size(), 0, glm::vec4(0, 0, 1, 1) };
+			packed[atlasMembers[i]] = p;
+			out.arrays.push_back(job.progress->array);
+		}
+	}
+
+	for (size_t i = 0; i < sources.size(); i++){
+		setTextureFileBytes(sources[i]->path, residentBytes(*sources[i]));
+		out.jobs.push_back(sources[i]);
+		getSharedThreadPool().enqueue(std::bind(decodeJob, sources[i]));
+	}
+	for (size_t i = 0; i < paths.size(); i++)
+		out.textures[i] = packed[sourceOfPath[i]];
+	printf("Packed %u textures in %u texture arrays, loading them in the background\n",
+		(unsigned int)sources.size(), (unsigned int)out.arrays.size());
+	return true;
+}
+
+unsigned int updateMaterialTextures(MaterialTextures & textures){
+	for (size_t i = 0; i < textures.jobs.size(); ){
+		std::shared_ptr<MaterialTextureJob> job = textures.jobs[i];
+		if (!job->done){
+			i++;
+			continue;
+		}
+		textures.jobs.erase(textures.jobs.begin() + i);
+		if (!job->ok && !job->missing)
+			printf("Could not load %s, using a grey placeholder\n", job->path.c_str());
+		enqueueLevels(getTextureStreamer(), job);
+	}
+	return (unsigned int)textures.jobs.size();
+}
+
+void deleteMaterialTextures(MaterialTextures & textures){
+	for (size_t i = 0; i < textures.jobs.size(); i++)
+		textures.jobs[i]->cancelled = true;
+	textures.jobs.clear();
+	for (size_t i = 0; i < textures.arrays.size(); i++)
+		getTextureStreamer().cancel(textures.arrays[i]);
+	if (!textures.arrays.empty())
+		glDeleteTextures((GLsizei)textures.arrays.size(), &textures.arrays[0]);
+	textures.arrays.clear();
+	textures.textures.clear();
+	for (size_t i = 0; i < textures.cacheKeys.size(); i++)
+		if (!textures.cacheKeys[i].empty())
+			releaseTextureFile(textures.cacheKeys[i]);
+	textures.cacheKeys.clear();
+}
@@ -0,0 +1,48 @@
+#ifndef TEXTUREARRAY_HPP
+#define TEXTUREARRAY_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+
+// Packs the textures of the materials in a few GL_TEXTURE_2D_ARRAYs, so that
+// every material of an array can be drawn without rebinding anything.
+// Shaders sample texture(array, vec3(uvRect.xy + fract(uv) * uvRect.zw, layer)).
+
+struct PackedTexture {
+	unsigned int array;   // index in MaterialTextures::arrays
+	unsigned int layer;
+	glm::vec4 uvRect;     // offset in xy, scale in zw ; (0, 0, 1, 1) for a whole layer
+};
+
+struct MaterialTextureJob;
+
+struct MaterialTextures {
+	std::vector<GLuint> arrays;          // GL_TEXTURE_2D_ARRAY, GL_REPEAT, mipmapped
+	std::vector<PackedTexture> textures; // one for each path given to packMaterialTextures
+	std::vector< std::shared_ptr<MaterialTextureJob> > jobs; // files still being read
+	std::vector<std::string> cacheKeys;  // from acquireTextureFile, released with the arrays
+};
+
+// Files are found through the texture cache : the same image under two paths
+// is stored once, and counts in its stats.
+// Images of the same size and format share an array, one layer each. BMPs of
+// an odd size go to an atlas (a one layer array) with `padding` texels of
+// wrapped border around each of them, so that bilinear filtering and the first
+// log2(padding) mipmaps don't bleed. Odd sized DDS files get an array to
+// themselves. Files that can't be loaded (or BC6H / BC7 without support for
+// them) become a 1x1 grey texture.
+// Only the headers are read here : the arrays are made with a grey coarsest
+// level, and the files are read on the shared thread pool (.dds levels from a
+// mapping of the file, BMPs through decodeBMP and generateMipmaps).
+bool packMaterialTextures(const std::vector<std::string> & paths, unsigned int padding, MaterialTextures & out);
+
+// Call once per frame on the GL thread, before the streamer's update : the
+// files read since the last call go to the texture streamer, smallest level
+// first, and each array sharpens once a level is in for all its layers.
+// Returns the number of files still being read.
+unsigned int updateMaterialTextures(MaterialTextures & textures);
+
+void deleteMaterialTextures(MaterialTextures & textures);
+
+#endif
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include <GL/glew.h>
+
+#include "texture.hpp"
+#include "texturestreamer.hpp"
+#include "texturecache.hpp"
+
+struct CachedFile {
+	unsigned long long contentHash;
+	unsigned int refCount;
+	size_t bytes;
+	std::vector<std::string> paths; // every canonical path that points to it, the key first
+};
+
+static std::map<std::string, std::string> pathToFile;
+static std::map<unsigned long long, std::string> hashToFile;
+static std::map<std::string, CachedFile> cachedFiles;
+static TextureCacheStats stats = { 0, 0, 0, 0, 0, 0.0 };
+
+static TextureStreamer * streamer = NULL;
+
+static std::string canonicalPath(const char * path){
+#ifdef _WIN32
+	char full[MAX_PATH];
+	if (_fullpath(full, path, MAX_PATH))
+		return full;
+#else
+	char * full = realpath(path, NULL);
+	if (full){
+		std::string result = full;
+		free(full);
+		return result;
+	}
+#endif
+	return path;
+}
+
+// 64 bit FNV-1a
+static unsigned long long hashBytes(const unsigned char * data, size_t size){
+	unsigned long long h = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; i++){
+		h ^= data[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+// A 64 bit hash can collide : before sharing an image, check that the file
+// it was loaded from has the same bytes, size first
+static bool sameContent(const unsigned char * data, size_t size, const std::string & loadedPath){
+	MappedFile loaded;
+	if (!mapFile(loadedPath.c_str(), loaded))
+		return false;
+	bool same = loaded.size == size && memcmp(loaded.data, data, size) == 0;
+	unmapFile(loaded);
+	return same;
+}
+
+std::string acquireTextureFile(const char * path){
+	std::string canonical = canonicalPath(path);
+
+	std::map<std::string, std::string>::iterator byPath = pathToFile.find(canonical);
+	if (byPath != pathToFile.end()){
+		cachedFiles[byPath->second].refCount++;
+		stats.hits++;
+		return byPath->second;
+	}
+
+	MappedFile file;
+	if (!mapFile(path, file)){
+		printf("%s could not be opened. Are you in the right directory ?\n", path);
+		return std::string();
+	}
+
+	unsigned long long hash = hashBytes(file.data, file.size);
+	std::map<unsigned long long, std::string>::iterator byHash = hashToFile.find(hash);
+	if (byHash != hashToFile.end() && !sameContent(file.data, file.size, byHash->second)){
+		printf("Texture %s has the hash of %s but not its content\n", path, byHash->second.c_str());
+		byHash = hashToFile.end();
+	}
+	unmapFile(file);
+	if (byHash != hashToFile.end()){
+		CachedFile & cached = cachedFiles[byHash->second];
+		cached.refCount++;
+		cached.paths.push_back(canonical);
+		pathToFile[canonical] = byHash->second;
+		stats.hits++;
+		printf("Texture %s has the same content as %s, sharing it\n", path, byHash->second.c_str());
+		return byHash->second;
+	}
+
+	CachedFile cached;
+	cached.contentHash = hash;
+	cached.refCount = 1;
+	cached.bytes = 0;
+	cached.paths.push_back(canonical);
+	cachedFiles[canonical] = cached;
+	pathToFile[canonical] = canonical;
+	if (hashToFile.find(hash) == hashToFile.end())
+		hashToFile[hash] = canonical;
+
+	stats.misses++;
+	stats.textures++;
+	return canonical;
+}
+
+void setTextureFileBytes(const std::string & key, size_t bytes){
+	std::map<std::string, CachedFile>::iterator it = cachedFiles.find(key);
+	if (it == cachedFiles.end())
+		return;
+	stats.bytesResident += bytes - it->second.bytes;
+	it->second.bytes = bytes;
+}
+
+void releaseTextureFile(const std::string & key){
+	std::map<std::string, CachedFile>::iterator it = cachedFiles.find(key);
+	if (it == cachedFiles.end())
+		return;
+	if (--it->second.refCount > 0)
+		return;
+
+	for (size_t i = 0; i < it->second.paths.size(); i++)
+		pathToFile.erase(it->second.paths[i]);
+	std::map<unsigned long long, std::string>::iterator byHash = hashToFile.find(it->second.contentHash);
+	if (byHash != hashToFile.end() && byHash->second == key)
+		hashToFile.erase(byHash);
+
+	stats.textures--;
+	stats.bytesResident -= it->second.bytes;
+	cachedFiles.erase(it);
+}
+
+TextureStreamer & getTextureStreamer(){
+	if (!streamer)
+		streamer = new TextureStreamer();
+	return *streamer;
+}
+
+unsigned int updateAsyncTextures(size_t byteBudget){
+	getTextureStreamer();
+	streamer->update(byteBudget);
+	stats.bytesQueued = streamer->getQueuedBytes();
+	stats.uploadStallTime = streamer->getTotalStallTime();
+	return streamer->getQueuedTextures();
+}
+
+void shutdownTextureCache(){
+	delete streamer;
+	streamer = NULL;
+}
+
+TextureCacheStats getTextureCacheStats(){
+	return stats;
+}
+
+void printTextureCacheStats(){
+	printf("Texture cache : %u hits, %u misses, %u textures, %.2f MB resident, %.2f MB queued, %.2f ms upload stalls\n",
+		stats.hits, stats.misses, stats.textures, stats.bytesResident / (1024.0 * 1024.0),
+		stats.bytesQueued / (1024.0 * 1024.0), stats.uploadStallTime);
+}
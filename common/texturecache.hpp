@@ -0,0 +1,47 @@
+#ifndef TEXTURECACHE_HPP
+#define TEXTURECACHE_HPP
+
+#include <string>
+
+// Reads every texture file only once. Files are found by canonical path first,
+// then by a hash of their content (checked byte for byte on a match), so the
+// same image under two names (or two relative paths) is loaded and stored
+// only once. Entries are reference counted : every acquireTextureFile() needs
+// a matching releaseTextureFile().
+
+struct TextureCacheStats {
+	unsigned int hits;          // acquires served by an image already loaded
+	unsigned int misses;        // acquires of a new image
+	unsigned int textures;      // images alive
+	size_t bytesResident;       // estimated video memory, mipmaps included
+	size_t bytesQueued;         // read, waiting for the texture streamer
+	double uploadStallTime;     // ms the streamer waited for its buffers, in total
+};
+
+// Returns the key of the file's image : the canonical path of the first file
+// it was acquired from, the same for every path with the same content. The
+// caller loads it once per key (see packMaterialTextures).
+// Returns an empty key if the file can't be read.
+std::string acquireTextureFile(const char * path);
+void releaseTextureFile(const std::string & key);
+
+// The video memory the loader gave the image, for the stats
+void setTextureFileBytes(const std::string & key, size_t bytes);
+
+// Call once per frame on the GL thread : the texture streamer uploads at most
+// byteBudget bytes of the levels queued in it (smallest levels first).
+// Returns how many textures are still being streamed.
+unsigned int updateAsyncTextures(size_t byteBudget);
+
+// The streamer updateAsyncTextures() pumps, for loaders to queue their levels
+// in (see packMaterialTextures). GL thread only.
+class TextureStreamer;
+TextureStreamer & getTextureStreamer();
+
+// Frees the streamer's buffers. Call before destroying the GL context.
+void shutdownTextureCache();
+
+TextureCacheStats getTextureCacheStats();
+void printTextureCacheStats();
+
+#endif
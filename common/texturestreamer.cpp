@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "texture.hpp"
+#include "texturestreamer.hpp"
+
+typedef std::chrono::high_resolution_clock StreamerClock;
+
+static double millisecondsSince(StreamerClock::time_point start){
+	return std::chrono::duration<double, std::milli>(StreamerClock::now() - start).count();
+}
+
+TextureStreamer::TextureStreamer(unsigned int numSlots, size_t size)
+	: nextSlot(0), slotSize(size), queuedBytes(0), uploadedBytes(0), stallTimeMs(0.0), totalStallTimeMs(0.0)
+{
+	buffers.resize(numSlots);
+	fences.assign(numSlots, (GLsync)0);
+	persistent.assign(numSlots, (unsigned char *)NULL);
+	glGenBuffers(numSlots, &buffers[0]);
+
+	for (unsigned int i = 0; i < numSlots; i++){
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[i]);
+		if (GLEW_ARB_buffer_storage){
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER, slotSize, NULL, flags);
+			persistent[i] = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slotSize, flags);
+		}else{
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, slotSize, NULL, GL_STREAM_DRAW);
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+TextureStreamer::~TextureStreamer(){
+	for (size_t i = 0; i < buffers.size(); i++){
+		if (fences[i])
+			glDeleteSync(fences[i]);
+		if (persistent[i]){
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[i]);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glDeleteBuffers((GLsizei)buffers.size(), &buffers[0]);
+}
+
+void TextureStreamer::enqueueLevel(GLuint texture, GLint level, GLint maxLevel, GLenum format, bool compressed,
+	GLsizei width, GLsizei height, const unsigned char * data, size_t size, bool generateMipmap,
+	const std::shared_ptr<const void> & owner)
+{
+	PendingLevel l;
+	l.target = GL_TEXTURE_2D;
+	l.texture = texture;
+	l.level = level;
+	l.maxLevel = maxLevel;
+	l.layer = l.x = l.y = 0;
+	l.format = format;
+	l.compressed = compressed;
+	l.width = width;
+	l.height = height;
+	if (owner){
+		l.data = data;
+		l.owner = owner;
+	}else{
+		std::shared_ptr< std::vector<unsigned char> > copy(new std::vector<unsigned char>(data, data + size));
+		l.data = copy->empty() ? NULL : &(*copy)[0];
+		l.owner = copy;
+	}
+	l.size = size;
+	l.generateMipmap = generateMipmap;
+	l.rowsDone = 0;
+	pending.push_back(l);
+	queuedBytes += size;
+}
+
+void TextureStreamer::enqueueSubImage(GLuint array, GLint level, GLint layer, GLint x, GLint y, GLsizei width, GLsizei height,
+	GLenum format, bool compressed, const unsigned char * data, size_t size,
+	const std::shared_ptr<const void> & owner, const std::function<void()> & uploaded)
+{
+	PendingLevel l;
+	l.target = GL_TEXTURE_2D_ARRAY;
+	l.texture = array;
+	l.level = l.maxLevel = level;
+	l.layer = layer;
+	l.x = x;
+	l.y = y;
+	l.format = format;
+	l.compressed = compressed;
+	l.width = width;
+	l.height = height;
+	l.data = data;
+	l.size = size;
+	l.owner = owner;
+	l.generateMipmap = false;
+	l.uploaded = uploaded;
+	l.rowsDone = 0;
+	pending.push_back(l);
+	queuedBytes += size;
+}
+
+bool TextureStreamer::enqueueImage(GLuint texture, const TextureImage & image, const unsigned char * pixels,
+	const std::shared_ptr<const void> & owner)
+{
+	if (!image.compressed && image.mipMapCount <= 1){
+		// One level, the GPU makes the others
+		enqueueLevel(texture, 0, 1000, image.format, false, image.width, image.height,
+			pixels, image.data.size(), true, owner);
+		return true;
+	}
+	if (!image.compressed){
+		// A chain from generateMipmaps, rows 4 bytes aligned
+		PendingLevel l;
+		l.format = image.format;
+		l.compressed = false;
+		std::vector<size_t> offsets;
+		size_t offset = 0;
+		for (unsigned int level = 0; level < image.mipMapCount; level++){
+			l.width = std::max(1u, image.width >> level);
+			l.height = std::max(1u, image.height >> level);
+			offsets.push_back(offset);
+			offset += rowBytes(l) * l.height;
+		}
+		offsets.push_back(offset);
+		for (int level = (int)image.mipMapCount - 1; level >= 0; level--)
+			enqueueLevel(texture, level, image.mipMapCount - 1, image.format, false,
+				std::max(1u, image.width >> level), std::max(1u, image.height >> level),
+				pixels + offsets[level], offsets[level + 1] - offsets[level], false, owner);
+		return true;
+	}
+	if (!isTextureFormatSupported(image.format)){
+		printf("BC6H / BC7 textures need GL_ARB_texture_compression_bptc\n");
+		return false;
+	}
+
+	std::vector<size_t> offsets, sizes;
+	size_t offset = 0;
+	unsigned int w = image.width, h = image.height;
+	for (unsigned int level = 0; level < image.mipMapCount; level++){
+		size_t size = compressedLevelSize(image.format, w, h);
+		offsets.push_back(offset);
+		sizes.push_back(size);
+		offset += size;
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+	for (int level = (int)image.mipMapCount - 1; level >= 0; level--)
+		enqueueLevel(texture, level, image.mipMapCount - 1, image.format, true,
+			std::max(1u, image.width >> level), std::max(1u, image.height >> level),
+			pixels + offsets[level], sizes[level], false, owner);
+	return true;
+}
+
+void TextureStreamer::cancel(GLuint texture){
+	for (std::deque<PendingLevel>::iterator it = pending.begin(); it != pending.end(); ){
+		if (it->texture == texture){
+			size_t done = it->compressed ? (it->rowsDone / 4) * rowBytes(*it) : it->rowsDone * rowBytes(*it);
+			queuedBytes -= it->size - done;
+			it = pending.erase(it);
+		}else{
+			++it;
+		}
+	}
+}
+
+unsigned int TextureStreamer::getQueuedTextures() const{
+	std::vector<GLuint> textures;
+	for (size_t i = 0; i < pending.size(); i++)
+		if (std::find(textures.begin(), textures.end(), pending[i].texture) == textures.end())
+			textures.push_back(pending[i].texture);
+	return (unsigned int)textures.size();
+}
+
+size_t TextureStreamer::rowBytes(const PendingLevel & l){
+	if (l.compressed)
+		return ((size_t)(l.width + 3) / 4) * compressedBlockSize(l.format);
+	// BMP rows are 4 bytes aligned
+	size_t bytesPerPixel = (l.format == GL_BGRA || l.format == GL_RGBA) ? 4 : (l.format == GL_RED ? 1 : 3);
+	return (l.width * bytesPerPixel + 3) & ~(size_t)3;
+}
+
+void TextureStreamer::upload(const PendingLevel & l, const Strip & strip){
+	glBindTexture(l.target, l.texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, l.compressed ? 1 : 4);
+	bool whole = strip.y == 0 && strip.rows == l.height;
+	size_t size = l.compressed ? ((strip.rows + 3) / 4) * rowBytes(l) : strip.rows * rowBytes(l);
+	if (l.target == GL_TEXTURE_2D_ARRAY && l.compressed){
+		glCompressedTexSubImage3D(l.target, l.level, l.x, l.y + strip.y, l.layer, l.width, strip.rows, 1, l.format, (GLsizei)size, strip.pixels);
+	}else if (l.target == GL_TEXTURE_2D_ARRAY){
+		glTexSubImage3D(l.target, l.level, l.x, l.y + strip.y, l.layer, l.width, strip.rows, 1, l.format, GL_UNSIGNED_BYTE, strip.pixels);
+	}else if (whole && l.compressed){
+		glCompressedTexImage2D(GL_TEXTURE_2D, l.level, l.format, l.width, l.height, 0, (GLsizei)size, strip.pixels);
+	}else if (whole){
+		glTexImage2D(GL_TEXTURE_2D, l.level, GL_RGB, l.width, l.height, 0, l.format, GL_UNSIGNED_BYTE, strip.pixels);
+	}else if (l.compressed){
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, l.level, 0, strip.y, l.width, strip.rows, l.format, (GLsizei)size, strip.pixels);
+	}else{
+		glTexSubImage2D(GL_TEXTURE_2D, l.level, 0, strip.y, l.width, strip.rows, l.format, GL_UNSIGNED_BYTE, strip.pixels);
+	}
+}
+
+// Storage for a level that comes in strips. No pixel unpack buffer may be bound.
+void TextureStreamer::specifyLevel(const PendingLevel & l){
+	glBindTexture(GL_TEXTURE_2D, l.texture);
+	if (l.compressed)
+		glCompressedTexImage2D(GL_TEXTURE_2D, l.level, l.format, l.width, l.height, 0, (GLsizei)l.size, NULL);
+	else
+		glTexImage2D(GL_TEXTURE_2D, l.level, GL_RGB, l.width, l.height, 0, l.format, GL_UNSIGNED_BYTE, NULL);
+}
+
+// The level is complete : sample it
+void TextureStreamer::finishLevel(const PendingLevel & l){
+	if (l.uploaded)
+		l.uploaded();
+	if (l.target != GL_TEXTURE_2D)
+		return;
+	glBindTexture(GL_TEXTURE_2D, l.texture);
+	if (l.generateMipmap)
+		glGenerateMipmap(GL_TEXTURE_2D);
+
+	// Only sample what is there already
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, l.level);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, l.maxLevel);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+		(l.generateMipmap || l.maxLevel > l.level) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+}
+
+void TextureStreamer::update(size_t byteBudget){
+	uploadedBytes = 0;
+	stallTimeMs = 0.0;
+	if (pending.empty())
+		return;
+
+	size_t budget = std::min(byteBudget, slotSize);
+	unsigned int slot = nextSlot;
+	nextSlot = (nextSlot + 1) % buffers.size();
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[slot]);
+
+	// Make sure the GPU is done reading what we wrote in this slot last time
+	unsigned char * base = NULL;
+	StreamerClock::time_point start = StreamerClock::now();
+	if (persistent[slot]){
+		if (fences[slot]){
+			glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+			glDeleteSync(fences[slot]);
+			fences[slot] = 0;
+		}
+		base = persistent[slot];
+	}else{
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, slotSize, NULL, GL_STREAM_DRAW);
+		base = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slotSize,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	}
+	stallTimeMs = millisecondsSince(start);
+	totalStallTimeMs += stallTimeMs;
+
+	// Pack as many rows as the budget allows in the slot : whole levels while
+	// they fit, then a strip of the next one
+	std::vector<Strip> strips;
+	size_t used = 0;
+	for (size_t i = 0; i < pending.size() && base; i++){
+		const PendingLevel & l = pending[i];
+		GLsizei unit = l.compressed ? 4 : 1;
+		size_t unitBytes = rowBytes(l);
+		size_t unitsLeft = (l.height - l.rowsDone + unit - 1) / unit;
+		size_t units = std::min(unitsLeft, (budget - std::min(budget, used)) / unitBytes);
+		// Over the budget rather than nothing at all, as long as it fits in the slot
+		if (units == 0 && strips.empty() && unitBytes <= slotSize)
+			units = 1;
+		if (units == 0)
+			break;
+		Strip strip;
+		strip.index = i;
+		strip.y = l.rowsDone;
+		strip.rows = std::min((GLsizei)(units * unit), l.height - l.rowsDone);
+		strip.pixels = (const unsigned char *)0 + used;
+		memcpy(base + used, l.data + (l.rowsDone / unit) * unitBytes, units * unitBytes);
+		used += (units * unitBytes + 15) & ~(size_t)15;
+		strips.push_back(strip);
+		if (units < unitsLeft)
+			break;
+	}
+	if (base && !persistent[slot])
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	// The first strip of a level that doesn't come whole specifies it empty,
+	// outside of the buffer : a NULL pointer would be an offset in it
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	for (size_t s = 0; s < strips.size(); s++){
+		const PendingLevel & l = pending[strips[s].index];
+		if (l.target != GL_TEXTURE_2D || strips[s].y != 0 || strips[s].rows == l.height)
+			continue;
+		specifyLevel(l);
+	}
+
+	if (!strips.empty()){
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[slot]);
+		for (size_t s = 0; s < strips.size(); s++)
+			upload(pending[strips[s].index], strips[s]);
+		if (persistent[slot])
+			fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}else{
+		// One row bigger than the ring : straight from client memory, alone
+		PendingLevel & l = pending.front();
+		Strip strip;
+		strip.index = 0;
+		strip.y = l.rowsDone;
+		strip.rows = std::min(l.compressed ? 4 : 1, l.height - l.rowsDone);
+		strip.pixels = l.data + (l.compressed ? l.rowsDone / 4 : l.rowsDone) * rowBytes(l);
+		if (l.target == GL_TEXTURE_2D && strip.y == 0 && strip.rows != l.height)
+			specifyLevel(l);
+		upload(l, strip);
+		strips.push_back(strip);
+	}
+
+	for (size_t s = 0; s < strips.size(); s++){
+		PendingLevel & l = pending[strips[s].index];
+		size_t bytes = (l.compressed ? (strips[s].rows + 3) / 4 : strips[s].rows) * rowBytes(l);
+		uploadedBytes += bytes;
+		queuedBytes -= bytes;
+		l.rowsDone += strips[s].rows;
+		if (l.rowsDone == l.height)
+			finishLevel(l);
+	}
+	while (!pending.empty() && pending.front().rowsDone == pending.front().height)
+		pending.pop_front();
+}
@@ -0,0 +1,101 @@
+#ifndef TEXTURESTREAMER_HPP
+#define TEXTURESTREAMER_HPP
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+
+// Uploads texture levels over several frames through a ring of pixel unpack
+// buffers, never more than a byte budget per frame. A level bigger than the
+// budget or a ring slot goes in strips of rows (of 4x4 block rows when
+// compressed) with glTexSubImage2D / glCompressedTexSubImage2D, one strip per
+// frame, so that a 4K texture can't stall a frame.
+// With GL_ARB_buffer_storage the ring is persistently mapped and fenced,
+// otherwise every slot is orphaned with glBufferData before being mapped.
+class TextureStreamer {
+public:
+	TextureStreamer(unsigned int numSlots = 3, size_t slotSize = 4 * 1024 * 1024);
+	~TextureStreamer();
+
+	// Queue one level. Levels are uploaded in FIFO order ; after each one the
+	// texture's base level is moved to it, so a chain queued from the smallest
+	// level up sharpens progressively. Without an owner the data is copied ;
+	// with one, data is read in place until the level is uploaded and owner
+	// keeps it alive until then (a mapped DDS file, a decoded image).
+	void enqueueLevel(GLuint texture, GLint level, GLint maxLevel, GLenum format, bool compressed,
+		GLsizei width, GLsizei height, const unsigned char * data, size_t size, bool generateMipmap,
+		const std::shared_ptr<const void> & owner = std::shared_ptr<const void>());
+
+	// All the levels of an image, smallest first, read from pixels (image.data
+	// or a mapped DDS view) which owner keeps alive. An uncompressed image with
+	// a single level gets glGenerateMipmap once it is in. Returns false,
+	// queuing nothing, if the format is not supported.
+	bool enqueueImage(GLuint texture, const TextureImage & image, const unsigned char * pixels,
+		const std::shared_ptr<const void> & owner);
+
+	// A rectangle of one level of one layer of a GL_TEXTURE_2D_ARRAY whose
+	// storage already exists, uploaded like the levels above, in the same
+	// queue. data is read in place, owner keeps it alive ; rows are 4 bytes
+	// aligned when uncompressed. uploaded() runs on the GL thread once all of
+	// it is in : the texture's parameters are left to it.
+	void enqueueSubImage(GLuint array, GLint level, GLint layer, GLint x, GLint y, GLsizei width, GLsizei height,
+		GLenum format, bool compressed, const unsigned char * data, size_t size,
+		const std::shared_ptr<const void> & owner, const std::function<void()> & uploaded);
+
+	// Call once per frame on the GL thread. At least one row is uploaded even
+	// if it is bigger than the budget, so that nothing starves ; a row bigger
+	// than a slot goes from client memory.
+	void update(size_t byteBudget);
+
+	// Forget the levels of a texture that is about to be deleted
+	void cancel(GLuint texture);
+
+	bool idle() const { return pending.empty(); }
+	unsigned int getQueuedTextures() const;
+	size_t getQueuedBytes() const { return queuedBytes; }
+	size_t getUploadedBytes() const { return uploadedBytes; }       // last update()
+	double getStallTime() const { return stallTimeMs; }              // waiting on the ring, last update()
+	double getTotalStallTime() const { return totalStallTimeMs; }
+
+private:
+	struct PendingLevel {
+		GLenum target;             // GL_TEXTURE_2D, or GL_TEXTURE_2D_ARRAY for enqueueSubImage
+		GLuint texture;
+		GLint level, maxLevel;
+		GLint layer, x, y;         // GL_TEXTURE_2D_ARRAY only
+		GLenum format;
+		bool compressed;
+		GLsizei width, height;
+		const unsigned char * data;
+		size_t size;
+		std::shared_ptr<const void> owner;
+		bool generateMipmap;
+		std::function<void()> uploaded;
+		GLsizei rowsDone;          // uploaded so far, a multiple of 4 if compressed
+	};
+
+	// A run of rows of a level : from the bound buffer at offset, or client memory
+	struct Strip {
+		size_t index;              // in pending
+		GLsizei y, rows;
+		const unsigned char * pixels;
+	};
+
+	static size_t rowBytes(const PendingLevel & l);   // of one row, or one row of blocks
+	void specifyLevel(const PendingLevel & l);
+	void upload(const PendingLevel & l, const Strip & strip);
+	void finishLevel(const PendingLevel & l);
+
+	std::deque<PendingLevel> pending;
+	std::vector<GLuint> buffers;
+	std::vector<GLsync> fences;
+	std::vector<unsigned char *> persistent; // mapped pointers, if persistent
+	unsigned int nextSlot;
+	size_t slotSize;
+
+	size_t queuedBytes, uploadedBytes;
+	double stallTimeMs, totalStallTimeMs;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#include "threadpool.hpp"
+
+ThreadPool::ThreadPool(unsigned int numThreads)
+	: running(0), quit(false)
+{
+	if (numThreads == 0){
+		unsigned int cores = std::thread::hardware_concurrency();
+		numThreads = cores > 1 ? cores - 1 : 1;
+	}
+	for (unsigned int i = 0; i < numThreads; i++)
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool(){
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	jobAvailable.notify_all();
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+void ThreadPool::enqueue(const std::function<void()> & job){
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(job);
+	}
+	jobAvailable.notify_one();
+}
+
+void ThreadPool::wait(){
+	std::unique_lock<std::mutex> lock(mutex);
+	allDone.wait(lock, [this]{ return jobs.empty() && running == 0; });
+}
+
+void ThreadPool::workerLoop(){
+	while (true){
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			jobAvailable.wait(lock, [this]{ return quit || !jobs.empty(); });
+			if (quit && jobs.empty())
+				return;
+			job = jobs.front();
+			jobs.pop_front();
+			running++;
+		}
+
+		job();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running--;
+			if (jobs.empty() && running == 0)
+				allDone.notify_all();
+		}
+	}
+}
+
+ThreadPool & getSharedThreadPool(){
+	static ThreadPool pool;
+	return pool;
+}
@@ -0,0 +1,41 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Fixed set of worker threads running jobs in FIFO order.
+class ThreadPool {
+public:
+	// 0 : one thread per core, minus the one running the render loop
+	explicit ThreadPool(unsigned int numThreads = 0);
+	~ThreadPool();
+
+	void enqueue(const std::function<void()> & job);
+
+	// Blocks until every job enqueued so far has finished
+	void wait();
+
+	unsigned int size() const { return (unsigned int)workers.size(); }
+
+private:
+	void workerLoop();
+
+	std::vector<std::thread> workers;
+	std::deque< std::function<void()> > jobs;
+	std::mutex mutex;
+	std::condition_variable jobAvailable, allDone;
+	unsigned int running;
+	bool quit;
+};
+
+// One pool for the whole program, created on first use : texture decoding
+// and mipmap generation share it instead of each starting their own threads.
+// Joined at exit ; wait() on it before tearing down what its jobs use.
+ThreadPool & getSharedThreadPool();
+
+#endif
@@ -1,6 +1,19 @@
 #ifndef VBOINDEXER_HPP
 #define VBOINDEXER_HPP
 
+// Linear search for every vertex : quadratic, the reference the others are
+// measured against
+void indexVBO_slow(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+
+	std::vector<unsigned short> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+);
+
 void indexVBO(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
@@ -12,6 +25,18 @@ void indexVBO(
 	std::vector<glm::vec3> & out_normals
 );
 
+// 32 bit indices, for meshes with more than 65536 unique vertices
+void indexVBO(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+);
+
 
 void indexVBO_TBN(
 	std::vector<glm::vec3> & in_vertices,
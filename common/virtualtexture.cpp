@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+#include <GL/glew.h>
+
+#include "texture.hpp"
+#include "dxtcompress.hpp"
+#include "threadpool.hpp"
+#include "virtualtexture.hpp"
+
+VirtualTexture::VirtualTexture()
+	: slotsPerRow(0), slotSize(0),
+	  physicalTexture(0), indirectionTexture(0),
+	  feedbackFramebuffer(0), feedbackColor(0), feedbackDepth(0),
+	  feedbackFrame(0), feedbackWidth(0), feedbackHeight(0), feedbackScale(1), savedFramebuffer(0), uploads(0), uploadedBytes(0)
+{
+	feedbackBuffers[0] = feedbackBuffers[1] = 0;
+	feedbackPending[0] = feedbackPending[1] = false;
+}
+
+VirtualTexture::~VirtualTexture(){
+	unload();
+}
+
+void VirtualTexture::unload(){
+	// The jobs point at this object and read the page file
+	if (pool){
+		pool->wait();
+		pool.reset();
+	}
+	residency.reset();
+	loaded.clear();
+	ready.clear();
+	// The physical texture comes first : without it nothing was made. glDelete*
+	// ignore 0, so a half finished load() goes too.
+	if (physicalTexture){
+		glDeleteTextures(1, &physicalTexture);
+		glDeleteTextures(1, &indirectionTexture);
+		glDeleteFramebuffers(1, &feedbackFramebuffer);
+		glDeleteTextures(1, &feedbackColor);
+		glDeleteRenderbuffers(1, &feedbackDepth);
+		glDeleteBuffers(2, feedbackBuffers);
+	}
+	physicalTexture = indirectionTexture = 0;
+	feedbackFramebuffer = feedbackColor = feedbackDepth = 0;
+	feedbackBuffers[0] = feedbackBuffers[1] = 0;
+	feedbackPending[0] = feedbackPending[1] = false;
+	feedbackFrame = 0;
+}
+
+bool VirtualTexture::load(const char * path, unsigned int slotsPerRow, int viewportWidth, int viewportHeight, int feedbackScale){
+	unload();
+	if (!file.open(path))
+		return false;
+	const VTHeader & header = file.getHeader();
+	unsigned int rootPages = file.pagesX(header.levels - 1) * file.pagesY(header.levels - 1);
+	if (slotsPerRow > 255 || slotsPerRow * slotsPerRow <= rootPages){
+		printf("%s : %u slots can't hold the coarsest level\n", path, slotsPerRow * slotsPerRow);
+		return false;
+	}
+	this->slotsPerRow = slotsPerRow;
+	slotSize = header.pageSize + 2 * header.border;
+
+	GLint maxSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	if ((GLint)(slotsPerRow * slotSize) > maxSize){
+		printf("%s : a %ux%u physical texture is too big\n", path, slotsPerRow * slotSize, slotsPerRow * slotSize);
+		return false;
+	}
+
+	residency.reset(new PageResidency(file.pagesX(0), file.pagesY(0), header.levels, slotsPerRow * slotsPerRow));
+	pool.reset(new ThreadPool());
+
+	// No mipmaps : pages carry their own levels, and the border covers bilinear
+	glGenTextures(1, &physicalTexture);
+	glBindTexture(GL_TEXTURE_2D, physicalTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, slotsPerRow * slotSize, slotsPerRow * slotSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+	// One texel per page, one mipmap per level of the virtual texture
+	glGenTextures(1, &indirectionTexture);
+	glBindTexture(GL_TEXTURE_2D, indirectionTexture);
+	for (unsigned int l = 0; l < header.levels; l++)
+		glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA8, file.pagesX(l), file.pagesY(l), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.levels - 1);
+
+	this->feedbackScale = std::max(1, feedbackScale);
+	feedbackWidth = std::max(1, viewportWidth / this->feedbackScale);
+	feedbackHeight = std::max(1, viewportHeight / this->feedbackScale);
+	glGenTextures(1, &feedbackColor);
+	glBindTexture(GL_TEXTURE_2D, feedbackColor);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, feedbackWidth, feedbackHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glGenRenderbuffers(1, &feedbackDepth);
+	glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, feedbackWidth, feedbackHeight);
+	glGenFramebuffers(1, &feedbackFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, feedbackColor, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (!complete){
+		printf("%s : the feedback framebuffer is incomplete\n", path);
+		return false;
+	}
+
+	// Read back into one buffer while the other one is mapped
+	glGenBuffers(2, feedbackBuffers);
+	for (int i = 0; i < 2; i++){
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)feedbackWidth * feedbackHeight * 4, NULL, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	printf("Virtual texture %s : %ux%u, %u levels, %u cache slots of %u texels, feedback %dx%d\n",
+		path, header.width, header.height, header.levels, slotsPerRow * slotsPerRow, slotSize, feedbackWidth, feedbackHeight);
+	return true;
+}
+
+void VirtualTexture::beginFeedback(){
+	glGetIntegerv(GL_VIEWPORT, savedViewport);
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &savedFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+	glViewport(0, 0, feedbackWidth, feedbackHeight);
+	// Alpha 0 : no page wanted
+	GLfloat clearColor[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+}
+
+void VirtualTexture::endFeedback(){
+	unsigned int current = feedbackFrame % 2;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[current]);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	feedbackPending[current] = true;
+	feedbackFrame++;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+	glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+}
+
+// The buffer filled a frame ago, so the copy is most likely done
+void VirtualTexture::readFeedback(std::vector<unsigned int> & requested){
+	requested.clear();
+	unsigned int previous = feedbackFrame % 2;
+	if (!feedbackPending[previous])
+		return;
+	feedbackPending[previous] = false;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[previous]);
+	size_t size = (size_t)feedbackWidth * feedbackHeight * 4;
+	const unsigned char * pixels = (const unsigned char *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+	if (pixels){
+		unsigned int last = 0xFFFFFFFF;
+		for (size_t i = 0; i < size; i += 4){
+			if (pixels[i + 3] == 0)
+				continue;
+			unsigned int page = PageResidency::pageId(pixels[i + 2], pixels[i], pixels[i + 1]);
+			// Neighbouring texels mostly want the same page
+			if (page != last)
+				requested.push_back(page);
+			last = page;
+		}
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	std::sort(requested.begin(), requested.end());
+	requested.erase(std::unique(requested.begin(), requested.end()), requested.end());
+}
+
+// On a worker
+void VirtualTexture::loadPage(unsigned int page){
+	LoadedPage result;
+	result.page = page;
+	result.pixels.resize(file.pageBytes());
+	if (!file.readPage(PageResidency::pageLevel(page), PageResidency::pageX(page), PageResidency::pageY(page), &result.pixels[0]))
+		result.pixels.clear();
+	std::lock_guard<std::mutex> lock(loadedMutex);
+	loaded.push_back(std::move(result));
+}
+
+void VirtualTexture::update(unsigned int maxLoads, unsigned int maxUploads){
+	std::vector<unsigned int> requested, toLoad;
+	readFeedback(requested);
+	residency->update(requested, maxLoads, toLoad);
+	for (size_t i = 0; i < toLoad.size(); i++)
+		pool->enqueue(std::bind(&VirtualTexture::loadPage, this, toLoad[i]));
+
+	{
+		std::lock_guard<std::mutex> lock(loadedMutex);
+		for (size_t i = 0; i < loaded.size(); i++)
+			ready.push_back(std::move(loaded[i]));
+		loaded.clear();
+	}
+
+	uploads = 0;
+	uploadedBytes = 0;
+	glBindTexture(GL_TEXTURE_2D, physicalTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	while (!ready.empty() && uploads < maxUploads){
+		LoadedPage & page = ready.front();
+		if (page.pixels.empty()){
+			residency->pageFailed(page.page);
+		}else{
+			int slot = residency->pageLoaded(page.page);
+			if (slot >= 0){
+				glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % slotsPerRow) * slotSize, (slot / slotsPerRow) * slotSize,
+					slotSize, slotSize, GL_RGBA, GL_UNSIGNED_BYTE, &page.pixels[0]);
+				uploads++;
+				uploadedBytes += (unsigned long long)slotSize * slotSize * 4;
+			}
+		}
+		ready.pop_front();
+	}
+
+	if (residency->isIndirectionDirty()){
+		std::vector< std::vector<unsigned char> > levels;
+		residency->buildIndirection(slotsPerRow, levels);
+		glBindTexture(GL_TEXTURE_2D, indirectionTexture);
+		for (unsigned int l = 0; l < levels.size(); l++)
+			glTexSubImage2D(GL_TEXTURE_2D, l, 0, 0, residency->getPagesX(l), residency->getPagesY(l),
+				GL_RGBA, GL_UNSIGNED_BYTE, &levels[l][0]);
+		for (unsigned int l = 0; l < levels.size(); l++)
+			uploadedBytes += levels[l].size();
+	}
+}
+
+void VirtualTexture::setUniforms(GLuint programID, int indirectionUnit, int physicalUnit, bool feedback) const{
+	const VTHeader & header = file.getHeader();
+	glUseProgram(programID);
+	glUniform2f(glGetUniformLocation(programID, "vtTexels"), (float)header.width, (float)header.height);
+	glUniform1f(glGetUniformLocation(programID, "vtPageSize"), (float)header.pageSize);
+	glUniform1f(glGetUniformLocation(programID, "vtBorder"), (float)header.border);
+	glUniform1f(glGetUniformLocation(programID, "vtLevels"), (float)header.levels);
+	glUniform2f(glGetUniformLocation(programID, "vtPhysicalSize"), (float)(slotsPerRow * slotSize), (float)(slotsPerRow * slotSize));
+	float lodBias = 0.0f;
+	for (int s = feedbackScale; feedback && s > 1; s /= 2)
+		lodBias -= 1.0f;
+	glUniform1f(glGetUniformLocation(programID, "vtLodBias"), lodBias);
+	glUniform1i(glGetUniformLocation(programID, "vtIndirection"), indirectionUnit);
+	glUniform1i(glGetUniformLocation(programID, "vtPhysical"), physicalUnit);
+}
+
+void VirtualTexture::bind(int indirectionUnit, int physicalUnit) const{
+	glActiveTexture(GL_TEXTURE0 + indirectionUnit);
+	glBindTexture(GL_TEXTURE_2D, indirectionTexture);
+	glActiveTexture(GL_TEXTURE0 + physicalUnit);
+	glBindTexture(GL_TEXTURE_2D, physicalTexture);
+	glActiveTexture(GL_TEXTURE0);
+}
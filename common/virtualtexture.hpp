@@ -0,0 +1,85 @@
+#ifndef VIRTUALTEXTURE_HPP
+#define VIRTUALTEXTURE_HPP
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+
+#include "vtpagefile.hpp"
+#include "pageresidency.hpp"
+
+class ThreadPool;
+
+// A texture too big to be resident, streamed page by page from a VTPageFile.
+//
+// Each frame the scene is drawn at low resolution with Feedback.fragmentshader,
+// which writes the page every texel wants. That image is read back one frame
+// later, the missing pages are read from the page file on worker threads, and
+// the render thread copies them into a physical cache texture (a grid of
+// slots) and refreshes the indirection texture that maps every page to the
+// slot of its finest resident ancestor.
+class VirtualTexture {
+public:
+	VirtualTexture();
+	~VirtualTexture();
+
+	// slotsPerRow * slotsPerRow pages in the physical texture ; the feedback
+	// is rendered at the viewport size divided by feedbackScale. Loading again
+	// drops everything of the previous file first.
+	bool load(const char * path, unsigned int slotsPerRow, int viewportWidth, int viewportHeight, int feedbackScale);
+
+	// Around the feedback draw calls : binds and clears the feedback
+	// framebuffer, then starts the readback and restores framebuffer 0.
+	void beginFeedback();
+	void endFeedback();
+
+	// Turns the last feedback into page loads (at most maxLoads new ones),
+	// uploads at most maxUploads pages that came back, and refreshes the
+	// indirection texture if anything changed.
+	void update(unsigned int maxLoads, unsigned int maxUploads);
+
+	// vtTexels, vtPageSize, vtBorder, vtLevels, vtPhysicalSize and the two
+	// samplers (given texture units) ; vtLodBias is 0 for shading and
+	// -log2(feedbackScale) for the feedback program
+	void setUniforms(GLuint programID, int indirectionUnit, int physicalUnit, bool feedback) const;
+	void bind(int indirectionUnit, int physicalUnit) const;
+
+	const PageResidency & getResidency() const { return *residency; }
+	unsigned int getUploads() const { return uploads; }
+	// Pages and indirection levels sent by the last update
+	unsigned long long getUploadedBytes() const { return uploadedBytes; }
+
+private:
+	struct LoadedPage {
+		unsigned int page;
+		std::vector<unsigned char> pixels;  // empty if the read failed
+	};
+
+	// Waits for the page loads in flight, then frees the GL objects
+	void unload();
+	void readFeedback(std::vector<unsigned int> & requested);
+	void loadPage(unsigned int page);
+
+	VTPageFile file;
+	std::unique_ptr<PageResidency> residency;
+	std::unique_ptr<ThreadPool> pool;
+	unsigned int slotsPerRow, slotSize;
+
+	GLuint physicalTexture, indirectionTexture;
+	GLuint feedbackFramebuffer, feedbackColor, feedbackDepth;
+	GLuint feedbackBuffers[2];
+	bool feedbackPending[2];
+	unsigned int feedbackFrame;
+	int feedbackWidth, feedbackHeight, feedbackScale;
+	GLint savedViewport[4];
+	GLint savedFramebuffer;     // the one drawn to before the feedback pass
+
+	std::mutex loadedMutex;
+	std::vector<LoadedPage> loaded;   // filled by the workers
+	std::deque<LoadedPage> ready;     // waiting for an upload
+	unsigned int uploads;
+	unsigned long long uploadedBytes;
+};
+
+#endif
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include <GL/glew.h>
+
+#include "texture.hpp"
+#include "dxtcompress.hpp"
+#include "vtpagefile.hpp"
+
+static unsigned int nextPowerOfTwo(unsigned int v){
+	unsigned int p = 1;
+	while (p < v)
+		p *= 2;
+	return p;
+}
+
+// Bilinear, wrapping around
+static void resample(const RGBAImage & src, unsigned int width, unsigned int height, RGBAImage & dst){
+	dst.width = width;
+	dst.height = height;
+	dst.pixels.resize((size_t)width * height * 4);
+	for (unsigned int y = 0; y < height; y++)
+		for (unsigned int x = 0; x < width; x++){
+			float fx = (x + 0.5f) * src.width / width - 0.5f;
+			float fy = (y + 0.5f) * src.height / height - 0.5f;
+			int x0 = (int)floorf(fx), y0 = (int)floorf(fy);
+			float ax = fx - x0, ay = fy - y0;
+			int xs[2] = { x0, x0 + 1 }, ys[2] = { y0, y0 + 1 };
+			for (int i = 0; i < 2; i++){
+				xs[i] = ((xs[i] % (int)src.width) + (int)src.width) % (int)src.width;
+				ys[i] = ((ys[i] % (int)src.height) + (int)src.height) % (int)src.height;
+			}
+			for (int c = 0; c < 4; c++){
+				float top    = src.pixels[4 * (ys[0] * src.width + xs[0]) + c] * (1 - ax) + src.pixels[4 * (ys[0] * src.width + xs[1]) + c] * ax;
+				float bottom = src.pixels[4 * (ys[1] * src.width + xs[0]) + c] * (1 - ax) + src.pixels[4 * (ys[1] * src.width + xs[1]) + c] * ax;
+				dst.pixels[4 * ((size_t)y * width + x) + c] = (unsigned char)(top * (1 - ay) + bottom * ay + 0.5f);
+			}
+		}
+}
+
+bool bakeVirtualTexture(const RGBAImage & image, unsigned int pageSize, unsigned int border,
+	MipFilter filter, const char * path)
+{
+	if (pageSize == 0 || (pageSize & (pageSize - 1)) != 0){
+		printf("The page size must be a power of two\n");
+		return false;
+	}
+
+	RGBAImage level0;
+	resample(image, std::max(pageSize, nextPowerOfTwo(image.width)), std::max(pageSize, nextPowerOfTwo(image.height)), level0);
+	std::vector<RGBAImage> mips;
+	buildMipChain(level0, filter, mips);
+
+	VTHeader header;
+	memcpy(header.magic, "VTX1", 4);
+	header.width = level0.width;
+	header.height = level0.height;
+	header.pageSize = pageSize;
+	header.border = border;
+	header.levels = 1;
+	while (header.levels < mips.size() &&
+		(mips[header.levels - 1].width > pageSize || mips[header.levels - 1].height > pageSize))
+		header.levels++;
+	// The feedback pass stores page coordinates in 8 bits
+	if (level0.width / pageSize > 256 || level0.height / pageSize > 256){
+		printf("At most 256x256 pages, use bigger pages\n");
+		return false;
+	}
+
+	FILE * file = fopen(path, "wb");
+	if (!file){
+		printf("Could not write %s\n", path);
+		return false;
+	}
+	fwrite(&header, sizeof(header), 1, file);
+
+	unsigned int slot = pageSize + 2 * border;
+	std::vector<unsigned char> page((size_t)slot * slot * 4);
+	size_t pages = 0;
+	for (unsigned int l = 0; l < header.levels; l++){
+		const RGBAImage & mip = mips[l];
+		unsigned int pagesX = std::max(1u, mip.width / pageSize), pagesY = std::max(1u, mip.height / pageSize);
+		for (unsigned int py = 0; py < pagesY; py++)
+			for (unsigned int px = 0; px < pagesX; px++){
+				for (unsigned int y = 0; y < slot; y++)
+					for (unsigned int x = 0; x < slot; x++){
+						int sx = (int)(px * pageSize + x) - (int)border;
+						int sy = (int)(py * pageSize + y) - (int)border;
+						sx = ((sx % (int)mip.width) + (int)mip.width) % (int)mip.width;
+						sy = ((sy % (int)mip.height) + (int)mip.height) % (int)mip.height;
+						memcpy(&page[4 * ((size_t)y * slot + x)], &mip.pixels[4 * ((size_t)sy * mip.width + sx)], 4);
+					}
+				fwrite(&page[0], 1, page.size(), file);
+				pages++;
+			}
+	}
+	bool ok = !ferror(file);
+	fclose(file);
+	printf("%s : %ux%u, %u levels, %u pages of %u+%u texels\n",
+		path, header.width, header.height, header.levels, (unsigned int)pages, pageSize, 2 * border);
+	return ok;
+}
+
+VTPageFile::VTPageFile(){
+	file.data = NULL;
+	file.size = 0;
+	memset(&header, 0, sizeof(header));
+}
+
+VTPageFile::~VTPageFile(){
+	close();
+}
+
+bool VTPageFile::open(const char * path){
+	close();
+	if (!mapFile(path, file))
+		return false;
+	if (file.size < sizeof(VTHeader) || memcmp(file.data, "VTX1", 4) != 0){
+		printf("%s is not a virtual texture page file\n", path);
+		close();
+		return false;
+	}
+	memcpy(&header, file.data, sizeof(header));
+
+	// Nothing below is computed from a header that doesn't make sense. The
+	// feedback pass writes page coordinates in 8 bits : 256 pages per axis.
+	if (header.pageSize == 0 || header.pageSize > 4096 || header.border > header.pageSize ||
+		header.levels == 0 || header.levels > 32){
+		printf("%s : bad header (page size %u, border %u, %u levels)\n", path, header.pageSize, header.border, header.levels);
+		close();
+		return false;
+	}
+	if (pagesX(0) > 256 || pagesY(0) > 256){
+		printf("%s : %ux%u pages, the feedback can't address more than 256x256\n", path, pagesX(0), pagesY(0));
+		close();
+		return false;
+	}
+
+	size_t offset = sizeof(VTHeader);
+	for (unsigned int l = 0; l < header.levels; l++){
+		levelOffsets.push_back(offset);
+		offset += (size_t)pagesX(l) * pagesY(l) * pageBytes();
+	}
+	if (offset > file.size){
+		printf("%s is truncated\n", path);
+		close();
+		return false;
+	}
+	return true;
+}
+
+void VTPageFile::close(){
+	unmapFile(file);
+	levelOffsets.clear();
+}
+
+unsigned int VTPageFile::pagesX(unsigned int level) const{
+	return std::max(1u, (header.width >> level) / header.pageSize);
+}
+
+unsigned int VTPageFile::pagesY(unsigned int level) const{
+	return std::max(1u, (header.height >> level) / header.pageSize);
+}
+
+size_t VTPageFile::pageBytes() const{
+	size_t slot = header.pageSize + 2 * header.border;
+	return slot * slot * 4;
+}
+
+bool VTPageFile::readPage(unsigned int level, unsigned int x, unsigned int y, unsigned char * out) const{
+	if (level >= levelOffsets.size() || x >= pagesX(level) || y >= pagesY(level))
+		return false;
+	size_t offset = levelOffsets[level] + ((size_t)y * pagesX(level) + x) * pageBytes();
+	memcpy(out, file.data + offset, pageBytes());
+	return true;
+}
@@ -0,0 +1,43 @@
+#ifndef VTPAGEFILE_HPP
+#define VTPAGEFILE_HPP
+
+// Page file of a virtual texture : every mip level cut in square pages of
+// pageSize texels, each stored with `border` extra texels on every side (so
+// that bilinear filtering inside a page never needs its neighbours), RGBA8,
+// level 0 first, pages row by row.
+struct VTHeader {
+	char magic[4];           // "VTX1"
+	unsigned int width, height;  // level 0, powers of two
+	unsigned int pageSize;       // power of two
+	unsigned int border;
+	unsigned int levels;         // down to the level that fits in one page
+};
+
+// The image is resampled to power of two sizes (at least pageSize) first ; UVs
+// don't change. Borders wrap around, like GL_REPEAT.
+bool bakeVirtualTexture(const RGBAImage & image, unsigned int pageSize, unsigned int border,
+	MipFilter filter, const char * path);
+
+class VTPageFile {
+public:
+	VTPageFile();
+	~VTPageFile();
+
+	bool open(const char * path);
+	void close();
+
+	const VTHeader & getHeader() const { return header; }
+	unsigned int pagesX(unsigned int level) const;
+	unsigned int pagesY(unsigned int level) const;
+	size_t pageBytes() const;
+
+	// Copies a page out of the mapping : can be called from any thread
+	bool readPage(unsigned int level, unsigned int x, unsigned int y, unsigned char * out) const;
+
+private:
+	MappedFile file;
+	VTHeader header;
+	std::vector<size_t> levelOffsets;
+};
+
+#endif
@@ -1,10 +1,20 @@
 // Include standard headers
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
 #include <string>
 #include <iostream>
 #include <cfloat>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 
 // Include GLEW
 #include <GL/glew.h>
@@ -19,24 +29,417 @@ GLFWwindow* window;
 using namespace glm;
 
 #include <common/shader.hpp>
+#include <common/shaderpermutations.hpp>
+#include <common/filewatcher.hpp>
 #include <common/texture.hpp>
+#include <common/texturearray.hpp>
+#include <common/texturecache.hpp>
+#include <common/dxtcompress.hpp>
+#include <common/virtualtexture.hpp>
 #include <common/controls.hpp>
+#include <common/camerapath.hpp>
+#include <common/jsonreader.hpp>
+#include <common/benchmark.hpp>
+#include <common/profiler.hpp>
+#include <common/renderstats.hpp>
+#include <common/offscreen.hpp>
+#include <common/imagediff.hpp>
+#include <common/capture.hpp>
+#include <common/text2D.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/occlusion.hpp>
+#include <common/pvs.hpp>
+#include <common/meshsimplify.hpp>
+#include <common/meshlet.hpp>
+#include <common/meshcluster.hpp>
+
+// One level of detail : a range of the mesh's element buffer
+struct MeshLOD {
+    unsigned int indexOffset, indexCount;
+};
+
+// A group of nearby objects of a mesh (see common/meshcluster.hpp) : occlusion,
+// PVS culling and LOD selection work on these, a material mesh spans the
+// whole room
+struct GLCluster {
+    std::vector<MeshLOD> lods;             // lods[0] is the full cluster
+    int currentLod;
+    glm::vec3 boundsMin, boundsMax;
+    unsigned int firstMeshlet, meshletCount;  // of LOD 0
+};
 
 struct GLMesh {
-    GLuint vao, vertexbuffer, uvbuffer, normalbuffer, elementbuffer;
-    std::vector<unsigned short> indices;
-    GLuint textureID;
+    // All the meshes share one VAO : the vertices start at baseVertex, the
+    // indices at firstIndex, and every vertex carries the mesh's material index.
+    GLint baseVertex;
+    unsigned int firstIndex;
+    std::vector<unsigned int> indices; // LOD 0, then the coarser LODs of the clusters
     glm::vec3 metarialColor;
     bool useTexture;
+    std::string texturePath;
+    unsigned int bucket;               // 0 : untextured, else 1 + its texture array
     int vertexCount;
+
+    // LOD 0 is stored cluster after cluster, each in meshlet order. The
+    // visible clusters, at their LOD (or only their visible meshlets), are
+    // drawn as index ranges with glMultiDrawElements.
+    std::vector<GLCluster> clusters;
+    unsigned int firstCluster;         // in the scene's list of clusters
+    std::vector<Meshlet> meshlets;
+    std::vector<GLsizei> drawCounts;
+    std::vector<const GLvoid*> drawOffsets;
 };
 
 std::vector<GLMesh> GLMeshes;
 
-int main(void)
+// A coarser LOD is used when the bounding sphere covers less than this
+// fraction of the screen height.
+const int MAX_LODS = 4;
+const float LOD_SCREEN_SIZE[MAX_LODS - 1] = { 0.5f, 0.2f, 0.08f };
+// Index count ratio and max error (fraction of the cluster diagonal) of each LOD
+const float LOD_RATIO[MAX_LODS - 1] = { 0.5f, 0.25f, 0.125f };
+const float LOD_ERROR[MAX_LODS - 1] = { 0.002f, 0.01f, 0.03f };
+// To go to a coarser level, the size has to be that much below the threshold
+const float LOD_HYSTERESIS = 0.85f;
+// Objects smaller than this (in scene units, about a bench) are grouped in
+// clusters by grid cell, see common/meshcluster.hpp
+const float CLUSTER_SIZE = 2.0f;
+
+int lodForScreenSize(const GLCluster & m, float screenSize){
+    int lod = 0;
+    while (lod + 1 < (int)m.lods.size() && screenSize < LOD_SCREEN_SIZE[lod])
+        lod++;
+    return lod;
+}
+
+void updateLOD(GLCluster & m, const glm::mat4 & ViewMatrix, const glm::mat4 & ProjectionMatrix){
+    glm::vec3 center = (m.boundsMin + m.boundsMax) * 0.5f;
+    float radius = glm::length(m.boundsMax - m.boundsMin) * 0.5f;
+    float distance = -(ViewMatrix * glm::vec4(center, 1.0f)).z;
+    if (distance <= radius) {
+        m.currentLod = 0;
+        return;
+    }
+    // ProjectionMatrix[1][1] is 1/tan(fov/2) : fraction of the screen height
+    float screenSize = radius * ProjectionMatrix[1][1] / distance;
+
+    int coarser = lodForScreenSize(m, screenSize / LOD_HYSTERESIS);
+    int finer   = lodForScreenSize(m, screenSize);
+    if (coarser > m.currentLod)
+        m.currentLod = coarser;
+    else if (finer < m.currentLod)
+        m.currentLod = finer;
+}
+
+// The current LOD of the visible clusters, or only the visible meshlets of
+// those at LOD 0, with the ranges that follow each other merged. Returns the
+// number of triangles kept.
+unsigned int updateClusterDraws(GLMesh & m, const char * clusterVisible, bool cullMeshlets,
+                                const glm::vec3 & cameraPosition, const glm::vec4 planes[6]){
+    m.drawCounts.clear();
+    m.drawOffsets.clear();
+    unsigned int triangles = 0;
+    unsigned int rangeStart = 0, rangeEnd = 0;
+    auto addRange = [&](unsigned int offset, unsigned int count) {
+        triangles += count / 3;
+        if (rangeEnd != rangeStart && offset == rangeEnd) {
+            rangeEnd += count;
+            return;
+        }
+        if (rangeEnd != rangeStart) {
+            m.drawCounts.push_back(rangeEnd - rangeStart);
+            m.drawOffsets.push_back((const GLvoid*)(rangeStart * sizeof(unsigned int)));
+        }
+        rangeStart = offset;
+        rangeEnd = offset + count;
+    };
+    for (size_t c = 0; c < m.clusters.size(); c++) {
+        if (!clusterVisible[c])
+            continue;
+        const GLCluster & cluster = m.clusters[c];
+        if (!cullMeshlets || cluster.currentLod != 0) {
+            const MeshLOD & lod = cluster.lods[cluster.currentLod];
+            addRange(lod.indexOffset, lod.indexCount);
+            continue;
+        }
+        for (unsigned int i = cluster.firstMeshlet; i < cluster.firstMeshlet + cluster.meshletCount; i++) {
+            const Meshlet & ml = m.meshlets[i];
+            if (isMeshletVisible(ml, cameraPosition, planes))
+                addRange(ml.indexOffset, ml.triangleCount * 3);
+        }
+    }
+    if (rangeEnd != rangeStart) {
+        m.drawCounts.push_back(rangeEnd - rangeStart);
+        m.drawOffsets.push_back((const GLvoid*)(rangeStart * sizeof(unsigned int)));
+    }
+    return triangles;
+}
+
+// Index ranges of several meshes, drawn with a single glMultiDrawElementsBaseVertex
+struct DrawBatch {
+    std::vector<GLsizei> counts;
+    std::vector<const GLvoid*> offsets;
+    std::vector<GLint> baseVertices;
+
+    void clear() {
+        counts.clear();
+        offsets.clear();
+        baseVertices.clear();
+    }
+};
+
+// The ranges of the mesh's visible clusters, from updateClusterDraws
+void addToBatch(const GLMesh & m, DrawBatch & batch){
+    const char * first = (const char*)0 + m.firstIndex * sizeof(unsigned int);
+    for (size_t i = 0; i < m.drawCounts.size(); i++) {
+        batch.counts.push_back(m.drawCounts[i]);
+        batch.offsets.push_back(first + (size_t)m.drawOffsets[i]);
+        batch.baseVertices.push_back(m.baseVertex);
+    }
+}
+
+void drawBatch(const DrawBatch & batch, RenderStats & stats){
+    if (batch.counts.empty())
+        return;
+    stats.drawCalls++;
+    for (size_t i = 0; i < batch.counts.size(); i++) {
+        stats.vertices += batch.counts[i];
+        stats.triangles += batch.counts[i] / 3;
+    }
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, &batch.counts[0], GL_UNSIGNED_INT,
+        &batch.offsets[0], (GLsizei)batch.counts.size(), &batch.baseVertices[0]);
+}
+
+// The render loop's glUniform* calls, each one counted as an upload
+void uploadUniform(RenderStats & stats, GLint location, const glm::mat4 & value){
+    glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]);
+    stats.uniformUploads++;
+}
+
+void uploadUniform(RenderStats & stats, GLint location, GLsizei count, const glm::vec3 * values){
+    glUniform3fv(location, count, &values[0].x);
+    stats.uniformUploads++;
+}
+
+// foo.dds (made from foo.bmp by tools/texcook) when it exists : DXT compressed,
+// 6 times smaller in video memory, and its mipmaps don't have to be generated.
+std::string cookedTexturePath(const char * bmpPath) {
+    std::string dds = bmpPath;
+    dds = dds.substr(0, dds.rfind('.')) + ".dds";
+    FILE * file = fopen(dds.c_str(), "rb");
+    if (!file)
+        return bmpPath;
+    fclose(file);
+    return dds;
+}
+
+// foo.vt (made by tools/vtbake) when it exists, else an empty string
+std::string virtualTexturePath(const std::string & texturePath) {
+    std::string vt = texturePath.substr(0, texturePath.rfind('.')) + ".vt";
+    FILE * file = fopen(vt.c_str(), "rb");
+    if (!file)
+        return "";
+    fclose(file);
+    return vt;
+}
+
+// The texture of a material variant made by tools/hallgen, bench_wood_2.dds
+// for wood_2, else the one of the plain material
+std::string variantTexturePath(const char * bmpPath, const std::string & variant) {
+    if (!variant.empty()) {
+        std::string bmp = bmpPath;
+        bmp = bmp.substr(0, bmp.rfind('.')) + variant + ".bmp";
+        std::string path = cookedTexturePath(bmp.c_str());
+        if (FILE * file = fopen(path.c_str(), "rb")) {
+            fclose(file);
+            return path;
+        }
+    }
+    return cookedTexturePath(bmpPath);
+}
+
+// { "lights": [ [x, y, z], ... ] }, as tools/hallgen writes it
+bool loadLights(const char * path, std::vector<glm::vec3> & out) {
+    std::vector<unsigned char> file;
+    if (!readFile(path, file))
+        return false;
+    file.push_back(0);
+
+    JsonReader json = { (const char *)&file[0], true };
+    out.clear();
+    json.expect('{');
+    while (json.ok && !json.accept('}')) {
+        std::string name = json.string();
+        json.expect(':');
+        if (name == "lights") {
+            json.expect('[');
+            if (!json.accept(']')) {
+                do {
+                    glm::vec3 light;
+                    json.expect('[');
+                    for (int i = 0; i < 3; i++) {
+                        if (i > 0)
+                            json.expect(',');
+                        light[i] = (float)json.number();
+                    }
+                    json.expect(']');
+                    out.push_back(light);
+                } while (json.ok && json.accept(','));
+                json.expect(']');
+            }
+        } else {
+            json.skipValue();
+        }
+        json.accept(',');
+    }
+    if (!json.ok || out.empty()) {
+        printf("%s : not a list of lights, ignoring it\n", path);
+        out.clear();
+        return false;
+    }
+    return true;
+}
+
+// --regression : the optimized render of a view against the reference one
+// (nothing culled, full detail) and against its golden image, which must be
+// there if goldenRequired. Everything that differs is written to regression/
+// with a _diff.bmp showing where.
+bool checkRegressionView(unsigned int view, const RGBAImage & optimized, const RGBAImage & reference,
+                         const char * goldenDirectory, bool goldenRequired, bool updateGolden, double diffBudget) {
+    const float threshold = 2.3f;   // delta E, the smallest visible difference
+    char name[64], path[512];
+    snprintf(name, sizeof(name), "view_%02u", view);
+    snprintf(path, sizeof(path), "%s/%s.bmp", goldenDirectory, name);
+    if (updateGolden && saveBMPImage(path, reference))
+        printf("%s : golden image written to %s\n", name, path);
+
+    bool pass = true;
+    ImageDiffResult diff;
+    RGBAImage diffImage;
+    compareImages(optimized, reference, threshold, diff, &diffImage);
+    printf("%s : optimized vs reference, %.4f%% of the pixels differ (max delta E %.1f)\n",
+        name, 100.0 * diff.differentFraction, diff.maxDeltaE);
+    if (diff.differentFraction > diffBudget) {
+        snprintf(path, sizeof(path), "regression/%s_reference_diff.bmp", name);
+        saveBMPImage(path, diffImage);
+        pass = false;
+    }
+
+    RGBAImage golden;
+    snprintf(path, sizeof(path), "%s/%s.bmp", goldenDirectory, name);
+    if (!loadBMPImage(path, golden)) {
+        // Without --golden, only the optimized vs reference check until the goldens are made
+        printf("%s : no golden image in %s, make them with --update-golden\n", name, goldenDirectory);
+        if (goldenRequired)
+            pass = false;
+    } else if (!compareImages(optimized, golden, threshold, diff, &diffImage)) {
+        printf("%s : the golden image is %ux%u, the render %ux%u\n",
+            name, golden.width, golden.height, optimized.width, optimized.height);
+        snprintf(path, sizeof(path), "regression/%s_golden.bmp", name);
+        saveBMPImage(path, golden);
+        pass = false;
+    } else {
+        printf("%s : optimized vs golden, %.4f%% of the pixels differ (max delta E %.1f)\n",
+            name, 100.0 * diff.differentFraction, diff.maxDeltaE);
+        if (diff.differentFraction > diffBudget) {
+            snprintf(path, sizeof(path), "regression/%s_golden_diff.bmp", name);
+            saveBMPImage(path, diffImage);
+            pass = false;
+        }
+    }
+
+    if (!pass) {
+        snprintf(path, sizeof(path), "regression/%s.bmp", name);
+        saveBMPImage(path, optimized);
+        snprintf(path, sizeof(path), "regression/%s_reference.bmp", name);
+        saveBMPImage(path, reference);
+        printf("%s : FAILED, see regression/%s*.bmp\n", name, name);
+    }
+    return pass;
+}
+
+int main(int argc, char * argv[])
 {
+    // --scene hall.obj : the model drawn instead of room.obj, with hall.lights
+    //   and hall.pvs next to it
+    // --skip-mips N : low memory mode, DDS textures lose their N largest levels
+    // --benchmark path.json : plays the camera path back in a hidden window,
+    //   rendering offscreen, and writes the frame time percentiles to
+    //   --benchmark-out (benchmark_results.json, - for stdout). Without a GPU,
+    //   Mesa's llvmpipe does it : LIBGL_ALWAYS_SOFTWARE=1 xvfb-run ./project_classroom ...
+    //   Also writes the render stats of every measured frame to --stats-out
+    //   (render_stats.csv), and with --stats-limits limits.json, fails (exit
+    //   code 2) if a frame goes over a limit, see common/renderstats.hpp
+    // --record path.json : saves the camera path of this session, for --benchmark
+    // --trace path.json : profiles every frame, for chrome://tracing
+    // --regression views.json : renders every key of a camera path offscreen,
+    //   with and without the culling and the LODs, and compares the images
+    //   with each other and with --golden (golden/view_NN.bmp, skipped if
+    //   missing, unless --golden was given), see common/imagediff.hpp. Exit
+    //   code 1 if one differs by more than --diff-budget (0.002) of its
+    //   pixels. --update-golden rewrites them.
+    // --capture walk.y4m : records the frames, as a Y4M video at --capture-fps
+    //   (60), or as prefix_000000.bmp... for any other name. R pauses it. With
+    //   --benchmark, the measured frames are recorded.
+    const char * benchmarkPath = NULL;
+    const char * benchmarkOutPath = "benchmark_results.json";
+    const char * recordPath = NULL;
+    const char * tracePath = NULL;
+    const char * statsOutPath = "render_stats.csv";
+    const char * statsLimitsPath = NULL;
+    const char * regressionPath = NULL;
+    const char * goldenDirectory = "golden";
+    bool goldenRequired = false;
+    bool updateGolden = false;
+    double diffBudget = 0.002;
+    const char * capturePath = NULL;
+    unsigned int captureFps = 60;
+    std::string scenePath = "room.obj";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc)
+            scenePath = argv[++i];
+        else if (strcmp(argv[i], "--skip-mips") == 0 && i + 1 < argc)
+            setTextureMipSkip((unsigned int)atoi(argv[++i]));
+        else if (strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc)
+            benchmarkPath = argv[++i];
+        else if (strcmp(argv[i], "--benchmark-out") == 0 && i + 1 < argc)
+            benchmarkOutPath = argv[++i];
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            recordPath = argv[++i];
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            tracePath = argv[++i];
+        else if (strcmp(argv[i], "--stats-out") == 0 && i + 1 < argc)
+            statsOutPath = argv[++i];
+        else if (strcmp(argv[i], "--stats-limits") == 0 && i + 1 < argc)
+            statsLimitsPath = argv[++i];
+        else if (strcmp(argv[i], "--regression") == 0 && i + 1 < argc)
+            regressionPath = argv[++i];
+        else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+            goldenDirectory = argv[++i];
+            goldenRequired = true;
+        }
+        else if (strcmp(argv[i], "--update-golden") == 0)
+            updateGolden = true;
+        else if (strcmp(argv[i], "--diff-budget") == 0 && i + 1 < argc)
+            diffBudget = atof(argv[++i]);
+        else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+            capturePath = argv[++i];
+        else if (strcmp(argv[i], "--capture-fps") == 0 && i + 1 < argc)
+            captureFps = (unsigned int)atoi(argv[++i]);
+    }
+    CameraPath cameraPath;
+    if (benchmarkPath && !loadCameraPath(benchmarkPath, cameraPath))
+        return -1;
+    // Each key is a view ; warmupFrames is how many frames it is given to settle
+    CameraPath regressionViews;
+    if (regressionPath && !loadCameraPath(regressionPath, regressionViews))
+        return -1;
+    bool offscreen = benchmarkPath || regressionPath;
+    RenderStatsLimits statsLimits;
+    if (statsLimitsPath && !loadRenderStatsLimits(statsLimitsPath, statsLimits))
+        return -1;
+
     // Initialize GLFW
     if (!glfwInit())
     {
@@ -50,6 +453,8 @@ int main(void)
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // To make macOS happy; should not be needed
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (offscreen)
+        glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
 
     // Open a window and create its OpenGL context
     int windowWidth = 1024;
@@ -71,6 +476,19 @@ int main(void)
         return -1;
     }
 
+    // The benchmark and the regression runs draw into their own framebuffer,
+    // the same size whatever the window system gives, and never wait for a
+    // vertical sync
+    OffscreenTarget offscreenTarget;
+    if (offscreen) {
+        glfwSwapInterval(0);
+        setInputEnabled(false);
+        if (!offscreenTarget.create(windowWidth, windowHeight)) {
+            glfwTerminate();
+            return -1;
+        }
+    }
+
     glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
@@ -83,55 +501,66 @@ int main(void)
     glDepthFunc(GL_LESS);
     glEnable(GL_CULL_FACE);
 
-    GLuint phongProgram = LoadShaders("Phong.vertexshader", "Phong.fragmentshader");
-    GLuint gouraudProgram = LoadShaders("Gouraud.vertexshader", "Gouraud.fragmentshader");
-    // GLuint depthProgram = LoadShaders("Depth.vertexshader", "Depth.fragmentshader");
-
-    bool usePhong = true;
-    GLuint programID = usePhong ? phongProgram : gouraudProgram;
-
-    const int NUM_LIGHTS = 9;
+    // room.lights (next to a room.obj made by tools/hallgen) places the
+    // lights, else they are a 3 x 3 grid under the classroom's ceiling
+    const std::string sceneBase = scenePath.substr(0, scenePath.rfind('.'));
+    const std::string lightsPath = sceneBase + ".lights", pvsPath = sceneBase + ".pvs";
     std::vector<glm::vec3> lightPositions;
-
-    float roomX = 9.0f;
-    float roomZ = 7.0f;
-    float ceilingY = -0.2f;
-
-    float stepX = roomX / 3.0f;
-    float stepZ = roomZ / 3.0f;
-
-    for (int iz = 1; iz <= 3; iz++) {
-        for (int ix = 1; ix <= 3; ix++) {
-            float x = stepX * ix - stepX / 2.0f; 
-            float y = ceilingY;                
-            float z = stepZ * iz - stepZ / 2.0f;  
-
-            lightPositions.push_back(glm::vec3(x, y, z));
-            std::cout << "light at (" << x << ", " << y << ", " << z << ")\n";
+    if (loadLights(lightsPath.c_str(), lightPositions)) {
+        std::cout << "Loaded " << lightsPath << " : " << lightPositions.size() << " lights\n";
+    } else {
+        float roomX = 9.0f;
+        float roomZ = 7.0f;
+        float ceilingY = -0.2f;
+
+        float stepX = roomX / 3.0f;
+        float stepZ = roomZ / 3.0f;
+
+        for (int iz = 1; iz <= 3; iz++) {
+            for (int ix = 1; ix <= 3; ix++) {
+                float x = stepX * ix - stepX / 2.0f; 
+                float y = ceilingY;                
+                float z = stepZ * iz - stepZ / 2.0f;  
+
+                lightPositions.push_back(glm::vec3(x, y, z));
+                std::cout << "light at (" << x << ", " << y << ", " << z << ")\n";
+            }
         }
     }
-
-    glm::vec3 mainLightPos = lightPositions[4];
-    glUseProgram(programID);
-
-    GLuint MatrixID = glGetUniformLocation(programID, "MVP");
-    GLuint ViewMatrixID = glGetUniformLocation(programID, "V");
-    GLuint ModelMatrixID = glGetUniformLocation(programID, "M");
-    GLuint TextureID = glGetUniformLocation(programID, "myTextureSampler");
-    GLuint MaterialColorID = glGetUniformLocation(programID, "materialColor");
-    GLint  useTextureLoc = glGetUniformLocation(programID, "useTexture");
-    GLint  lightPosLoc = glGetUniformLocation(programID, "LightPosition_worldspace");
-
-    glUniform3fv(lightPosLoc, NUM_LIGHTS, &lightPositions[0].x);
-
-    // GLint depthMVPLoc  = glGetUniformLocation(programID, "depthMVP");
-    // GLint shadowMapLoc = glGetUniformLocation(programID, "shadowMap");
-
-    // glUniform1i(TextureID, 0);     
-    // glUniform1i(shadowMapLoc, 1);
+    // The lights are a uniform array of the vertex (Gouraud) and fragment
+    // (Phong) shaders, a vec4 slot each next to the material arrays and the
+    // matrices : tools/hallgen writes MAX_LIGHTS at most, small enough for
+    // GL 3.3's 1024 components, but a hand written file may have more.
+    const int MAX_LIGHTS = 64;
+    GLint vertexComponents = 0, fragmentComponents = 0;
+    glGetIntegerv(GL_MAX_VERTEX_UNIFORM_COMPONENTS, &vertexComponents);
+    glGetIntegerv(GL_MAX_FRAGMENT_UNIFORM_COMPONENTS, &fragmentComponents);
+    const int reservedComponents = 4 * 3 * 32 + 4 * 16;   // materials, matrices and scalars
+    int maxLights = std::min(MAX_LIGHTS, (std::min(vertexComponents, fragmentComponents) - reservedComponents) / 4);
+    if ((int)lightPositions.size() > maxLights) {
+        std::cout << lightPositions.size() << " lights, the shaders take " << maxLights << " : the others are ignored\n";
+        lightPositions.resize(std::max(1, maxLights));
+    }
+    const int NUM_LIGHTS = (int)lightPositions.size();
+    glm::vec3 mainLightPos = lightPositions[NUM_LIGHTS / 2];
+
+    // Submitted now, picked up once the scene is loaded : with parallel shader
+    // compilation the driver works on them meanwhile. The untextured and
+    // textured variants are always needed, the virtual texture one is
+    // requested once we know there is a .vt to stream.
+    ShaderPermutations phongShaders("Phong.vertexshader", "Phong.fragmentshader", NUM_LIGHTS);
+    ShaderPermutations gouraudShaders("Gouraud.vertexshader", "Gouraud.fragmentshader", NUM_LIGHTS);
+    for (ShaderPermutations * shaders : { &phongShaders, &gouraudShaders }) {
+        shaders->request(0);
+        shaders->request(SHADER_TEXTURED);
+    }
+    ShaderPermutations depthShaders("Depth.vertexshader", "Depth.fragmentshader");
+    ShaderPermutations feedbackShaders("Feedback.vertexshader", "Feedback.fragmentshader");
+    depthShaders.request(0);
+    feedbackShaders.request(0);
 
     std::vector<MaterialMesh> materialMeshes;
-    loadOBJWithMaterials("room.obj", materialMeshes);
+    loadOBJWithMaterials(scenePath.c_str(), materialMeshes);
     std::cout << "Loaded " << materialMeshes.size() << " material meshes\n";
 
 	// model size
@@ -157,67 +586,334 @@ int main(void)
     std::cout << "Bounding box min: " << minV.x << ", " << minV.y << ", " << minV.z << std::endl;
     std::cout << "Bounding box max: " << maxV.x << ", " << maxV.y << ", " << maxV.z << std::endl;
 
+    // Precomputed visibility, baked offline by tools/pvsbake. For each cluster,
+    // the cells it touches : it is drawn if one of them is seen from the camera cell.
+    PVSData pvs;
+    bool usePVS = loadPVS(pvsPath.c_str(), pvs);
+    if (usePVS) {
+        unsigned int triangles = 0;
+        for (auto &m : materialMeshes) triangles += (unsigned int)m.vertices.size() / 3;
+        if (triangles != pvs.sourceTriangles) {
+            std::cout << pvsPath << " was baked from another version of " << scenePath << ", ignoring it\n";
+            usePVS = false;
+        } else {
+            std::cout << "Loaded " << pvsPath << " : " << pvs.numCells() << " cells\n";
+        }
+    }
+    std::vector< std::vector<int> > clusterCells;
+
+    // Occluders for the CPU culler : the big, closed surfaces of the room.
+    // The objects it tests are the clusters.
+    std::vector<glm::vec3> occluderTriangles;
+    std::vector<OcclusionBox> clusterBoxes;
+
+    // Every mesh goes in the same buffers, so that a whole material bucket
+    // is one draw call
+    std::vector<glm::vec3> sceneVertices, sceneNormals;
+    std::vector<glm::vec2> sceneUVs;
+    std::vector<unsigned short> sceneMaterials;
+    std::vector<unsigned int> sceneIndices;
+
 	// material meshes to GLMeshes
     for (auto &m : materialMeshes)
     {
         GLMesh glmesh;
-        glmesh.vertexCount = (int)m.vertices.size();
+
+        // tools/hallgen's texture variants : wood_2 is wood with bench_wood_2.dds
+        std::string material = m.materialName;
+        std::string variant;
+        size_t underscore = material.rfind('_');
+        if (underscore != std::string::npos && underscore + 1 < material.size() &&
+            material.find_first_not_of("0123456789", underscore + 1) == std::string::npos) {
+            variant = material.substr(underscore);
+            material = material.substr(0, underscore);
+        }
+
+        if (material == "wall" || material == "board" || material == "podium")
+            occluderTriangles.insert(occluderTriangles.end(), m.vertices.begin(), m.vertices.end());
         glmesh.useTexture  = false;
-        glmesh.textureID   = 0;
+        glmesh.metarialColor = glm::vec3(1.0f);
 
-        if (m.materialName == "wood") {
-            glmesh.textureID = loadBMP_custom("bench_wood.bmp");
+        if (material == "wood") {
+            glmesh.texturePath = variantTexturePath("bench_wood.bmp", variant);
             glmesh.useTexture = true;
         }
-        else if (m.materialName == "board") {
+        else if (material == "board") {
             glmesh.useTexture   = false;    
             glmesh.metarialColor = glm::vec3(.03f, .30f, .11f);
         }
-        else if (m.materialName == "projector") {
+        else if (material == "projector") {
             glmesh.useTexture   = false;
             glmesh.metarialColor = glm::vec3(0.8f, 0.8f, 0.8f);
         }
-		else if(m.materialName == "podium"){
+		else if(material == "podium"){
 			glmesh.useTexture = false;
 			glmesh.metarialColor = glm::vec3(0.88f, 0.63f, 0.27f); // 
         }
-        else if (m.materialName == "wall") {
+        else if (material == "wall") {
 			// glmesh.useTexture = false;
 			// glmesh.metarialColor = glm::vec3(1.0f, .99f, .81f); // yellowish
             glmesh.useTexture = true;
-            glmesh.textureID = loadBMP_custom("wall.bmp");
+            glmesh.texturePath = variantTexturePath("wall.bmp", variant);
         }
-		else if (m.materialName == "metal"){
+		else if (material == "metal"){
 			glmesh.useTexture = false;
 			glmesh.metarialColor = glm::vec3(0.8f, 0.8f, 0.8f); // light gray
 		}
-		else if (m.materialName == "floor") {
+		else if (material == "floor") {
 			glmesh.useTexture = true;
-			glmesh.textureID = loadBMP_custom("floor_texture.bmp");
+			glmesh.texturePath = variantTexturePath("floor_texture.bmp", variant);
         }
 
-        MaterialMesh indexedMesh = m;
+        MaterialMesh indexedMesh;
+        indexedMesh.materialName = m.materialName;
+        std::vector<unsigned int> unclustered;
+        indexVBO(m.vertices, m.uvs, m.normals, unclustered, indexedMesh.vertices, indexedMesh.uvs, indexedMesh.normals);
+        glmesh.vertexCount = (int)indexedMesh.vertices.size();
+        std::vector<glm::vec3>().swap(m.vertices);
+        std::vector<glm::vec2>().swap(m.uvs);
+        std::vector<glm::vec3>().swap(m.normals);
+
+        // The objects of the mesh in clusters, LOD 0 sorted cluster by cluster
+        std::vector<MeshCluster> clusters;
+        buildMeshClusters(indexedMesh.vertices, unclustered, CLUSTER_SIZE, clusters, glmesh.indices);
+        std::vector<unsigned int>().swap(unclustered);
+
+        // Each cluster on its own vertices : meshlets for the full
+        // resolution level, so that none straddles two clusters (its
+        // triangles are reordered in place), then its LOD chain, appended
+        // after LOD 0. Each level is simplified from the previous one ; stop
+        // when the simplifier can't get meaningfully below it.
+        glmesh.firstCluster = (unsigned int)clusterBoxes.size();
+        std::vector<unsigned int> localIndices, vertexMap, reordered;
+        std::vector<glm::vec3> localPositions, localNormals, clusterTriangles;
+        std::vector<Meshlet> meshlets;
+        unsigned int lodTriangles[MAX_LODS] = {};
+        for (auto &c : clusters) {
+            compactClusterVertices(glmesh.indices, c.indexOffset, c.indexCount, localIndices, vertexMap);
+            localPositions.resize(vertexMap.size());
+            localNormals.resize(vertexMap.size());
+            for (size_t i = 0; i < vertexMap.size(); i++) {
+                localPositions[i] = indexedMesh.vertices[vertexMap[i]];
+                localNormals[i] = indexedMesh.normals[vertexMap[i]];
+            }
+            buildMeshlets(localPositions, localIndices, 64, 124, meshlets, reordered);
+            for (size_t i = 0; i < reordered.size(); i++)
+                glmesh.indices[c.indexOffset + i] = vertexMap[reordered[i]];
+
+            GLCluster cluster;
+            cluster.currentLod = 0;
+            cluster.boundsMin = c.boundsMin;
+            cluster.boundsMax = c.boundsMax;
+            cluster.firstMeshlet = (unsigned int)glmesh.meshlets.size();
+            cluster.meshletCount = (unsigned int)meshlets.size();
+            MeshLOD full = { c.indexOffset, c.indexCount };
+            cluster.lods.push_back(full);
+            lodTriangles[0] += c.indexCount / 3;
+
+            float diagonal = glm::length(c.boundsMax - c.boundsMin);
+            for (int l = 0; l < MAX_LODS - 1; l++) {
+                std::vector<unsigned int> simplified;
+                float maxError = (diagonal * LOD_ERROR[l]) * (diagonal * LOD_ERROR[l]);
+                simplifyMesh(localPositions, localNormals, reordered,
+                    (size_t)(c.indexCount * LOD_RATIO[l]), maxError, simplified);
+                if (simplified.empty() || simplified.size() > reordered.size() * 9 / 10)
+                    break;
+                MeshLOD lod = { (unsigned int)glmesh.indices.size(), (unsigned int)simplified.size() };
+                cluster.lods.push_back(lod);
+                lodTriangles[l + 1] += lod.indexCount / 3;
+                for (size_t i = 0; i < simplified.size(); i++)
+                    glmesh.indices.push_back(vertexMap[simplified[i]]);
+                reordered.swap(simplified);
+            }
+
+            for (auto ml : meshlets) {
+                ml.indexOffset += c.indexOffset;
+                glmesh.meshlets.push_back(ml);
+            }
+            glmesh.clusters.push_back(std::move(cluster));
+            OcclusionBox box = { c.boundsMin, c.boundsMax };
+            clusterBoxes.push_back(box);
+
+            clusterCells.push_back(std::vector<int>());
+            if (usePVS) {
+                clusterTriangles.clear();
+                for (unsigned int i = c.indexOffset; i < c.indexOffset + c.indexCount; i++)
+                    clusterTriangles.push_back(indexedMesh.vertices[glmesh.indices[i]]);
+                pvs.cellsOfTriangles(clusterTriangles, clusterCells.back());
+            }
+        }
 
-        glGenVertexArrays(1, &glmesh.vao);
-        glBindVertexArray(glmesh.vao);
+        // Triangles of each level, over the clusters that have it
+        std::cout << m.materialName << " : " << glmesh.vertexCount << " vertices, "
+                  << glmesh.clusters.size() << " clusters, "
+                  << glmesh.meshlets.size() << " meshlets, LOD triangles";
+        for (int l = 0; l < MAX_LODS && lodTriangles[l]; l++) std::cout << " " << lodTriangles[l];
+        std::cout << "\n";
+
+        glmesh.baseVertex = (GLint)sceneVertices.size();
+        glmesh.firstIndex = (unsigned int)sceneIndices.size();
+        sceneVertices.insert(sceneVertices.end(), indexedMesh.vertices.begin(), indexedMesh.vertices.end());
+        sceneUVs.insert(sceneUVs.end(), indexedMesh.uvs.begin(), indexedMesh.uvs.end());
+        sceneNormals.insert(sceneNormals.end(), indexedMesh.normals.begin(), indexedMesh.normals.end());
+        sceneMaterials.insert(sceneMaterials.end(), indexedMesh.vertices.size(), (unsigned short)GLMeshes.size());
+        sceneIndices.insert(sceneIndices.end(), glmesh.indices.begin(), glmesh.indices.end());
+        GLMeshes.push_back(std::move(glmesh));
+    }
+
+    // The material of a vertex indexes uniform arrays in the shaders
+    const int MAX_MATERIALS = 32;
+    if (GLMeshes.size() > MAX_MATERIALS) {
+        fprintf(stderr, "%s has %d materials, the shaders handle %d\n", scenePath.c_str(), (int)GLMeshes.size(), MAX_MATERIALS);
+        getchar();
+        glfwTerminate();
+        return -1;
+    }
+
+    GLuint sceneVAO;
+    glGenVertexArrays(1, &sceneVAO);
+    glBindVertexArray(sceneVAO);
+
+    GLuint vertexbuffer;
+    glGenBuffers(1, &vertexbuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+    glBufferData(GL_ARRAY_BUFFER, sceneVertices.size() * sizeof(glm::vec3), &sceneVertices[0], GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+    GLuint uvbuffer;
+    glGenBuffers(1, &uvbuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
+    glBufferData(GL_ARRAY_BUFFER, sceneUVs.size() * sizeof(glm::vec2), &sceneUVs[0], GL_STATIC_DRAW);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+    GLuint normalbuffer;
+    glGenBuffers(1, &normalbuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
+    glBufferData(GL_ARRAY_BUFFER, sceneNormals.size() * sizeof(glm::vec3), &sceneNormals[0], GL_STATIC_DRAW);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+    GLuint materialbuffer;
+    glGenBuffers(1, &materialbuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, materialbuffer);
+    glBufferData(GL_ARRAY_BUFFER, sceneMaterials.size() * sizeof(unsigned short), &sceneMaterials[0], GL_STATIC_DRAW);
+    glEnableVertexAttribArray(3);
+    glVertexAttribIPointer(3, 1, GL_UNSIGNED_SHORT, 0, 0);
+
+    GLuint elementbuffer;
+    glGenBuffers(1, &elementbuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sceneIndices.size() * sizeof(unsigned int), &sceneIndices[0], GL_STATIC_DRAW);
+
+    // The GL has its copy now
+    std::vector<glm::vec3>().swap(sceneVertices);
+    std::vector<glm::vec2>().swap(sceneUVs);
+    std::vector<glm::vec3>().swap(sceneNormals);
+    std::vector<unsigned short>().swap(sceneMaterials);
+    std::vector<unsigned int>().swap(sceneIndices);
+
+    // Textures of the same size become layers of one array, the others share
+    // an atlas : the meshes are bucketed by array, not by texture.
+    // A material with a page file streams its texture page by page instead :
+    // one virtual texture for now, 15x15 cache slots of 136 texels.
+    VirtualTexture virtualTexture;
+    int vtMaterial = -1;
+    std::vector<std::string> texturePaths;
+    for (size_t i = 0; i < GLMeshes.size(); i++) {
+        GLMesh &m = GLMeshes[i];
+        if (!m.useTexture) continue;
+        std::string vtPath = virtualTexturePath(m.texturePath);
+        if (vtMaterial < 0 && !vtPath.empty() &&
+            virtualTexture.load(vtPath.c_str(), 15, windowWidth, windowHeight, 8)) {
+            vtMaterial = (int)i;
+            continue;
+        }
+        texturePaths.push_back(m.texturePath);
+    }
+    MaterialTextures materialTextures;
+    if (!texturePaths.empty() && !packMaterialTextures(texturePaths, 8, materialTextures)) {
+        fprintf(stderr, "Failed to load the textures\n");
+        getchar();
+        glfwTerminate();
+        return -1;
+    }
 
-		glGenBuffers(1, &glmesh.vertexbuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, glmesh.vertexbuffer);
-        glBufferData(GL_ARRAY_BUFFER, indexedMesh.vertices.size()*sizeof(glm::vec3), &indexedMesh.vertices[0], GL_STATIC_DRAW);
+    if (vtMaterial >= 0) {
+        phongShaders.request(SHADER_VIRTUAL_TEXTURE);
+        gouraudShaders.request(SHADER_VIRTUAL_TEXTURE);
+    }
+    bool usePhong = true;
 
-        glGenBuffers(1, &glmesh.uvbuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, glmesh.uvbuffer);
-        glBufferData(GL_ARRAY_BUFFER, indexedMesh.uvs.size()*sizeof(glm::vec2), &indexedMesh.uvs[0], GL_STATIC_DRAW);
+    // GLint depthMVPLoc  = glGetUniformLocation(programID, "depthMVP");
+    // GLint shadowMapLoc = glGetUniformLocation(programID, "shadowMap");
 
-        glGenBuffers(1, &glmesh.normalbuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, glmesh.normalbuffer);
-        glBufferData(GL_ARRAY_BUFFER, indexedMesh.normals.size()*sizeof(glm::vec3), &indexedMesh.normals[0], GL_STATIC_DRAW);
+    // glUniform1i(TextureID, 0);     
+    // glUniform1i(shadowMapLoc, 1);
 
-		/*glGenBuffers(1, &glmesh.elementbuffer);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glmesh.elementbuffer);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0], GL_STATIC_DRAW);*/
-        GLMeshes.push_back(glmesh);
+    std::vector<glm::vec3> materialColors;
+    std::vector<glm::vec4> materialUVRects;
+    std::vector<float> materialLayers;
+    const size_t vtBucket = 1 + materialTextures.arrays.size();
+    for (size_t i = 0, t = 0; i < GLMeshes.size(); i++) {
+        GLMesh &m = GLMeshes[i];
+        PackedTexture packed = { 0, 0, glm::vec4(0, 0, 1, 1) };
+        m.bucket = 0;
+        if ((int)i == vtMaterial) {
+            m.bucket = vtBucket;
+        } else if (m.useTexture) {
+            packed = materialTextures.textures[t++];
+            m.bucket = 1 + packed.array;
+        }
+        materialColors.push_back(m.metarialColor);
+        materialUVRects.push_back(packed.uvRect);
+        materialLayers.push_back((float)packed.layer);
     }
+    // Which variant draws each bucket : plain colours, texture arrays, virtual texture
+    std::vector<unsigned int> bucketFeatures(vtBucket + 1, SHADER_TEXTURED);
+    bucketFeatures[0] = 0;
+    bucketFeatures[vtBucket] = SHADER_VIRTUAL_TEXTURE;
+
+    // The uniforms that never change, and the locations kept across frames :
+    // at load time, and again whenever a hot reload swaps programs
+    GLuint depthProgram = 0, feedbackProgram = 0;
+    GLint  prepassMVPLoc = -1, feedbackMVPLoc = -1;
+    auto setupPrograms = [&]() {
+        depthProgram = depthShaders.get(0);
+        feedbackProgram = feedbackShaders.get(0);
+        prepassMVPLoc = glGetUniformLocation(depthProgram, "depthMVP");
+        feedbackMVPLoc = glGetUniformLocation(feedbackProgram, "MVP");
+
+        std::vector<GLuint> shadingPrograms = phongShaders.getPrograms();
+        std::vector<GLuint> gouraudPrograms = gouraudShaders.getPrograms();
+        shadingPrograms.insert(shadingPrograms.end(), gouraudPrograms.begin(), gouraudPrograms.end());
+        for (GLuint program : shadingPrograms) {
+            glUseProgram(program);
+            glUniform3fv(glGetUniformLocation(program, "materialColor"), (GLsizei)GLMeshes.size(), &materialColors[0].x);
+            glUniform4fv(glGetUniformLocation(program, "materialUVRect"), (GLsizei)GLMeshes.size(), &materialUVRects[0].x);
+            glUniform1fv(glGetUniformLocation(program, "materialLayer"), (GLsizei)GLMeshes.size(), &materialLayers[0]);
+            glUniform1i(glGetUniformLocation(program, "myTextureSampler"), 0);
+            if (vtMaterial >= 0)
+                virtualTexture.setUniforms(program, 1, 2, false);
+        }
+        if (vtMaterial >= 0) {
+            virtualTexture.setUniforms(feedbackProgram, 1, 2, true);
+            glUniform1i(glGetUniformLocation(feedbackProgram, "vtMaterial"), vtMaterial);
+        }
+    };
+    setupPrograms();
+
+    // Saving a shader recompiles it in the background, see ShaderPermutations::reload
+    std::vector<ShaderPermutations *> allShaders = { &phongShaders, &gouraudShaders, &depthShaders, &feedbackShaders };
+    FileWatcher shaderWatcher;
+    for (ShaderPermutations * shaders : allShaders) {
+        shaderWatcher.watch(shaders->getVertexPath().c_str());
+        shaderWatcher.watch(shaders->getFragmentPath().c_str());
+    }
+    // The last bucket is the virtual texture's
+    std::vector<DrawBatch> buckets(vtBucket + 1);
+    DrawBatch visibleBatch;
 
 	// const GLuint SHADOW_WIDTH  = 2048;
 	// const GLuint SHADOW_HEIGHT = 2048;
@@ -252,24 +948,357 @@ int main(void)
 	// // depth shader uniform
 	// GLuint depthMVPLocation = glGetUniformLocation(depthProgram, "depthMVP");
 
+    // Depth pre-pass : lay down depth with the Depth shader first, then shade
+    // with GL_EQUAL so every pixel runs the 9-light fragment shader only once.
+    // PREPASS_AUTO turns it on when the measured overdraw gets too high, and
+    // off again only once it is well below : between the two thresholds, and
+    // for a second after each switch, it stays as it is.
+    enum { PREPASS_AUTO, PREPASS_ON, PREPASS_OFF };
+    const char* prepassModeNames[] = { "auto", "on", "off" };
+    int prepassMode = PREPASS_AUTO;
+    bool usePrepass = false;
+    const double OVERDRAW_ON_THRESHOLD = 1.6;
+    const double OVERDRAW_OFF_THRESHOLD = 1.3;
+    const double PREPASS_MIN_DWELL = 1.0;
+    double prepassSwitchTime = -PREPASS_MIN_DWELL;
+
+    // GL_SAMPLES_PASSED queries, double buffered so that we read last
+    // frame's result instead of waiting for the GPU.
+    GLuint depthQueries[2], colorQueries[2];
+    bool   depthQueryIssued[2] = { false, false };
+    bool   colorQueryIssued[2] = { false, false };
+    glGenQueries(2, depthQueries);
+    glGenQueries(2, colorQueries);
+    int queryFrame = 0;
+
+    // Of the framebuffer the frames go to : the offscreen target is single
+    // sampled, the window has GLFW_SAMPLES
+    GLint samplesPerPixel = 1;
+    if (offscreen)
+        offscreenTarget.bind();
+    else
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glGetIntegerv(GL_SAMPLES, &samplesPerPixel);
+    if (samplesPerPixel < 1) samplesPerPixel = 1;
+    const double pixelSamples = double(windowWidth) * windowHeight * samplesPerPixel;
+
+    double overdraw = 0.0;            // depth-tested samples per covered screen sample
+    GLuint64 shadedSamples = 0;       // samples that ran the lighting shader, last frame
+    GLuint64 shadedSamplesTotal = 0;  // accumulated for the 1 second report
+    int prepassSwitches = 0;          // auto mode toggles, for the report
+    int statFrames = 0;
+
+    // CPU occlusion culling of the clusters, on a worker thread. O toggles it.
+    OcclusionCuller occlusionCuller(256, 192);
+    occlusionCuller.setOccluders(occluderTriangles);
+    occlusionCuller.setObjects(clusterBoxes);
+    std::cout << "Occlusion culler : " << occluderTriangles.size() / 3 << " occluder triangles, "
+              << clusterBoxes.size() << " clusters\n";
+    bool useOcclusionCulling = true;
+    std::vector<char> clusterVisible(clusterBoxes.size(), 1);
+    std::vector<char> meshVisible(GLMeshes.size(), 1);
+    int culledTotal = 0;
+    int pvsCulledTotal = 0;
+    bool pvsLoaded = usePVS;
+
+    // Distance based LOD selection, L toggles it
+    bool useLOD = true;
+    // Per meshlet frustum and normal cone culling, M toggles it
+    bool useMeshletCulling = true;
+    unsigned long long trianglesFull = 0, trianglesSubmitted = 0;
+
     // For speed computation
     double lastTime = glfwGetTime();
     int nbFrames = 0;
+    bool firstFrame = true;
+
+    // --benchmark : warm-up frames at the first key, then the measured ones
+    // spread evenly along the path
+    BenchmarkResults benchmark;
+    benchmark.scriptPath = benchmarkPath ? benchmarkPath : "";
+    benchmark.renderer = (const char *)glGetString(GL_RENDERER);
+    benchmark.version = (const char *)glGetString(GL_VERSION);
+    benchmark.warmupFrames = cameraPath.warmupFrames;
+    GPUFrameTimer gpuTimer;
+    unsigned int benchmarkFrame = 0;
+    double previousFrameStart = 0.0;
+    bool benchmarkDone = false;
+
+    // --record : a key every quarter of a second
+    CameraPath recordedPath;
+    double recordStart = glfwGetTime();
+
+    // F shows where the frame time goes. The font is the tutorials' one,
+    // copy Holstein.DDS next to the shaders to get the overlay.
+    bool showProfiler = false;
+    bool haveOverlayFont = false;
+    if (FILE * font = fopen("Holstein.DDS", "rb")) {
+        fclose(font);
+        initText2D("Holstein.DDS");
+        haveOverlayFont = true;
+    }
+    if (tracePath)
+        profilerStartTrace();
+
+    // --capture : read back asynchronously, so recording costs about a copy
+    // per frame instead of a pipeline stall
+    FrameCapture frameCapture;
+    bool capturePaused = false;
+    if (capturePath) {
+        int captureWidth = windowWidth, captureHeight = windowHeight;
+        if (!offscreen)
+            glfwGetFramebufferSize(window, &captureWidth, &captureHeight);
+        if (!frameCapture.start(capturePath, captureWidth, captureHeight, captureFps))
+            return -1;
+    }
+
+    // Counted where the GL calls are made. The worst frame of a benchmark is
+    // checked against --stats-limits.
+    RenderStats renderStats, lastRenderStats, worstRenderStats;
+    FILE * statsFile = NULL;
+    if (benchmarkPath) {
+        statsFile = fopen(statsOutPath, "w");
+        if (statsFile)
+            writeRenderStatsHeader(statsFile);
+        else
+            printf("Could not write %s\n", statsOutPath);
+    }
+
+    // --regression : each view is drawn twice, with every optimization on and
+    // with none of them (the reference), captured once it has settled and the
+    // virtual texture has all its pages
+    enum { PASS_OPTIMIZED, PASS_REFERENCE };
+    unsigned int regressionView = 0, regressionFrame = 0;
+    int regressionPass = PASS_OPTIMIZED;
+    RGBAImage optimizedImage, referenceImage;
+    unsigned int regressionFailures = 0;
+    if (regressionPath) {
+#ifdef _WIN32
+        _mkdir("regression");
+        if (updateGolden) _mkdir(goldenDirectory);
+#else
+        mkdir("regression", 0755);
+        if (updateGolden) mkdir(goldenDirectory, 0755);
+#endif
+    }
+
+    // The material textures load in the background, at most this many bytes
+    // of levels uploaded per frame. The benchmark and the regression runs
+    // wait for all of them : measured frames and captures see the real thing.
+    const size_t TEXTURE_UPLOAD_BUDGET = 2 * 1024 * 1024;
+    unsigned int texturesPending = updateMaterialTextures(materialTextures) + updateAsyncTextures(TEXTURE_UPLOAD_BUDGET);
+    while (offscreen && texturesPending > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        texturesPending = updateMaterialTextures(materialTextures) + updateAsyncTextures(TEXTURE_UPLOAD_BUDGET);
+    }
+
+    // The loaders above may have bound the window's framebuffer
+    if (offscreen)
+        offscreenTarget.bind();
 
     do {
         double currentTime = glfwGetTime();
         nbFrames++;
-			if(glfwGetKey(window, GLFW_KEY_SPACE ) == GLFW_PRESS){
+        profilerBeginFrame();
+        lastRenderStats = renderStats;
+        renderStats.reset();
+
+        if (texturesPending > 0) {
+            texturesPending = updateMaterialTextures(materialTextures) + updateAsyncTextures(TEXTURE_UPLOAD_BUDGET);
+            if (texturesPending == 0)
+                printTextureCacheStats();
+        }
+
+        bool measured = false;
+        if (benchmarkPath) {
+            measured = benchmarkFrame >= cameraPath.warmupFrames;
+            float t = cameraPath.keys.front().time;
+            if (measured && cameraPath.frames > 1)
+                t += cameraPath.duration() * (benchmarkFrame - cameraPath.warmupFrames) / (cameraPath.frames - 1);
+            CameraKey key = sampleCameraPath(cameraPath, t);
+            setCameraPose(key.position, key.horizontalAngle, key.verticalAngle);
+            if (measured) {
+                if (benchmarkFrame > cameraPath.warmupFrames)
+                    benchmark.frameMilliseconds.push_back((currentTime - previousFrameStart) * 1000.0);
+                gpuTimer.begin();
+            }
+            previousFrameStart = currentTime;
+            benchmarkFrame++;
+            benchmarkDone = benchmarkFrame >= cameraPath.warmupFrames + cameraPath.frames;
+        }
+        if (regressionPath) {
+            const CameraKey & key = regressionViews.keys[regressionView];
+            setCameraPose(key.position, key.horizontalAngle, key.verticalAngle);
+            bool optimized = regressionPass == PASS_OPTIMIZED;
+            useOcclusionCulling = optimized;
+            usePVS = optimized && pvsLoaded;
+            useLOD = optimized;
+            useMeshletCulling = optimized;
+            regressionFrame++;
+        }
+
+        PROFILE_BEGIN("input");
+        // Update camera matrices
+        computeMatricesFromInputs();
+        if (recordPath && (recordedPath.keys.empty() || currentTime - recordStart >= recordedPath.keys.back().time + 0.25)) {
+            CameraKey key;
+            key.time = (float)(currentTime - recordStart);
+            getCameraPose(key.position, key.horizontalAngle, key.verticalAngle);
+            recordedPath.keys.push_back(key);
+        }
+        glm::mat4 ProjectionMatrix = getProjectionMatrix();
+		glm::mat4 ViewMatrix = getViewMatrix();
+		glm::mat4 ModelMatrix = glm::mat4(1.0f);
+		glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
+		glm::vec3 cameraPosition = glm::vec3(glm::inverse(ViewMatrix)[3]);
+
+		// Start culling right away, it overlaps with the rest of the frame setup
+		// and with the GPU finishing the previous frame.
+		if (useOcclusionCulling) {
+			PROFILE_SCOPE("cull submit");
+			occlusionCuller.submit(MVP);
+		}
+
+		if(glfwGetKey(window, GLFW_KEY_SPACE ) == GLFW_PRESS){
 			usePhong = !usePhong;
 			while(glfwGetKey(window, GLFW_KEY_SPACE ) == GLFW_PRESS){
 				glfwPollEvents();
 			}
 		}
-		programID = usePhong ? phongProgram : gouraudProgram;
+		if(glfwGetKey(window, GLFW_KEY_O ) == GLFW_PRESS){
+			useOcclusionCulling = !useOcclusionCulling;
+			while(glfwGetKey(window, GLFW_KEY_O ) == GLFW_PRESS){
+				glfwPollEvents();
+			}
+		}
+		if(glfwGetKey(window, GLFW_KEY_L ) == GLFW_PRESS){
+			useLOD = !useLOD;
+			while(glfwGetKey(window, GLFW_KEY_L ) == GLFW_PRESS){
+				glfwPollEvents();
+			}
+		}
+		if(glfwGetKey(window, GLFW_KEY_M ) == GLFW_PRESS){
+			useMeshletCulling = !useMeshletCulling;
+			while(glfwGetKey(window, GLFW_KEY_M ) == GLFW_PRESS){
+				glfwPollEvents();
+			}
+		}
+		if(glfwGetKey(window, GLFW_KEY_P ) == GLFW_PRESS){
+			prepassMode = (prepassMode + 1) % 3;
+			while(glfwGetKey(window, GLFW_KEY_P ) == GLFW_PRESS){
+				glfwPollEvents();
+			}
+		}
+		if(glfwGetKey(window, GLFW_KEY_R ) == GLFW_PRESS){
+			capturePaused = !capturePaused;
+			if (frameCapture.isRecording())
+				printf("Capture %s\n", capturePaused ? "paused" : "resumed");
+			while(glfwGetKey(window, GLFW_KEY_R ) == GLFW_PRESS){
+				glfwPollEvents();
+			}
+		}
+		if(glfwGetKey(window, GLFW_KEY_F ) == GLFW_PRESS){
+			showProfiler = !showProfiler && haveOverlayFont;
+			if (!haveOverlayFont)
+				printf("No Holstein.DDS, no profiler overlay\n");
+			while(glfwGetKey(window, GLFW_KEY_F ) == GLFW_PRESS){
+				glfwPollEvents();
+			}
+		}
+		PROFILE_END();
+
+		PROFILE_BEGIN("shader reload");
+		std::vector<std::string> changedShaders;
+		if (shaderWatcher.poll(changedShaders))
+			for (ShaderPermutations * shaders : allShaders) {
+				bool changed = false;
+				for (const std::string & path : changedShaders)
+					changed = changed || shaders->uses(path);
+				if (changed)
+					shaders->reload();
+			}
+		bool shadersSwapped = false;
+		for (ShaderPermutations * shaders : allShaders)
+			shadersSwapped = shaders->update() || shadersSwapped;
+		if (shadersSwapped)
+			setupPrograms();
+		PROFILE_END();
+		ShaderPermutations & shading = usePhong ? phongShaders : gouraudShaders;
+
+		// Collect the queries issued two frames ago (same slot), if they are ready.
+		{
+			GLuint64 depthSamples = 0, colorSamples = 0;
+			GLint available = 0;
+			bool haveColor = false, haveDepth = false;
+			if (colorQueryIssued[queryFrame]) {
+				glGetQueryObjectiv(colorQueries[queryFrame], GL_QUERY_RESULT_AVAILABLE, &available);
+				if (available) {
+					glGetQueryObjectui64v(colorQueries[queryFrame], GL_QUERY_RESULT, &colorSamples);
+					colorQueryIssued[queryFrame] = false;
+					haveColor = true;
+				}
+			}
+			if (depthQueryIssued[queryFrame]) {
+				glGetQueryObjectiv(depthQueries[queryFrame], GL_QUERY_RESULT_AVAILABLE, &available);
+				if (available) {
+					glGetQueryObjectui64v(depthQueries[queryFrame], GL_QUERY_RESULT, &depthSamples);
+					depthQueryIssued[queryFrame] = false;
+					haveDepth = true;
+				}
+			}
+			if (haveColor) {
+				shadedSamples = colorSamples;
+				shadedSamplesTotal += colorSamples;
+				statFrames++;
+				// With the pre-pass on, the colour pass only sees the front-most
+				// surface; the depth pass still measures the real overdraw.
+				overdraw = double(haveDepth ? depthSamples : colorSamples) / pixelSamples;
+			}
+		}
+
+		if (prepassMode == PREPASS_AUTO) {
+			bool wanted = usePrepass ? overdraw > OVERDRAW_OFF_THRESHOLD : overdraw > OVERDRAW_ON_THRESHOLD;
+			if (wanted != usePrepass && currentTime - prepassSwitchTime >= PREPASS_MIN_DWELL) {
+				usePrepass = wanted;
+				prepassSwitchTime = currentTime;
+				prepassSwitches++;
+			}
+		} else {
+			usePrepass = (prepassMode == PREPASS_ON);
+		}
+
 		if ( currentTime - lastTime >= 1.0 ){ // If last prinf() was more than 1sec ago
 			// printf and reset
 			printf("%f ms/frame\n", 1000.0/double(nbFrames));
             printf("%s \n", usePhong ? "Phong" : "Gouraud");
+            printf("depth pre-pass %s (%s, %d switches), overdraw %.2f, %.0f shaded samples/frame (%llu last frame, %.2f per pixel)\n",
+                usePrepass ? "on" : "off", prepassModeNames[prepassMode], prepassSwitches, overdraw,
+                statFrames ? double(shadedSamplesTotal) / statFrames : 0.0,
+                (unsigned long long)shadedSamples, double(shadedSamples) / pixelSamples);
+            prepassSwitches = 0;
+            printf("occlusion culling %s, %.1f clusters culled/frame (%.3f ms on the worker)\n",
+                useOcclusionCulling ? "on" : "off", double(culledTotal) / nbFrames,
+                occlusionCuller.getCullTime());
+            culledTotal = 0;
+            if (usePVS)
+                printf("PVS : %.1f clusters culled/frame\n", double(pvsCulledTotal) / nbFrames);
+            pvsCulledTotal = 0;
+            printf("LOD %s, meshlet culling %s : %.0f triangles/frame submitted, %.0f without\n",
+                useLOD ? "on" : "off", useMeshletCulling ? "on" : "off",
+                double(trianglesSubmitted) / nbFrames, double(trianglesFull) / nbFrames);
+            trianglesSubmitted = 0;
+            trianglesFull = 0;
+            printf("last frame : %llu draw calls, %llu program binds, %llu texture binds, %llu uniform uploads, %llu bytes uploaded\n",
+                lastRenderStats.drawCalls, lastRenderStats.programBinds, lastRenderStats.textureBinds,
+                lastRenderStats.uniformUploads, lastRenderStats.uploadBytes);
+            if (vtMaterial >= 0) {
+                const PageResidency & residency = virtualTexture.getResidency();
+                printf("virtual texture : %u/%u pages resident, %u loading, %u misses, %u evictions\n",
+                    (unsigned int)residency.getResidentCount(), residency.getNumSlots(),
+                    (unsigned int)residency.getLoadingCount(), residency.getMisses(), residency.getEvictions());
+            }
+            shadedSamplesTotal = 0;
+            statFrames = 0;
             nbFrames = 0;
             lastTime += 1.0;
         }
@@ -324,8 +1353,83 @@ int main(void)
         // glViewport(0, 0, windowWidth, windowHeight);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // For now, we keep the same programID (usePhong).
-        glUseProgram(programID);
+		PROFILE_BEGIN("culling");
+		if (useOcclusionCulling) {
+			clusterVisible = occlusionCuller.wait();
+			culledTotal += occlusionCuller.getCulledCount();
+		} else {
+			std::fill(clusterVisible.begin(), clusterVisible.end(), 1);
+		}
+
+		if (usePVS) {
+			// Outside of the baked grid, we can't tell : draw everything.
+			int cameraCell = pvs.cellIndex(cameraPosition);
+			for (size_t i = 0; i < clusterVisible.size() && cameraCell >= 0; i++) {
+				if (!clusterVisible[i]) continue;
+				bool seen = false;
+				for (size_t c = 0; c < clusterCells[i].size() && !seen; c++)
+					seen = pvs.isVisible(cameraCell, clusterCells[i][c]);
+				if (!seen) {
+					clusterVisible[i] = 0;
+					pvsCulledTotal++;
+				}
+			}
+		}
+
+		// Pick the LODs and cull the meshlets once, both passes have to draw
+		// the same triangles
+		glm::vec4 frustumPlanes[6];
+		extractFrustumPlanes(MVP, frustumPlanes);
+		for (size_t i = 0; i < GLMeshes.size(); i++) {
+			GLMesh &m = GLMeshes[i];
+			const char * visible = &clusterVisible[m.firstCluster];
+			meshVisible[i] = std::find(visible, visible + m.clusters.size(), 1) != visible + m.clusters.size();
+			if (!meshVisible[i]) continue;
+			for (size_t c = 0; c < m.clusters.size(); c++) {
+				if (!visible[c]) continue;
+				if (useLOD)
+					updateLOD(m.clusters[c], ViewMatrix, ProjectionMatrix);
+				else
+					m.clusters[c].currentLod = 0;
+				trianglesFull += m.clusters[c].lods[0].indexCount / 3;
+			}
+			trianglesSubmitted += updateClusterDraws(m, visible, useMeshletCulling, cameraPosition, frustumPlanes);
+		}
+
+		// Every visible mesh in one draw, for the passes that don't shade
+		visibleBatch.clear();
+		for (size_t i = 0; i < GLMeshes.size(); i++) {
+			if (!meshVisible[i]) continue;
+			addToBatch(GLMeshes[i], visibleBatch);
+		}
+		renderStats.objectsDrawn = std::count(clusterVisible.begin(), clusterVisible.end(), 1);
+		renderStats.objectsCulled = clusterVisible.size() - renderStats.objectsDrawn;
+		PROFILE_END();
+
+		// Bound again every frame : the overlay and the loaders may have
+		// switched vertex arrays
+		glBindVertexArray(sceneVAO);
+		renderStats.vertexArrayBinds++;
+
+		if (usePrepass) {
+			PROFILE_GPU_SCOPE("depth prepass");
+			glUseProgram(depthProgram);
+			renderStats.programBinds++;
+			uploadUniform(renderStats, prepassMVPLoc, MVP);
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			glDepthFunc(GL_LESS);
+
+			glBeginQuery(GL_SAMPLES_PASSED, depthQueries[queryFrame]);
+			drawBatch(visibleBatch, renderStats);
+			glEndQuery(GL_SAMPLES_PASSED);
+			depthQueryIssued[queryFrame] = true;
+
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			glDepthMask(GL_FALSE);
+			glDepthFunc(GL_EQUAL);
+		} else {
+			depthQueryIssued[queryFrame] = false;
+		}
 
         // Bind shadow map to texture unit 1
         // glActiveTexture(GL_TEXTURE1);
@@ -333,70 +1437,161 @@ int main(void)
         // glUniform1i(shadowMapLoc, 1);
         // glUniformMatrix4fv(depthMVPLoc, 1, GL_FALSE, &depthMVP[0][0]);
 
-		MatrixID = glGetUniformLocation(programID, "MVP");
-		ViewMatrixID = glGetUniformLocation(programID, "V");
-		ModelMatrixID = glGetUniformLocation(programID, "M");
-		TextureID = glGetUniformLocation(programID, "myTextureSampler");
-		MaterialColorID = glGetUniformLocation(programID, "materialColor");
-		useTextureLoc = glGetUniformLocation(programID, "useTexture");
-		lightPosLoc = glGetUniformLocation(programID, "LightPosition_worldspace");
-
-		glUniform3fv(lightPosLoc, NUM_LIGHTS, &lightPositions[0].x);
-
-        // Update camera matrices
-        computeMatricesFromInputs();
-        glm::mat4 ProjectionMatrix = getProjectionMatrix();
-		glm::mat4 ViewMatrix = getViewMatrix();
-		glm::mat4 ModelMatrix = glm::mat4(1.0f);
-		glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
-
-		glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix[0][0]);
-		glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
-		
-        // Draw all meshes
-        for (auto &m : GLMeshes) {
-
-            glBindVertexArray(m.vao);
-
-            glEnableVertexAttribArray(0);
-            glBindBuffer(GL_ARRAY_BUFFER, m.vertexbuffer);
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-            glEnableVertexAttribArray(1);
-            glBindBuffer(GL_ARRAY_BUFFER, m.uvbuffer);
-            glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-            glEnableVertexAttribArray(2);
-            glBindBuffer(GL_ARRAY_BUFFER, m.normalbuffer);
-            glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-            // Texture / material
-            if (m.useTexture) {
-				glUniform1i(glGetUniformLocation(programID,"useTexture"), 1);
-				glUniform3f(MaterialColorID, 1,1,1);
+        // Draw all meshes : one draw per bucket, the material is per vertex
+        PROFILE_GPU_BEGIN("opaque pass");
+        for (auto &b : buckets) b.clear();
+        for (size_t i = 0; i < GLMeshes.size(); i++) {
+            if (!meshVisible[i]) continue;
+            addToBatch(GLMeshes[i], buckets[GLMeshes[i].bucket]);
+        }
+        GLuint programID = 0;
+        glBeginQuery(GL_SAMPLES_PASSED, colorQueries[queryFrame]);
+        for (size_t b = 0; b < buckets.size(); b++) {
+            if (buckets[b].counts.empty()) continue;
+            // Buckets of the same variant follow each other, so this only
+            // switches programs once or twice a frame
+            GLuint program = shading.get(bucketFeatures[b]);
+            if (program != programID) {
+                programID = program;
+                glUseProgram(programID);
+                renderStats.programBinds++;
+                uploadUniform(renderStats, glGetUniformLocation(programID, "LightPosition_worldspace"), NUM_LIGHTS, &lightPositions[0]);
+                uploadUniform(renderStats, glGetUniformLocation(programID, "MVP"), MVP);
+                uploadUniform(renderStats, glGetUniformLocation(programID, "M"), ModelMatrix);
+                uploadUniform(renderStats, glGetUniformLocation(programID, "V"), ViewMatrix);
+            }
+            if (b == vtBucket) {
+                virtualTexture.bind(1, 2);
+                renderStats.textureBinds += 2;
+            } else if (b > 0) {
                 glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, m.textureID);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-                glUniform1i(TextureID, 0);
-			} else {
-				glUniform1i(glGetUniformLocation(programID,"useTexture"), 0);
-				glUniform3f(MaterialColorID, m.metarialColor.x, m.metarialColor.y, m.metarialColor.z);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, materialTextures.arrays[b - 1]);
+                renderStats.textureBinds++;
             }
 			// // bind shadow map
 			// glActiveTexture(GL_TEXTURE1);
 			// glBindTexture(GL_TEXTURE_2D, shadowDepthTex);
 			// glUniform1i(shadowMapLoc, 1);
 			//         glUniformMatrix4fv(depthMVPLoc, 1, GL_FALSE, &depthMVP[0][0]);
-            glDrawArrays(GL_TRIANGLES, 0, m.vertexCount);
+            drawBatch(buckets[b], renderStats);
+        }
+        glEndQuery(GL_SAMPLES_PASSED);
+        colorQueryIssued[queryFrame] = true;
+        queryFrame = 1 - queryFrame;
+        PROFILE_END();
+
+        if (usePrepass) {
+            glDepthMask(GL_TRUE);
+            glDepthFunc(GL_LESS);
+        }
+
+        // What the virtual texture needs, at 1/8 of the resolution : read
+        // back during the next frame, which also uploads the pages that came in
+        if (vtMaterial >= 0) {
+            PROFILE_GPU_SCOPE("vt feedback");
+            virtualTexture.beginFeedback();
+            glUseProgram(feedbackProgram);
+            renderStats.programBinds++;
+            uploadUniform(renderStats, feedbackMVPLoc, MVP);
+            drawBatch(visibleBatch, renderStats);
+            virtualTexture.endFeedback();
+            virtualTexture.update(16, 8);
+            renderStats.uploadBytes += virtualTexture.getUploadedBytes();
         }
 
-        glfwSwapBuffers(window);
+        if (measured) {
+            gpuTimer.end();
+            benchmark.cpuMilliseconds.push_back((glfwGetTime() - currentTime) * 1000.0);
+            if (statsFile)
+                writeRenderStatsRow(statsFile, benchmarkFrame - 1 - cameraPath.warmupFrames, benchmark.cpuMilliseconds.back(), renderStats);
+            worstRenderStats.keepMax(renderStats);
+            gpuTimer.collect(benchmark.gpuMilliseconds, false);
+        }
+
+        if (regressionPath) {
+            bool settled = regressionFrame > regressionViews.warmupFrames &&
+                (vtMaterial < 0 || virtualTexture.getResidency().getLoadingCount() == 0);
+            if (settled || regressionFrame > regressionViews.warmupFrames + 600) {
+                offscreenTarget.read(regressionPass == PASS_OPTIMIZED ? optimizedImage : referenceImage);
+                regressionFrame = 0;
+                if (regressionPass == PASS_OPTIMIZED) {
+                    regressionPass = PASS_REFERENCE;
+                } else {
+                    if (!checkRegressionView(regressionView, optimizedImage, referenceImage,
+                                             goldenDirectory, goldenRequired, updateGolden, diffBudget))
+                        regressionFailures++;
+                    regressionPass = PASS_OPTIMIZED;
+                    regressionView++;
+                    benchmarkDone = regressionView >= regressionViews.keys.size();
+                }
+            }
+        }
+
+        // The scene only, without the overlay
+        if (frameCapture.isRecording() && !capturePaused && (!benchmarkPath || measured)) {
+            PROFILE_SCOPE("capture");
+            frameCapture.capture();
+        }
+
+        if (showProfiler) {
+            PROFILE_GPU_SCOPE("overlay");
+            glDisable(GL_DEPTH_TEST);
+            profilerDrawOverlay(10, 570, 14);
+            glEnable(GL_DEPTH_TEST);
+        }
+
+        // Nothing to show offscreen
+        PROFILE_BEGIN("swap");
+        if (offscreen)
+            glFlush();
+        else
+            glfwSwapBuffers(window);
         glfwPollEvents();
+        PROFILE_END();
+        profilerEndFrame();
 
-    } while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
-             glfwWindowShouldClose(window) == 0);
+        if (firstFrame) {
+            printf("First frame after %.3f s\n", glfwGetTime());
+            firstFrame = false;
+        }
 
+    } while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
+             glfwWindowShouldClose(window) == 0 && !benchmarkDone);
+
+    if (benchmarkPath) {
+        gpuTimer.collect(benchmark.gpuMilliseconds, true);
+        bool toStdout = strcmp(benchmarkOutPath, "-") == 0;
+        if (!writeBenchmarkResults(toStdout ? NULL : benchmarkOutPath, benchmark))
+            return -1;
+        if (!toStdout)
+            printf("Benchmark results written to %s\n", benchmarkOutPath);
+        if (statsFile) {
+            fclose(statsFile);
+            printf("Render stats written to %s\n", statsOutPath);
+        }
+    }
+    offscreenTarget.destroy();
+    if (frameCapture.isRecording()) {
+        frameCapture.stop();
+        printf("%u frames captured to %s, %.1f ms spent waiting\n",
+            frameCapture.getCapturedFrames(), capturePath, frameCapture.getStallTime());
+    }
+    if (tracePath)
+        profilerWriteTrace(tracePath);
+    if (haveOverlayFont)
+        cleanupText2D();
+    if (recordPath && saveCameraPath(recordPath, recordedPath))
+        printf("Camera path written to %s (%u keys)\n", recordPath, (unsigned int)recordedPath.keys.size());
+
+    deleteMaterialTextures(materialTextures);
+    shutdownTextureCache();
+
+    if (benchmarkPath && statsLimitsPath && checkRenderStatsLimits(worstRenderStats, statsLimits) > 0)
+        return 2;
+    if (regressionPath) {
+        printf("%u of %u views differ\n", regressionFailures, (unsigned int)regressionViews.keys.size());
+        if (regressionFailures > 0)
+            return 1;
+    }
     return 0;
 }
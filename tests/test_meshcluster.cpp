@@ -0,0 +1,91 @@
+// Clusters of common/meshcluster : objects found through shared positions,
+// grouped by cell, big ones alone, and the triangles kept. Exit code 1 on failure.
+
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include <common/meshcluster.hpp>
+
+static int failures = 0;
+
+#define CHECK(condition) do { if (!(condition)) { printf("%s:%d : CHECK(%s) failed\n", __FILE__, __LINE__, #condition); failures++; } } while (0)
+
+// A unit cube at o, each face with its own 4 vertices (hard edges, like indexVBO gives)
+static void addCube(std::vector<glm::vec3> & positions, std::vector<unsigned int> & indices, glm::vec3 o, float size){
+	for (int axis = 0; axis < 3; axis++)
+		for (int side = 0; side < 2; side++){
+			glm::vec3 u(0.0f), v(0.0f), n(0.0f);
+			u[(axis + 1) % 3] = size;
+			v[(axis + 2) % 3] = size;
+			n[axis] = side * size;
+			unsigned int base = (unsigned int)positions.size();
+			positions.push_back(o + n);
+			positions.push_back(o + n + u);
+			positions.push_back(o + n + u + v);
+			positions.push_back(o + n + v);
+			unsigned int quad[6] = { 0, 1, 2, 0, 2, 3 };
+			for (int i = 0; i < 6; i++)
+				indices.push_back(base + quad[i]);
+		}
+}
+
+static std::vector<unsigned int> sortedTriangles(const std::vector<unsigned int> & indices){
+	std::vector<unsigned int> keys;
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		keys.push_back(indices[i] * 1000000u + indices[i + 1] * 1000u + indices[i + 2]);
+	std::sort(keys.begin(), keys.end());
+	return keys;
+}
+
+int main()
+{
+	std::vector<glm::vec3> positions;
+	std::vector<unsigned int> indices;
+	// Two small cubes in cell (0, 0, 0), one in cell (5, 0, 0), interleaved in
+	// the index buffer, and a floor bigger than a cell
+	addCube(positions, indices, glm::vec3(0.1f, 0.1f, 0.1f), 0.3f);
+	addCube(positions, indices, glm::vec3(10.2f, 0.1f, 0.1f), 0.3f);
+	addCube(positions, indices, glm::vec3(1.0f, 0.1f, 0.1f), 0.3f);
+	addCube(positions, indices, glm::vec3(-5.0f, -1.0f, -5.0f), 20.0f);
+
+	std::vector<MeshCluster> clusters;
+	std::vector<unsigned int> clustered;
+	buildMeshClusters(positions, indices, 2.0f, clusters, clustered);
+
+	CHECK(clusters.size() == 3);
+	CHECK(clustered.size() == indices.size());
+	CHECK(sortedTriangles(clustered) == sortedTriangles(indices));
+	if (clusters.size() == 3){
+		// In order of first triangle, contiguous
+		CHECK(clusters[0].indexOffset == 0 && clusters[0].indexCount == 72);
+		CHECK(clusters[1].indexOffset == 72 && clusters[1].indexCount == 36);
+		CHECK(clusters[2].indexOffset == 108 && clusters[2].indexCount == 36);
+		CHECK(clusters[0].boundsMin == glm::vec3(0.1f, 0.1f, 0.1f));
+		CHECK(glm::all(glm::lessThan(glm::abs(clusters[0].boundsMax - glm::vec3(1.3f, 0.4f, 0.4f)), glm::vec3(1e-5f))));
+		CHECK(clusters[2].boundsMin == glm::vec3(-5.0f, -1.0f, -5.0f));
+		for (unsigned int i = clusters[1].indexOffset; i < clusters[1].indexOffset + clusters[1].indexCount; i++)
+			CHECK(positions[clustered[i]].x > 10.0f);
+	}
+
+	// Compacted : same triangles, vertices numbered by first use
+	std::vector<unsigned int> local, vertexMap;
+	compactClusterVertices(clustered, 72, 36, local, vertexMap);
+	CHECK(local.size() == 36);
+	CHECK(vertexMap.size() == 24);
+	CHECK(local[0] == 0);
+	for (size_t i = 0; i < local.size() && i < 36; i++)
+		CHECK(local[i] < vertexMap.size() && vertexMap[local[i]] == clustered[72 + i]);
+
+	// Nothing in, nothing out
+	buildMeshClusters(positions, std::vector<unsigned int>(), 2.0f, clusters, clustered);
+	CHECK(clusters.empty() && clustered.empty());
+
+	if (failures)
+		printf("test_meshcluster : %d checks failed\n", failures);
+	else
+		printf("test_meshcluster : ok\n");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,154 @@
+// The CPU occlusion culler without a GL context : rasterizer coverage and
+// depth, the Hi-Z test, and the worker thread. Exit code 1 on failure.
+
+#include <stdio.h>
+#include <vector>
+#include <cmath>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <common/occlusion.hpp>
+
+static int failures = 0;
+
+#define CHECK(condition) do { if (!(condition)) { printf("%s:%d : CHECK(%s) failed\n", __FILE__, __LINE__, #condition); failures++; } } while (0)
+
+// Camera at the origin looking down -z, like the classroom's
+static glm::mat4 viewProjection(){
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0, 0, 0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0));
+	return projection * view;
+}
+
+// A rectangle facing the camera at z = -distance, as two triangles
+static void addSquare(std::vector<glm::vec3> & triangles, float distance, float x0, float x1, float y0, float y1){
+	glm::vec3 a(x0, y0, -distance), b(x1, y0, -distance), c(x1, y1, -distance), d(x0, y1, -distance);
+	triangles.push_back(a); triangles.push_back(b); triangles.push_back(c);
+	triangles.push_back(a); triangles.push_back(c); triangles.push_back(d);
+}
+
+static float windowDepth(const glm::mat4 & viewProj, float distance){
+	glm::vec4 p = viewProj * glm::vec4(0, 0, -distance, 1);
+	return p.z / p.w * 0.5f + 0.5f;
+}
+
+static void testCoverageAndDepth(){
+	glm::mat4 viewProj = viewProjection();
+	OcclusionBuffer buffer(64, 48);
+
+	// The left half of the screen at z = -5, seen from both windings
+	std::vector<glm::vec3> triangles;
+	addSquare(triangles, 5.0f, -100.0f, 0.0f, -100.0f, 100.0f);
+	buffer.clear();
+	buffer.rasterizeOccluders(viewProj, triangles);
+
+	const std::vector<float> & depth = buffer.getDepth();
+	float expected = windowDepth(viewProj, 5.0f);
+	int w = buffer.getWidth(), h = buffer.getHeight();
+	int covered = 0, wrong = 0;
+	for (int y = 0; y < h; y++)
+		for (int x = 0; x < w; x++){
+			float d = depth[y * w + x];
+			if (x < w / 2 - 1){
+				covered += d < 1.0f;
+				wrong += fabs(d - expected) > 1e-4f;
+			}else if (x > w / 2){
+				wrong += d != 1.0f;
+			}
+		}
+	CHECK(covered == (w / 2 - 1) * h);
+	CHECK(wrong == 0);
+
+	// The other winding draws the same
+	std::vector<glm::vec3> flipped;
+	for (size_t i = 0; i < triangles.size(); i += 3){
+		flipped.push_back(triangles[i]);
+		flipped.push_back(triangles[i + 2]);
+		flipped.push_back(triangles[i + 1]);
+	}
+	buffer.clear();
+	buffer.rasterizeOccluders(viewProj, flipped);
+	CHECK(buffer.getDepth() == depth);
+
+	// The closest surface wins, whatever the order
+	std::vector<glm::vec3> layers;
+	addSquare(layers, 8.0f, -100.0f, 100.0f, -100.0f, 100.0f);
+	addSquare(layers, 3.0f, -100.0f, 100.0f, -100.0f, 100.0f);
+	addSquare(layers, 6.0f, -100.0f, 100.0f, -100.0f, 100.0f);
+	buffer.clear();
+	buffer.rasterizeOccluders(viewProj, layers);
+	CHECK(fabs(buffer.getDepth()[(h / 2) * w + w / 2] - windowDepth(viewProj, 3.0f)) < 1e-4f);
+
+	// Behind the camera : dropped, never drawn
+	std::vector<glm::vec3> behind;
+	addSquare(behind, -5.0f, -100.0f, 100.0f, -100.0f, 100.0f);
+	buffer.clear();
+	buffer.rasterizeOccluders(viewProj, behind);
+	bool empty = true;
+	for (size_t i = 0; i < buffer.getDepth().size(); i++)
+		empty = empty && buffer.getDepth()[i] == 1.0f;
+	CHECK(empty);
+}
+
+static void testHiZ(){
+	glm::mat4 viewProj = viewProjection();
+	OcclusionBuffer buffer(64, 48);
+
+	// A wall filling the screen at z = -5, and a small one on the right at z = -2
+	std::vector<glm::vec3> triangles;
+	addSquare(triangles, 5.0f, -100.0f, 100.0f, -100.0f, 100.0f);
+	addSquare(triangles, 2.0f, 0.2f, 0.8f, -0.3f, 0.3f);
+	buffer.clear();
+	buffer.rasterizeOccluders(viewProj, triangles);
+	buffer.buildHiZ();
+
+	// Behind the wall, small or big
+	CHECK(!buffer.isVisible(viewProj, glm::vec3(-0.5f, -0.5f, -11.0f), glm::vec3(0.5f, 0.5f, -10.0f)));
+	CHECK(!buffer.isVisible(viewProj, glm::vec3(-20.0f, -10.0f, -30.0f), glm::vec3(20.0f, 10.0f, -6.0f)));
+	// In front of it
+	CHECK(buffer.isVisible(viewProj, glm::vec3(-0.5f, -0.5f, -4.0f), glm::vec3(0.5f, 0.5f, -3.0f)));
+	// Going through it
+	CHECK(buffer.isVisible(viewProj, glm::vec3(-0.5f, -0.5f, -6.0f), glm::vec3(0.5f, 0.5f, -4.5f)));
+	// Between the walls, hidden by the small one only
+	CHECK(!buffer.isVisible(viewProj, glm::vec3(0.35f, -0.1f, -3.5f), glm::vec3(0.45f, 0.1f, -3.0f)));
+	// Between the walls, but only half behind the small one
+	CHECK(buffer.isVisible(viewProj, glm::vec3(-0.2f, -0.1f, -3.5f), glm::vec3(0.45f, 0.1f, -3.0f)));
+	// Off screen
+	CHECK(!buffer.isVisible(viewProj, glm::vec3(30.0f, -0.5f, -4.0f), glm::vec3(31.0f, 0.5f, -3.0f)));
+	// Around the camera : crosses the near plane, always visible
+	CHECK(buffer.isVisible(viewProj, glm::vec3(-1.0f, -1.0f, -1.0f), glm::vec3(1.0f, 1.0f, 1.0f)));
+}
+
+static void testCuller(){
+	std::vector<glm::vec3> wall;
+	addSquare(wall, 5.0f, -100.0f, 100.0f, -100.0f, 100.0f);
+	std::vector<OcclusionBox> boxes(3);
+	boxes[0].min = glm::vec3(-0.5f, -0.5f, -4.0f); boxes[0].max = glm::vec3(0.5f, 0.5f, -3.0f);   // in front
+	boxes[1].min = glm::vec3(-0.5f, -0.5f, -9.0f); boxes[1].max = glm::vec3(0.5f, 0.5f, -8.0f);   // behind
+	boxes[2].min = glm::vec3(-2.0f, -2.0f, -7.0f); boxes[2].max = glm::vec3(2.0f, 2.0f, -6.0f);   // behind
+
+	OcclusionCuller culler(64, 48);
+	culler.setOccluders(wall);
+	culler.setObjects(boxes);
+	for (int frame = 0; frame < 3; frame++){
+		culler.submit(viewProjection());
+		std::vector<char> visible = culler.wait();
+		CHECK(visible.size() == 3);
+		CHECK(visible.size() == 3 && visible[0] == 1 && visible[1] == 0 && visible[2] == 0);
+		CHECK(culler.getCulledCount() == 2);
+		CHECK(culler.getCullTime() >= 0.0);
+	}
+}
+
+int main()
+{
+	testCoverageAndDepth();
+	testHiZ();
+	testCuller();
+	if (failures)
+		printf("test_occlusion : %d checks failed\n", failures);
+	else
+		printf("test_occlusion : ok\n");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,137 @@
+// The virtual texture's page cache without a GL context : what gets loaded,
+// LRU eviction, pages pinned by the current frame, and the indirection that
+// falls back to resident ancestors. Exit code 1 on failure.
+
+#include <stdio.h>
+#include <vector>
+
+#include <common/pageresidency.hpp>
+
+static int failures = 0;
+
+#define CHECK(condition) do { if (!(condition)) { printf("%s:%d : CHECK(%s) failed\n", __FILE__, __LINE__, #condition); failures++; } } while (0)
+
+static unsigned int page(unsigned int level, unsigned int x, unsigned int y){
+	return PageResidency::pageId(level, x, y);
+}
+
+// One frame asking for pages, everything it loads coming back at once
+static std::vector<unsigned int> frame(PageResidency & residency, const std::vector<unsigned int> & requested, std::vector<int> & slots){
+	std::vector<unsigned int> toLoad;
+	residency.update(requested, 16, toLoad);
+	slots.clear();
+	for (size_t i = 0; i < toLoad.size(); i++)
+		slots.push_back(residency.pageLoaded(toLoad[i]));
+	return toLoad;
+}
+
+static void testEviction(){
+	// 4x4, 2x2 and 1x1 pages in 4 slots
+	PageResidency residency(4, 4, 3, 4);
+	std::vector<unsigned int> requested, loads;
+	std::vector<int> slots;
+
+	// The coarsest level comes first, even when nothing asks for it
+	loads = frame(residency, requested, slots);
+	CHECK(loads.size() == 1 && loads[0] == page(2, 0, 0));
+	CHECK(slots.size() == 1 && slots[0] == 0);
+
+	// A fine page brings its missing ancestors, coarsest first
+	requested.assign(1, page(0, 0, 0));
+	loads = frame(residency, requested, slots);
+	CHECK(loads.size() == 2 && loads[0] == page(1, 0, 0) && loads[1] == page(0, 0, 0));
+	CHECK(slots.size() == 2 && slots[0] == 1 && slots[1] == 2);
+
+	requested.assign(1, page(0, 1, 0));
+	loads = frame(residency, requested, slots);
+	CHECK(loads.size() == 1 && loads[0] == page(0, 1, 0));
+	CHECK(slots.size() == 1 && slots[0] == 3);
+	CHECK(residency.getEvictions() == 0);
+
+	// Full : the least recently used pages go, (0, 0, 0) unused since the
+	// second frame, then its parent, unused since the third
+	requested.assign(1, page(0, 2, 0));
+	loads = frame(residency, requested, slots);
+	CHECK(loads.size() == 2 && loads[0] == page(1, 1, 0) && loads[1] == page(0, 2, 0));
+	CHECK(slots.size() == 2 && slots[0] == 2 && slots[1] == 1);
+	CHECK(residency.getEvictions() == 2);
+	CHECK(!residency.isResident(page(0, 0, 0)));
+	CHECK(!residency.isResident(page(1, 0, 0)));
+	CHECK(residency.isResident(page(0, 1, 0)));
+	CHECK(residency.isResident(page(2, 0, 0)));
+	CHECK(residency.getResidentCount() == 4);
+
+	// Every resident page is needed by this frame : the new ones, the evicted
+	// parent among them, are dropped and asked for again later
+	requested.clear();
+	requested.push_back(page(0, 1, 0));
+	requested.push_back(page(0, 2, 0));
+	requested.push_back(page(0, 3, 3));
+	loads = frame(residency, requested, slots);
+	CHECK(loads.size() == 3 && loads[0] == page(1, 1, 1) && loads[1] == page(1, 0, 0) && loads[2] == page(0, 3, 3));
+	CHECK(slots.size() == 3 && slots[0] == -1 && slots[1] == -1 && slots[2] == -1);
+	CHECK(residency.getEvictions() == 2);
+	CHECK(residency.getLoadingCount() == 0);
+	CHECK(residency.getResidentCount() == 4);
+}
+
+static void testLoading(){
+	PageResidency residency(4, 4, 3, 8);
+	std::vector<unsigned int> requested(1, page(0, 3, 3)), toLoad;
+
+	// At most maxLoads, and nothing twice while it loads
+	residency.update(requested, 2, toLoad);
+	CHECK(toLoad.size() == 2 && toLoad[0] == page(2, 0, 0) && toLoad[1] == page(1, 1, 1));
+	CHECK(residency.getLoadingCount() == 2);
+	residency.update(requested, 16, toLoad);
+	CHECK(toLoad.size() == 1 && toLoad[0] == page(0, 3, 3));
+
+	// A failed read is asked for again
+	residency.pageFailed(page(0, 3, 3));
+	CHECK(!residency.isResident(page(0, 3, 3)));
+	residency.update(requested, 16, toLoad);
+	CHECK(toLoad.size() == 1 && toLoad[0] == page(0, 3, 3));
+
+	// Out of range requests are ignored
+	std::vector<unsigned int> bogus(1, page(0, 9, 0));
+	bogus.push_back(page(5, 0, 0));
+	residency.update(bogus, 16, toLoad);
+	CHECK(toLoad.empty());
+}
+
+static void testIndirection(){
+	PageResidency residency(4, 4, 3, 4);
+	std::vector<unsigned int> requested(1, page(0, 2, 0)), toLoad;
+	residency.update(requested, 16, toLoad);
+	for (size_t i = 0; i < toLoad.size(); i++)
+		residency.pageLoaded(toLoad[i]);   // root in 0, (1, 1, 0) in 1, (0, 2, 0) in 2
+	CHECK(residency.isIndirectionDirty());
+
+	std::vector< std::vector<unsigned char> > levels;
+	residency.buildIndirection(2, levels);
+	CHECK(!residency.isIndirectionDirty());
+	CHECK(levels.size() == 3);
+	CHECK(levels[0].size() == 4 * 4 * 4 && levels[1].size() == 2 * 2 * 4 && levels[2].size() == 4);
+
+	// Slot 2 is x 0, y 1 in a grid of 2 per row
+	const unsigned char * texel = &levels[0][4 * (0 * 4 + 2)];
+	CHECK(texel[0] == 0 && texel[1] == 1 && texel[2] == 0 && texel[3] == 255);
+	// Its neighbour falls back to the parent, in slot 1
+	texel = &levels[0][4 * (0 * 4 + 3)];
+	CHECK(texel[0] == 1 && texel[1] == 0 && texel[2] == 1 && texel[3] == 255);
+	// Far from it : the root
+	texel = &levels[0][4 * (3 * 4 + 0)];
+	CHECK(texel[0] == 0 && texel[1] == 0 && texel[2] == 2 && texel[3] == 255);
+}
+
+int main()
+{
+	testEviction();
+	testLoading();
+	testIndirection();
+	if (failures)
+		printf("test_pageresidency : %d checks failed\n", failures);
+	else
+		printf("test_pageresidency : ok\n");
+	return failures ? 1 : 0;
+}
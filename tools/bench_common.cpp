@@ -0,0 +1,278 @@
+// Microbenchmarks of the common/ asset pipeline : OBJ loading, VBO indexing,
+// tangent basis and BMP / DDS decoding (no GL involved), on generated data
+// of increasing size. Time per call, throughput, and the heap use of one call
+// (common/allocstats) : allocations, bytes, and the peak.
+// Usage : bench_common [--json results.json] [--max-triangles 524288] [--min-time 0.25]
+//
+// The meshes are written next to the binary as bench_mesh_N.obj and removed
+// afterwards ; the loaders print their usual messages as they go.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <common/objloader.hpp>
+#include <common/vboindexer.hpp>
+#include <common/tangentspace.hpp>
+#include <common/texture.hpp>
+#include <common/dxtcompress.hpp>
+#include <common/imagediff.hpp>
+#include <common/benchmark.hpp>
+#include <common/allocstats.hpp>
+
+struct BenchResult {
+	std::string name;
+	unsigned long long size;       // in units
+	const char * unit;             // what size counts
+	unsigned int iterations;
+	TimingSummary milliseconds;
+	double throughput;             // units per second, at the median time
+	unsigned long long allocations, bytes;   // one call
+	unsigned long long peakBytes;            // most of the heap it held at once, over what was there before
+};
+
+// Calls f once to count its allocations, then again until minSeconds have
+// gone by (3 calls at least, 1000 at most).
+template <typename F>
+static BenchResult run(const char * name, unsigned long long size, const char * unit, double minSeconds, F f){
+	BenchResult result;
+	result.name = name;
+	result.size = size;
+	result.unit = unit;
+
+	resetAllocationPeak();
+	AllocationStats before = getAllocationStats();
+	f();
+	AllocationStats after = getAllocationStats();
+	result.allocations = after.allocations - before.allocations;
+	result.bytes = after.bytes - before.bytes;
+	result.peakBytes = after.peakBytes - before.liveBytes;
+
+	std::vector<double> samples;
+	double total = 0.0;
+	while (samples.size() < 3 || (total < minSeconds * 1000.0 && samples.size() < 1000)) {
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		f();
+		samples.push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+		total += samples.back();
+	}
+	result.iterations = (unsigned int)samples.size();
+	result.milliseconds = summarizeTimings(samples);
+	result.throughput = result.milliseconds.p50 > 0.0 ? size / (result.milliseconds.p50 / 1000.0) : 0.0;
+	return result;
+}
+
+static void printResult(const BenchResult & r){
+	printf("%-22s %9llu %-9s %9.3f ms %10.2f M%s/s %8llu allocs %10.1f KB, peak %10.1f KB\n",
+		r.name.c_str(), r.size, r.unit, r.milliseconds.p50, r.throughput / 1e6, r.unit,
+		r.allocations, r.bytes / 1024.0, r.peakBytes / 1024.0);
+}
+
+// A wavy n x n grid, 2 n^2 triangles, each half in its own material
+static bool writeGridOBJ(const char * path, unsigned int n){
+	FILE * f = fopen(path, "w");
+	if (!f) {
+		printf("Could not write %s\n", path);
+		return false;
+	}
+	for (unsigned int z = 0; z <= n; z++)
+		for (unsigned int x = 0; x <= n; x++) {
+			float u = float(x) / n, v = float(z) / n;
+			float h = 0.1f * sinf(u * 12.0f) * cosf(v * 9.0f);
+			glm::vec3 normal = glm::normalize(glm::vec3(-1.2f * cosf(u * 12.0f) * cosf(v * 9.0f), 1.0f,
+			                                            0.9f * sinf(u * 12.0f) * sinf(v * 9.0f)));
+			fprintf(f, "v %f %f %f\n", u, h, v);
+			fprintf(f, "vt %f %f\n", u, v);
+			fprintf(f, "vn %f %f %f\n", normal.x, normal.y, normal.z);
+		}
+	for (unsigned int z = 0; z < n; z++) {
+		if (z == 0 || z == n / 2)
+			fprintf(f, "usemtl %s\n", z == 0 ? "wood" : "metal");
+		for (unsigned int x = 0; x < n; x++) {
+			unsigned int a = z * (n + 1) + x + 1, b = a + 1, c = a + n + 1, d = c + 1;
+			fprintf(f, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, c, c, c, b, b, b);
+			fprintf(f, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", b, b, b, c, c, c, d, d, d);
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+// A 24 bits BMP file, in memory
+static std::vector<unsigned char> makeBMP(unsigned int size){
+	unsigned int rowBytes = (size * 3 + 3) & ~3u;
+	std::vector<unsigned char> file(54 + (size_t)rowBytes * size, 0);
+	file[0] = 'B';
+	file[1] = 'M';
+	*(unsigned int *)&file[0x02] = (unsigned int)file.size();
+	*(unsigned int *)&file[0x0A] = 54;
+	*(unsigned int *)&file[0x0E] = 40;
+	*(int *)&file[0x12] = (int)size;
+	*(int *)&file[0x16] = (int)size;
+	*(unsigned short *)&file[0x1A] = 1;
+	*(unsigned short *)&file[0x1C] = 24;
+	*(unsigned int *)&file[0x22] = rowBytes * size;
+	unsigned int seed = 12345;
+	for (size_t i = 54; i < file.size(); i++) {
+		seed = seed * 1664525u + 1013904223u;
+		file[i] = (unsigned char)(seed >> 24);
+	}
+	return file;
+}
+
+// The same, as a DXT1 DDS with its mip chain, read back from disk
+static bool makeDDS(unsigned int size, std::vector<unsigned char> & out){
+	std::vector<unsigned char> bmpFile = makeBMP(size);
+	TextureImage bmp;
+	if (!decodeBMP(&bmpFile[0], bmpFile.size(), bmp))
+		return false;
+	RGBAImage image;
+	bmpToRGBA(bmp, image);
+	std::vector<RGBAImage> mips;
+	buildMipChain(image, MIP_FILTER_BOX, mips);
+	std::vector< std::vector<unsigned char> > levels(mips.size());
+	for (size_t i = 0; i < mips.size(); i++)
+		compressDXT(mips[i], false, std::max(1u, std::thread::hardware_concurrency()), levels[i]);
+	const char * path = "bench_texture.dds";
+	bool ok = saveDDS(path, size, size, false, levels) && readFile(path, out);
+	remove(path);
+	return ok;
+}
+
+static bool writeResults(const char * path, const std::vector<BenchResult> & results){
+	FILE * f = fopen(path, "w");
+	if (!f) {
+		printf("Could not write %s\n", path);
+		return false;
+	}
+	fprintf(f, "{\n  \"benchmarks\": [");
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchResult & r = results[i];
+		fprintf(f, "%s\n    { \"name\": \"%s\", \"size\": %llu, \"unit\": \"%s\", \"iterations\": %u,",
+			i ? "," : "", r.name.c_str(), r.size, r.unit, r.iterations);
+		fprintf(f, " \"medianMs\": %.4f, \"minMs\": %.4f, \"maxMs\": %.4f, \"throughput\": %.1f,",
+			r.milliseconds.p50, r.milliseconds.min, r.milliseconds.max, r.throughput);
+		fprintf(f, " \"allocations\": %llu, \"allocatedBytes\": %llu, \"peakBytes\": %llu }", r.allocations, r.bytes, r.peakBytes);
+	}
+	fprintf(f, "\n  ]\n}\n");
+	fclose(f);
+	return true;
+}
+
+int main(int argc, char * argv[])
+{
+	const char * jsonPath = NULL;
+	unsigned int maxTriangles = 512 * 1024;
+	double minSeconds = 0.25;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+			jsonPath = argv[++i];
+		else if (strcmp(argv[i], "--max-triangles") == 0 && i + 1 < argc)
+			maxTriangles = (unsigned int)atoi(argv[++i]);
+		else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+			minSeconds = atof(argv[++i]);
+		else {
+			printf("Usage : %s [--json results.json] [--max-triangles 524288] [--min-time 0.25]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	std::vector<BenchResult> results;
+
+	// Meshes : 1K, 8K, 64K, 512K triangles
+	for (unsigned int triangles = 1024; triangles <= maxTriangles; triangles *= 8) {
+		unsigned int n = (unsigned int)sqrtf(triangles / 2.0f);
+		unsigned long long count = 2ULL * n * n;
+		unsigned long long uniqueVertices = (n + 1ULL) * (n + 1ULL);
+		char path[64];
+		snprintf(path, sizeof(path), "bench_mesh_%llu.obj", count);
+		if (!writeGridOBJ(path, n))
+			return 1;
+
+		std::vector<glm::vec3> vertices, normals;
+		std::vector<glm::vec2> uvs;
+		results.push_back(run("loadOBJ", count, "tris", minSeconds, [&]{
+			vertices.clear(); uvs.clear(); normals.clear();
+			loadOBJ(path, vertices, uvs, normals);
+		}));
+		results.push_back(run("loadOBJWithMaterials", count, "tris", minSeconds, [&]{
+			std::vector<MaterialMesh> meshes;
+			loadOBJWithMaterials(path, meshes);
+		}));
+		remove(path);
+
+		results.push_back(run("indexVBO (32 bits)", count, "tris", minSeconds, [&]{
+			std::vector<unsigned int> indices;
+			std::vector<glm::vec3> outVertices, outNormals;
+			std::vector<glm::vec2> outUVs;
+			indexVBO(vertices, uvs, normals, indices, outVertices, outUVs, outNormals);
+		}));
+		// 16 bits indices : up to 65536 vertices
+		if (uniqueVertices <= 65536) {
+			results.push_back(run("indexVBO (16 bits)", count, "tris", minSeconds, [&]{
+				std::vector<unsigned short> indices;
+				std::vector<glm::vec3> outVertices, outNormals;
+				std::vector<glm::vec2> outUVs;
+				indexVBO(vertices, uvs, normals, indices, outVertices, outUVs, outNormals);
+			}));
+		}
+		// indexVBO_slow and indexVBO_TBN search linearly : the small meshes only
+		bool quadratic = count <= 16 * 1024;
+		if (quadratic) {
+			results.push_back(run("indexVBO_slow", count, "tris", minSeconds, [&]{
+				std::vector<unsigned short> indices;
+				std::vector<glm::vec3> outVertices, outNormals;
+				std::vector<glm::vec2> outUVs;
+				indexVBO_slow(vertices, uvs, normals, indices, outVertices, outUVs, outNormals);
+			}));
+		}
+
+		std::vector<glm::vec3> tangents, bitangents;
+		results.push_back(run("computeTangentBasis", count, "tris", minSeconds, [&]{
+			tangents.clear(); bitangents.clear();
+			computeTangentBasis(vertices, uvs, normals, tangents, bitangents);
+		}));
+		if (quadratic) {
+			results.push_back(run("indexVBO_TBN", count, "tris", minSeconds, [&]{
+				std::vector<unsigned short> indices;
+				std::vector<glm::vec3> outVertices, outNormals, outTangents, outBitangents;
+				std::vector<glm::vec2> outUVs;
+				indexVBO_TBN(vertices, uvs, normals, tangents, bitangents,
+					indices, outVertices, outUVs, outNormals, outTangents, outBitangents);
+			}));
+		}
+	}
+
+	// Textures : 256 to 2048 texels square, decoded from memory
+	for (unsigned int size = 256; size <= 2048; size *= 2) {
+		std::vector<unsigned char> bmpFile = makeBMP(size), ddsFile;
+		results.push_back(run("decodeBMP", bmpFile.size(), "B", minSeconds, [&]{
+			TextureImage image;
+			decodeBMP(&bmpFile[0], bmpFile.size(), image);
+		}));
+		if (!makeDDS(size, ddsFile)) {
+			printf("Could not make a %ux%u DDS\n", size, size);
+			return 1;
+		}
+		results.push_back(run("decodeDDS", ddsFile.size(), "B", minSeconds, [&]{
+			TextureImage image;
+			decodeDDS(&ddsFile[0], ddsFile.size(), image);
+		}));
+	}
+
+	printf("\n");
+	for (const BenchResult & r : results)
+		printResult(r);
+	if (jsonPath && !writeResults(jsonPath, results))
+		return 1;
+	return 0;
+}
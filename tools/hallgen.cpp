@@ -0,0 +1,382 @@
+// Synthetic lecture halls, for benchmarks at scales room.obj can't reach.
+// Usage : hallgen out.obj [rows=8] [benches=6] [rooms=1] [lights=9] [textures=1] [prototype=bench.obj]
+//
+// Every room is a box (floor, ceiling, walls) with a board and a podium at the
+// front and rows x benches copies of the prototype. Writes out.obj, out.mtl
+// and out.lights (the light positions, project_classroom reads room.lights
+// next to room.obj). With textures > 1 the textured materials get variants,
+// wood_1, wood_2..., each a tinted copy of its texture cooked to DDS like
+// texcook does, and the benches and rooms cycle through them.
+//
+// Run it from project_classroom/ : bench_wood.bmp, wall.bmp and
+// floor_texture.bmp are the sources of the variants.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <thread>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <common/objloader.hpp>
+#include <common/vboindexer.hpp>
+#include <common/texture.hpp>
+#include <common/dxtcompress.hpp>
+
+// The materials project_classroom knows, and the texture of the textured ones
+struct HallMaterial {
+	const char * name;
+	const char * texture;   // NULL : plain colour
+	float color[3];
+};
+static const HallMaterial MATERIALS[] = {
+	{ "wood",   "bench_wood.bmp",    { 0.60f, 0.40f, 0.20f } },
+	{ "metal",  NULL,                { 0.80f, 0.80f, 0.80f } },
+	{ "wall",   "wall.bmp",          { 1.00f, 0.99f, 0.81f } },
+	{ "floor",  "floor_texture.bmp", { 0.50f, 0.50f, 0.50f } },
+	{ "board",  NULL,                { 0.03f, 0.30f, 0.11f } },
+	{ "podium", NULL,                { 0.88f, 0.63f, 0.27f } },
+};
+static const int NUM_MATERIALS = sizeof(MATERIALS) / sizeof(MATERIALS[0]);
+
+// What the shaders of project_classroom can take (MAX_MATERIALS and
+// MAX_LIGHTS in its main.cpp)
+static const int MAX_MATERIALS = 32;
+static const int MAX_LIGHTS = 64;
+
+// OBJ indices are global and 1 based : count what has been written
+struct ObjWriter {
+	FILE * file;
+	unsigned long long vertices, uvs, normals, triangles;
+	std::string material;
+};
+
+static void useMaterial(ObjWriter & obj, const std::string & name){
+	if (obj.material == name)
+		return;
+	fprintf(obj.file, "usemtl %s\n", name.c_str());
+	obj.material = name;
+}
+
+static std::string variantName(int material, int variant){
+	if (variant == 0)
+		return MATERIALS[material].name;
+	char name[64];
+	snprintf(name, sizeof(name), "%s_%d", MATERIALS[material].name, variant);
+	return name;
+}
+
+// Two triangles, counter-clockwise seen from the side cross(u, v) points to.
+// The UVs repeat every 2 m.
+static void writeQuad(ObjWriter & obj, const std::string & material, glm::vec3 o, glm::vec3 u, glm::vec3 v){
+	glm::vec3 n = glm::normalize(glm::cross(u, v));
+	glm::vec3 corners[4] = { o, o + u, o + u + v, o + v };
+	glm::vec2 uvs[4] = { glm::vec2(0, 0), glm::vec2(glm::length(u) / 2, 0),
+	                     glm::vec2(glm::length(u) / 2, glm::length(v) / 2), glm::vec2(0, glm::length(v) / 2) };
+	for (int i = 0; i < 4; i++){
+		fprintf(obj.file, "v %.4f %.4f %.4f\n", corners[i].x, corners[i].y, corners[i].z);
+		fprintf(obj.file, "vt %.4f %.4f\n", uvs[i].x, uvs[i].y);
+	}
+	fprintf(obj.file, "vn %.4f %.4f %.4f\n", n.x, n.y, n.z);
+	useMaterial(obj, material);
+	unsigned long long v0 = obj.vertices + 1, t0 = obj.uvs + 1, n0 = obj.normals + 1;
+	fprintf(obj.file, "f %llu/%llu/%llu %llu/%llu/%llu %llu/%llu/%llu\n", v0, t0, n0, v0 + 1, t0 + 1, n0, v0 + 2, t0 + 2, n0);
+	fprintf(obj.file, "f %llu/%llu/%llu %llu/%llu/%llu %llu/%llu/%llu\n", v0, t0, n0, v0 + 2, t0 + 2, n0, v0 + 3, t0 + 3, n0);
+	obj.vertices += 4;
+	obj.uvs += 4;
+	obj.normals += 1;
+	obj.triangles += 2;
+}
+
+// Facing outwards
+static void writeBox(ObjWriter & obj, const std::string & material, glm::vec3 min, glm::vec3 max){
+	glm::vec3 size = max - min;
+	glm::vec3 x(size.x, 0, 0), y(0, size.y, 0), z(0, 0, size.z);
+	writeQuad(obj, material, min, z, y);                  // -x
+	writeQuad(obj, material, min + x, y, z);              // +x
+	writeQuad(obj, material, min, x, z);                  // -y
+	writeQuad(obj, material, min + y, z, x);              // +y
+	writeQuad(obj, material, min, y, x);                  // -z
+	writeQuad(obj, material, min + z, x, y);              // +z
+}
+
+// The prototype, indexed : one vertex list, one index list per material
+struct Prototype {
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	std::vector<int> materials;                     // index in MATERIALS
+	std::vector< std::vector<unsigned int> > indices;
+	glm::vec3 size;
+	unsigned long long uvBase, normalBase;          // where its uvs and normals are in the OBJ
+};
+
+static bool loadPrototype(const char * path, Prototype & out){
+	std::vector<MaterialMesh> meshes;
+	if (!loadOBJWithMaterials(path, meshes) || meshes.empty()){
+		printf("Could not load %s\n", path);
+		return false;
+	}
+	glm::vec3 min(1e30f), max(-1e30f);
+	for (auto & m : meshes){
+		int material = 0;
+		while (material < NUM_MATERIALS && m.materialName != MATERIALS[material].name)
+			material++;
+		if (material == NUM_MATERIALS){
+			printf("%s : unknown material %s, drawn as metal\n", path, m.materialName.c_str());
+			material = 1;
+		}
+		std::vector<unsigned int> indices;
+		std::vector<glm::vec3> vertices, normals;
+		std::vector<glm::vec2> uvs;
+		indexVBO(m.vertices, m.uvs, m.normals, indices, vertices, uvs, normals);
+		for (auto & i : indices)
+			i += (unsigned int)out.vertices.size();
+		out.vertices.insert(out.vertices.end(), vertices.begin(), vertices.end());
+		out.uvs.insert(out.uvs.end(), uvs.begin(), uvs.end());
+		out.normals.insert(out.normals.end(), normals.begin(), normals.end());
+		out.materials.push_back(material);
+		out.indices.push_back(indices);
+		for (auto & v : vertices){
+			min = glm::min(min, v);
+			max = glm::max(max, v);
+		}
+	}
+	// Corner on the origin, standing on y = 0
+	for (auto & v : out.vertices)
+		v -= min;
+	out.size = max - min;
+	return true;
+}
+
+// Tinted copies of a material's texture, cooked to DDS. false if the
+// source isn't there : the material then has no variants.
+static bool cookVariants(const HallMaterial & material, int textures){
+	std::vector<unsigned char> file;
+	TextureImage bmp;
+	if (!readFile(material.texture, file) || !decodeBMP(file.empty() ? NULL : &file[0], file.size(), bmp)){
+		printf("No %s, %s gets no texture variants\n", material.texture, material.name);
+		return false;
+	}
+	unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+	size_t rowBytes = ((size_t)bmp.width * 3 + 3) & ~(size_t)3;
+	unsigned int seed = 12345;
+	for (int variant = 1; variant < textures; variant++){
+		float tint[3];
+		for (int c = 0; c < 3; c++){
+			seed = seed * 1103515245u + 12345u;
+			tint[c] = 0.6f + 0.4f * ((seed >> 16) & 0x7fff) / 32767.0f;
+		}
+		RGBAImage image;
+		image.width = bmp.width;
+		image.height = bmp.height;
+		image.pixels.resize((size_t)bmp.width * bmp.height * 4);
+		for (unsigned int y = 0; y < bmp.height; y++)
+			for (unsigned int x = 0; x < bmp.width; x++){
+				const unsigned char * src = &bmp.data[y * rowBytes + x * 3];
+				unsigned char * dst = &image.pixels[4 * ((size_t)y * bmp.width + x)];
+				dst[0] = (unsigned char)(src[2] * tint[0]);
+				dst[1] = (unsigned char)(src[1] * tint[1]);
+				dst[2] = (unsigned char)(src[0] * tint[2]);
+				dst[3] = 255;
+			}
+
+		std::vector<RGBAImage> mips;
+		buildMipChain(image, MIP_FILTER_KAISER, mips);
+		std::vector< std::vector<unsigned char> > levels(mips.size());
+		for (size_t i = 0; i < mips.size(); i++)
+			compressDXT(mips[i], false, threads, levels[i]);
+
+		std::string path = material.texture;
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), "_%d.dds", variant);
+		path = path.substr(0, path.rfind('.')) + suffix;
+		if (!saveDDS(path.c_str(), bmp.width, bmp.height, false, levels))
+			return false;
+		printf("Wrote %s\n", path.c_str());
+	}
+	return true;
+}
+
+int main(int argc, char * argv[])
+{
+	if (argc < 2) {
+		printf("Usage : %s out.obj [rows=8] [benches=6] [rooms=1] [lights=9] [textures=1] [prototype=bench.obj]\n", argv[0]);
+		return 1;
+	}
+
+	int rows     = argc > 2 ? atoi(argv[2]) : 8;
+	int benches  = argc > 3 ? atoi(argv[3]) : 6;
+	int rooms    = argc > 4 ? atoi(argv[4]) : 1;
+	int lights   = argc > 5 ? atoi(argv[5]) : 9;
+	int textures = argc > 6 ? atoi(argv[6]) : 1;
+	const char * prototypePath = argc > 7 ? argv[7] : "bench.obj";
+	if (rows < 1 || benches < 1 || rooms < 1 || lights < 1 || textures < 1) {
+		printf("rows, benches, rooms, lights and textures must be positive\n");
+		return 1;
+	}
+	if (lights * rooms > MAX_LIGHTS) {
+		lights = std::max(1, MAX_LIGHTS / rooms);
+		printf("The shaders take %d lights at most : %d per room\n", MAX_LIGHTS, lights);
+	}
+
+	Prototype prototype;
+	if (!loadPrototype(prototypePath, prototype))
+		return 1;
+
+	// Every variant is a material of its own : no more than the shaders take
+	int textured = 0;
+	for (int m = 0; m < NUM_MATERIALS; m++)
+		if (MATERIALS[m].texture)
+			textured++;
+	int maxTextures = std::max(1, (MAX_MATERIALS - (NUM_MATERIALS - textured)) / std::max(1, textured));
+	if (textures > maxTextures) {
+		textures = maxTextures;
+		printf("project_classroom draws %d materials at most : %d textures per textured material\n", MAX_MATERIALS, textures);
+	}
+
+	// Variants of each material, 1 if it has none
+	int variants[NUM_MATERIALS];
+	for (int m = 0; m < NUM_MATERIALS; m++) {
+		variants[m] = 1;
+		if (textures > 1 && MATERIALS[m].texture && cookVariants(MATERIALS[m], textures))
+			variants[m] = textures;
+	}
+
+	std::string objPath = argv[1];
+	std::string basePath = objPath.substr(0, objPath.rfind('.'));
+	std::string mtlPath = basePath + ".mtl";
+	std::string lightsPath = basePath + ".lights";
+
+	// Materials
+	FILE * mtl = fopen(mtlPath.c_str(), "w");
+	if (!mtl) {
+		printf("Could not write %s\n", mtlPath.c_str());
+		return 1;
+	}
+	fprintf(mtl, "# hallgen\n");
+	for (int m = 0; m < NUM_MATERIALS; m++)
+		for (int v = 0; v < variants[m]; v++) {
+			fprintf(mtl, "\nnewmtl %s\n", variantName(m, v).c_str());
+			fprintf(mtl, "Kd %.2f %.2f %.2f\n", MATERIALS[m].color[0], MATERIALS[m].color[1], MATERIALS[m].color[2]);
+			if (MATERIALS[m].texture) {
+				std::string texture = MATERIALS[m].texture;
+				if (v > 0) {
+					char suffix[32];
+					snprintf(suffix, sizeof(suffix), "_%d.dds", v);
+					texture = texture.substr(0, texture.rfind('.')) + suffix;
+				}
+				fprintf(mtl, "map_Kd %s\n", texture.c_str());
+			}
+		}
+	fclose(mtl);
+
+	ObjWriter obj;
+	obj.file = fopen(objPath.c_str(), "w");
+	if (!obj.file) {
+		printf("Could not write %s\n", objPath.c_str());
+		return 1;
+	}
+	obj.vertices = obj.uvs = obj.normals = obj.triangles = 0;
+	fprintf(obj.file, "# hallgen : %d rooms of %d x %d benches\n", rooms, rows, benches);
+	const char * mtlName = strrchr(mtlPath.c_str(), '/');
+	fprintf(obj.file, "mtllib %s\n", mtlName ? mtlName + 1 : mtlPath.c_str());
+
+	// The prototype's UVs and normals are the same for every copy
+	prototype.uvBase = obj.uvs;
+	prototype.normalBase = obj.normals;
+	for (auto & uv : prototype.uvs)
+		fprintf(obj.file, "vt %.4f %.4f\n", uv.x, uv.y);
+	for (auto & n : prototype.normals)
+		fprintf(obj.file, "vn %.4f %.4f %.4f\n", n.x, n.y, n.z);
+	obj.uvs += prototype.uvs.size();
+	obj.normals += prototype.normals.size();
+
+	// Room layout, in metres
+	const float aisle = 0.4f, rowGap = 0.6f, margin = 1.0f, front = 3.0f, height = 3.0f, roomGap = 0.3f;
+	float spacingX = prototype.size.x + aisle;
+	float spacingZ = prototype.size.z + rowGap;
+	float roomWidth = 2 * margin + benches * spacingX - aisle;
+	float roomDepth = front + rows * spacingZ - rowGap + margin;
+
+	std::vector<glm::vec3> lightPositions;
+	unsigned long long instance = 0;
+	for (int r = 0; r < rooms; r++) {
+		glm::vec3 o(r * (roomWidth + roomGap), 0, 0);
+		std::string wall = variantName(2, r % variants[2]);
+		std::string floor = variantName(3, r % variants[3]);
+		glm::vec3 x(roomWidth, 0, 0), y(0, height, 0), z(0, 0, roomDepth);
+
+		// Shell, facing inwards
+		writeQuad(obj, floor, o, z, x);
+		writeQuad(obj, wall, o + y, x, z);
+		writeQuad(obj, wall, o, x, y);
+		writeQuad(obj, wall, o + z, y, x);
+		writeQuad(obj, wall, o, y, z);
+		writeQuad(obj, wall, o + x, z, y);
+
+		// Board on the front wall, podium in front of it
+		float boardWidth = std::min(4.0f, roomWidth - 2 * margin);
+		glm::vec3 center = o + glm::vec3(roomWidth / 2, 0, 0);
+		writeBox(obj, "board", center + glm::vec3(-boardWidth / 2, 1.0f, 0.0f), center + glm::vec3(boardWidth / 2, 2.2f, 0.05f));
+		writeBox(obj, "podium", center + glm::vec3(-0.6f, 0.0f, 1.2f), center + glm::vec3(0.6f, 1.1f, 1.8f));
+
+		// Benches
+		for (int row = 0; row < rows; row++)
+			for (int b = 0; b < benches; b++, instance++) {
+				glm::vec3 position = o + glm::vec3(margin + b * spacingX, 0, front + row * spacingZ);
+				unsigned long long base = obj.vertices + 1;
+				for (auto & v : prototype.vertices)
+					fprintf(obj.file, "v %.4f %.4f %.4f\n", v.x + position.x, v.y + position.y, v.z + position.z);
+				obj.vertices += prototype.vertices.size();
+				for (size_t m = 0; m < prototype.indices.size(); m++) {
+					int material = prototype.materials[m];
+					useMaterial(obj, variantName(material, (int)(instance % variants[material])));
+					const std::vector<unsigned int> & indices = prototype.indices[m];
+					for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+						fprintf(obj.file, "f");
+						for (int k = 0; k < 3; k++)
+							fprintf(obj.file, " %llu/%llu/%llu", base + indices[i + k],
+								prototype.uvBase + 1 + indices[i + k], prototype.normalBase + 1 + indices[i + k]);
+						fprintf(obj.file, "\n");
+					}
+					obj.triangles += indices.size() / 3;
+				}
+			}
+
+		// Lights on a grid under the ceiling, about as many across as the room's proportions
+		int columns = std::max(1, (int)ceilf(sqrtf(lights * roomWidth / roomDepth)));
+		int lightRows = (lights + columns - 1) / columns;
+		for (int i = 0; i < lights; i++) {
+			float lx = (i % columns + 0.5f) * roomWidth / columns;
+			float lz = (i / columns + 0.5f) * roomDepth / lightRows;
+			lightPositions.push_back(o + glm::vec3(lx, height - 0.2f, lz));
+		}
+	}
+	bool written = ferror(obj.file) == 0;
+	fclose(obj.file);
+	if (!written) {
+		printf("Could not write %s\n", objPath.c_str());
+		return 1;
+	}
+
+	FILE * lightsFile = fopen(lightsPath.c_str(), "w");
+	if (!lightsFile) {
+		printf("Could not write %s\n", lightsPath.c_str());
+		return 1;
+	}
+	fprintf(lightsFile, "{ \"lights\": [");
+	for (size_t i = 0; i < lightPositions.size(); i++)
+		fprintf(lightsFile, "%s\n  [%.3f, %.3f, %.3f]", i ? "," : "", lightPositions[i].x, lightPositions[i].y, lightPositions[i].z);
+	fprintf(lightsFile, "\n] }\n");
+	fclose(lightsFile);
+
+	printf("%s : %d rooms, %llu benches, %llu triangles, %llu vertices, %d lights\n",
+		objPath.c_str(), rooms, instance, obj.triangles, obj.vertices, (int)lightPositions.size());
+	return 0;
+}
@@ -0,0 +1,42 @@
+// Perceptual image diff, for the --regression captures of project_classroom.
+// Usage : imagediff a.bmp b.bmp [threshold=2.3] [maxFraction=0.002] [diff.bmp]
+// Exit code 1 if more than maxFraction of the pixels are over threshold
+// (CIE76 delta E), see common/imagediff.hpp.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include <common/texture.hpp>
+#include <common/dxtcompress.hpp>
+#include <common/imagediff.hpp>
+
+int main(int argc, char * argv[])
+{
+	if (argc < 3) {
+		printf("Usage : %s a.bmp b.bmp [threshold=2.3] [maxFraction=0.002] [diff.bmp]\n", argv[0]);
+		return 2;
+	}
+
+	float threshold = argc > 3 ? (float)atof(argv[3]) : 2.3f;
+	double maxFraction = argc > 4 ? atof(argv[4]) : 0.002;
+
+	RGBAImage a, b;
+	if (!loadBMPImage(argv[1], a) || !loadBMPImage(argv[2], b)) {
+		printf("Could not load %s or %s\n", argv[1], argv[2]);
+		return 2;
+	}
+
+	ImageDiffResult diff;
+	RGBAImage diffImage;
+	if (!compareImages(a, b, threshold, diff, argc > 5 ? &diffImage : NULL))
+		return 1;
+	printf("%u pixels (%.4f%%) over delta E %.1f, max %.1f, mean %.3f\n",
+		diff.differentPixels, 100.0 * diff.differentFraction, threshold, diff.maxDeltaE, diff.meanDeltaE);
+	if (argc > 5 && saveBMPImage(argv[5], diffImage))
+		printf("Differences written to %s\n", argv[5]);
+
+	return diff.differentFraction > maxFraction ? 1 : 0;
+}
@@ -0,0 +1,52 @@
+// Throughput of the CPU mip generator (common/mipmap.hpp), in megapixels of
+// level 0 per second, for RGB8 / RGBA8, with and without gamma, and 1 thread
+// up to one per core.
+// Usage : mipbench [width=2048] [height=2048] [iterations=10]
+//
+// Build with -mavx2 (or /arch:AVX2) to get the AVX2 kernel.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include <common/mipmap.hpp>
+
+int main(int argc, char * argv[])
+{
+	unsigned int width = argc > 1 ? (unsigned int)atoi(argv[1]) : 2048;
+	unsigned int height = argc > 2 ? (unsigned int)atoi(argv[2]) : 2048;
+	int iterations = argc > 3 ? atoi(argv[3]) : 10;
+	if (width == 0 || height == 0 || iterations < 1) {
+		printf("Usage : %s [width=2048] [height=2048] [iterations=10]\n", argv[0]);
+		return 1;
+	}
+	unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+	printf("%ux%u, %s kernel, %u cores\n", width, height, getMipmapKernel(), cores);
+
+	// Noise : nothing for the caches or the branch predictor to exploit
+	std::vector<unsigned char> pixels((size_t)width * height * 4);
+	unsigned int seed = 12345;
+	for (size_t i = 0; i < pixels.size(); i++) {
+		seed = seed * 1664525u + 1013904223u;
+		pixels[i] = (unsigned char)(seed >> 24);
+	}
+
+	std::vector< std::vector<unsigned char> > levels;
+	for (unsigned int channels = 3; channels <= 4; channels++)
+		for (int srgb = 0; srgb < 2; srgb++)
+			for (unsigned int threads = 1; ; threads = std::min(threads * 2, cores)) {
+				generateMipmaps(&pixels[0], width, height, channels, 4, srgb != 0, threads, 0, levels); // warm up
+				std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+				for (int i = 0; i < iterations; i++)
+					generateMipmaps(&pixels[0], width, height, channels, 4, srgb != 0, threads, 0, levels);
+				double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+				printf("%s %-6s %2u threads : %8.1f MP/s (%.2f ms per chain)\n",
+					channels == 4 ? "RGBA8" : "RGB8 ", srgb ? "sRGB" : "linear", threads,
+					double(width) * height * iterations / seconds / 1e6, seconds * 1000.0 / iterations);
+				if (threads == cores)
+					break;
+			}
+	return 0;
+}
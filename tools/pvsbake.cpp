@@ -0,0 +1,42 @@
+// Offline PVS baker.
+// Usage : pvsbake scene.obj scene.pvs [cellSize] [raysPerPair] [threads] [dilation]
+// project_classroom loads room.pvs next to room.obj when it exists.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <string>
+#include <thread>
+
+#include <glm/glm.hpp>
+
+#include <common/objloader.hpp>
+#include <common/pvs.hpp>
+
+int main(int argc, char * argv[])
+{
+	if (argc < 3) {
+		printf("Usage : %s scene.obj scene.pvs [cellSize=1.0] [raysPerPair=32] [threads=all] [dilation=1]\n", argv[0]);
+		return 1;
+	}
+
+	float cellSize  = argc > 3 ? (float)atof(argv[3]) : 1.0f;
+	int raysPerPair = argc > 4 ? atoi(argv[4]) : 32;
+	int numThreads  = argc > 5 ? atoi(argv[5]) : (int)std::thread::hardware_concurrency();
+	int dilation    = argc > 6 ? atoi(argv[6]) : 1;
+	if (numThreads < 1) numThreads = 1;
+	if (cellSize <= 0.0f || raysPerPair < 1 || dilation < 0) {
+		printf("cellSize and raysPerPair must be positive, dilation at least 0\n");
+		return 1;
+	}
+
+	std::vector<MaterialMesh> meshes;
+	if (!loadOBJWithMaterials(argv[1], meshes) || meshes.empty()) {
+		printf("Could not load %s\n", argv[1]);
+		return 1;
+	}
+
+	PVSData pvs;
+	bakePVS(meshes, cellSize, raysPerPair, dilation, numThreads, pvs);
+	return savePVS(argv[2], pvs) ? 0 : 1;
+}
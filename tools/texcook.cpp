@@ -0,0 +1,65 @@
+// Offline texture cooker : 24 bits BMP -> DXT1 / DXT5 DDS with a full mip chain.
+// Usage : texcook in.bmp out.dds [bc1|bc3] [box|kaiser|gamma] [threads]
+// project_classroom loads foo.dds instead of foo.bmp when it exists.
+//
+// Rows stay in the BMP order (bottom up), so the UVs need no flipping,
+// unlike the DDS files made by other tools.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include <GL/glew.h>
+
+#include <common/texture.hpp>
+#include <common/dxtcompress.hpp>
+#include <common/imagediff.hpp>
+
+int main(int argc, char * argv[])
+{
+	if (argc < 3) {
+		printf("Usage : %s in.bmp out.dds [bc1|bc3] [box|kaiser|gamma] [threads=all]\n", argv[0]);
+		return 1;
+	}
+
+	bool bc3 = argc > 3 && strcmp(argv[3], "bc3") == 0;
+	MipFilter filter = MIP_FILTER_KAISER;
+	if (argc > 4 && strcmp(argv[4], "box") == 0)
+		filter = MIP_FILTER_BOX;
+	else if (argc > 4 && strcmp(argv[4], "gamma") == 0)
+		filter = MIP_FILTER_GAMMA_BOX;
+	int numThreads = argc > 5 ? atoi(argv[5]) : (int)std::thread::hardware_concurrency();
+	if (numThreads < 1) numThreads = 1;
+
+	std::vector<unsigned char> file;
+	TextureImage bmp;
+	if (!readFile(argv[1], file) || !decodeBMP(file.empty() ? NULL : &file[0], file.size(), bmp)) {
+		printf("Could not load %s\n", argv[1]);
+		return 1;
+	}
+
+	RGBAImage level0;
+	bmpToRGBA(bmp, level0);
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	std::vector<RGBAImage> mips;
+	buildMipChain(level0, filter, mips);
+
+	std::vector< std::vector<unsigned char> > levels(mips.size());
+	size_t compressedBytes = 0;
+	for (size_t i = 0; i < mips.size(); i++) {
+		compressDXT(mips[i], bc3, numThreads, levels[i]);
+		compressedBytes += levels[i].size();
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	printf("%s : %ux%u, %u levels, %s, %.1f KB -> %.1f KB in %.2f s (%d threads)\n",
+		argv[1], bmp.width, bmp.height, (unsigned int)mips.size(), bc3 ? "DXT5" : "DXT1",
+		bmp.data.size() / 1024.0, compressedBytes / 1024.0, seconds, numThreads);
+
+	return saveDDS(argv[2], bmp.width, bmp.height, bc3, levels) ? 0 : 1;
+}
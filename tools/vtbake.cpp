@@ -0,0 +1,46 @@
+// Virtual texture baker : 24 bits BMP -> page file for common/virtualtexture.
+// Usage : vtbake in.bmp out.vt [pageSize=128] [border=4] [box|kaiser|gamma]
+// project_classroom streams foo.vt instead of loading foo.bmp or foo.dds when
+// it exists (one material at a time).
+//
+// Like texcook, rows stay bottom up so the UVs need no flipping.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include <common/texture.hpp>
+#include <common/dxtcompress.hpp>
+#include <common/imagediff.hpp>
+#include <common/vtpagefile.hpp>
+
+int main(int argc, char * argv[])
+{
+	if (argc < 3) {
+		printf("Usage : %s in.bmp out.vt [pageSize=128] [border=4] [box|kaiser|gamma]\n", argv[0]);
+		return 1;
+	}
+
+	unsigned int pageSize = argc > 3 ? (unsigned int)atoi(argv[3]) : 128;
+	unsigned int border = argc > 4 ? (unsigned int)atoi(argv[4]) : 4;
+	MipFilter filter = MIP_FILTER_KAISER;
+	if (argc > 5 && strcmp(argv[5], "box") == 0)
+		filter = MIP_FILTER_BOX;
+	else if (argc > 5 && strcmp(argv[5], "gamma") == 0)
+		filter = MIP_FILTER_GAMMA_BOX;
+
+	std::vector<unsigned char> file;
+	TextureImage bmp;
+	if (!readFile(argv[1], file) || !decodeBMP(file.empty() ? NULL : &file[0], file.size(), bmp)) {
+		printf("Could not load %s\n", argv[1]);
+		return 1;
+	}
+
+	RGBAImage image;
+	bmpToRGBA(bmp, image);
+
+	return bakeVirtualTexture(image, pageSize, border, filter, argv[2]) ? 0 : 1;
+}